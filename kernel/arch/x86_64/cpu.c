@@ -0,0 +1,22 @@
+#include "arch/x86_64/cpu.h"
+#include "lib/string.h"
+
+cpu_local_t cpu_locals[MAX_CPUS];
+
+// Point GS at this CPU's cpu_local_t. While in the kernel GS_BASE holds the
+// per-CPU pointer; KERNEL_GS_BASE holds the user value and SWAPGS exchanges
+// the two on every user/kernel transition.
+void cpu_local_init(uint32_t cpu_id) {
+    cpu_local_t* cpu = &cpu_locals[cpu_id];
+    memset(cpu, 0, sizeof(cpu_local_t));
+    cpu->self = cpu;
+    cpu->cpu_id = cpu_id;
+
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+
+    // RDTSCP returns TSC_AUX in ECX; the vDSO's getcpu() reads it from there
+    if (cpu_has_rdtscp()) {
+        wrmsr(MSR_TSC_AUX, cpu_id);
+    }
+}
@@ -0,0 +1,152 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// --- Model Specific Registers ---
+#define MSR_EFER            0xC0000080
+#define MSR_STAR            0xC0000081 // Segment selectors for SYSCALL/SYSRET
+#define MSR_LSTAR           0xC0000082 // 64-bit SYSCALL entry point
+#define MSR_CSTAR           0xC0000083 // Compatibility-mode SYSCALL entry (unused)
+#define MSR_FMASK           0xC0000084 // RFLAGS bits cleared on SYSCALL
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102 // Swapped with GS_BASE by SWAPGS
+#define MSR_TSC_AUX         0xC0000103
+#define MSR_APIC_BASE       0x1B
+
+#define EFER_SCE            (1ULL << 0)  // SYSCALL/SYSRET enable
+
+// --- CPUID leaves and feature bits ---
+#define CPUID_EXT_MAX           0x80000000
+#define CPUID_EXT_FEATURES      0x80000001
+#define CPUID_EXT_POWER_MGMT    0x80000007
+#define CPUID_EDX_RDTSCP        (1U << 27)   // Leaf 0x80000001
+#define CPUID_EDX_INVARIANT_TSC (1U << 8)    // Leaf 0x80000007
+
+// --- RFLAGS bits ---
+#define RFLAGS_TF           (1ULL << 8)
+#define RFLAGS_IF           (1ULL << 9)
+#define RFLAGS_DF           (1ULL << 10)
+#define RFLAGS_AC           (1ULL << 18)
+
+// --- CR0 bits ---
+#define CR0_WP              (1ULL << 16) // Supervisor writes honour read-only pages
+
+#define MAX_CPUS 16
+
+// Per-CPU data, reachable through GS while running in the kernel.
+// The first fields are accessed by offset from assembly (syscall_entry.asm),
+// so keep them in sync with the CPU_* constants there.
+typedef struct cpu_local {
+    uint64_t kernel_rsp;       // 0x00: top of the current thread's kernel stack
+    uint64_t user_rsp;         // 0x08: scratch slot for the user RSP on SYSCALL
+    struct cpu_local* self;    // 0x10: linear address of this structure
+    uint32_t cpu_id;           // 0x18
+    uint32_t reserved;
+} cpu_local_t;
+
+extern cpu_local_t cpu_locals[MAX_CPUS];
+
+void cpu_local_init(uint32_t cpu_id);
+
+static inline cpu_local_t* this_cpu(void) {
+    cpu_local_t* cpu;
+    asm volatile ("mov %%gs:0x10, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint32_t this_cpu_id(void) {
+    uint32_t id;
+    asm volatile ("movl %%gs:0x18, %0" : "=r"(id));
+    return id;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+// EDX of an extended CPUID leaf, or 0 if the CPU does not implement it
+static inline uint32_t cpuid_ext_edx(uint32_t leaf) {
+    uint32_t a, b, c, d;
+    cpuid(CPUID_EXT_MAX, &a, &b, &c, &d);
+    if (a < leaf) return 0;
+    cpuid(leaf, &a, &b, &c, &d);
+    return d;
+}
+
+static inline int cpu_has_rdtscp(void) {
+    return (cpuid_ext_edx(CPUID_EXT_FEATURES) & CPUID_EDX_RDTSCP) != 0;
+}
+
+// The TSC ticks at a constant rate regardless of P-/C-states
+static inline int cpu_has_invariant_tsc(void) {
+    return (cpuid_ext_edx(CPUID_EXT_POWER_MGMT) & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// --- Interrupt flag ---
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        asm volatile ("sti" : : : "memory");
+    }
+}
+
+// --- Control registers ---
+static inline uint64_t read_cr0(void) {
+    uint64_t cr0;
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint64_t cr0) {
+    asm volatile ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+// --- Port I/O ---
+static inline void outb(uint16_t port, uint8_t val) {
+    asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+static inline void outw(uint16_t port, uint16_t val) {
+    asm volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    asm volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+static inline void outl(uint16_t port, uint32_t val) {
+    asm volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    asm volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+#endif
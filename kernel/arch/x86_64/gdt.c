@@ -30,8 +30,8 @@ void init_gdt() {
     gdt_set_gate(0, 0, 0, 0, 0);                // Null segment
     gdt_set_gate(1, 0, 0, 0x9A, 0x20);          // Kernel Code Segment (64-bit)
     gdt_set_gate(2, 0, 0, 0x92, 0x00);          // Kernel Data Segment
-    gdt_set_gate(3, 0, 0, 0xFA, 0x20);          // User Code Segment
-    gdt_set_gate(4, 0, 0, 0xF2, 0x00);          // User Data Segment
+    gdt_set_gate(3, 0, 0, 0xF2, 0x00);          // User Data Segment
+    gdt_set_gate(4, 0, 0, 0xFA, 0x20);          // User Code Segment (64-bit)
 
     gdt_flush((uint64_t)&gdt_ptr);
 }
@@ -17,10 +17,19 @@ typedef struct gdt_entry_struct gdt_entry_t;
 // The GDT pointer structure that is loaded into the GDTR register
 struct gdt_ptr_struct {
     uint16_t limit;
-    uint32_t base;
+    uint64_t base;
 } __attribute__((packed));
 typedef struct gdt_ptr_struct gdt_ptr_t;
 
+// Segment selectors. SYSRET derives the user selectors from STAR[63:48]:
+// SS = base + 8 and CS = base + 16, so user data must sit directly before
+// user code in the table.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_DATA   0x18
+#define GDT_USER_CODE   0x20
+#define GDT_RPL_USER    0x3
+
 // Public function to initialize the GDT
 void init_gdt();
 
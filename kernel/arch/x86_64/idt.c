@@ -1,17 +1,61 @@
 #include "arch/x86_64/idt.h"
+#include "arch/x86_64/cpu.h"
 #include "lib/string.h" // Corrected include path
 
 // Define the IDT and IDT pointer
 static idt_entry_t idt_entries[256];
 static idt_ptr_t   idt_ptr;
 
+// C-level handlers, indexed by vector
+static interrupt_handler_t interrupt_handlers[256];
+
 // External assembly functions from interrupts.asm
 extern void idt_flush(uint64_t);
 extern void isr0();
-extern void irq0();
-extern void irq1();
-extern void irq12();
+extern void isr14();
 extern void isr128();
+extern uint64_t irq_stubs[16];
+extern uint64_t msi_stubs[MSI_VECTORS];
+
+// --- Local APIC ---
+#define APIC_BASE_ENABLE (1ULL << 11)
+#define LAPIC_REG_ID     0x20
+#define LAPIC_REG_EOI    0xB0
+#define LAPIC_REG_SVR    0xF0
+#define LAPIC_SVR_ENABLE (1U << 8)
+#define LAPIC_SPURIOUS   0xFF
+
+static uint8_t next_msi_vector = MSI_VECTOR_BASE;
+
+static volatile uint32_t* lapic_reg(uint32_t reg) {
+    return (volatile uint32_t*)((rdmsr(MSR_APIC_BASE) & ~0xFFFULL) + reg);
+}
+
+void lapic_enable(void) {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    *lapic_reg(LAPIC_REG_SVR) = LAPIC_SVR_ENABLE | LAPIC_SPURIOUS;
+}
+
+uint32_t lapic_id(void) {
+    return *lapic_reg(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    *lapic_reg(LAPIC_REG_EOI) = 0;
+}
+
+uint8_t msi_alloc_vector(void) {
+    if (next_msi_vector >= MSI_VECTOR_BASE + MSI_VECTORS) return 0;
+    return next_msi_vector++;
+}
+
+void pic_unmask(uint8_t irq) {
+    if (irq >= 8) {
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        irq = 2; // Cascade
+    }
+    outb(0x21, inb(0x21) & ~(1 << irq));
+}
 
 
 // Set an IDT entry for 64-bit mode
@@ -36,10 +80,37 @@ void init_idt() {
 
     // Set up ISRs and IRQs using 64-bit pointers
     idt_set_gate(0, (uint64_t)isr0, 0x08, 0x8E);
-    idt_set_gate(32, (uint64_t)irq0, 0x08, 0x8E);    // IRQ0: Timer
-    idt_set_gate(33, (uint64_t)irq1, 0x08, 0x8E);   // IRQ1: PS/2 Keyboard
-    idt_set_gate(44, (uint64_t)irq12, 0x08, 0x8E);  // IRQ12: PS/2 Mouse
+    idt_set_gate(14, (uint64_t)isr14, 0x08, 0x8E);  // Page fault
+    for (int i = 0; i < 16; i++) {
+        idt_set_gate(IRQ_BASE + i, irq_stubs[i], 0x08, 0x8E); // Timer, keyboard, mouse, disks...
+    }
+    for (int i = 0; i < MSI_VECTORS; i++) {
+        idt_set_gate(MSI_VECTOR_BASE + i, msi_stubs[i], 0x08, 0x8E);
+    }
     idt_set_gate(128, (uint64_t)isr128, 0x08, 0xEE); // Syscall vector (set user-level flag)
 
     idt_flush((uint64_t)&idt_ptr);
+    lapic_enable();
+}
+
+void register_interrupt_handler(uint8_t n, interrupt_handler_t handler) {
+    interrupt_handlers[n] = handler;
+}
+
+// Called from isr_common_stub with a pointer to the saved register state.
+void interrupt_handler_c(registers_t* regs) {
+    interrupt_handler_t handler = interrupt_handlers[regs->int_no & 0xFF];
+    if (handler) {
+        handler(regs);
+    }
+
+    // Acknowledge legacy PIC interrupts
+    if (regs->int_no >= 32 && regs->int_no < 48) {
+        if (regs->int_no >= 40) {
+            outb(0xA0, 0x20);
+        }
+        outb(0x20, 0x20);
+    } else if (regs->int_no >= MSI_VECTOR_BASE && regs->int_no < MSI_VECTOR_BASE + MSI_VECTORS) {
+        lapic_eoi();
+    }
 }
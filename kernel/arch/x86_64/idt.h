@@ -3,24 +3,63 @@
 
 #include <stdint.h>
 
-// An entry in the Interrupt Descriptor Table
+// An entry in the Interrupt Descriptor Table (16 bytes in long mode)
 struct idt_entry_struct {
     uint16_t base_lo;
     uint16_t sel;
-    uint8_t  always0;
+    uint8_t  ist;
     uint8_t  flags;
-    uint16_t base_hi;
+    uint16_t base_mid;
+    uint32_t base_hi;
+    uint32_t always0;
 } __attribute__((packed));
 typedef struct idt_entry_struct idt_entry_t;
 
 // The IDT pointer structure
 struct idt_ptr_struct {
     uint16_t limit;
-    uint32_t base;
+    uint64_t base;
 } __attribute__((packed));
 typedef struct idt_ptr_struct idt_ptr_t;
 
+// Register state saved by isr_common_stub and syscall_entry.
+// Field order is the reverse of the push order in the assembly stubs.
+typedef struct registers {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t int_no, err_code;
+    uint64_t rip, cs, rflags, rsp, ss; // Pushed by the CPU (or built by syscall_entry)
+} registers_t;
+
+#define IRQ_BASE 32 // Vector of legacy PIC line 0
+#define IRQ0  32
+#define IRQ1  33
+#define IRQ12 44
+
+// Vectors for message signalled interrupts, given out by msi_alloc_vector
+#define MSI_VECTOR_BASE 0x50
+#define MSI_VECTORS     16
+
+#define SYSCALL_VECTOR      0x80
+// Pseudo vector stored in registers_t.int_no for frames built by the
+// SYSCALL instruction path. It lies outside the IDT range on purpose.
+#define SYSCALL_FAST_VECTOR 0x100
+
+typedef void (*interrupt_handler_t)(registers_t* regs);
+
 // Public function to initialize the IDT
 void init_idt();
+void register_interrupt_handler(uint8_t n, interrupt_handler_t handler);
+
+// Unmasks legacy PIC line `irq` (and the cascade for lines 8-15)
+void pic_unmask(uint8_t irq);
+
+// --- Local APIC ---
+// MSIs are delivered through the local APIC, which init_idt software-enables
+void lapic_enable(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+// A free MSI vector, or 0 when all MSI_VECTORS are taken
+uint8_t msi_alloc_vector(void);
 
 #endif
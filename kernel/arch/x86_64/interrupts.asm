@@ -56,36 +56,64 @@ ISR_ERR_CODE    21
 ; ... ISRs 22-31 are reserved ...
 ISR_NO_ERR_CODE 31
 
-; Define IRQs
-global irq0, irq1, irq12, isr128
-irq0:  ; Timer
+; Legacy PIC lines 0-15 at vectors 32-47
+%assign i 0
+%rep 16
+global irq%[i]
+irq%[i]:
     cli
     push 0
-    push 32
+    push 32 + i
     jmp isr_common_stub
-
-irq1:  ; Keyboard
-    cli
-    push 0
-    push 33
-    jmp isr_common_stub
-    
-irq12: ; Mouse
+%assign i i + 1
+%endrep
+
+; Vectors 0x50-0x5F, handed out to devices for message signalled interrupts
+%assign i 0
+%rep 16
+global msi%[i]
+msi%[i]:
     cli
     push 0
-    push 44
+    push 0x50 + i
     jmp isr_common_stub
+%assign i i + 1
+%endrep
 
+global isr128
 isr128: ; Syscall
     cli
     push 0
     push 128
     jmp isr_common_stub
 
+; Entry points of the stubs above, for init_idt
+section .rodata
+global irq_stubs, msi_stubs
+irq_stubs:
+%assign i 0
+%rep 16
+    dq irq%[i]
+%assign i i + 1
+%endrep
+msi_stubs:
+%assign i 0
+%rep 16
+    dq msi%[i]
+%assign i i + 1
+%endrep
+section .text
+
 
 ; --- Common ISR Stub ---
 ; This is where all ISRs and IRQs jump after pushing their specific info.
 isr_common_stub:
+    ; If we came from user mode, switch GS to the per-CPU area.
+    ; [rsp+24] is the saved CS (after int_no, err_code and RIP).
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     ; Save all general-purpose registers
     push rax
     push rbx
@@ -130,13 +158,18 @@ isr_common_stub:
     ; Pop the interrupt number and error code
     add rsp, 16
 
+    ; Restore the user GS base when returning to ring 3
+    test qword [rsp + 8], 3
+    jz .kernel_return
+    swapgs
+.kernel_return:
     sti          ; Re-enable interrupts
     iretq        ; Return from interrupt (64-bit)
 
 
 ; --- Context Switch Implementation ---
-; void context_switch(registers_t* old, registers_t* new);
-; RDI = old, RSI = new
+; void context_switch(uint64_t* old_rsp, uint64_t* new_rsp);
+; RDI = &old->kernel_rsp_saved, RSI = &new->kernel_rsp_saved
 global context_switch
 context_switch:
     ; Save the state of the old thread
@@ -147,16 +180,14 @@ context_switch:
     push r14
     push r15
     
-    ; old->rsp = current stack pointer
-    mov [rdi + 8*15], rsp
+    ; old->kernel_rsp_saved = current stack pointer
+    mov [rdi], rsp
 
     ; Restore the state of the new thread
-    ; new->rsp is the new stack pointer
-    mov rsp, [rsi + 8*15]
-
-    ; new->rip is the new instruction pointer. The 'ret' will jump to it.
-    mov rax, [rsi + 8*16]
-    push rax
+    ; new->kernel_rsp_saved is the new stack pointer. The callee-saved
+    ; registers and the return address were left on it when the thread was
+    ; switched out (or by kthread_create for a new kernel thread).
+    mov rsp, [rsi]
 
     pop r15
     pop r14
@@ -172,3 +203,13 @@ context_switch:
     mov cr3, rax
     
     ret
+
+; First code run by a thread from kthread_create (proc/task.c):
+; RBX = entry point, R12 = its argument.
+extern kthread_exit
+global kthread_trampoline
+kthread_trampoline:
+    sti
+    mov rdi, r12
+    call rbx
+    call kthread_exit
@@ -0,0 +1,120 @@
+;
+; 64-bit SYSCALL/SYSRET entry point
+;
+; Register ABI on entry (set by user space):
+;   RAX = syscall number
+;   RDI, RSI, RDX, R10, R8, R9 = arguments 0-5
+; The CPU saves the user RIP in RCX and RFLAGS in R11; RFLAGS is masked by
+; MSR_FMASK, so we arrive here with interrupts disabled.
+;
+
+bits 64
+
+extern syscall_dispatcher
+
+; Offsets into cpu_local_t (arch/x86_64/cpu.h)
+CPU_KERNEL_RSP      equ 0x00
+CPU_USER_RSP        equ 0x08
+
+; Selectors with RPL 3 (arch/x86_64/gdt.h)
+USER_DS             equ 0x18 | 3
+USER_CS             equ 0x20 | 3
+
+SYSCALL_FAST_VECTOR equ 0x100
+
+; Offset of the saved RIP in registers_t
+FRAME_RIP           equ 8*17
+
+global syscall_entry
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+
+    ; Build an iretq-compatible frame so registers_t has the same layout
+    ; as for isr_common_stub.
+    push USER_DS                    ; ss
+    push qword [gs:CPU_USER_RSP]    ; rsp
+    push r11                        ; rflags
+    push USER_CS                    ; cs
+    push rcx                        ; rip
+    push 0                          ; err_code
+    push SYSCALL_FAST_VECTOR        ; int_no
+
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    ; The user state is saved; the kernel may be preempted from here on.
+    sti
+
+    mov rdi, rsp
+    call syscall_dispatcher
+
+    cli
+
+    ; SYSRET with a non-canonical RIP faults in ring 0 on Intel parts.
+    ; Fall back to iretq if the return address was changed to one.
+    mov rcx, [rsp + FRAME_RIP]
+    mov r11, rcx
+    shl r11, 16
+    sar r11, 16
+    cmp r11, rcx
+    jne .iret_return
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    add rsp, 16                     ; int_no, err_code
+    pop rcx                         ; user rip
+    add rsp, 8                      ; cs
+    pop r11                         ; user rflags
+    swapgs
+    pop rsp                         ; user rsp (ss is implied by STAR)
+    o64 sysret
+
+.iret_return:
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    add rsp, 16
+    swapgs
+    iretq
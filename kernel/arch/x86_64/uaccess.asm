@@ -0,0 +1,52 @@
+;
+; User memory accessors with fault fixups
+;
+; Each instruction that touches a user pointer has an entry in .ex_table
+; pairing its address with a fixup label. If it faults, the page fault
+; handler (vmm_page_fault -> uaccess_fixup) resumes at the fixup instead of
+; treating the fault as a kernel bug.
+;
+
+bits 64
+
+section .text
+
+; size_t __copy_user(void* dst, const void* src, size_t len)
+; Returns the number of bytes NOT copied (0 on success).
+global __copy_user
+__copy_user:
+    mov rcx, rdx
+.copy:
+    rep movsb
+    xor eax, eax
+    ret
+.fault:
+    ; RCX holds the remaining count at the faulting iteration
+    mov rax, rcx
+    ret
+
+; long __strncpy_user(char* dst, const char* src, size_t max)
+; Copies up to and including the terminating NUL. Returns the string
+; length, -1 on a fault, or `max` if no NUL was found within max bytes.
+global __strncpy_user
+__strncpy_user:
+    xor eax, eax
+.loop:
+    cmp rax, rdx
+    je .done
+.load:
+    mov cl, [rsi + rax]
+    mov [rdi + rax], cl
+    test cl, cl
+    jz .done
+    inc rax
+    jmp .loop
+.done:
+    ret
+.fault:
+    mov rax, -1
+    ret
+
+section .ex_table progbits alloc noexec nowrite align=8
+    dq __copy_user.copy, __copy_user.fault
+    dq __strncpy_user.load, __strncpy_user.fault
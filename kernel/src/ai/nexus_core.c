@@ -4,7 +4,7 @@
 #include "lib/print.h"
 
 // A very simple state model for a process
-typedef struct {
+typedef struct process_model {
     pid_t pid;
     bool has_used_net;
     bool has_written_file;
@@ -19,39 +19,45 @@ void nexus_core_init() {
     model_count = 0;
 }
 
-void nexus_core_analyze_syscall(registers_t* regs) {
-    if (!current_thread) return;
+// Find or create the model for a process. The result is cached in the
+// process, so the table is only searched on a process's first audited call.
+static process_model_t* nexus_core_model_for(process_t* proc) {
+    if (proc->nexus_model) return proc->nexus_model;
 
-    // Find model for current PID
-    process_model_t* model = NULL;
-    for(int i = 0; i < model_count; i++) {
-        if (models[i].pid == current_thread->parent_process->pid) {
-            model = &models[i];
-            break;
+    for (int i = 0; i < model_count; i++) {
+        if (models[i].pid == proc->pid) {
+            proc->nexus_model = &models[i];
+            return proc->nexus_model;
         }
     }
-    if (!model && model_count < MAX_MODELS) {
-        models[model_count].pid = current_thread->parent_process->pid;
-        models[model_count].has_used_net = false;
-        models[model_count].has_written_file = false;
-        model = &models[model_count];
-        model_count++;
-    }
+    if (model_count >= MAX_MODELS) return NULL;
+
+    process_model_t* model = &models[model_count++];
+    model->pid = proc->pid;
+    model->has_used_net = false;
+    model->has_written_file = false;
+    proc->nexus_model = model;
+    return model;
+}
+
+void nexus_core_analyze_syscall(uint64_t nr, uint32_t flags) {
+    (void)nr;
+    if (!current_thread) return;
 
+    process_model_t* model = nexus_core_model_for(current_thread->parent_process);
     if (!model) return;
 
-    // Use rax for 64-bit syscall number
-    if (model->has_used_net && regs->rax == SYS_WRITE) {
+    if (model->has_used_net && (flags & SC_WRITE)) {
         if (!model->has_written_file) {
             print("NEXUS CORE ALERT: Process PID wrote to file after network activity.\n");
         }
     }
     
     // Update model state
-    if (regs->rax >= SYS_SOCKET && regs->rax <= SYS_RECV) {
+    if (flags & SC_NET) {
         model->has_used_net = true;
     }
-    if (regs->rax == SYS_WRITE) {
+    if (flags & SC_WRITE) {
         model->has_written_file = true;
     }
 }
@@ -6,6 +6,7 @@
 #include "../proc/task.h"
 
 void nexus_core_init();
-void nexus_core_analyze_syscall(registers_t* regs);
+// Called by the syscall dispatcher for calls in the SC_AUDIT classes only.
+void nexus_core_analyze_syscall(uint64_t nr, uint32_t flags);
 
 #endif
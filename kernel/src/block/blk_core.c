@@ -0,0 +1,697 @@
+/* kernel/src/block/blk_core.c */
+
+#include "blkdev.h"
+#include "elevator.h"
+#include "../mem/pmm.h"
+#include "../proc/task.h"
+#include "../lib/string.h"
+#include "../../arch/x86_64/cpu.h"
+
+// A plug holding this many requests is flushed on the spot
+#define BLK_MAX_PLUG_REQUESTS 32
+
+static block_device_t* blkdev_list = NULL;
+static spinlock_t blkdev_list_lock = 0;
+static workqueue_t* kblockd_wq = NULL;
+
+static void blk_run_hw_queue(blk_hw_queue_t* hctx);
+
+// --- Bios ---
+
+bio_t* bio_alloc(block_device_t* bdev, uint32_t op, uint64_t sector, uint32_t nr_vecs) {
+    if (nr_vecs > BIO_MAX_VECS) nr_vecs = BIO_MAX_VECS;
+
+    bio_t* bio = pmm_alloc(sizeof(bio_t) + nr_vecs * sizeof(bio_vec_t));
+    if (!bio) return NULL;
+    memset(bio, 0, sizeof(bio_t));
+    bio->bdev = bdev;
+    bio->op = op;
+    bio->sector = sector;
+    bio->max_vecs = nr_vecs;
+    return bio;
+}
+
+void bio_put(bio_t* bio) {
+    pmm_free(bio, sizeof(bio_t) + bio->max_vecs * sizeof(bio_vec_t));
+}
+
+int bio_add(bio_t* bio, void* buf, uint32_t len) {
+    block_device_t* bdev = bio->bdev;
+    if (len == 0 || len % SECTOR_SIZE) return -1;
+    if (((uint64_t)bio->size + len) >> SECTOR_SHIFT > bdev->max_sectors) return -1;
+
+    // A buffer that carries on from the last one extends it
+    if (bio->vcnt > 0) {
+        bio_vec_t* last = &bio->vecs[bio->vcnt - 1];
+        if ((uint8_t*)last->base + last->len == (uint8_t*)buf) {
+            last->len += len;
+            bio->size += len;
+            return 0;
+        }
+    }
+    if (bio->vcnt == bio->max_vecs || bio->vcnt == bdev->max_segments) return -1;
+
+    bio->vecs[bio->vcnt].base = buf;
+    bio->vecs[bio->vcnt].len = len;
+    bio->vcnt++;
+    bio->size += len;
+    return 0;
+}
+
+static void bio_endio(bio_t* bio, int status) {
+    bio->status = status;
+    if (bio->end_io) bio->end_io(bio);
+}
+
+// --- Requests ---
+
+static request_t* blk_rq_from_bio(bio_t* bio) {
+    request_t* rq = pmm_alloc(sizeof(request_t));
+    if (!rq) return NULL;
+    memset(rq, 0, sizeof(request_t));
+    rq->sector = bio->sector;
+    rq->nr_sectors = bio->size >> SECTOR_SHIFT;
+    rq->op = bio->op;
+    rq->nr_segments = bio->vcnt;
+    rq->tag = -1;
+    rq->bio = rq->biotail = bio;
+    bio->next = NULL;
+    return rq;
+}
+
+int blk_try_merge(request_t* rq, bio_t* bio) {
+    block_device_t* bdev = bio->bdev;
+    uint32_t sectors = bio->size >> SECTOR_SHIFT;
+
+    if (rq->op != bio->op || rq->bio->bdev != bdev) return ELV_NO_MERGE;
+    if (rq->op != REQ_OP_READ && rq->op != REQ_OP_WRITE) return ELV_NO_MERGE;
+    if (rq->nr_sectors + sectors > bdev->max_sectors) return ELV_NO_MERGE;
+    if (rq->nr_segments + bio->vcnt > bdev->max_segments) return ELV_NO_MERGE;
+
+    if (rq->sector + rq->nr_sectors == bio->sector) {
+        bio->next = NULL;
+        rq->biotail->next = bio;
+        rq->biotail = bio;
+    } else if (bio->sector + sectors == rq->sector) {
+        bio->next = rq->bio;
+        rq->bio = bio;
+        rq->sector = bio->sector;
+    } else {
+        return ELV_NO_MERGE;
+    }
+    rq->nr_sectors += sectors;
+    rq->nr_segments += bio->vcnt;
+    return rq->biotail == bio ? ELV_BACK_MERGE : ELV_FRONT_MERGE;
+}
+
+// --- Hardware Queues ---
+
+static blk_hw_queue_t* blk_map_queue(block_device_t* bdev) {
+    return bdev->hctx[this_cpu_id() % bdev->nr_hw_queues];
+}
+
+// Under hctx->lock
+static int blk_get_tag(blk_hw_queue_t* hctx) {
+    for (uint32_t i = 0; i < BLK_MAX_DEPTH / 64; i++) {
+        if (hctx->tags[i] != ~0ULL) {
+            int bit = __builtin_ctzll(~hctx->tags[i]);
+            hctx->tags[i] |= 1ULL << bit;
+            return i * 64 + bit;
+        }
+    }
+    return -1;
+}
+
+static void blk_put_tag(blk_hw_queue_t* hctx, int tag) {
+    hctx->tags[tag / 64] &= ~(1ULL << (tag % 64));
+}
+
+// Under hctx->lock
+static void blk_dispatch_add(blk_hw_queue_t* hctx, request_t* rq, bool front) {
+    if (front) {
+        rq->next = hctx->dispatch_head;
+        hctx->dispatch_head = rq;
+        if (!hctx->dispatch_tail) hctx->dispatch_tail = rq;
+    } else {
+        rq->next = NULL;
+        if (hctx->dispatch_tail) hctx->dispatch_tail->next = rq;
+        else hctx->dispatch_head = rq;
+        hctx->dispatch_tail = rq;
+    }
+}
+
+// Under hctx->lock
+static request_t* blk_next_request(blk_hw_queue_t* hctx) {
+    request_t* rq = hctx->dispatch_head;
+    if (rq) {
+        hctx->dispatch_head = rq->next;
+        if (!hctx->dispatch_head) hctx->dispatch_tail = NULL;
+        return rq;
+    }
+
+    blk_sched_t* sched = hctx->sched;
+    spinlock_acquire(&sched->lock);
+    rq = sched->type->dispatch(sched->data);
+    spinlock_release(&sched->lock);
+    return rq;
+}
+
+static void blk_insert_request(blk_hw_queue_t* hctx, request_t* rq) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&hctx->lock);
+    if (rq->op == REQ_OP_FLUSH) {
+        // Only has to follow writes that already completed, so it does
+        // not wait behind queued ones
+        blk_dispatch_add(hctx, rq, false);
+    } else {
+        blk_sched_t* sched = hctx->sched;
+        spinlock_acquire(&sched->lock);
+        sched->type->insert(sched->data, rq);
+        spinlock_release(&sched->lock);
+    }
+    spinlock_release(&hctx->lock);
+    irq_restore(flags);
+}
+
+// Hands requests to the driver while it has room. Only one caller runs
+// the loop at a time; others, completions mostly, just ask it to go round
+// once more.
+static void blk_run_hw_queue(blk_hw_queue_t* hctx) {
+    block_device_t* bdev = hctx->bdev;
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&hctx->lock);
+    if (hctx->running) {
+        hctx->rerun = true;
+        spinlock_release(&hctx->lock);
+        irq_restore(flags);
+        return;
+    }
+    hctx->running = true;
+
+    while (hctx->inflight < bdev->queue_depth) {
+        request_t* rq = blk_next_request(hctx);
+        if (!rq) break;
+        rq->hctx = hctx;
+        rq->tag = blk_get_tag(hctx);
+        hctx->inflight++;
+        hctx->rerun = false;
+
+        spinlock_release(&hctx->lock);
+        irq_restore(flags);
+        int status = bdev->ops->queue_rq(hctx, rq);
+        flags = irq_save();
+        spinlock_acquire(&hctx->lock);
+
+        if (status == BLK_STS_BUSY) {
+            blk_put_tag(hctx, rq->tag);
+            rq->tag = -1;
+            hctx->inflight--;
+            blk_dispatch_add(hctx, rq, true);
+            // Whatever completes next runs the queue again, unless it
+            // already came and went while the driver was refusing
+            if (!hctx->rerun) break;
+        }
+    }
+
+    hctx->running = false;
+    spinlock_release(&hctx->lock);
+    irq_restore(flags);
+}
+
+void blk_complete_request(request_t* rq, int status) {
+    blk_hw_queue_t* hctx = rq->hctx;
+
+    bio_t* bio = rq->bio;
+    while (bio) {
+        bio_t* next = bio->next; // end_io may free it
+        bio->next = NULL;
+        bio_endio(bio, status);
+        bio = next;
+    }
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&hctx->lock);
+    blk_put_tag(hctx, rq->tag);
+    hctx->inflight--;
+    hctx->rerun = true;
+    spinlock_release(&hctx->lock);
+    irq_restore(flags);
+
+    pmm_free(rq, sizeof(request_t));
+    blk_run_hw_queue(hctx);
+}
+
+void blk_complete_request_irq(request_t* rq, int status) {
+    blk_hw_queue_t* hctx = rq->hctx;
+    if (!kblockd_wq) {
+        blk_complete_request(rq, status);
+        return;
+    }
+
+    rq->status = status;
+    uint64_t flags = irq_save();
+    spinlock_acquire(&hctx->lock);
+    rq->next = hctx->done_head;
+    hctx->done_head = rq;
+    spinlock_release(&hctx->lock);
+    irq_restore(flags);
+    queue_work(kblockd_wq, &hctx->done_work);
+}
+
+static void blk_done_work(work_t* work) {
+    blk_hw_queue_t* hctx = container_of(work, blk_hw_queue_t, done_work);
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&hctx->lock);
+    request_t* list = hctx->done_head;
+    hctx->done_head = NULL;
+    spinlock_release(&hctx->lock);
+    irq_restore(flags);
+
+    // Pushed newest first; finish them in the order they completed
+    request_t* ordered = NULL;
+    while (list) {
+        request_t* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    while (ordered) {
+        request_t* next = ordered->next;
+        blk_complete_request(ordered, ordered->status);
+        ordered = next;
+    }
+}
+
+// --- Submission ---
+
+static bool blk_bio_valid(bio_t* bio) {
+    block_device_t* bdev = bio->bdev;
+    uint64_t sectors = bio->size >> SECTOR_SHIFT;
+
+    if (bio->op == REQ_OP_FLUSH) return bio->size == 0;
+    if (bio->size == 0 || bio->size % bdev->block_size) return false;
+    if (bio->sector % (bdev->block_size >> SECTOR_SHIFT)) return false;
+    if (bio->sector + sectors > bdev->nr_sectors) return false;
+    if (bio->op == REQ_OP_DISCARD) return bio->vcnt == 0 && sectors <= bdev->max_discard_sectors;
+    return bio->vcnt > 0 && sectors <= bdev->max_sectors;
+}
+
+static void blk_queue_bio(bio_t* bio) {
+    blk_hw_queue_t* hctx = blk_map_queue(bio->bdev);
+
+    if (bio->op == REQ_OP_READ || bio->op == REQ_OP_WRITE) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&hctx->lock);
+        blk_sched_t* sched = hctx->sched;
+        spinlock_acquire(&sched->lock);
+        bool merged = sched->type->bio_merge(sched->data, bio);
+        spinlock_release(&sched->lock);
+        spinlock_release(&hctx->lock);
+        irq_restore(flags);
+        if (merged) return; // Rides along with a request already queued
+    }
+
+    request_t* rq = blk_rq_from_bio(bio);
+    if (!rq) {
+        bio_endio(bio, BLK_STS_IOERR);
+        return;
+    }
+    blk_insert_request(hctx, rq);
+    blk_run_hw_queue(hctx);
+}
+
+static blk_plug_t* blk_current_plug(void) {
+    return current_thread ? current_thread->plug : NULL;
+}
+
+// Plugged bios merge with what the plug holds so far, or start a request
+// of their own on it
+static void blk_plug_bio(blk_plug_t* plug, bio_t* bio) {
+    for (request_t* rq = plug->head; rq; rq = rq->next) {
+        if (blk_try_merge(rq, bio) != ELV_NO_MERGE) return;
+    }
+
+    request_t* rq = blk_rq_from_bio(bio);
+    if (!rq) {
+        bio_endio(bio, BLK_STS_IOERR);
+        return;
+    }
+    rq->next = NULL;
+    if (plug->tail) plug->tail->next = rq;
+    else plug->head = rq;
+    plug->tail = rq;
+    plug->count++;
+}
+
+static void blk_flush_plug(blk_plug_t* plug) {
+    request_t* list = plug->head;
+    plug->head = plug->tail = NULL;
+    plug->count = 0;
+
+    // Sort by device, then sector, so each device gets its requests in order
+    request_t* sorted = NULL;
+    while (list) {
+        request_t* rq = list;
+        list = rq->next;
+
+        request_t** pos = &sorted;
+        while (*pos && ((uintptr_t)(*pos)->bio->bdev < (uintptr_t)rq->bio->bdev ||
+                        ((*pos)->bio->bdev == rq->bio->bdev && (*pos)->sector <= rq->sector))) {
+            pos = &(*pos)->next;
+        }
+        rq->next = *pos;
+        *pos = rq;
+    }
+
+    blk_hw_queue_t* last = NULL;
+    while (sorted) {
+        request_t* rq = sorted;
+        sorted = rq->next;
+
+        blk_hw_queue_t* hctx = blk_map_queue(rq->bio->bdev);
+        if (last && last != hctx) blk_run_hw_queue(last);
+        last = hctx;
+        blk_insert_request(hctx, rq);
+    }
+    if (last) blk_run_hw_queue(last);
+}
+
+void submit_bio(bio_t* bio) {
+    bio->status = BLK_STS_OK;
+    if (!blk_bio_valid(bio)) {
+        bio_endio(bio, BLK_STS_IOERR);
+        return;
+    }
+
+    blk_plug_t* plug = blk_current_plug();
+    if (plug && bio->op != REQ_OP_FLUSH) {
+        blk_plug_bio(plug, bio);
+        if (plug->count >= BLK_MAX_PLUG_REQUESTS) blk_flush_plug(plug);
+        return;
+    }
+    blk_queue_bio(bio);
+}
+
+void blk_start_plug(blk_plug_t* plug) {
+    plug->head = plug->tail = NULL;
+    plug->count = 0;
+    // Nested plugs leave it all to the outermost one
+    if (current_thread && !current_thread->plug) current_thread->plug = plug;
+}
+
+void blk_finish_plug(blk_plug_t* plug) {
+    if (current_thread && current_thread->plug == plug) {
+        blk_flush_plug(plug);
+        current_thread->plug = NULL;
+    }
+}
+
+// --- Waiting ---
+
+void bio_batch_init(bio_batch_t* batch) {
+    batch->pending = 1; // Dropped by bio_batch_wait
+    batch->status = BLK_STS_OK;
+    batch->done = false;
+    batch->waiters = NULL;
+}
+
+void bio_batch_add(bio_batch_t* batch) {
+    __atomic_add_fetch(&batch->pending, 1, __ATOMIC_RELAXED);
+}
+
+void bio_batch_done(bio_batch_t* batch, int status) {
+    if (status != BLK_STS_OK) batch->status = BLK_STS_IOERR;
+    if (__atomic_sub_fetch(&batch->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        thread_wake_event(&batch->waiters, &batch->done);
+    }
+}
+
+int bio_batch_wait(bio_batch_t* batch) {
+    // The bios may still be on our own plug
+    blk_plug_t* plug = blk_current_plug();
+    if (plug) blk_flush_plug(plug);
+
+    bio_batch_done(batch, BLK_STS_OK);
+    thread_wait_event(&batch->waiters, &batch->done);
+    return batch->status;
+}
+
+static void bio_end_batch(bio_t* bio) {
+    bio_batch_done(bio->private, bio->status);
+}
+
+int submit_bio_wait(bio_t* bio) {
+    bio_batch_t batch;
+    bio_batch_init(&batch);
+    bio_batch_add(&batch);
+    bio->end_io = bio_end_batch;
+    bio->private = &batch;
+    submit_bio(bio);
+    return bio_batch_wait(&batch);
+}
+
+static void bio_end_put(bio_t* bio) {
+    bio_batch_done(bio->private, bio->status);
+    bio_put(bio);
+}
+
+// One bio per max_sectors, all in flight together
+static int blkdev_rw(block_device_t* bdev, uint32_t op, uint64_t sector, void* buf, size_t bytes) {
+    bio_batch_t batch;
+    bio_batch_init(&batch);
+    blk_plug_t plug;
+    blk_start_plug(&plug);
+
+    uint8_t* p = buf;
+    size_t max = (size_t)(op == REQ_OP_DISCARD ? bdev->max_discard_sectors : bdev->max_sectors) << SECTOR_SHIFT;
+    while (bytes > 0) {
+        size_t len = bytes < max ? bytes : max;
+        bio_t* bio = bio_alloc(bdev, op, sector, 1);
+        if (!bio) {
+            batch.status = BLK_STS_IOERR;
+            break;
+        }
+        if (op == REQ_OP_DISCARD) {
+            bio->size = len;
+        } else if (bio_add(bio, p, len) != 0) {
+            bio_put(bio);
+            batch.status = BLK_STS_IOERR;
+            break;
+        }
+        bio->end_io = bio_end_put;
+        bio->private = &batch;
+        bio_batch_add(&batch);
+        submit_bio(bio);
+
+        p += len;
+        sector += len >> SECTOR_SHIFT;
+        bytes -= len;
+    }
+
+    blk_finish_plug(&plug);
+    return bio_batch_wait(&batch) == BLK_STS_OK ? 0 : -1;
+}
+
+int blkdev_read(block_device_t* bdev, uint64_t sector, void* buf, size_t bytes) {
+    return blkdev_rw(bdev, REQ_OP_READ, sector, buf, bytes);
+}
+
+int blkdev_write(block_device_t* bdev, uint64_t sector, const void* buf, size_t bytes) {
+    return blkdev_rw(bdev, REQ_OP_WRITE, sector, (void*)buf, bytes);
+}
+
+int blkdev_discard(block_device_t* bdev, uint64_t sector, uint64_t nr_sectors) {
+    if (!bdev->max_discard_sectors) return -1;
+    return blkdev_rw(bdev, REQ_OP_DISCARD, sector, NULL, nr_sectors << SECTOR_SHIFT);
+}
+
+void* blkdev_direct_access(block_device_t* bdev, uint64_t sector, bool create) {
+    if (!bdev->ops->direct_access || (sector & (PAGE_SIZE / SECTOR_SIZE - 1))) return NULL;
+    if (sector + PAGE_SIZE / SECTOR_SIZE > bdev->nr_sectors) return NULL;
+    return bdev->ops->direct_access(bdev, sector, create);
+}
+
+int blkdev_flush(block_device_t* bdev) {
+    bio_t* bio = bio_alloc(bdev, REQ_OP_FLUSH, 0, 0);
+    if (!bio) return -1;
+    int status = submit_bio_wait(bio);
+    bio_put(bio);
+    return status == BLK_STS_OK ? 0 : -1;
+}
+
+// --- Device Node ---
+
+// Byte ranges that are not whole blocks go through a bounce buffer
+// covering the blocks they touch
+static size_t blkdev_node_rw(fs_node_t* node, uint32_t op, uint64_t offset, size_t size, void* buffer) {
+    block_device_t* bdev = node->device_info;
+    uint64_t capacity = bdev->nr_sectors << SECTOR_SHIFT;
+    if (offset >= capacity) return 0;
+    if (size > capacity - offset) size = capacity - offset;
+
+    uint32_t bs = bdev->block_size;
+    if (offset % bs == 0 && size % bs == 0) {
+        return blkdev_rw(bdev, op, offset >> SECTOR_SHIFT, buffer, size) == 0 ? size : 0;
+    }
+
+    uint64_t start = offset - offset % bs;
+    uint64_t end = (offset + size + bs - 1) / bs * bs;
+    uint8_t* bounce = pmm_alloc(end - start);
+    if (!bounce) return 0;
+
+    size_t done = 0;
+    if (blkdev_rw(bdev, REQ_OP_READ, start >> SECTOR_SHIFT, bounce, end - start) == 0) {
+        if (op == REQ_OP_READ) {
+            memcpy(buffer, bounce + (offset - start), size);
+            done = size;
+        } else {
+            memcpy(bounce + (offset - start), buffer, size);
+            if (blkdev_rw(bdev, REQ_OP_WRITE, start >> SECTOR_SHIFT, bounce, end - start) == 0) done = size;
+        }
+    }
+    pmm_free(bounce, end - start);
+    return done;
+}
+
+static size_t blkdev_node_read(fs_node_t* node, uint64_t offset, size_t size, void* buffer) {
+    return blkdev_node_rw(node, REQ_OP_READ, offset, size, buffer);
+}
+
+static size_t blkdev_node_write(fs_node_t* node, uint64_t offset, size_t size, const void* buffer) {
+    return blkdev_node_rw(node, REQ_OP_WRITE, offset, size, (void*)buffer);
+}
+
+block_device_t* blkdev_of(fs_node_t* node) {
+    return node && node->read == &blkdev_node_read ? node->device_info : NULL;
+}
+
+// --- Registration ---
+
+static blk_sched_t* blk_sched_create(const elevator_type_t* type, block_device_t* bdev) {
+    blk_sched_t* sched = pmm_alloc(sizeof(blk_sched_t));
+    if (!sched) return NULL;
+    sched->type = type;
+    sched->lock = 0;
+    sched->data = type->init(bdev);
+    if (!sched->data) {
+        pmm_free(sched, sizeof(blk_sched_t));
+        return NULL;
+    }
+    return sched;
+}
+
+static void blk_sched_destroy(blk_sched_t* sched) {
+    sched->type->exit(sched->data);
+    pmm_free(sched, sizeof(blk_sched_t));
+}
+
+int blkdev_set_elevator(block_device_t* bdev, const char* name) {
+    const elevator_type_t* type = elv_find(name);
+    if (!type) return -1;
+
+    // Everything the switch needs is allocated before anything changes
+    blk_sched_t* fresh[BLK_MAX_HW_QUEUES];
+    blk_sched_t* old[BLK_MAX_HW_QUEUES];
+    uint32_t n = type->per_hctx ? bdev->nr_hw_queues : 1;
+    for (uint32_t i = 0; i < n; i++) {
+        fresh[i] = blk_sched_create(type, bdev);
+        if (!fresh[i]) {
+            while (i-- > 0) blk_sched_destroy(fresh[i]);
+            return -1;
+        }
+    }
+
+    // Requests the old scheduler holds move to the dispatch lists. A
+    // shared old instance is drained once per queue, which also catches
+    // requests inserted through queues not switched yet.
+    for (uint32_t i = 0; i < bdev->nr_hw_queues; i++) {
+        blk_hw_queue_t* hctx = bdev->hctx[i];
+        uint64_t flags = irq_save();
+        spinlock_acquire(&hctx->lock);
+        blk_sched_t* sched = hctx->sched;
+        old[i] = sched;
+        if (sched) {
+            spinlock_acquire(&sched->lock);
+            request_t* rq;
+            while ((rq = sched->type->dispatch(sched->data))) blk_dispatch_add(hctx, rq, false);
+            spinlock_release(&sched->lock);
+        }
+        hctx->sched = fresh[type->per_hctx ? i : 0];
+        spinlock_release(&hctx->lock);
+        irq_restore(flags);
+    }
+
+    for (uint32_t i = 0; i < bdev->nr_hw_queues; i++) {
+        bool first = true;
+        for (uint32_t j = 0; j < i; j++) {
+            if (old[j] == old[i]) first = false;
+        }
+        if (old[i] && first) blk_sched_destroy(old[i]);
+    }
+    for (uint32_t i = 0; i < bdev->nr_hw_queues; i++) blk_run_hw_queue(bdev->hctx[i]);
+    return 0;
+}
+
+int blkdev_register(block_device_t* bdev) {
+    if (!kblockd_wq) kblockd_wq = workqueue_create("kblockd");
+    if (!bdev->block_size) bdev->block_size = SECTOR_SIZE;
+    if (!bdev->physical_block_size) bdev->physical_block_size = bdev->block_size;
+    if (!bdev->max_sectors) bdev->max_sectors = 256;
+    // A discard bio's size is 32-bit like any other's
+    uint64_t discard_limit = (UINT32_MAX >> SECTOR_SHIFT) & ~(uint64_t)((bdev->block_size >> SECTOR_SHIFT) - 1);
+    if (bdev->max_discard_sectors > discard_limit) bdev->max_discard_sectors = discard_limit;
+    if (!bdev->max_segments || bdev->max_segments > BIO_MAX_VECS) bdev->max_segments = BIO_MAX_VECS;
+    if (!bdev->queue_depth) bdev->queue_depth = 1;
+    if (bdev->queue_depth > BLK_MAX_DEPTH) bdev->queue_depth = BLK_MAX_DEPTH;
+    if (!bdev->nr_hw_queues) bdev->nr_hw_queues = 1;
+    if (bdev->nr_hw_queues > BLK_MAX_HW_QUEUES) bdev->nr_hw_queues = BLK_MAX_HW_QUEUES;
+
+    for (uint32_t i = 0; i < bdev->nr_hw_queues; i++) {
+        blk_hw_queue_t* hctx = pmm_alloc(sizeof(blk_hw_queue_t));
+        if (!hctx) goto fail;
+        memset(hctx, 0, sizeof(blk_hw_queue_t));
+        hctx->bdev = bdev;
+        hctx->index = i;
+        hctx->done_work = (work_t)WORK_INIT(blk_done_work);
+        bdev->hctx[i] = hctx;
+    }
+    if (blkdev_set_elevator(bdev, bdev->elevator ? bdev->elevator : "mq-deadline") != 0) goto fail;
+
+    fs_node_t* node = pmm_alloc(sizeof(fs_node_t));
+    if (!node) goto fail;
+    memset(node, 0, sizeof(fs_node_t));
+    strcpy(node->name, bdev->name);
+    node->flags = FS_BLOCKDEVICE;
+    node->length = bdev->nr_sectors << SECTOR_SHIFT;
+    node->refcount = 1;
+    node->device_info = bdev;
+    node->read = &blkdev_node_read;
+    node->write = &blkdev_node_write;
+    bdev->node = node;
+
+    spinlock_acquire(&blkdev_list_lock);
+    bdev->next = blkdev_list;
+    blkdev_list = bdev;
+    spinlock_release(&blkdev_list_lock);
+    return 0;
+
+fail:
+    for (uint32_t i = 0; i < bdev->nr_hw_queues && bdev->hctx[i]; i++) {
+        if (bdev->hctx[i]->sched && (i == 0 || bdev->hctx[i]->sched != bdev->hctx[0]->sched)) {
+            blk_sched_destroy(bdev->hctx[i]->sched);
+        }
+        pmm_free(bdev->hctx[i], sizeof(blk_hw_queue_t));
+        bdev->hctx[i] = NULL;
+    }
+    return -1;
+}
+
+block_device_t* blkdev_find(const char* name) {
+    spinlock_acquire(&blkdev_list_lock);
+    block_device_t* bdev = blkdev_list;
+    while (bdev && strcmp(bdev->name, name) != 0) bdev = bdev->next;
+    spinlock_release(&blkdev_list_lock);
+    return bdev;
+}
@@ -0,0 +1,207 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../fs/vfs.h"
+#include "../sync/spinlock.h"
+#include "../proc/workqueue.h"
+
+// Block I/O layer. Upper layers describe I/O as bios: one operation on a
+// run of sectors, the data in one or more buffers, and a callback for when
+// it is done. Bios become requests, bios that continue one another being
+// merged into one request, and an I/O scheduler (elevator.h) decides the
+// order in which requests go to the driver. Drivers take requests through
+// their queue_rq op, at most queue_depth at a time per hardware queue, and
+// report them done with blk_complete_request, or blk_complete_request_irq
+// from an interrupt handler.
+//
+// A thread about to submit a batch of bios can plug: the bios collect on
+// the plug, merged as they arrive, and only reach the scheduler, sorted,
+// when the plug is finished. The device then sees a few large requests in
+// order rather than many small ones.
+//
+// Sectors are 512 bytes here whatever the device's logical block size;
+// I/O must still be aligned to the latter.
+
+#define SECTOR_SHIFT 9
+#define SECTOR_SIZE  (1u << SECTOR_SHIFT)
+
+// Operations
+#define REQ_OP_READ    0
+#define REQ_OP_WRITE   1
+#define REQ_OP_FLUSH   2 // No data; writes completed before it are on the media after it
+#define REQ_OP_DISCARD 3 // No data; the contents of the sectors are no longer needed
+
+// Completion status, and what queue_rq returns
+#define BLK_STS_OK     0
+#define BLK_STS_IOERR  -1
+#define BLK_STS_BUSY   1 // queue_rq only: the hardware is full, retry after a completion
+
+#define BLK_MAX_HW_QUEUES 16  // One per CPU at most
+#define BLK_MAX_DEPTH     256 // Requests in flight per hardware queue
+#define BIO_MAX_VECS      128
+
+struct block_device;
+struct blk_hw_queue;
+struct blk_sched;
+
+typedef struct bio_vec {
+    void* base;
+    uint32_t len; // Multiple of SECTOR_SIZE
+} bio_vec_t;
+
+typedef struct bio bio_t;
+typedef void (*bio_end_io_t)(bio_t* bio);
+
+struct bio {
+    struct block_device* bdev;
+    uint64_t sector;
+    uint32_t op;            // REQ_OP_*
+    uint32_t size;          // Bytes; a discard has a size but no vecs
+    uint16_t vcnt;
+    uint16_t max_vecs;
+    int status;             // BLK_STS_*, set before end_io runs
+    bio_end_io_t end_io;    // Runs in process context, in the driver or kblockd
+    void* private;          // For end_io
+    bio_t* next;            // Next bio of the same request
+    bio_vec_t vecs[];
+};
+
+typedef struct request {
+    struct blk_hw_queue* hctx; // Queue it was dispatched on
+    uint64_t sector;
+    uint32_t nr_sectors;
+    uint32_t op;
+    uint32_t nr_segments;   // Vecs over all bios
+    int tag;                // Unique among the queue's requests in flight; -1 before
+    int status;             // Passed to blk_complete_request_irq
+    uint64_t deadline;      // ktime_get_ns() by which the scheduler should dispatch it
+    bio_t* bio;             // In sector order
+    bio_t* biotail;
+    void* driver_data;
+
+    struct request* next;   // Plug and dispatch lists
+    struct request* sort_prev;
+    struct request* sort_next;
+    struct request* fifo_prev;
+    struct request* fifo_next;
+} request_t;
+
+typedef struct blk_hw_queue {
+    struct block_device* bdev;
+    uint32_t index;
+    spinlock_t lock;            // Everything below, with interrupts off
+    struct blk_sched* sched;    // Shared with the other queues unless the elevator is per queue
+    request_t* dispatch_head;   // Ahead of the scheduler: flushes and requests the driver bounced
+    request_t* dispatch_tail;
+    uint32_t inflight;
+    uint64_t tags[BLK_MAX_DEPTH / 64];
+    bool running;               // Someone is in the dispatch loop
+    bool rerun;                 // A completion came in while they were
+    request_t* done_head;       // Completed from interrupts, for done_work
+    work_t done_work;
+    void* driver_data;
+} blk_hw_queue_t;
+
+typedef struct blkdev_ops {
+    // Starts `rq` on the hardware; rq->tag is free to use as a slot number.
+    // Returns BLK_STS_OK once the request is the driver's to complete
+    // (it may already be), or BLK_STS_BUSY to have it handed over again
+    // after the next completion. Called without locks held.
+    int (*queue_rq)(blk_hw_queue_t* hctx, request_t* rq);
+    // Optional, for devices that are memory: the page of the device that
+    // holds the PAGE_SIZE bytes from `sector` (page aligned), which stays
+    // put for as long as the device exists. With `create` a page is
+    // provided for a hole; without, a hole gives NULL.
+    void* (*direct_access)(struct block_device* bdev, uint64_t sector, bool create);
+} blkdev_ops_t;
+
+typedef struct block_device {
+    // Filled in by the driver
+    char name[16];
+    const blkdev_ops_t* ops;
+    void* driver_data;
+    uint32_t block_size;    // Logical block size in bytes; 0: 512
+    uint32_t physical_block_size; // Smallest write without read-modify-write; 0: block_size
+    uint64_t nr_sectors;    // Capacity
+    uint32_t max_sectors;   // Largest request; 0: 256
+    uint32_t max_segments;  // Most vecs in one request; 0: BIO_MAX_VECS
+    uint64_t max_discard_sectors; // Largest discard; 0: discard not supported
+    uint32_t queue_depth;   // Requests in flight per hardware queue; 0: 1
+    uint32_t nr_hw_queues;  // 0: 1
+    const char* elevator;   // Scheduler to start with; NULL: mq-deadline
+
+    // Set up by blkdev_register
+    blk_hw_queue_t* hctx[BLK_MAX_HW_QUEUES];
+    fs_node_t* node;        // Byte-addressed synchronous I/O through the layer
+    struct block_device* next;
+} block_device_t;
+
+typedef struct blk_plug {
+    request_t* head;
+    request_t* tail;
+    uint32_t count;
+} blk_plug_t;
+
+// Waits for a group of bios: bio_batch_add before submitting each one,
+// bio_batch_done from each end_io
+typedef struct bio_batch {
+    uint32_t pending;
+    int status;             // BLK_STS_IOERR if any bio failed
+    volatile bool done;
+    struct wait_queue* waiters;
+} bio_batch_t;
+
+// Sets up the hardware queues and the scheduler, and makes the device
+// findable by name. Returns -1 when out of memory.
+int blkdev_register(block_device_t* bdev);
+block_device_t* blkdev_find(const char* name);
+// The device behind a node from blkdev_register, NULL for other nodes
+block_device_t* blkdev_of(fs_node_t* node);
+// Switches to the elevator called `name`; queued requests are kept
+int blkdev_set_elevator(block_device_t* bdev, const char* name);
+
+// A bio with room for `nr_vecs` buffers (at most BIO_MAX_VECS). NULL when
+// out of memory.
+bio_t* bio_alloc(block_device_t* bdev, uint32_t op, uint64_t sector, uint32_t nr_vecs);
+// Appends a buffer. -1 if the bio is full or would exceed the device's
+// limits; the caller then submits it and starts another.
+int bio_add(bio_t* bio, void* buf, uint32_t len);
+void bio_put(bio_t* bio);
+
+// Queues `bio`. Its end_io runs once it is done, possibly before this
+// returns; the submitter owns the bio again from then on.
+void submit_bio(bio_t* bio);
+// Submits `bio` and waits for it. Returns its status; the caller puts it.
+int submit_bio_wait(bio_t* bio);
+
+// Called by drivers when `rq` is done. Completes its bios and starts
+// whatever can go next.
+void blk_complete_request(request_t* rq, int status);
+// The same from an interrupt handler. The bios' end_io callbacks may
+// allocate or take locks that interrupts must not, so the completion is
+// finished by the kblockd thread.
+void blk_complete_request_irq(request_t* rq, int status);
+
+void blk_start_plug(blk_plug_t* plug);
+void blk_finish_plug(blk_plug_t* plug);
+
+void bio_batch_init(bio_batch_t* batch);
+void bio_batch_add(bio_batch_t* batch);
+void bio_batch_done(bio_batch_t* batch, int status);
+// Waits until every bio added so far is done; returns the batch status
+int bio_batch_wait(bio_batch_t* batch);
+
+// Synchronous helpers. Return 0 or -1.
+int blkdev_read(block_device_t* bdev, uint64_t sector, void* buf, size_t bytes);
+int blkdev_write(block_device_t* bdev, uint64_t sector, const void* buf, size_t bytes);
+int blkdev_flush(block_device_t* bdev);
+// -1 also when the device does not support discard
+int blkdev_discard(block_device_t* bdev, uint64_t sector, uint64_t nr_sectors);
+// The device's own page at `sector`, as direct_access. NULL when the
+// device has no direct access.
+void* blkdev_direct_access(block_device_t* bdev, uint64_t sector, bool create);
+
+#endif
@@ -0,0 +1,153 @@
+/* kernel/src/block/deadline.c */
+
+#include "elevator.h"
+#include "../mem/pmm.h"
+#include "../proc/vdso.h"
+#include "../lib/string.h"
+
+// Requests are kept twice per direction: sorted by sector, which is the
+// order they are normally dispatched in, one batch at a time, and in
+// arrival order with a deadline each. A batch that starts while the oldest
+// request is past its deadline starts there instead of where the sweep
+// left off. Reads are preferred, but only DD_WRITES_STARVED times in a row
+// while writes are waiting.
+
+#define DD_READ  0
+#define DD_WRITE 1
+
+#define DD_READ_EXPIRE_NS  (500ULL * 1000000)  // 500 ms
+#define DD_WRITE_EXPIRE_NS (5000ULL * 1000000) // 5 s
+#define DD_FIFO_BATCH      16
+#define DD_WRITES_STARVED  2
+
+typedef struct {
+    request_t* sort_head[2];
+    request_t* fifo_head[2];
+    request_t* fifo_tail[2];
+    request_t* next_rq[2];  // Where the current sweep continues
+    uint32_t batching;      // Requests dispatched in the current batch
+    uint32_t starved;       // Read batches started while writes waited
+} deadline_data_t;
+
+static int dd_dir(const request_t* rq) {
+    return rq->op == REQ_OP_READ ? DD_READ : DD_WRITE;
+}
+
+static void* dd_init(block_device_t* bdev) {
+    (void)bdev;
+    deadline_data_t* dd = pmm_alloc(sizeof(deadline_data_t));
+    if (dd) memset(dd, 0, sizeof(deadline_data_t));
+    return dd;
+}
+
+static void dd_exit(void* data) {
+    pmm_free(data, sizeof(deadline_data_t));
+}
+
+static bool dd_bio_merge(void* data, bio_t* bio) {
+    deadline_data_t* dd = data;
+    if (bio->op != REQ_OP_READ && bio->op != REQ_OP_WRITE) return false;
+
+    int dir = bio->op == REQ_OP_READ ? DD_READ : DD_WRITE;
+    for (request_t* rq = dd->sort_head[dir]; rq && rq->sector <= bio->sector + (bio->size >> SECTOR_SHIFT); rq = rq->sort_next) {
+        if (blk_try_merge(rq, bio) != ELV_NO_MERGE) return true;
+    }
+    return false;
+}
+
+static void dd_insert(void* data, request_t* rq) {
+    deadline_data_t* dd = data;
+    int dir = dd_dir(rq);
+
+    rq->deadline = ktime_get_ns() + (dir == DD_READ ? DD_READ_EXPIRE_NS : DD_WRITE_EXPIRE_NS);
+    rq->fifo_next = NULL;
+    rq->fifo_prev = dd->fifo_tail[dir];
+    if (dd->fifo_tail[dir]) dd->fifo_tail[dir]->fifo_next = rq;
+    else dd->fifo_head[dir] = rq;
+    dd->fifo_tail[dir] = rq;
+
+    request_t* prev = NULL;
+    request_t* next = dd->sort_head[dir];
+    while (next && next->sector <= rq->sector) {
+        prev = next;
+        next = next->sort_next;
+    }
+    rq->sort_prev = prev;
+    rq->sort_next = next;
+    if (prev) prev->sort_next = rq;
+    else dd->sort_head[dir] = rq;
+    if (next) next->sort_prev = rq;
+}
+
+static void dd_remove(deadline_data_t* dd, request_t* rq) {
+    int dir = dd_dir(rq);
+
+    if (rq->sort_prev) rq->sort_prev->sort_next = rq->sort_next;
+    else dd->sort_head[dir] = rq->sort_next;
+    if (rq->sort_next) rq->sort_next->sort_prev = rq->sort_prev;
+
+    if (rq->fifo_prev) rq->fifo_prev->fifo_next = rq->fifo_next;
+    else dd->fifo_head[dir] = rq->fifo_next;
+    if (rq->fifo_next) rq->fifo_next->fifo_prev = rq->fifo_prev;
+    else dd->fifo_tail[dir] = rq->fifo_prev;
+}
+
+static request_t* dd_dispatch(void* data) {
+    deadline_data_t* dd = data;
+    request_t* rq = NULL;
+    int dir = DD_READ;
+
+    // Carry on with the current batch while it lasts
+    if (dd->next_rq[DD_READ]) {
+        rq = dd->next_rq[DD_READ];
+    } else if (dd->next_rq[DD_WRITE]) {
+        rq = dd->next_rq[DD_WRITE];
+        dir = DD_WRITE;
+    }
+
+    if (!rq || dd->batching >= DD_FIFO_BATCH) {
+        bool reads = dd->fifo_head[DD_READ] != NULL;
+        bool writes = dd->fifo_head[DD_WRITE] != NULL;
+
+        if (reads && !(writes && dd->starved >= DD_WRITES_STARVED)) {
+            dir = DD_READ;
+            if (writes) dd->starved++;
+        } else if (writes) {
+            dir = DD_WRITE;
+            dd->starved = 0;
+        } else {
+            return NULL;
+        }
+
+        rq = dd->next_rq[dir];
+        request_t* oldest = dd->fifo_head[dir];
+        if (!rq || ktime_get_ns() >= oldest->deadline) rq = oldest;
+        dd->batching = 0;
+    }
+
+    dd->next_rq[DD_READ] = dd->next_rq[DD_WRITE] = NULL;
+    dd->next_rq[dir] = rq->sort_next;
+    dd->batching++;
+    dd_remove(dd, rq);
+    return rq;
+}
+
+const elevator_type_t elv_deadline = {
+    .name = "deadline",
+    .per_hctx = false,
+    .init = dd_init,
+    .exit = dd_exit,
+    .bio_merge = dd_bio_merge,
+    .insert = dd_insert,
+    .dispatch = dd_dispatch,
+};
+
+const elevator_type_t elv_mq_deadline = {
+    .name = "mq-deadline",
+    .per_hctx = true,
+    .init = dd_init,
+    .exit = dd_exit,
+    .bio_merge = dd_bio_merge,
+    .insert = dd_insert,
+    .dispatch = dd_dispatch,
+};
@@ -0,0 +1,70 @@
+/* kernel/src/block/elevator.c */
+
+#include "elevator.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+
+static const elevator_type_t* elevators[] = {
+    &elv_noop,
+    &elv_deadline,
+    &elv_mq_deadline,
+};
+
+const elevator_type_t* elv_find(const char* name) {
+    for (size_t i = 0; i < sizeof(elevators) / sizeof(elevators[0]); i++) {
+        if (strcmp(elevators[i]->name, name) == 0) return elevators[i];
+    }
+    return NULL;
+}
+
+// --- noop ---
+
+typedef struct {
+    request_t* head;
+    request_t* tail;
+} noop_data_t;
+
+static void* noop_init(block_device_t* bdev) {
+    (void)bdev;
+    noop_data_t* nd = pmm_alloc(sizeof(noop_data_t));
+    if (nd) memset(nd, 0, sizeof(noop_data_t));
+    return nd;
+}
+
+static void noop_exit(void* data) {
+    pmm_free(data, sizeof(noop_data_t));
+}
+
+// Only the newest request: a sequential stream keeps extending it
+static bool noop_bio_merge(void* data, bio_t* bio) {
+    noop_data_t* nd = data;
+    return nd->tail && blk_try_merge(nd->tail, bio) != ELV_NO_MERGE;
+}
+
+static void noop_insert(void* data, request_t* rq) {
+    noop_data_t* nd = data;
+    rq->fifo_next = NULL;
+    if (nd->tail) nd->tail->fifo_next = rq;
+    else nd->head = rq;
+    nd->tail = rq;
+}
+
+static request_t* noop_dispatch(void* data) {
+    noop_data_t* nd = data;
+    request_t* rq = nd->head;
+    if (rq) {
+        nd->head = rq->fifo_next;
+        if (!nd->head) nd->tail = NULL;
+    }
+    return rq;
+}
+
+const elevator_type_t elv_noop = {
+    .name = "noop",
+    .per_hctx = true,
+    .init = noop_init,
+    .exit = noop_exit,
+    .bio_merge = noop_bio_merge,
+    .insert = noop_insert,
+    .dispatch = noop_dispatch,
+};
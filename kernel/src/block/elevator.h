@@ -0,0 +1,52 @@
+#ifndef ELEVATOR_H
+#define ELEVATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blkdev.h"
+
+// I/O schedulers. An elevator holds the requests that have been submitted
+// but not dispatched, picks which goes to the driver next, and gets a
+// chance to merge each new bio into one it holds. Its ops run under the
+// instance lock, with interrupts off.
+//
+//   noop         FIFO order, merging only with the newest request
+//   deadline     Ascending sector order per direction, reads preferred,
+//                each request dispatched by its deadline; one instance
+//                for the whole device
+//   mq-deadline  The same with one instance per hardware queue, so CPUs
+//                submitting to different queues do not share a lock
+
+typedef struct elevator_type {
+    const char* name;
+    bool per_hctx; // One instance per hardware queue rather than per device
+    void* (*init)(block_device_t* bdev);
+    void (*exit)(void* data);
+    // Whether `bio` was merged into a request held by the scheduler
+    bool (*bio_merge)(void* data, bio_t* bio);
+    void (*insert)(void* data, request_t* rq);
+    // Takes the next request out, or NULL
+    request_t* (*dispatch)(void* data);
+} elevator_type_t;
+
+typedef struct blk_sched {
+    const elevator_type_t* type;
+    void* data;
+    spinlock_t lock;
+} blk_sched_t;
+
+#define ELV_NO_MERGE    0
+#define ELV_BACK_MERGE  1 // Bio added at the end of the request
+#define ELV_FRONT_MERGE 2 // At the start; the request's sector moved down
+
+extern const elevator_type_t elv_noop;
+extern const elevator_type_t elv_deadline;
+extern const elevator_type_t elv_mq_deadline;
+
+const elevator_type_t* elv_find(const char* name);
+
+// Adds `bio` to `rq` if it continues it either way and the result stays
+// within the device's limits. Returns ELV_*.
+int blk_try_merge(request_t* rq, bio_t* bio);
+
+#endif
@@ -1,328 +1,530 @@
-/*
- * AHCI SATA driver (minimal, boot-ready)
- * - Probes HBA ports, identifies SATA devices
- * - Exposes read/write via VFS fs_node_t hooks
- *
- * This file is self-contained with local shims for missing kernel glue:
- *  - print() macro -> kprintf()
- *  - pmm_alloc_page() wrapper -> pmm_alloc(PAGE_SIZE)
- *  - PAGE_SIZE default (4096) if not defined
- *
- * Assumes:
- *  - PCI enumeration sets up BAR5 for AHCI HBA mapping (not shown here)
- *  - MMIO mapping provides a valid volatile hba_mem_t* (see ahci.h)
- *  - VFS nodes support ->device_info for per-device pointer
- */
+/* kernel/src/drivers/ahci.c */
+
+// AHCI SATA driver. Probes the HBA's ports and registers each SATA disk
+// with the block layer. Requests are issued in the command slot matching
+// their tag. Disks that support NCQ get up to 32 of them in flight as
+// READ/WRITE FPDMA QUEUED; the interrupt handler finds the finished ones
+// by comparing the slots it issued with PxSACT and PxCI. Without NCQ, or
+// with no usable interrupt, there is one request at a time.
 
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
-#include <stdarg.h>
 
+#include "ahci.h"
+#include "pci.h"
+#include "ata_identify.h"
+#include "../block/blkdev.h"
+#include "../mem/pmm.h"
+#include "../mem/vmm.h"
 #include "../lib/string.h"
+#include "../sync/spinlock.h"
+#include "../../arch/x86_64/cpu.h"
+#include "../../arch/x86_64/idt.h"
 
-/* ---- Kernel logging shim ---- */
-#ifndef HAVE_KPRINTF
-extern void kprintf(const char *fmt, ...);
-#endif
-#ifndef print
-#define print kprintf
-#endif
-
-/* ---- Paging/PMM shim ---- */
-#ifndef PAGE_SIZE
-#define PAGE_SIZE 4096u
-#endif
-
-/* Try to use the kernel PMM if available; otherwise declare externs. */
-#if !defined(HAVE_PMM_ALLOC_PAGE)
-extern void *pmm_alloc(size_t size);
-static inline void *pmm_alloc_page(void) {
-    return pmm_alloc(PAGE_SIZE);
-}
-#else
-extern void *pmm_alloc_page(void);
-#endif
-
-/* ---- Local includes ---- */
-#include "ahci.h"           /* AHCI register/struct definitions + ahci_device_t */
-#include "../mem/vmm.h"      /* If you need to map MMIO; not strictly required here */
-#include "../fs/vfs.h"      /* fs_node_t and VFS ops (now includes device_info) */
-#include "../lib/byteswap.h"/* if present; otherwise not required */
-
-/* ------------ Utility macros ------------ */
-#define MIN(a,b) ((a) < (b) ? (a) : (b))
-
-/* HBA/Port helpers (names match common OSDev layouts) */
-static int find_cmd_slot(hba_port_t *port) {
-    /* A command slot is free if both SACT and CI bits are zero. */
-    uint32_t slots = port->sact | port->ci;
-    for (int i = 0; i < 32; i++) {
-        if ((slots & (1u << i)) == 0)
-            return i;
-    }
-    return -1;
+void print(char*);
+
+#define AHCI_TIMEOUT_SPINS 10000000
+#define AHCI_PCI_CLASS     0x01 // Mass storage
+#define AHCI_PCI_SUBCLASS  0x06 // SATA
+#define AHCI_ABAR          (PCI_BAR0 + 5 * 4)
+
+// Completions the ports interrupt for
+#define AHCI_PORT_IRQS (HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_SDBS | HBA_PxIS_DPS | HBA_PxIS_ERRORS)
+
+volatile hba_mem_t* ahci_hba = NULL;
+
+typedef struct ahci_device {
+    hba_port_t* port;
+    int port_num;
+    hba_cmd_header_t* cmd_list; // What PxCLB points the HBA at
+    void* rx_fis;               // PxFB
+    hba_cmd_tbl_t* tables[32];  // Each slot's CTBA
+    bool ncq;               // Reads and writes go out as FPDMA QUEUED
+    uint32_t lba_shift;     // log2 of 512-byte sectors per LBA
+    bool write_cache;       // Flushes need to reach the drive
+    spinlock_t lock;        // Below, with interrupts off
+    uint32_t active;        // Slots issued and not yet seen complete
+    bool non_queued;        // The active slot is a non-NCQ command, which runs alone
+    request_t* slots[32];
+    block_device_t bdev;
+} ahci_device_t;
+
+static ahci_device_t* ahci_ports[32];
+static bool ahci_irqs;      // Completions are interrupt driven; polled otherwise
+static bool ahci_dma64;     // CAP.S64A: buffers may be above 4 GiB
+
+// --- Port Setup ---
+
+// Bus address of `virt` for the HBA, -1 if it cannot reach it. Buffers
+// are kernel addresses, so the kernel's tables will do for the walk.
+static uint64_t ahci_dma_addr(const void* virt) {
+    uint64_t phys = (uint64_t)(uintptr_t)virt;
+    if (current_pml4 && !vmm_virt_to_phys((pml4_t*)current_pml4, phys, &phys)) return (uint64_t)-1;
+    if (!ahci_dma64 && phys >= (1ULL << 32)) return (uint64_t)-1;
+    return phys;
 }
 
-/* Rebase a single port: allocate command list, FIS, and command tables */
-static void port_rebase(hba_port_t *port) {
-    /* Stop command engine */
+static void port_stop(hba_port_t* port) {
     port->cmd &= ~HBA_PxCMD_ST;
-    while (port->cmd & HBA_PxCMD_CR) { /* wait until CR clears */ }
-
-    /* Allocate command list (1 page aligned) */
-    void *cmd_list_base = pmm_alloc_page();
-    memset(cmd_list_base, 0, PAGE_SIZE);
-    port->clb  = (uint32_t)(uintptr_t)cmd_list_base;
-    port->clbu = 0;
-
-    /* Allocate received FIS (1 page aligned) */
-    void *fis_base = pmm_alloc_page();
-    memset(fis_base, 0, PAGE_SIZE);
-    port->fb  = (uint32_t)(uintptr_t)fis_base;
-    port->fbu = 0;
-
-    /* Command tables: one per slot, we use 256 bytes alignment; one page per slot is simplest */
-    hba_cmd_header_t *cmd_hdr = (hba_cmd_header_t *)cmd_list_base;
-    for (int i = 0; i < 32; i++) {
-        cmd_hdr[i].prdtl = 0;
-        cmd_hdr[i].cfl   = 0;
-        cmd_hdr[i].w     = 0;
-        void *cmd_table_base = pmm_alloc_page();
-        memset(cmd_table_base, 0, PAGE_SIZE);
-        cmd_hdr[i].ctba  = (uint32_t)(uintptr_t)cmd_table_base;
-        cmd_hdr[i].ctbau = 0;
-    }
+    port->cmd &= ~HBA_PxCMD_FRE;
+    while (port->cmd & (HBA_PxCMD_FR | HBA_PxCMD_CR));
+}
 
-    /* Start command engine */
+static void port_start(hba_port_t* port) {
+    while (port->cmd & HBA_PxCMD_CR);
     port->cmd |= HBA_PxCMD_FRE;
     port->cmd |= HBA_PxCMD_ST;
 }
 
-/* --------- Simple per-device struct bound to VFS node --------- */
-typedef struct ahci_device {
-    hba_port_t    *port;
-    uint32_t       sector_size; /* logical block size; default 512 */
-    uint64_t       num_sectors; /* capacity if known; 0 = unknown */
-} ahci_device_t;
+// Frees what port_rebase allocated; the port must be stopped
+static void port_free(ahci_device_t* dev) {
+    for (int i = 0; i < 32; i++) {
+        if (dev->tables[i]) pmm_free(dev->tables[i], AHCI_CMD_TBL_SIZE);
+        dev->tables[i] = NULL;
+    }
+    if (dev->cmd_list) pmm_free_page(dev->cmd_list);
+    if (dev->rx_fis) pmm_free_page(dev->rx_fis);
+    dev->cmd_list = NULL;
+    dev->rx_fis = NULL;
+}
 
-/* Extern from platform code: AHCI controller MMIO base */
-extern volatile hba_mem_t *ahci_hba;
+// Gives the port a command list and a received-FIS area, a page each, and
+// a command table of AHCI_CMD_TBL_SIZE per slot. The HBA is handed their
+// bus addresses and the driver keeps the kernel pointers. Fails if any of
+// them is out of the HBA's reach.
+static int port_rebase(ahci_device_t* dev) {
+    hba_port_t* port = dev->port;
+    port_stop(port);
+
+    dev->cmd_list = pmm_alloc_page();
+    dev->rx_fis = pmm_alloc_page();
+    uint64_t clb = dev->cmd_list ? ahci_dma_addr(dev->cmd_list) : (uint64_t)-1;
+    uint64_t fb = dev->rx_fis ? ahci_dma_addr(dev->rx_fis) : (uint64_t)-1;
+    if (clb == (uint64_t)-1 || fb == (uint64_t)-1) goto fail;
+    memset(dev->cmd_list, 0, PAGE_SIZE);
+    memset(dev->rx_fis, 0, PAGE_SIZE);
 
-/* Probe HBA ports and create device nodes under /dev/sdX (integration left to VFS code) */
-static void ahci_probe_and_attach(void) {
-    if (!ahci_hba) {
-        print("AHCI: HBA MMIO base is NULL; controller not initialized\n");
-        return;
+    for (int i = 0; i < 32; i++) {
+        dev->tables[i] = pmm_alloc(AHCI_CMD_TBL_SIZE);
+        if (!dev->tables[i]) goto fail;
+        uint64_t ctba = ahci_dma_addr(dev->tables[i]);
+        if (ctba == (uint64_t)-1) goto fail;
+        memset(dev->tables[i], 0, AHCI_CMD_TBL_SIZE);
+        dev->cmd_list[i].ctba = ctba;
     }
 
-    uint32_t pi = ahci_hba->pi;
-    for (int i = 0; i < 32; i++) {
-        if (!(pi & (1u << i))) continue;
+    port->clb = clb;
+    port->fb = fb;
+    port->serr = port->serr; // Write-1-to-clear
+    port->is = port->is;
+    port_start(port);
+    return 0;
 
-        hba_port_t *port = &ahci_hba->ports[i];
+fail:
+    print("AHCI: no memory the HBA can reach for the port\n");
+    port_free(dev);
+    return -1;
+}
 
-        /* Check device type */
-        uint32_t ssts = port->ssts;
-        uint8_t ipm = (ssts >> 8) & 0x0F;
-        uint8_t det = (ssts >> 0) & 0x0F;
-        if (det != HBA_PORT_DET_PRESENT || ipm != HBA_PORT_IPM_ACTIVE) {
-            continue;
-        }
+// --- Commands ---
 
-        uint32_t sig = port->sig;
-        if (sig != SATA_SIG_ATAPI && sig != SATA_SIG_ATA && sig != SATA_SIG_SEMB && sig != SATA_SIG_PM) {
-            continue;
-        }
+// Fills in the slot's header and command FIS for `command`, with the
+// PRDT left empty
+static hba_cmd_tbl_t* ahci_setup_cmd(ahci_device_t* dev, int slot, uint8_t command, uint64_t lba, uint32_t count, bool write) {
+    hba_cmd_header_t* hdr = &dev->cmd_list[slot];
+    hdr->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+    hdr->w = write;
+    hdr->prdtl = 0;
+    hdr->prdbc = 0;
 
-        /* Rebase buffers */
-        port_rebase(port);
+    hba_cmd_tbl_t* tbl = dev->tables[slot];
+    memset(tbl, 0, sizeof(hba_cmd_tbl_t) - sizeof(hba_prdt_entry_t));
 
-        /* Allocate device struct */
-        ahci_device_t *dev = (ahci_device_t *)pmm_alloc_page();
-        memset(dev, 0, sizeof(*dev));
-        dev->port = port;
-        dev->sector_size = 512;
-        dev->num_sectors = 0;
-
-        /* Create/attach VFS node for this device */
-        char name[FS_NAME_MAX];
-        /* sdX naming: sda, sdb... based on port index */
-        name[0] = 's'; name[1] = 'd';
-        name[2] = 'a' + (char)i; name[3] = '\0';
-
-        fs_node_t *node = vfs_create_blockdev_node(name);
-        if (!node) {
-            print("AHCI: failed to create VFS node for port %d\n", i);
-            continue;
+    fis_reg_h2d_t* fis = (fis_reg_h2d_t*)tbl->cfis;
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->c = 1;
+    fis->command = command;
+    fis->device = 1 << 6; // LBA mode
+    fis->lba0 = (uint8_t)lba;
+    fis->lba1 = (uint8_t)(lba >> 8);
+    fis->lba2 = (uint8_t)(lba >> 16);
+    fis->lba3 = (uint8_t)(lba >> 24);
+    fis->lba4 = (uint8_t)(lba >> 32);
+    fis->lba5 = (uint8_t)(lba >> 40);
+    fis->count_low = (uint8_t)count;
+    fis->count_high = (uint8_t)(count >> 8);
+    return tbl;
+}
+
+// Describes the request's buffers to the HBA. Each is translated a page at
+// a time, and pages that turn out to be physically contiguous (within and
+// across buffers) share an entry, up to the 4 MiB one can describe.
+static int ahci_fill_prdt(ahci_device_t* dev, int slot, hba_cmd_tbl_t* tbl, request_t* rq) {
+    uint32_t n = 0;
+    uint64_t next = (uint64_t)-1; // Physical address the last entry ends at
+
+    for (bio_t* bio = rq->bio; bio; bio = bio->next) {
+        for (uint16_t i = 0; i < bio->vcnt; i++) {
+            uint8_t* base = bio->vecs[i].base;
+            uint32_t left = bio->vecs[i].len;
+            while (left > 0) {
+                uint32_t len = PAGE_SIZE - ((uintptr_t)base & (PAGE_SIZE - 1));
+                if (len > left) len = left;
+                uint64_t phys = ahci_dma_addr(base);
+                if (phys == (uint64_t)-1) return -1;
+
+                hba_prdt_entry_t* prev = n ? &tbl->prdt_entry[n - 1] : NULL;
+                if (prev && phys == next && (prev->dbc & 0x3FFFFF) + 1 + len <= HBA_PRDT_DBC_MAX) {
+                    prev->dbc += len;
+                } else {
+                    if (n == AHCI_PRDT_ENTRIES) return -1;
+                    tbl->prdt_entry[n].dba = phys;
+                    tbl->prdt_entry[n].rsv0 = 0;
+                    tbl->prdt_entry[n].dbc = len - 1;
+                    n++;
+                }
+                next = phys + len;
+                base += len;
+                left -= len;
+            }
         }
+    }
+    dev->cmd_list[slot].prdtl = n;
+    return 0;
+}
 
-        node->flags        = FS_BLOCKDEVICE;
-        node->length       = 0; /* unknown until identify */
-        node->device_info  = dev;
-        node->read         = ahci_read;
-        node->write        = ahci_write;
+// Issues the slot and spins until the HBA clears it. -1 on a task file
+// error or timeout.
+static int ahci_issue_and_wait(hba_port_t* port, int slot) {
+    for (int i = 0; port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ); i++) {
+        if (i == AHCI_TIMEOUT_SPINS) return -1;
+    }
 
-        /* Optional: perform IDENTIFY to fill capacity (not fully implemented here) */
-        print("AHCI: Attached %s at port %d (sig=0x%08x)\n", name, i, sig);
+    port->ci = 1u << slot;
+    for (int i = 0; port->ci & (1u << slot); i++) {
+        if (port->is & HBA_PxIS_TFES) return -1;
+        if (i == AHCI_TIMEOUT_SPINS) return -1;
     }
+    return (port->is & HBA_PxIS_TFES) ? -1 : 0;
 }
 
-/* -------------- Low-level I/O helpers --------------
- * Minimal PIO via FIS/command list. For brevity and portability, the following
- * read/write implementation is conservative and synchronous.
- */
+// READ/WRITE FPDMA QUEUED: the sector count moves to the feature field
+// and the count field carries the NCQ tag, which is the slot
+static hba_cmd_tbl_t* ahci_setup_fpdma(ahci_device_t* dev, int slot, uint64_t lba, uint32_t count, bool write) {
+    hba_cmd_tbl_t* tbl = ahci_setup_cmd(dev, slot, write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA, lba, 0, write);
+    fis_reg_h2d_t* fis = (fis_reg_h2d_t*)tbl->cfis;
+    fis->feature_low = (uint8_t)count;
+    fis->feature_high = (uint8_t)(count >> 8);
+    fis->count_low = (uint8_t)(slot << 3);
+    fis->count_high = 0;
+    return tbl;
+}
 
-static int ahci_wait_ready(hba_port_t *port) {
-    /* Wait until the port is not busy and not DRQ */
-    for (int i = 0; i < 1000000; i++) {
-        if ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)) == 0)
-            return 0;
+// Sets the slot going; its completion is picked up by ahci_port_irq. NCQ
+// and non-NCQ commands cannot be outstanding together, so the latter wait
+// for the port to go idle and hold everything else off while they run.
+static int ahci_issue(ahci_device_t* dev, int slot, request_t* rq, bool queued) {
+    hba_port_t* port = dev->port;
+    uint32_t bit = 1u << slot;
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&dev->lock);
+    if (dev->non_queued || (!queued && dev->active)) {
+        spinlock_release(&dev->lock);
+        irq_restore(flags);
+        return BLK_STS_BUSY;
     }
-    return -1;
+    dev->slots[slot] = rq;
+    dev->active |= bit;
+    dev->non_queued = !queued;
+    if (queued) port->sact = bit;
+    port->ci = bit;
+    spinlock_release(&dev->lock);
+    irq_restore(flags);
+    return BLK_STS_OK;
 }
 
-static int ahci_issue_cmd(hba_port_t *port, int slot) {
-    port->ci |= (1u << slot);
-    for (int i = 0; i < 10000000; i++) {
-        if ((port->ci & (1u << slot)) == 0)
-            return 0; /* completed */
+// DATA SET MANAGEMENT (TRIM) for the request's range. The range list is
+// one 512-byte block at the end of the slot's command table, so every
+// slot has its own.
+static hba_cmd_tbl_t* ahci_setup_trim(ahci_device_t* dev, int slot, request_t* rq) {
+    hba_cmd_tbl_t* tbl = ahci_setup_cmd(dev, slot, ATA_CMD_DSM, 0, 1, true);
+    ((fis_reg_h2d_t*)tbl->cfis)->feature_low = ATA_DSM_TRIM;
+
+    uint64_t* ranges = (uint64_t*)((uint8_t*)tbl + AHCI_CMD_TBL_SIZE - AHCI_DSM_SIZE);
+    memset(ranges, 0, AHCI_DSM_SIZE);
+    uint64_t lba = rq->sector >> dev->lba_shift;
+    uint64_t left = rq->nr_sectors >> dev->lba_shift;
+    for (uint32_t i = 0; left > 0 && i < AHCI_DSM_RANGES; i++) {
+        uint64_t count = left < ATA_DSM_RANGE_MAX ? left : ATA_DSM_RANGE_MAX;
+        ranges[i] = lba | (count << 48);
+        lba += count;
+        left -= count;
     }
-    return -1; /* timeout */
+
+    tbl->prdt_entry[0].dba = ahci_dma_addr(ranges);
+    tbl->prdt_entry[0].rsv0 = 0;
+    tbl->prdt_entry[0].dbc = AHCI_DSM_SIZE - 1;
+    dev->cmd_list[slot].prdtl = 1;
+    return tbl;
 }
 
-/* Build a READ DMA EXT command (LBA48) */
-static int ahci_read_sectors(hba_port_t *port, uint64_t lba, uint32_t count, void *buffer) {
-    if (ahci_wait_ready(port) != 0) return -1;
+static int ahci_queue_rq(blk_hw_queue_t* hctx, request_t* rq) {
+    ahci_device_t* dev = hctx->bdev->driver_data;
+    hba_port_t* port = dev->port;
+    int slot = rq->tag;
+    bool queued = false;
+
+    switch (rq->op) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE: {
+        bool write = rq->op == REQ_OP_WRITE;
+        uint64_t lba = rq->sector >> dev->lba_shift;
+        uint32_t count = rq->nr_sectors >> dev->lba_shift;
+        hba_cmd_tbl_t* tbl;
+        if (dev->ncq) {
+            tbl = ahci_setup_fpdma(dev, slot, lba, count, write);
+            queued = true;
+        } else {
+            tbl = ahci_setup_cmd(dev, slot, write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX,
+                                 lba, count, write);
+        }
+        if (ahci_fill_prdt(dev, slot, tbl, rq) != 0) {
+            blk_complete_request(rq, BLK_STS_IOERR);
+            return BLK_STS_OK;
+        }
+        break;
+    }
+    case REQ_OP_FLUSH:
+        // Without a write cache every completed write is already durable
+        if (!dev->write_cache) {
+            blk_complete_request(rq, BLK_STS_OK);
+            return BLK_STS_OK;
+        }
+        ahci_setup_cmd(dev, slot, ATA_CMD_FLUSH_CACHE_EXT, 0, 0, false);
+        break;
+    case REQ_OP_DISCARD:
+        ahci_setup_trim(dev, slot, rq);
+        break;
+    default:
+        blk_complete_request(rq, BLK_STS_IOERR);
+        return BLK_STS_OK;
+    }
 
-    int slot = find_cmd_slot(port);
-    if (slot < 0) return -1;
+    if (ahci_irqs) return ahci_issue(dev, slot, rq, queued);
 
-    hba_cmd_header_t *cmd_hdr = (hba_cmd_header_t *)(uintptr_t)port->clb;
-    hba_cmd_header_t *hdr = &cmd_hdr[slot];
-    hdr->cfl = sizeof(fis_reg_h2d_t)/sizeof(uint32_t); /* Command FIS length in DWORDS */
-    hdr->w   = 0; /* read */
-    hdr->prdtl = 1;
+    int status = ahci_issue_and_wait(port, slot) == 0 ? BLK_STS_OK : BLK_STS_IOERR;
+    port->is = port->is;
+    blk_complete_request(rq, status);
+    return BLK_STS_OK;
+}
 
-    hba_cmd_tbl_t *tbl = (hba_cmd_tbl_t *)(uintptr_t)hdr->ctba;
-    memset(tbl, 0, sizeof(hba_cmd_tbl_t));
-    tbl->prdt_entry[0].dba  = (uint32_t)(uintptr_t)buffer;
-    tbl->prdt_entry[0].dbau = 0;
-    tbl->prdt_entry[0].dbc  = (count * 512) - 1; /* byte count-1 */
-    tbl->prdt_entry[0].i    = 1;
+// --- Interrupts ---
 
-    fis_reg_h2d_t *fis = (fis_reg_h2d_t *)&tbl->cfis;
-    fis->fis_type = FIS_TYPE_REG_H2D;
-    fis->c = 1;
-    fis->command = ATA_CMD_READ_DMA_EX;
+// After an error the port stops processing commands until it is restarted.
+// Which NCQ command failed is only in the device's error log, so everything
+// in flight is failed with it.
+static void ahci_port_recover(hba_port_t* port) {
+    port_stop(port);
+    port->serr = port->serr;
+    port->is = port->is;
+    port_start(port);
+}
 
-    fis->lba0 = (uint8_t)(lba & 0xFF);
-    fis->lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis->lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis->device = 1 << 6; /* LBA mode */
+static void ahci_port_irq(ahci_device_t* dev) {
+    hba_port_t* port = dev->port;
+    int status = BLK_STS_OK;
+    uint32_t done;
+
+    spinlock_acquire(&dev->lock);
+    uint32_t is = port->is;
+    port->is = is;
+    if (is & HBA_PxIS_ERRORS) {
+        done = dev->active;
+        status = BLK_STS_IOERR;
+        ahci_port_recover(port);
+    } else {
+        // A slot is finished once the device has cleared it from PxSACT
+        // (NCQ) and the HBA from PxCI
+        done = dev->active & ~(port->sact | port->ci);
+    }
+    dev->active &= ~done;
+    if (!dev->active) dev->non_queued = false;
+    spinlock_release(&dev->lock);
+
+    // The slots stay reserved until these complete, so reading them
+    // outside the lock is fine; completing under it could re-enter
+    // ahci_issue if kblockd is missing
+    while (done) {
+        int slot = __builtin_ctz(done);
+        done &= done - 1;
+        blk_complete_request_irq(dev->slots[slot], status);
+    }
+}
 
-    fis->lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis->lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis->lba5 = (uint8_t)((lba >> 40) & 0xFF);
+static void ahci_irq_handler(registers_t* regs) {
+    (void)regs;
+    uint32_t is = ahci_hba->is;
+    for (uint32_t pending = is; pending; pending &= pending - 1) {
+        ahci_device_t* dev = ahci_ports[__builtin_ctz(pending)];
+        if (dev) ahci_port_irq(dev);
+        else ahci_hba->ports[__builtin_ctz(pending)].is = ~0u;
+    }
+    ahci_hba->is = is; // After the ports, or the bits come straight back
+}
 
-    fis->countl = (uint8_t)(count & 0xFF);
-    fis->counth = (uint8_t)((count >> 8) & 0xFF);
+// MSI when the function has it; the legacy line (shared, level triggered,
+// through the PIC) otherwise
+static void ahci_setup_irq(uint8_t bus, uint8_t device, uint8_t function) {
+    uint8_t vector = msi_alloc_vector();
+    if (vector && pci_enable_msi(bus, device, function, vector) == 0) {
+        register_interrupt_handler(vector, ahci_irq_handler);
+        ahci_irqs = true;
+        return;
+    }
 
-    /* Issue */
-    if (ahci_issue_cmd(port, slot) != 0) return -1;
-    return 0;
+    uint8_t line = pci_read_config(bus, device, function, PCI_INTERRUPT_LINE) & 0xFF;
+    if (line >= 16) {
+        print("AHCI: no usable interrupt; polling\n");
+        return;
+    }
+    register_interrupt_handler(IRQ_BASE + line, ahci_irq_handler);
+    pic_unmask(line);
+    ahci_irqs = true;
 }
 
-/* Build a WRITE DMA EXT command (LBA48) */
-static int ahci_write_sectors(hba_port_t *port, uint64_t lba, uint32_t count, const void *buffer) {
-    if (ahci_wait_ready(port) != 0) return -1;
-
-    int slot = find_cmd_slot(port);
-    if (slot < 0) return -1;
+static const blkdev_ops_t ahci_ops = {
+    .queue_rq = ahci_queue_rq,
+};
+
+// IDENTIFY DEVICE, for the geometry and features the block device is set
+// up with
+static int ahci_identify(ahci_device_t* dev) {
+    uint16_t* id = pmm_alloc_page();
+    if (!id) return -1;
+    uint64_t id_phys = ahci_dma_addr(id);
+    if (id_phys == (uint64_t)-1) {
+        pmm_free_page(id);
+        return -1;
+    }
 
-    hba_cmd_header_t *cmd_hdr = (hba_cmd_header_t *)(uintptr_t)port->clb;
-    hba_cmd_header_t *hdr = &cmd_hdr[slot];
-    hdr->cfl = sizeof(fis_reg_h2d_t)/sizeof(uint32_t); /* Command FIS length in DWORDS */
-    hdr->w   = 1; /* write */
-    hdr->prdtl = 1;
+    hba_cmd_tbl_t* tbl = ahci_setup_cmd(dev, 0, ATA_CMD_IDENTIFY, 0, 0, false);
+    ((fis_reg_h2d_t*)tbl->cfis)->device = 0;
+    tbl->prdt_entry[0].dba = id_phys;
+    tbl->prdt_entry[0].dbc = 512 - 1;
+    dev->cmd_list[0].prdtl = 1;
+
+    int ret = ahci_issue_and_wait(dev->port, 0);
+    if (ret == 0) {
+        ata_identity_t ident;
+        ata_parse_identify(id, &ident);
+        block_device_t* bdev = &dev->bdev;
+
+        bdev->nr_sectors = ident.nr_sectors;
+        bdev->block_size = ident.logical_size;
+        bdev->physical_block_size = ident.physical_size;
+        dev->lba_shift = __builtin_ctz(ident.logical_size / SECTOR_SIZE);
+        dev->write_cache = ident.write_cache;
+
+        uint32_t slots = ((ahci_hba->cap >> HBA_CAP_NCS_SHIFT) & HBA_CAP_NCS_MASK) + 1;
+        dev->ncq = ahci_irqs && (ahci_hba->cap & HBA_CAP_SNCQ) && ident.ncq;
+        bdev->queue_depth = dev->ncq ? (ident.ncq_depth < slots ? ident.ncq_depth : slots) : 1;
+
+        // One block of ranges per command, which every drive takes
+        if (ident.trim) bdev->max_discard_sectors = (uint64_t)AHCI_DSM_RANGES * ATA_DSM_RANGE_MAX << dev->lba_shift;
+    }
+    pmm_free_page(id);
+    return ret;
+}
 
-    hba_cmd_tbl_t *tbl = (hba_cmd_tbl_t *)(uintptr_t)hdr->ctba;
-    memset(tbl, 0, sizeof(hba_cmd_tbl_t));
-    tbl->prdt_entry[0].dba  = (uint32_t)(uintptr_t)buffer;
-    tbl->prdt_entry[0].dbau = 0;
-    tbl->prdt_entry[0].dbc  = (count * 512) - 1; /* byte count-1 */
-    tbl->prdt_entry[0].i    = 1;
+// --- Probe ---
 
-    fis_reg_h2d_t *fis = (fis_reg_h2d_t *)&tbl->cfis;
-    fis->fis_type = FIS_TYPE_REG_H2D;
-    fis->c = 1;
-    fis->command = ATA_CMD_WRITE_DMA_EX;
+static void ahci_probe_and_attach(void) {
+    if (!ahci_hba) {
+        print("AHCI: HBA MMIO base is NULL; controller not initialized\n");
+        return;
+    }
 
-    fis->lba0 = (uint8_t)(lba & 0xFF);
-    fis->lba1 = (uint8_t)((lba >> 8) & 0xFF);
-    fis->lba2 = (uint8_t)((lba >> 16) & 0xFF);
-    fis->device = 1 << 6; /* LBA mode */
+    uint32_t pi = ahci_hba->pi;
+    for (int i = 0; i < 32; i++) {
+        if (!(pi & (1u << i))) continue;
 
-    fis->lba3 = (uint8_t)((lba >> 24) & 0xFF);
-    fis->lba4 = (uint8_t)((lba >> 32) & 0xFF);
-    fis->lba5 = (uint8_t)((lba >> 40) & 0xFF);
+        hba_port_t* port = &ahci_hba->ports[i];
+        uint8_t ipm = (port->ssts >> 8) & 0x0F;
+        uint8_t det = port->ssts & 0x0F;
+        if (det != HBA_PORT_DET_PRESENT || ipm != HBA_PORT_IPM_ACTIVE) continue;
+        if (port->sig != SATA_SIG_ATA) continue; // Disks only
 
-    fis->countl = (uint8_t)(count & 0xFF);
-    fis->counth = (uint8_t)((count >> 8) & 0xFF);
+        ahci_device_t* dev = pmm_alloc(sizeof(ahci_device_t));
+        if (!dev) return;
+        memset(dev, 0, sizeof(ahci_device_t));
+        dev->port = port;
+        dev->port_num = i;
 
-    /* Issue */
-    if (ahci_issue_cmd(port, slot) != 0) return -1;
-    return 0;
-}
+        if (port_rebase(dev) != 0) {
+            pmm_free(dev, sizeof(ahci_device_t));
+            continue;
+        }
+        if (ahci_identify(dev) != 0) {
+            print("AHCI: port did not respond to IDENTIFY\n");
+            port_stop(port);
+            port_free(dev);
+            pmm_free(dev, sizeof(ahci_device_t));
+            continue;
+        }
 
-/* -------------- VFS bindings -------------- */
-size_t ahci_read(fs_node_t *node, uint64_t offset, size_t size, void *buffer) {
-    if (!node || !buffer) return 0;
-    ahci_device_t *dev = (ahci_device_t *)node->device_info;
-    if (!dev || !dev->port) return 0;
+        block_device_t* bdev = &dev->bdev;
+        bdev->name[0] = 's';
+        bdev->name[1] = 'd';
+        bdev->name[2] = 'a' + (char)i;
+        bdev->name[3] = '\0';
+        bdev->ops = &ahci_ops;
+        bdev->driver_data = dev;
+        // A buffer adds at most a partial page at either end to the
+        // entries its whole pages need, so a full request always fits
+        bdev->max_segments = BIO_MAX_VECS;
+        bdev->max_sectors = (AHCI_PRDT_ENTRIES - 2 * BIO_MAX_VECS) * (PAGE_SIZE / SECTOR_SIZE);
+        if (blkdev_register(bdev) != 0) {
+            print("AHCI: failed to register the block device\n");
+            port_stop(port);
+            port_free(dev);
+            pmm_free(dev, sizeof(ahci_device_t));
+            continue;
+        }
 
-    uint32_t sector = dev->sector_size ? dev->sector_size : 512;
-    uint64_t lba = offset / sector;
-    uint32_t count = (uint32_t)((size + sector - 1) / sector);
+        // IDENTIFY above was polled; from here on the port interrupts
+        ahci_ports[i] = dev;
+        if (ahci_irqs) {
+            port->is = ~0u;
+            port->ie = AHCI_PORT_IRQS;
+        }
 
-    /* For simplicity, assume buffer is contiguous and aligned enough */
-    if (ahci_read_sectors(dev->port, lba, count, buffer) != 0) {
-        return 0;
+        print("AHCI: attached ");
+        print(bdev->name);
+        print(dev->ncq ? " (NCQ)\n" : "\n");
     }
-    return count * sector;
 }
 
-size_t ahci_write(fs_node_t *node, uint64_t offset, size_t size, const void *buffer) {
-    if (!node || !buffer) return 0;
-    ahci_device_t *dev = (ahci_device_t *)node->device_info;
-    if (!dev || !dev->port) return 0;
-
-    uint32_t sector = dev->sector_size ? dev->sector_size : 512;
-    uint64_t lba = offset / sector;
-    uint32_t count = (uint32_t)((size + sector - 1) / sector);
+void ahci_init(void) {
+    print("AHCI: initializing\n");
 
-    if (ahci_write_sectors(dev->port, lba, count, buffer) != 0) {
-        return 0;
+    uint8_t bus, device, function;
+    if (!pci_scan_for_device(AHCI_PCI_CLASS, AHCI_PCI_SUBCLASS, &bus, &device, &function)) {
+        print("AHCI: no controller found\n");
+        return;
     }
-    return count * sector;
-}
+    ahci_hba = (volatile hba_mem_t*)(uintptr_t)(pci_read_config(bus, device, function, AHCI_ABAR) & ~0xFu);
+    uint32_t command = pci_read_config(bus, device, function, PCI_COMMAND);
+    pci_write_config(bus, device, function, PCI_COMMAND, (command & 0xFFFF) | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
 
-/* -------------- Driver init entry -------------- */
-void ahci_init(void) {
-    print("AHCI: initializing\n");
+    ahci_hba->ghc |= HBA_GHC_AE;
+    ahci_dma64 = (ahci_hba->cap & HBA_CAP_S64A) != 0;
+    ahci_setup_irq(bus, device, function);
     ahci_probe_and_attach();
+    if (ahci_irqs) {
+        ahci_hba->is = ~0u;
+        ahci_hba->ghc |= HBA_GHC_IE;
+    }
     print("AHCI: init done\n");
 }
-
-/* -------------- Weak defaults for VFS integration --------------
- * If your VFS does not provide these helpers,
- * you can implement them or wire up node creation elsewhere.
- */
-__attribute__((weak))
-fs_node_t *vfs_create_blockdev_node(const char *name) {
-    /* Fallback stub: if your VFS already has a device filesystem,
-       replace this with the actual factory. Returning NULL will
-       make probe fail loudly rather than crash. */
-    (void)name;
-    return NULL;
-}
@@ -8,6 +8,60 @@
 
 // --- AHCI Structure Definitions (as per AHCI 1.3.1 Spec) ---
 
+// Host Capabilities (CAP)
+#define HBA_CAP_NCS_SHIFT 8          // Command slots - 1, bits 12:8
+#define HBA_CAP_NCS_MASK  0x1F
+#define HBA_CAP_SNCQ      (1u << 30) // Native Command Queuing
+#define HBA_CAP_S64A      (1u << 31) // 64-bit addressing
+
+// Global HBA Control (GHC)
+#define HBA_GHC_IE (1u << 1)  // Interrupt Enable
+#define HBA_GHC_AE (1u << 31) // AHCI Enable
+
+// Port Command and Status (PxCMD)
+#define HBA_PxCMD_ST  (1u << 0)  // Start
+#define HBA_PxCMD_FRE (1u << 4)  // FIS Receive Enable
+#define HBA_PxCMD_FR  (1u << 14) // FIS Receive Running
+#define HBA_PxCMD_CR  (1u << 15) // Command List Running
+
+// Port Interrupt Status (PxIS) and Enable (PxIE)
+#define HBA_PxIS_DHRS (1u << 0)  // Device to Host Register FIS
+#define HBA_PxIS_PSS  (1u << 1)  // PIO Setup FIS
+#define HBA_PxIS_DSS  (1u << 2)  // DMA Setup FIS
+#define HBA_PxIS_SDBS (1u << 3)  // Set Device Bits FIS, how NCQ commands complete
+#define HBA_PxIS_DPS  (1u << 5)  // Descriptor Processed
+#define HBA_PxIS_IFS  (1u << 27) // Interface Fatal Error
+#define HBA_PxIS_HBDS (1u << 28) // Host Bus Data Error
+#define HBA_PxIS_HBFS (1u << 29) // Host Bus Fatal Error
+#define HBA_PxIS_TFES (1u << 30) // Task File Error Status
+#define HBA_PxIS_ERRORS (HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS | HBA_PxIS_TFES)
+
+// PxSSTS fields
+#define HBA_PORT_DET_PRESENT 3 // Device present, PHY communication established
+#define HBA_PORT_IPM_ACTIVE  1
+
+// Port signatures (PxSIG)
+#define SATA_SIG_ATA   0x00000101
+#define SATA_SIG_ATAPI 0xEB140101
+#define SATA_SIG_SEMB  0xC33C0101
+#define SATA_SIG_PM    0x96690101
+
+// Task file status bits (PxTFD)
+#define ATA_DEV_ERR  0x01
+#define ATA_DEV_DRQ  0x08
+#define ATA_DEV_BUSY 0x80
+
+#define ATA_CMD_DSM             0x06 // DATA SET MANAGEMENT
+#define ATA_CMD_READ_DMA_EX     0x25
+#define ATA_CMD_WRITE_DMA_EX    0x35
+#define ATA_CMD_READ_FPDMA      0x60 // READ FPDMA QUEUED (NCQ)
+#define ATA_CMD_WRITE_FPDMA     0x61 // WRITE FPDMA QUEUED (NCQ)
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+
+#define ATA_DSM_TRIM      0x01   // DSM feature bit
+#define ATA_DSM_RANGE_MAX 0xFFFF // LBAs per range entry
+
 #define FIS_TYPE_REG_H2D    0x27 // Register FIS - Host to Device
 #define FIS_TYPE_REG_D2H    0x34 // Register FIS - Device to Host
 #define FIS_TYPE_DMA_ACT    0x39 // DMA Activate FIS - Device to Host
@@ -95,9 +149,12 @@ typedef struct {
 typedef struct {
     uint64_t dba;        // Data Base Address
     uint32_t rsv0;
-    uint32_t dbc;        // Byte Count, 1-based
+    uint32_t dbc;        // Byte Count - 1 (bits 21:0), bit 31 interrupt on completion
 } __attribute__((packed)) hba_prdt_entry_t;
 
+#define HBA_PRDT_DBC_MAX (4u << 20) // Bytes per entry
+#define HBA_PRDT_DBC_I   (1u << 31)
+
 // Command Table (pointed to by a Command Header)
 typedef struct {
     uint8_t cfis[64];    // Command FIS
@@ -106,9 +163,23 @@ typedef struct {
     hba_prdt_entry_t prdt_entry[1]; // Variable-size PRDT (at least 1)
 } __attribute__((packed)) hba_cmd_tbl_t;
 
+// Command tables are 32 KiB each. The last 512 bytes hold the range list
+// of a TRIM, which leaves room for this many PRDT entries: enough for a
+// request of several MiB scattered page by page.
+#define AHCI_CMD_TBL_SIZE (32 * 1024)
+#define AHCI_DSM_SIZE     512
+#define AHCI_DSM_RANGES   (AHCI_DSM_SIZE / 8)
+#define AHCI_PRDT_ENTRIES ((AHCI_CMD_TBL_SIZE - 0x80 - AHCI_DSM_SIZE) / sizeof(hba_prdt_entry_t))
+
 
 // --- Public Driver Functions ---
+
+// Controller registers (BAR5 of the PCI function)
+extern volatile hba_mem_t* ahci_hba;
+
+// Finds the controller on the PCI bus, sets up its interrupt (MSI if it
+// has it, the legacy line otherwise) and registers every SATA disk on it
+// with the block layer, as sda, sdb, ... by port number
 void ahci_init();
-fs_node_t* create_ahci_device_node(int port_num);
 
 #endif
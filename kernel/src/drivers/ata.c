@@ -1,18 +1,40 @@
 /* kernel/src/drivers/ata.c */
 
+// Parallel ATA disks on the legacy IDE channels. With a PCI IDE controller
+// that can bus-master, requests are DMA transfers described by a PRD table
+// and completed from the channel's interrupt; otherwise they fall back to
+// polled PIO. The two drives of a channel share its registers, so each
+// channel runs one command at a time and keeps the other drive's request
+// waiting behind it.
+
 #include "ata.h"
-#include "../lib/string.h" // For inb/outb helpers
-
-// --- ATA I/O Ports (Primary Bus) ---
-#define ATA_DATA_REG        0x1F0
-#define ATA_ERROR_REG       0x1F1
-#define ATA_SECTOR_COUNT_REG 0x1F2
-#define ATA_LBA_LOW_REG     0x1F3
-#define ATA_LBA_MID_REG     0x1F4
-#define ATA_LBA_HIGH_REG    0x1F5
-#define ATA_DRIVE_HEAD_REG  0x1F6
-#define ATA_STATUS_REG      0x1F7
-#define ATA_COMMAND_REG     0x1F7
+#include "ata_identify.h"
+#include "pci.h"
+#include "../block/blkdev.h"
+#include "../mem/pmm.h"
+#include "../mem/vmm.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+#include "../../arch/x86_64/cpu.h" // For inb/outb helpers
+#include "../../arch/x86_64/idt.h"
+
+void print(char*);
+
+// --- Command Block Registers (offsets from the channel base) ---
+#define ATA_REG_DATA        0
+#define ATA_REG_ERROR       1
+#define ATA_REG_FEATURES    1
+#define ATA_REG_COUNT       2
+#define ATA_REG_LBA0        3
+#define ATA_REG_LBA1        4
+#define ATA_REG_LBA2        5
+#define ATA_REG_DEVICE      6
+#define ATA_REG_STATUS      7
+#define ATA_REG_COMMAND     7
+
+// Device control register (the control block); reads give the alternate
+// status, which does not acknowledge the interrupt
+#define ATA_CTRL_NIEN       0x02 // Interrupts off
 
 // --- ATA Status Register Flags ---
 #define ATA_SR_BSY          0x80 // Busy
@@ -25,75 +47,446 @@
 #define ATA_SR_ERR          0x01 // Error
 
 // --- ATA Commands ---
-#define ATA_CMD_READ_PIO    0x20
-#define ATA_CMD_WRITE_PIO   0x30
-#define ATA_CMD_CACHE_FLUSH 0xE7
-#define ATA_CMD_IDENTIFY    0xEC
+#define ATA_CMD_READ_PIO        0x20
+#define ATA_CMD_READ_PIO_EXT    0x24
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_PIO       0x30
+#define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_CACHE_FLUSH     0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+
+// --- Bus Master IDE Registers (offsets from the channel's BMIDE base) ---
+#define BM_REG_COMMAND      0
+#define BM_REG_STATUS       2
+#define BM_REG_PRDT         4
+#define BM_CMD_START        0x01
+#define BM_CMD_READ         0x08 // Device to memory
+#define BM_STATUS_ACTIVE    0x01
+#define BM_STATUS_ERROR     0x02
+#define BM_STATUS_IRQ       0x04 // Write-1-to-clear, like ERROR
+
+// Physical Region Descriptor: a buffer of up to 64 KiB that does not cross
+// a 64 KiB boundary, below 4 GiB
+typedef struct {
+    uint32_t addr;
+    uint16_t count;   // Bytes; 0 means 64 KiB
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+#define ATA_PRD_EOT     0x8000 // Last entry of the table
+#define ATA_PRD_MAX     0x10000
+#define ATA_PRD_ENTRIES (PAGE_SIZE / sizeof(ata_prd_t))
+
+#define ATA_PCI_CLASS    0x01 // Mass storage
+#define ATA_PCI_SUBCLASS 0x01 // IDE
+#define ATA_PCI_BMIDE    (PCI_BAR0 + 4 * 4)
+
+#define ATA_TIMEOUT_SPINS 10000000
+
+// PIO moves one sector per DRQ; an LBA28 command covers up to 256 (count 0)
+#define ATA_MAX_SECTORS 256
+
+typedef struct ata_channel {
+    uint16_t base;        // Command block
+    uint16_t ctrl;        // Control block
+    uint16_t bmide;       // Bus master registers; 0: PIO only
+    uint8_t irq;
+    spinlock_t lock;      // Below, with interrupts off
+    request_t* active;    // On the hardware
+    request_t* wait_head; // Accepted, waiting for the channel
+    request_t* wait_tail;
+    ata_prd_t* prdt;      // A page, for the active request
+} ata_channel_t;
+
+typedef struct ata_drive {
+    ata_channel_t* channel;
+    bool slave;
+    bool lba48;
+    bool write_cache;
+    uint32_t lba_shift;   // log2 of 512-byte sectors per LBA
+    block_device_t bdev;
+} ata_drive_t;
 
-// Waits for the BSY (Busy) bit to be cleared.
-static void ata_wait_busy() {
-    while (inb(ATA_STATUS_REG) & ATA_SR_BSY);
+static ata_channel_t ata_channels[2] = {
+    { .base = 0x1F0, .ctrl = 0x3F6, .irq = 14 },
+    { .base = 0x170, .ctrl = 0x376, .irq = 15 },
+};
+
+// Waits for the BSY (Busy) bit to be cleared. -1 on timeout.
+static int ata_wait_busy(ata_channel_t* ch) {
+    for (int i = 0; inb(ch->base + ATA_REG_STATUS) & ATA_SR_BSY; i++) {
+        if (i == ATA_TIMEOUT_SPINS) return -1;
+    }
+    return 0;
+}
+
+// Waits for the DRQ (Data Request Ready) bit to be set. -1 if the drive
+// reports an error instead.
+static int ata_wait_drq(ata_channel_t* ch) {
+    for (int i = 0; i < ATA_TIMEOUT_SPINS; i++) {
+        uint8_t status = inb(ch->base + ATA_REG_STATUS);
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) return 0;
+    }
+    return -1;
 }
 
-// Waits for the DRQ (Data Request Ready) bit to be set.
-static void ata_wait_drq() {
-    while (!(inb(ATA_STATUS_REG) & ATA_SR_DRQ));
+// The alternate status four times over: the 400 ns a drive needs after
+// being selected before its status means anything
+static void ata_delay(ata_channel_t* ch) {
+    for (int i = 0; i < 4; i++) inb(ch->ctrl);
 }
 
-void ata_init() {
-    // A full implementation would send the IDENTIFY command to both
-    // master and slave drives to detect them and get their parameters.
-    print("ATA PIO driver initialized.\n");
-}
-
-void ata_read_sectors(uint32_t lba, uint8_t count, uint8_t* buffer) {
-    ata_wait_busy();
-
-    // Select master drive (0xE0) and set LBA mode
-    outb(ATA_DRIVE_HEAD_REG, 0xE0 | ((lba >> 24) & 0x0F));
-    outb(ATA_SECTOR_COUNT_REG, count);
-    outb(ATA_LBA_LOW_REG, (uint8_t)lba);
-    outb(ATA_LBA_MID_REG, (uint8_t)(lba >> 8));
-    outb(ATA_LBA_HIGH_REG, (uint8_t)(lba >> 16));
-    outb(ATA_COMMAND_REG, ATA_CMD_READ_PIO);
-
-    for (int i = 0; i < count; i++) {
-        ata_wait_busy();
-        ata_wait_drq();
-
-        // Read 256 16-bit words (512 bytes) from the data port
-        uint16_t* ptr = (uint16_t*)buffer;
-        for (int j = 0; j < 256; j++) {
-            ptr[j] = inw(ATA_DATA_REG);
+// Loads the task file and issues `command`. LBA48 commands write each
+// register twice, high byte first.
+static void ata_issue(ata_drive_t* drive, uint64_t lba, uint32_t count, uint8_t command) {
+    ata_channel_t* ch = drive->channel;
+    uint16_t base = ch->base;
+    ata_wait_busy(ch);
+
+    if (drive->lba48) {
+        outb(base + ATA_REG_DEVICE, 0x40 | (drive->slave << 4));
+        ata_delay(ch);
+        outb(base + ATA_REG_COUNT, (uint8_t)(count >> 8)); // 65536 wraps to 0, which means 65536
+        outb(base + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(base + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(base + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        // LBA mode, top four address bits in the device register
+        outb(base + ATA_REG_DEVICE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        ata_delay(ch);
+    }
+    outb(base + ATA_REG_COUNT, (uint8_t)count); // 256 wraps to 0, which means 256
+    outb(base + ATA_REG_LBA0, (uint8_t)lba);
+    outb(base + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(base + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+    outb(base + ATA_REG_COMMAND, command);
+}
+
+static uint8_t ata_flush_command(ata_drive_t* drive) {
+    return drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH;
+}
+
+// --- PIO ---
+
+// One PIO command per request, moving its sectors through the request's
+// buffers in order. The transfer is done by the time this returns.
+static int ata_pio_rq(ata_drive_t* drive, request_t* rq) {
+    ata_channel_t* ch = drive->channel;
+
+    if (rq->op == REQ_OP_FLUSH) {
+        ata_issue(drive, 0, 0, ata_flush_command(drive));
+        if (ata_wait_busy(ch) != 0) return BLK_STS_IOERR;
+        return (inb(ch->base + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) ? BLK_STS_IOERR : BLK_STS_OK;
+    }
+
+    bool write = rq->op == REQ_OP_WRITE;
+    uint8_t command = drive->lba48 ? (write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT)
+                                   : (write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    ata_issue(drive, rq->sector >> drive->lba_shift, rq->nr_sectors >> drive->lba_shift, command);
+
+    for (bio_t* bio = rq->bio; bio; bio = bio->next) {
+        for (uint16_t i = 0; i < bio->vcnt; i++) {
+            uint16_t* ptr = (uint16_t*)bio->vecs[i].base;
+            for (uint32_t s = 0; s < bio->vecs[i].len / SECTOR_SIZE; s++) {
+                if (ata_wait_drq(ch) != 0) return BLK_STS_IOERR;
+                // 256 16-bit words (512 bytes) through the data port
+                for (int j = 0; j < 256; j++) {
+                    if (write) outw(ch->base + ATA_REG_DATA, ptr[j]);
+                    else ptr[j] = inw(ch->base + ATA_REG_DATA);
+                }
+                ptr += 256;
+            }
         }
-        buffer += 512;
     }
+    // Writes are done once the drive goes idle
+    if (write && ata_wait_busy(ch) != 0) return BLK_STS_IOERR;
+    return (inb(ch->base + ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) ? BLK_STS_IOERR : BLK_STS_OK;
 }
 
-void ata_write_sectors(uint32_t lba, uint8_t count, uint8_t* buffer) {
-    ata_wait_busy();
+// --- DMA ---
 
-    // Select master drive (0xE0) and set LBA mode
-    outb(ATA_DRIVE_HEAD_REG, 0xE0 | ((lba >> 24) & 0x0F));
-    outb(ATA_SECTOR_COUNT_REG, count);
-    outb(ATA_LBA_LOW_REG, (uint8_t)lba);
-    outb(ATA_LBA_MID_REG, (uint8_t)(lba >> 8));
-    outb(ATA_LBA_HIGH_REG, (uint8_t)(lba >> 16));
-    outb(ATA_COMMAND_REG, ATA_CMD_WRITE_PIO);
+// Bus address of `virt`, -1 if the controller cannot reach it. Buffers are
+// kernel addresses, so the kernel's tables will do for the walk.
+static uint64_t ata_dma_addr(const void* virt) {
+    uint64_t phys = (uint64_t)(uintptr_t)virt;
+    if (current_pml4 && !vmm_virt_to_phys((pml4_t*)current_pml4, phys, &phys)) return (uint64_t)-1;
+    return phys < (1ULL << 32) ? phys : (uint64_t)-1;
+}
+
+// Describes the request's buffers in the channel's PRD table, a page at a
+// time, merging pages that are physically contiguous within a 64 KiB block
+static int ata_fill_prdt(ata_channel_t* ch, request_t* rq) {
+    uint32_t n = 0;
+    uint64_t next = (uint64_t)-1;
 
-    for (int i = 0; i < count; i++) {
-        ata_wait_busy();
-        ata_wait_drq();
+    for (bio_t* bio = rq->bio; bio; bio = bio->next) {
+        for (uint16_t i = 0; i < bio->vcnt; i++) {
+            uint8_t* base = bio->vecs[i].base;
+            uint32_t left = bio->vecs[i].len;
+            while (left > 0) {
+                uint32_t len = PAGE_SIZE - ((uintptr_t)base & (PAGE_SIZE - 1));
+                if (len > left) len = left;
+                uint64_t phys = ata_dma_addr(base);
+                if (phys == (uint64_t)-1) return -1;
 
-        // Write 256 16-bit words (512 bytes) to the data port
-        uint16_t* ptr = (uint16_t*)buffer;
-        for (int j = 0; j < 256; j++) {
-            outw(ATA_DATA_REG, ptr[j]);
+                ata_prd_t* prev = n ? &ch->prdt[n - 1] : NULL;
+                if (prev && phys == next && (prev->addr / ATA_PRD_MAX) == (phys + len - 1) / ATA_PRD_MAX) {
+                    prev->count += len; // Wraps to 0 at exactly 64 KiB, as it should
+                } else {
+                    if (n == ATA_PRD_ENTRIES) return -1;
+                    ch->prdt[n].addr = (uint32_t)phys;
+                    ch->prdt[n].count = (uint16_t)len;
+                    ch->prdt[n].flags = 0;
+                    n++;
+                }
+                next = phys + len;
+                base += len;
+                left -= len;
+            }
         }
-        buffer += 512;
     }
+    if (n == 0) return -1;
+    ch->prdt[n - 1].flags = ATA_PRD_EOT;
+    return 0;
+}
+
+// Puts `rq` on the idle channel. Its completion interrupt finishes it. -1
+// if it could not be started, for the caller to fail it.
+static int ata_start(ata_channel_t* ch, request_t* rq) {
+    ata_drive_t* drive = rq->hctx->bdev->driver_data;
+
+    if (rq->op == REQ_OP_FLUSH) {
+        ata_issue(drive, 0, 0, ata_flush_command(drive));
+        ch->active = rq;
+        return 0;
+    }
+
+    if (ata_fill_prdt(ch, rq) != 0) return -1;
+    bool write = rq->op == REQ_OP_WRITE;
+    outl(ch->bmide + BM_REG_PRDT, (uint32_t)ata_dma_addr(ch->prdt));
+    outb(ch->bmide + BM_REG_COMMAND, write ? 0 : BM_CMD_READ);
+    outb(ch->bmide + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    uint8_t command = drive->lba48 ? (write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT)
+                                   : (write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    ata_issue(drive, rq->sector >> drive->lba_shift, rq->nr_sectors >> drive->lba_shift, command);
+    outb(ch->bmide + BM_REG_COMMAND, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+    ch->active = rq;
+    return 0;
+}
 
-    // Flush the cache to ensure data is written to the disk platter
-    outb(ATA_COMMAND_REG, ATA_CMD_CACHE_FLUSH);
-    ata_wait_busy();
+// Starts waiting requests until one gets going or none are left; the ones
+// that cannot start are failed. Under ch->lock.
+static void ata_start_next(ata_channel_t* ch) {
+    while (!ch->active && ch->wait_head) {
+        request_t* rq = ch->wait_head;
+        ch->wait_head = rq->next;
+        if (!ch->wait_head) ch->wait_tail = NULL;
+        if (ata_start(ch, rq) != 0) blk_complete_request_irq(rq, BLK_STS_IOERR);
+    }
+}
+
+static void ata_channel_irq(ata_channel_t* ch) {
+    spinlock_acquire(&ch->lock);
+    request_t* rq = ch->active;
+    if (!rq) {
+        inb(ch->base + ATA_REG_STATUS); // Spurious, or left over from probing
+        spinlock_release(&ch->lock);
+        return;
+    }
+
+    int status = BLK_STS_OK;
+    if (rq->op == REQ_OP_FLUSH) {
+        uint8_t ata_status = inb(ch->base + ATA_REG_STATUS);
+        if (ata_status & ATA_SR_BSY) {
+            spinlock_release(&ch->lock);
+            return;
+        }
+        if (ata_status & (ATA_SR_ERR | ATA_SR_DF)) status = BLK_STS_IOERR;
+    } else {
+        uint8_t bm_status = inb(ch->bmide + BM_REG_STATUS);
+        if (!(bm_status & BM_STATUS_IRQ)) {
+            spinlock_release(&ch->lock);
+            return; // Not this channel's, on a shared line
+        }
+        outb(ch->bmide + BM_REG_COMMAND, 0);
+        uint8_t ata_status = inb(ch->base + ATA_REG_STATUS); // Also acknowledges the drive
+        outb(ch->bmide + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERROR);
+        if ((bm_status & BM_STATUS_ERROR) || (ata_status & (ATA_SR_ERR | ATA_SR_DF))) status = BLK_STS_IOERR;
+    }
+
+    ch->active = NULL;
+    blk_complete_request_irq(rq, status);
+    ata_start_next(ch);
+    spinlock_release(&ch->lock);
+}
+
+// Native-mode channels may share one line, so both get a look
+static void ata_irq_handler(registers_t* regs) {
+    for (int c = 0; c < 2; c++) {
+        if (ata_channels[c].bmide && regs->int_no == (uint64_t)(IRQ_BASE + ata_channels[c].irq)) {
+            ata_channel_irq(&ata_channels[c]);
+        }
+    }
+}
+
+// --- Block Device ---
+
+static int ata_queue_rq(blk_hw_queue_t* hctx, request_t* rq) {
+    ata_drive_t* drive = hctx->bdev->driver_data;
+    ata_channel_t* ch = drive->channel;
+
+    if (rq->op != REQ_OP_READ && rq->op != REQ_OP_WRITE && rq->op != REQ_OP_FLUSH) {
+        blk_complete_request(rq, BLK_STS_IOERR);
+        return BLK_STS_OK;
+    }
+    // Without a write cache every completed write is already durable
+    if (rq->op == REQ_OP_FLUSH && !drive->write_cache) {
+        blk_complete_request(rq, BLK_STS_OK);
+        return BLK_STS_OK;
+    }
+
+    if (!ch->bmide) {
+        spinlock_acquire(&ch->lock);
+        int status = ata_pio_rq(drive, rq);
+        spinlock_release(&ch->lock);
+        blk_complete_request(rq, status);
+        return BLK_STS_OK;
+    }
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&ch->lock);
+    rq->next = NULL;
+    if (ch->wait_tail) ch->wait_tail->next = rq;
+    else ch->wait_head = rq;
+    ch->wait_tail = rq;
+    ata_start_next(ch);
+    spinlock_release(&ch->lock);
+    irq_restore(flags);
+    return BLK_STS_OK;
+}
+
+static const blkdev_ops_t ata_ops = {
+    .queue_rq = ata_queue_rq,
+};
+
+// --- Probe ---
+
+// IDENTIFY DEVICE by PIO. -1 if there is no ATA disk in that position.
+static int ata_identify(ata_channel_t* ch, bool slave, uint16_t* id) {
+    outb(ch->base + ATA_REG_DEVICE, 0xA0 | (slave << 4));
+    ata_delay(ch);
+    outb(ch->base + ATA_REG_COUNT, 0);
+    outb(ch->base + ATA_REG_LBA0, 0);
+    outb(ch->base + ATA_REG_LBA1, 0);
+    outb(ch->base + ATA_REG_LBA2, 0);
+    outb(ch->base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    // 0: no drive; all ones: nothing on the bus at all
+    uint8_t status = inb(ch->base + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) return -1;
+    if (ata_wait_busy(ch) != 0) return -1;
+    // Non-zero LBA mid/high: ATAPI or SATA, not a PATA disk
+    if (inb(ch->base + ATA_REG_LBA1) || inb(ch->base + ATA_REG_LBA2)) return -1;
+    if (ata_wait_drq(ch) != 0) return -1;
+
+    for (int i = 0; i < 256; i++) {
+        id[i] = inw(ch->base + ATA_REG_DATA);
+    }
+    return 0;
+}
+
+// The IDE function's bus master block, and the channels' ports and lines
+// when it runs them in PCI native mode rather than at the legacy addresses
+static void ata_pci_setup(void) {
+    uint8_t bus, device, function;
+    if (!pci_scan_for_device(ATA_PCI_CLASS, ATA_PCI_SUBCLASS, &bus, &device, &function)) return;
+
+    uint8_t prog_if = (pci_read_config(bus, device, function, 0x08) >> 8) & 0xFF;
+    for (int c = 0; c < 2; c++) {
+        if (prog_if & (1 << (2 * c))) {
+            ata_channels[c].base = pci_read_config(bus, device, function, PCI_BAR0 + 8 * c) & ~3u;
+            ata_channels[c].ctrl = (pci_read_config(bus, device, function, PCI_BAR0 + 8 * c + 4) & ~3u) + 2;
+            ata_channels[c].irq = pci_read_config(bus, device, function, PCI_INTERRUPT_LINE) & 0xFF;
+        }
+    }
+
+    uint32_t bar = pci_read_config(bus, device, function, ATA_PCI_BMIDE);
+    if (!(prog_if & 0x80) || !(bar & 1)) return; // No bus mastering, or not in I/O space
+    uint32_t command = pci_read_config(bus, device, function, PCI_COMMAND);
+    pci_write_config(bus, device, function, PCI_COMMAND, (command & 0xFFFF) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    for (int c = 0; c < 2; c++) {
+        ata_channels[c].bmide = (bar & ~3u) + 8 * c;
+    }
+}
+
+static void ata_attach(ata_channel_t* ch, int index, bool slave, uint16_t* id) {
+    ata_identity_t ident;
+    ata_parse_identify(id, &ident);
+
+    ata_drive_t* drive = pmm_alloc(sizeof(ata_drive_t));
+    if (!drive) return;
+    memset(drive, 0, sizeof(ata_drive_t));
+    drive->channel = ch;
+    drive->slave = slave;
+    drive->lba48 = ident.lba48;
+    drive->write_cache = ident.write_cache;
+    drive->lba_shift = __builtin_ctz(ident.logical_size / SECTOR_SIZE);
+
+    block_device_t* bdev = &drive->bdev;
+    strcpy(bdev->name, "hda");
+    bdev->name[2] = 'a' + index;
+    bdev->ops = &ata_ops;
+    bdev->driver_data = drive;
+    bdev->nr_sectors = ident.nr_sectors;
+    bdev->block_size = ident.logical_size;
+    bdev->physical_block_size = ident.physical_size;
+    bdev->max_sectors = ATA_MAX_SECTORS;
+    if (ch->bmide) {
+        // A buffer adds at most a partial page at either end to the PRDs
+        // its whole pages need; LBA48 counts are 16 bits
+        bdev->max_segments = BIO_MAX_VECS;
+        bdev->max_sectors = (ATA_PRD_ENTRIES - 2 * BIO_MAX_VECS) * (PAGE_SIZE / SECTOR_SIZE);
+        if (!drive->lba48) bdev->max_sectors = ATA_MAX_SECTORS << drive->lba_shift;
+    }
+    bdev->queue_depth = 1;
+    if (blkdev_register(bdev) != 0) {
+        print("ATA: failed to register the block device.\n");
+        pmm_free(drive, sizeof(ata_drive_t));
+        return;
+    }
+    print("ATA: attached ");
+    print(bdev->name);
+    print(ch->bmide ? " (DMA)\n" : " (PIO)\n");
+}
+
+void ata_init() {
+    ata_pci_setup();
+
+    uint16_t* id = pmm_alloc_page();
+    if (!id) return;
+    for (int c = 0; c < 2; c++) {
+        ata_channel_t* ch = &ata_channels[c];
+        if (ch->bmide) {
+            ch->prdt = pmm_alloc_page();
+            if (!ch->prdt || ata_dma_addr(ch->prdt) == (uint64_t)-1) ch->bmide = 0;
+        }
+
+        // Quiet while probing; interrupts only drive DMA completions
+        outb(ch->ctrl, ATA_CTRL_NIEN);
+        for (int d = 0; d < 2; d++) {
+            if (ata_identify(ch, d == 1, id) == 0) ata_attach(ch, 2 * c + d, d == 1, id);
+        }
+        if (ch->bmide) {
+            register_interrupt_handler(IRQ_BASE + ch->irq, ata_irq_handler);
+            pic_unmask(ch->irq);
+            outb(ch->ctrl, 0);
+        }
+    }
+    pmm_free_page(id);
 }
@@ -3,8 +3,9 @@
 
 #include <stdint.h>
 
+// Probes both IDE channels and registers each disk found with the block
+// layer, "hda" (primary master) through "hdd" (secondary slave). Transfers
+// use bus-master DMA when the PCI IDE controller supports it.
 void ata_init();
-void ata_read_sectors(uint32_t lba, uint8_t count, uint8_t* buffer);
-void ata_write_sectors(uint32_t lba, uint8_t count, uint8_t* buffer);
 
 #endif
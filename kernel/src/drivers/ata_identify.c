@@ -0,0 +1,58 @@
+/* kernel/src/drivers/ata_identify.c */
+
+#include "ata_identify.h"
+#include "../lib/string.h"
+
+// IDENTIFY DEVICE words (ACS-3, table 45)
+#define ID_LBA28_CAPACITY    60  // 60-61
+#define ID_QUEUE_DEPTH       75  // Bits 4:0, depth - 1
+#define ID_SATA_CAPS         76
+#define ID_CMDSET_SUPPORTED  82
+#define ID_CMDSET2_SUPPORTED 83
+#define ID_CMDSET_ENABLED    85
+#define ID_LBA48_CAPACITY    100 // 100-103
+#define ID_SECTOR_SIZE       106
+#define ID_LOGICAL_SIZE      117 // 117-118, in words
+#define ID_DSM_SUPPORT       169
+
+#define ID_SATA_NCQ          (1 << 8)
+#define ID_WRITE_CACHE       (1 << 5)  // Words 82 and 85
+#define ID_LBA48             (1 << 10) // Word 83
+#define ID_SECTOR_SIZE_VALID 0x4000    // Word 106 bits 15:14 = 01
+#define ID_LOGICAL_LONG      (1 << 12) // Word 106: logical size in words 117-118
+#define ID_PHYS_MULTIPLE     (1 << 13) // Word 106: 2^(bits 3:0) logical per physical
+#define ID_DSM_TRIM          (1 << 0)
+
+void ata_parse_identify(const uint16_t* id, ata_identity_t* out) {
+    memset(out, 0, sizeof(ata_identity_t));
+
+    out->logical_size = 512;
+    out->physical_size = 512;
+    if ((id[ID_SECTOR_SIZE] & 0xC000) == ID_SECTOR_SIZE_VALID) {
+        if (id[ID_SECTOR_SIZE] & ID_LOGICAL_LONG) {
+            uint32_t words = (uint32_t)id[ID_LOGICAL_SIZE] | ((uint32_t)id[ID_LOGICAL_SIZE + 1] << 16);
+            if (words >= 256) out->logical_size = words * 2;
+        }
+        out->physical_size = out->logical_size;
+        if (id[ID_SECTOR_SIZE] & ID_PHYS_MULTIPLE) {
+            out->physical_size <<= id[ID_SECTOR_SIZE] & 0xF;
+        }
+    }
+
+    uint64_t lbas;
+    out->lba48 = (id[ID_CMDSET2_SUPPORTED] & ID_LBA48) != 0;
+    if (out->lba48) {
+        lbas = (uint64_t)id[ID_LBA48_CAPACITY] | ((uint64_t)id[ID_LBA48_CAPACITY + 1] << 16) |
+               ((uint64_t)id[ID_LBA48_CAPACITY + 2] << 32) | ((uint64_t)id[ID_LBA48_CAPACITY + 3] << 48);
+    } else {
+        lbas = (uint64_t)id[ID_LBA28_CAPACITY] | ((uint64_t)id[ID_LBA28_CAPACITY + 1] << 16);
+    }
+    out->nr_sectors = lbas * (out->logical_size / 512);
+
+    out->ncq = (id[ID_SATA_CAPS] & ID_SATA_NCQ) != 0;
+    out->ncq_depth = (id[ID_QUEUE_DEPTH] & 0x1F) + 1;
+
+    out->write_cache = (id[ID_CMDSET_SUPPORTED] & ID_WRITE_CACHE) && (id[ID_CMDSET_ENABLED] & ID_WRITE_CACHE);
+
+    out->trim = (id[ID_DSM_SUPPORT] & ID_DSM_TRIM) != 0;
+}
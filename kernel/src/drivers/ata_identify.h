@@ -0,0 +1,21 @@
+#ifndef ATA_IDENTIFY_H
+#define ATA_IDENTIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What the ATA drivers need from the 256 words of IDENTIFY DEVICE data
+typedef struct ata_identity {
+    uint64_t nr_sectors;     // Capacity in 512-byte sectors
+    uint32_t logical_size;   // Bytes per LBA
+    uint32_t physical_size;  // Bytes per physical sector, a multiple of logical_size
+    bool lba48;              // 48-bit addressing (the EXT commands)
+    bool ncq;
+    uint32_t ncq_depth;      // Commands the drive queues, when ncq
+    bool write_cache;        // Volatile write cache enabled; writes need FLUSH CACHE
+    bool trim;               // DATA SET MANAGEMENT with the TRIM bit
+} ata_identity_t;
+
+void ata_parse_identify(const uint16_t* id, ata_identity_t* out);
+
+#endif
@@ -1,5 +1,10 @@
+/* kernel/src/drivers/pci.c */
+
 #include "pci.h"
-#include "../lib/string.h" // For outl/inl
+#include "../../arch/x86_64/cpu.h" // For outl/inl
+#include "../../arch/x86_64/idt.h"
+
+void print(char*);
 
 uint32_t pci_read_config(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
     uint32_t address;
@@ -16,7 +21,13 @@ uint32_t pci_read_config(uint8_t bus, uint8_t device, uint8_t function, uint8_t
     return inl(PCI_CONFIG_DATA);
 }
 
-void pci_scan_for_device(uint8_t class_code, uint8_t subclass, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function) {
+void pci_write_config(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t address = ((uint32_t)bus << 16) | ((uint32_t)device << 11) | ((uint32_t)function << 8) | (offset & 0xFC) | 0x80000000;
+    outl(PCI_CONFIG_ADDRESS, address);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+bool pci_scan_for_device(uint8_t class_code, uint8_t subclass, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function) {
     for (uint16_t bus = 0; bus < 256; bus++) {
         for (uint8_t device = 0; device < 32; device++) {
             for (uint8_t function = 0; function < 8; function++) {
@@ -34,9 +45,112 @@ void pci_scan_for_device(uint8_t class_code, uint8_t subclass, uint8_t* out_bus,
                     *out_device = device;
                     *out_function = function;
                     print("PCI: Found matching device.\n");
-                    return;
+                    return true;
                 }
             }
         }
     }
+    return false;
+}
+
+bool pci_scan_for_id(uint16_t vendor_id, uint16_t device_id, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function) {
+    for (uint16_t bus = 0; bus < 256; bus++) {
+        for (uint8_t device = 0; device < 32; device++) {
+            for (uint8_t function = 0; function < 8; function++) {
+                uint32_t vendor_device = pci_read_config(bus, device, function, 0);
+                if ((vendor_device & 0xFFFF) == vendor_id && (vendor_device >> 16) == device_id) {
+                    *out_bus = bus;
+                    *out_device = device;
+                    *out_function = function;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+uint64_t pci_read_bar(uint8_t bus, uint8_t device, uint8_t function, uint8_t bar) {
+    uint32_t lo = pci_read_config(bus, device, function, PCI_BAR0 + 4 * bar);
+    if (lo & PCI_BAR_IO) return lo & ~3u;
+    uint64_t addr = lo & ~0xFu;
+    if ((lo & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64 && bar < 5) {
+        addr |= (uint64_t)pci_read_config(bus, device, function, PCI_BAR0 + 4 * (bar + 1)) << 32;
+    }
+    return addr;
+}
+
+uint8_t pci_find_capability(uint8_t bus, uint8_t device, uint8_t function, uint8_t cap_id) {
+    return pci_find_next_capability(bus, device, function, 0, cap_id);
+}
+
+uint8_t pci_find_next_capability(uint8_t bus, uint8_t device, uint8_t function, uint8_t from, uint8_t cap_id) {
+    uint16_t status = pci_read_config(bus, device, function, PCI_COMMAND) >> 16;
+    if (!(status & PCI_STATUS_CAP_LIST)) return 0;
+
+    uint8_t ptr = from ? (pci_read_config(bus, device, function, from) >> 8) & 0xFC
+                       : pci_read_config(bus, device, function, PCI_CAP_PTR) & 0xFC;
+    for (int guard = 0; ptr && guard < 48; guard++) {
+        uint32_t cap = pci_read_config(bus, device, function, ptr);
+        if ((cap & 0xFF) == cap_id) return ptr;
+        ptr = (cap >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+int pci_enable_msi(uint8_t bus, uint8_t device, uint8_t function, uint8_t vector) {
+    uint8_t cap = pci_find_capability(bus, device, function, PCI_CAP_ID_MSI);
+    if (!cap) return -1;
+
+    // Fixed delivery, edge triggered, to this CPU's local APIC
+    uint32_t ctrl = pci_read_config(bus, device, function, cap) >> 16;
+    pci_write_config(bus, device, function, cap + 4, 0xFEE00000 | (lapic_id() << 12));
+    if (ctrl & PCI_MSI_64BIT) {
+        pci_write_config(bus, device, function, cap + 8, 0);
+        pci_write_config(bus, device, function, cap + 12, vector);
+    } else {
+        pci_write_config(bus, device, function, cap + 8, vector);
+    }
+
+    // One vector (multiple message enable = 0)
+    ctrl = (ctrl & ~(7 << 4)) | PCI_MSI_ENABLE;
+    uint32_t header = pci_read_config(bus, device, function, cap);
+    pci_write_config(bus, device, function, cap, (header & 0xFFFF) | (ctrl << 16));
+
+    uint32_t command = pci_read_config(bus, device, function, PCI_COMMAND);
+    pci_write_config(bus, device, function, PCI_COMMAND, (command & 0xFFFF) | PCI_COMMAND_INTX_DISABLE);
+    return 0;
+}
+
+uint16_t pci_msix_table_size(uint8_t bus, uint8_t device, uint8_t function) {
+    uint8_t cap = pci_find_capability(bus, device, function, PCI_CAP_ID_MSIX);
+    if (!cap) return 0;
+    return ((pci_read_config(bus, device, function, cap) >> 16) & PCI_MSIX_TABLE_SIZE) + 1;
+}
+
+int pci_enable_msix(uint8_t bus, uint8_t device, uint8_t function, const uint8_t* vectors, uint16_t count) {
+    uint8_t cap = pci_find_capability(bus, device, function, PCI_CAP_ID_MSIX);
+    if (!cap || count == 0) return -1;
+    uint32_t header = pci_read_config(bus, device, function, cap);
+    uint16_t ctrl = header >> 16;
+    if (count > (ctrl & PCI_MSIX_TABLE_SIZE) + 1) return -1;
+
+    // The table lives in one of the device's memory BARs
+    uint32_t table = pci_read_config(bus, device, function, cap + 4);
+    volatile uint32_t* entry = (volatile uint32_t*)(uintptr_t)
+        (pci_read_bar(bus, device, function, table & 7) + (table & ~7u));
+
+    // Masked as a whole while the entries are written
+    pci_write_config(bus, device, function, cap, (header & 0xFFFF) | ((uint32_t)(ctrl | PCI_MSIX_ENABLE | PCI_MSIX_MASKALL) << 16));
+    for (uint16_t i = 0; i < count; i++, entry += 4) {
+        entry[0] = 0xFEE00000 | (lapic_id() << 12);
+        entry[1] = 0;
+        entry[2] = vectors[i];
+        entry[3] = 0; // Unmasked
+    }
+    pci_write_config(bus, device, function, cap, (header & 0xFFFF) | ((uint32_t)(ctrl | PCI_MSIX_ENABLE) << 16));
+
+    uint32_t command = pci_read_config(bus, device, function, PCI_COMMAND);
+    pci_write_config(bus, device, function, PCI_COMMAND, (command & 0xFFFF) | PCI_COMMAND_MEMORY | PCI_COMMAND_INTX_DISABLE);
+    return 0;
 }
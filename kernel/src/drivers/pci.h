@@ -2,10 +2,37 @@
 #define PCI_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define PCI_CONFIG_ADDRESS 0xCF8
 #define PCI_CONFIG_DATA    0xCFC
 
+// Configuration space offsets
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_BAR0           0x10
+#define PCI_CAP_PTR        0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO           (1 << 0)
+#define PCI_COMMAND_MEMORY       (1 << 1)
+#define PCI_COMMAND_MASTER       (1 << 2)
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+#define PCI_STATUS_CAP_LIST      (1 << 4)
+
+#define PCI_BAR_IO         (1 << 0)
+#define PCI_BAR_TYPE_MASK  (3 << 1)
+#define PCI_BAR_TYPE_64    (2 << 1)
+
+#define PCI_CAP_ID_MSI     0x05
+#define PCI_MSI_64BIT      (1 << 7) // Message control: 64-bit address capable
+#define PCI_MSI_ENABLE     (1 << 0)
+#define PCI_CAP_ID_VNDR    0x09
+#define PCI_CAP_ID_MSIX    0x11
+#define PCI_MSIX_TABLE_SIZE 0x7FF    // Message control: entries - 1
+#define PCI_MSIX_MASKALL   (1 << 14)
+#define PCI_MSIX_ENABLE    (1 << 15)
+
 // PCI Configuration Space Header
 typedef struct {
     uint16_t vendor_id;
@@ -22,7 +49,34 @@ typedef struct {
 // Function to read from PCI configuration space
 uint32_t pci_read_config(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
 
-// Scans the PCI bus for a device matching a given class and subclass
-void pci_scan_for_device(uint8_t class_code, uint8_t subclass, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function);
+void pci_write_config(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+
+// Scans the PCI bus for a device matching a given class and subclass.
+// Returns false if there is none.
+bool pci_scan_for_device(uint8_t class_code, uint8_t subclass, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function);
+
+// The same by vendor and device ID
+bool pci_scan_for_id(uint16_t vendor_id, uint16_t device_id, uint8_t* out_bus, uint8_t* out_device, uint8_t* out_function);
+
+// Address a BAR decodes: the I/O port base, or the memory address (both
+// halves of a 64-bit BAR)
+uint64_t pci_read_bar(uint8_t bus, uint8_t device, uint8_t function, uint8_t bar);
+
+// Offset of the capability with ID `cap_id` in the device's list, 0 if absent
+uint8_t pci_find_capability(uint8_t bus, uint8_t device, uint8_t function, uint8_t cap_id);
+// The next one after the capability at `from`, for IDs that appear more
+// than once; `from` 0 starts at the head of the list
+uint8_t pci_find_next_capability(uint8_t bus, uint8_t device, uint8_t function, uint8_t from, uint8_t cap_id);
+
+// Points the device's MSI capability at `vector` on the current CPU and
+// enables it, masking legacy INTx. Returns -1 if the device has no MSI.
+int pci_enable_msi(uint8_t bus, uint8_t device, uint8_t function, uint8_t vector);
+
+// Entries in the device's MSI-X table, 0 if it has no MSI-X
+uint16_t pci_msix_table_size(uint8_t bus, uint8_t device, uint8_t function);
+// Points MSI-X entries 0..count-1 at `vectors` on the current CPU and
+// enables MSI-X, masking legacy INTx. -1 without MSI-X or with fewer
+// entries than `count`.
+int pci_enable_msix(uint8_t bus, uint8_t device, uint8_t function, const uint8_t* vectors, uint16_t count);
 
 #endif
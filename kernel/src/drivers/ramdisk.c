@@ -1,64 +1,164 @@
 #include "ramdisk.h"
+#include "../block/blkdev.h"
 #include "../mem/pmm.h"
-#include "../../../arch/x86_64/gdt.h" // For print function
-
-static uint8_t* ramdisk_storage = NULL;
-static size_t ramdisk_size = 0;
-// We'll use a fixed block size for simplicity, matching common hardware.
-#define RAMDISK_BLOCK_SIZE 512
+#include "../lib/radix_tree.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
 
 void print(char*); // Forward declare from main.c for logging
 
-void ramdisk_init(size_t size) {
-    // Ensure size is a multiple of the page size for easy allocation
-    if (size % PAGE_SIZE != 0) {
-        size = (size / PAGE_SIZE + 1) * PAGE_SIZE;
-    }
+// A RAM disk is a sparse array of pages indexed by page number. Pages come
+// into being on the first write to them and go away when discarded, so an
+// empty disk of any size costs nothing and reads of a hole are zeroes.
+//
+// In shared mode the disk also offers direct_access: a filesystem can put
+// the disk's pages in its page cache as they are rather than copy them, so
+// a live image is only held once. Pages handed out that way must outlive
+// any use of them, so discards zero them instead of freeing them.
+typedef struct ramdisk {
+    block_device_t bdev;
+    spinlock_t lock;        // The tree, and page contents against discards
+    radix_tree_t pages;
+    uint64_t nr_pages;      // Allocated
+    uint32_t flags;         // RAMDISK_*
+} ramdisk_t;
 
-    ramdisk_storage = (uint8_t*)pmm_alloc_page(); // In a real scenario, we'd allocate multiple pages
-    if (!ramdisk_storage) {
-        print("RAMDISK Error: Failed to allocate memory for ramdisk.\n");
-        return;
-    }
-    
-    ramdisk_size = size;
-    
-    // Zero out the ramdisk memory
-    for (size_t i = 0; i < ramdisk_size; i++) {
-        ramdisk_storage[i] = 0;
+// The page at `index`, allocated zeroed if `create` and missing. Under the
+// lock; NULL for a hole, or when out of memory.
+static uint8_t* ramdisk_page(ramdisk_t* rd, uint64_t index, bool create) {
+    uint8_t* page = radix_tree_lookup(&rd->pages, index);
+    if (page || !create) return page;
+
+    page = pmm_alloc_page();
+    if (!page) return NULL;
+    memset(page, 0, PAGE_SIZE);
+    if (radix_tree_insert(&rd->pages, index, page) != 0) {
+        pmm_free_page(page);
+        return NULL;
     }
+    rd->nr_pages++;
+    return page;
+}
 
-    print("RAM disk initialized.\n");
+// Copies between `buf` and the disk from byte `pos`, a page at a time
+static int ramdisk_copy(ramdisk_t* rd, uint64_t pos, uint8_t* buf, uint32_t len, bool write) {
+    while (len > 0) {
+        uint32_t off = pos & (PAGE_SIZE - 1);
+        uint32_t n = PAGE_SIZE - off;
+        if (n > len) n = len;
+
+        spinlock_acquire(&rd->lock);
+        uint8_t* page = ramdisk_page(rd, pos / PAGE_SIZE, write);
+        if (write && !page) {
+            spinlock_release(&rd->lock);
+            return BLK_STS_IOERR;
+        }
+        if (write) memcpy(page + off, buf, n);
+        else if (page) memcpy(buf, page + off, n);
+        else memset(buf, 0, n);
+        spinlock_release(&rd->lock);
+
+        pos += n;
+        buf += n;
+        len -= n;
+    }
+    return BLK_STS_OK;
 }
 
-void ramdisk_read(uint32_t block_no, uint32_t count, void* buffer) {
-    uint32_t offset = block_no * RAMDISK_BLOCK_SIZE;
-    uint32_t len = count * RAMDISK_BLOCK_SIZE;
-    
-    if (offset + len > ramdisk_size) {
-        // Handle error: read out of bounds
-        return;
+// Frees the pages wholly inside the range and zeroes the ends
+static void ramdisk_discard(ramdisk_t* rd, uint64_t pos, uint64_t len) {
+    spinlock_acquire(&rd->lock);
+    while (len > 0) {
+        uint32_t off = pos & (PAGE_SIZE - 1);
+        uint64_t n = PAGE_SIZE - off;
+        if (n > len) n = len;
+
+        uint64_t index = pos / PAGE_SIZE;
+        if (n == PAGE_SIZE && !(rd->flags & RAMDISK_SHARED)) {
+            uint8_t* page = radix_tree_delete(&rd->pages, index);
+            if (page) {
+                pmm_free_page(page);
+                rd->nr_pages--;
+            }
+        } else {
+            uint8_t* page = ramdisk_page(rd, index, false);
+            if (page) memset(page + off, 0, n);
+        }
+        pos += n;
+        len -= n;
     }
-    
-    uint8_t* src = ramdisk_storage + offset;
-    uint8_t* dest = (uint8_t*)buffer;
-    for (uint32_t i = 0; i < len; i++) {
-        dest[i] = src[i];
+    spinlock_release(&rd->lock);
+}
+
+// Requests complete before queue_rq returns; there is no seek to schedule
+// around, so the device runs the noop elevator.
+static int ramdisk_queue_rq(blk_hw_queue_t* hctx, request_t* rq) {
+    ramdisk_t* rd = hctx->bdev->driver_data;
+    uint64_t pos = rq->sector << SECTOR_SHIFT;
+    int status = BLK_STS_OK;
+
+    switch (rq->op) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        for (bio_t* bio = rq->bio; bio && status == BLK_STS_OK; bio = bio->next) {
+            for (uint16_t i = 0; i < bio->vcnt && status == BLK_STS_OK; i++) {
+                status = ramdisk_copy(rd, pos, bio->vecs[i].base, bio->vecs[i].len, rq->op == REQ_OP_WRITE);
+                pos += bio->vecs[i].len;
+            }
+        }
+        break;
+    case REQ_OP_DISCARD:
+        ramdisk_discard(rd, pos, (uint64_t)rq->nr_sectors << SECTOR_SHIFT);
+        break;
     }
+
+    blk_complete_request(rq, status);
+    return BLK_STS_OK;
 }
 
-void ramdisk_write(uint32_t block_no, uint32_t count, void* buffer) {
-    uint32_t offset = block_no * RAMDISK_BLOCK_SIZE;
-    uint32_t len = count * RAMDISK_BLOCK_SIZE;
+static void* ramdisk_direct_access(block_device_t* bdev, uint64_t sector, bool create) {
+    ramdisk_t* rd = bdev->driver_data;
+    spinlock_acquire(&rd->lock);
+    uint8_t* page = ramdisk_page(rd, (sector << SECTOR_SHIFT) / PAGE_SIZE, create);
+    spinlock_release(&rd->lock);
+    return page;
+}
 
-    if (offset + len > ramdisk_size) {
-        // Handle error: write out of bounds
-        return;
+static const blkdev_ops_t ramdisk_ops = {
+    .queue_rq = ramdisk_queue_rq,
+};
+
+static const blkdev_ops_t ramdisk_shared_ops = {
+    .queue_rq = ramdisk_queue_rq,
+    .direct_access = ramdisk_direct_access,
+};
+
+block_device_t* ramdisk_create(const char* name, uint64_t size, uint32_t flags) {
+    ramdisk_t* rd = pmm_alloc(sizeof(ramdisk_t));
+    if (!rd) return NULL;
+    memset(rd, 0, sizeof(ramdisk_t));
+    radix_tree_init(&rd->pages);
+    rd->flags = flags;
+
+    block_device_t* bdev = &rd->bdev;
+    for (size_t i = 0; name[i] && i < sizeof(bdev->name) - 1; i++) bdev->name[i] = name[i];
+    bdev->ops = (flags & RAMDISK_SHARED) ? &ramdisk_shared_ops : &ramdisk_ops;
+    bdev->driver_data = rd;
+    bdev->nr_sectors = ((size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1)) >> SECTOR_SHIFT;
+    bdev->max_sectors = 2048; // 1 MiB
+    bdev->max_discard_sectors = bdev->nr_sectors;
+    bdev->elevator = "noop";
+    if (blkdev_register(bdev) != 0) {
+        pmm_free(rd, sizeof(ramdisk_t));
+        return NULL;
     }
+    return bdev;
+}
 
-    uint8_t* src = (uint8_t*)buffer;
-    uint8_t* dest = ramdisk_storage + offset;
-    for (uint32_t i = 0; i < len; i++) {
-        dest[i] = src[i];
+void ramdisk_init(size_t size) {
+    if (!ramdisk_create("ram0", size, 0)) {
+        print("RAMDISK Error: Failed to register the block device.\n");
+        return;
     }
+    print("RAM disk initialized.\n");
 }
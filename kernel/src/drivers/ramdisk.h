@@ -4,16 +4,17 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Initializes the RAM disk with a given size in bytes.
-void ramdisk_init(size_t size);
+struct block_device;
+
+#define RAMDISK_SHARED 0x01 // Lend pages to the page cache (direct_access)
 
-// Reads a block of data from the RAM disk.
-// block_no: The block number to read from.
-// count: The number of blocks to read.
-// buffer: The destination buffer to write data into.
-void ramdisk_read(uint32_t block_no, uint32_t count, void* buffer);
+// Creates a RAM disk of `size` bytes (rounded up to a page) called `name`
+// and registers it with the block layer. Memory is only used for pages
+// that have been written. NULL when out of memory.
+struct block_device* ramdisk_create(const char* name, uint64_t size, uint32_t flags);
 
-// Writes a block of data to the RAM disk.
-void ramdisk_write(uint32_t block_no, uint32_t count, void* buffer);
+// Initializes a RAM disk of `size` bytes and registers it with the block
+// layer as "ram0".
+void ramdisk_init(size_t size);
 
 #endif
@@ -0,0 +1,61 @@
+#include "tsc.h"
+#include "../../arch/x86_64/cpu.h"
+
+// PIT channel 2 is gated by port 0x61 and its output can be read back
+// there, so it can time an interval without taking an interrupt.
+#define PIT_FREQUENCY    1193182
+#define PIT_CH2_DATA     0x42
+#define PIT_COMMAND      0x43
+#define PIT_GATE_PORT    0x61
+#define PIT_GATE_CH2     0x01
+#define PIT_SPEAKER      0x02
+#define PIT_CH2_OUT      0x20
+
+#define CALIBRATE_MS     10
+#define CALIBRATE_RUNS   3
+#define TSC_SHIFT        32
+
+uint64_t tsc_hz = 0;
+
+// Cycles elapsed while channel 2 counts down CALIBRATE_MS
+static uint64_t tsc_measure_once(void) {
+    uint16_t count = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+    uint64_t start, end;
+
+    // Gate high, speaker off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~PIT_SPEAKER) | PIT_GATE_CH2);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CH2_DATA, count & 0xFF);
+    outb(PIT_CH2_DATA, count >> 8);
+
+    // Restart the count by toggling the gate
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, gate & ~PIT_GATE_CH2);
+    outb(PIT_GATE_PORT, gate | PIT_GATE_CH2);
+
+    start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_CH2_OUT));
+    end = rdtsc();
+
+    return end - start;
+}
+
+uint64_t tsc_calibrate(void) {
+    uint64_t best = ~0ULL;
+
+    // The shortest run had the least interference (SMIs, emulator exits)
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = tsc_measure_once();
+        if (cycles < best) best = cycles;
+    }
+
+    tsc_hz = best * (1000 / CALIBRATE_MS);
+    return tsc_hz;
+}
+
+void tsc_get_scale(uint64_t* mult, uint32_t* shift) {
+    *shift = TSC_SHIFT;
+    *mult = tsc_hz ? (uint64_t)((1000000000ULL << TSC_SHIFT) / tsc_hz) : 0;
+}
@@ -0,0 +1,15 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+
+// Measured TSC frequency in Hz, 0 until tsc_calibrate() succeeds
+extern uint64_t tsc_hz;
+
+// Measures the TSC against PIT channel 2. Returns the frequency in Hz.
+uint64_t tsc_calibrate(void);
+
+// Fixed-point factors for ns = (cycles * mult) >> shift
+void tsc_get_scale(uint64_t* mult, uint32_t* shift);
+
+#endif
@@ -0,0 +1,466 @@
+/* kernel/src/drivers/virtio.c */
+
+#include "virtio.h"
+#include "pci.h"
+#include "../mem/pmm.h"
+#include "../mem/vmm.h"
+#include "../lib/string.h"
+
+void print(char*);
+
+// x86 keeps stores in order with stores and loads with loads, so only a
+// store followed by a load of another location needs a real fence
+#define virtio_mb()  __sync_synchronize()
+#define virtio_wmb() asm volatile ("" ::: "memory")
+#define virtio_rmb() asm volatile ("" ::: "memory")
+
+#define VRING_USED_F_NO_NOTIFY 1
+
+// Whether moving an index from `old` to `new` passed `event`, the index
+// the other side asked to be told about
+static inline bool vring_need_event(uint16_t event, uint16_t new, uint16_t old) {
+    return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+uint64_t virtio_dma_addr(const void* virt) {
+    uint64_t phys = (uint64_t)(uintptr_t)virt;
+    if (current_pml4 && !vmm_virt_to_phys((pml4_t*)current_pml4, phys, &phys)) return (uint64_t)-1;
+    return phys;
+}
+
+// --- PCI Transport ---
+
+int virtio_pci_init(virtio_device_t* vdev, uint8_t bus, uint8_t device, uint8_t function) {
+    memset(vdev, 0, sizeof(virtio_device_t));
+    vdev->bus = bus;
+    vdev->device = device;
+    vdev->function = function;
+
+    // The first capability of each type that sits in a memory BAR
+    for (uint8_t cap = pci_find_capability(bus, device, function, PCI_CAP_ID_VNDR); cap;
+         cap = pci_find_next_capability(bus, device, function, cap, PCI_CAP_ID_VNDR)) {
+        uint8_t type = pci_read_config(bus, device, function, cap) >> 24;
+        uint8_t bar = pci_read_config(bus, device, function, cap + 4) & 0xFF;
+        if (bar > 5 || (pci_read_config(bus, device, function, PCI_BAR0 + 4 * bar) & PCI_BAR_IO)) continue;
+        volatile uint8_t* addr = (volatile uint8_t*)(uintptr_t)
+            (pci_read_bar(bus, device, function, bar) + pci_read_config(bus, device, function, cap + 8));
+
+        if (type == VIRTIO_PCI_CAP_COMMON_CFG && !vdev->common) {
+            vdev->common = (volatile virtio_pci_common_cfg_t*)addr;
+        } else if (type == VIRTIO_PCI_CAP_NOTIFY_CFG && !vdev->notify_base) {
+            vdev->notify_base = addr;
+            vdev->notify_off_multiplier = pci_read_config(bus, device, function, cap + 16);
+        } else if (type == VIRTIO_PCI_CAP_ISR_CFG && !vdev->isr) {
+            vdev->isr = addr;
+        } else if (type == VIRTIO_PCI_CAP_DEVICE_CFG && !vdev->device_cfg) {
+            vdev->device_cfg = addr;
+        }
+    }
+    if (!vdev->common || !vdev->notify_base || !vdev->isr) return -1;
+
+    uint32_t command = pci_read_config(bus, device, function, PCI_COMMAND);
+    pci_write_config(bus, device, function, PCI_COMMAND, (command & 0xFFFF) | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+    // Reset; the device reads back 0 once it is done
+    vdev->common->device_status = 0;
+    while (vdev->common->device_status != 0) {
+        asm volatile ("pause");
+    }
+    vdev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+    vdev->common->device_status |= VIRTIO_STATUS_DRIVER;
+    return 0;
+}
+
+uint64_t virtio_device_features(virtio_device_t* vdev) {
+    vdev->common->device_feature_select = 0;
+    uint64_t features = vdev->common->device_feature;
+    vdev->common->device_feature_select = 1;
+    return features | ((uint64_t)vdev->common->device_feature << 32);
+}
+
+int virtio_negotiate(virtio_device_t* vdev, uint64_t wanted) {
+    vdev->features = virtio_device_features(vdev) & wanted;
+    if (!virtio_has_feature(vdev, VIRTIO_F_VERSION_1)) return -1;
+
+    vdev->common->driver_feature_select = 0;
+    vdev->common->driver_feature = (uint32_t)vdev->features;
+    vdev->common->driver_feature_select = 1;
+    vdev->common->driver_feature = (uint32_t)(vdev->features >> 32);
+
+    vdev->common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    return (vdev->common->device_status & VIRTIO_STATUS_FEATURES_OK) ? 0 : -1;
+}
+
+void virtio_read_config(virtio_device_t* vdev, uint32_t offset, void* buf, uint32_t len) {
+    uint8_t generation;
+    do {
+        generation = vdev->common->config_generation;
+        // Each field with an access of its own width, as the spec asks
+        uint8_t* out = buf;
+        for (uint32_t pos = offset; pos < offset + len;) {
+            uint32_t left = offset + len - pos;
+            if (!(pos & 3) && left >= 4) {
+                uint32_t v = *(volatile uint32_t*)(vdev->device_cfg + pos);
+                memcpy(out, &v, 4);
+                pos += 4, out += 4;
+            } else if (!(pos & 1) && left >= 2) {
+                uint16_t v = *(volatile uint16_t*)(vdev->device_cfg + pos);
+                memcpy(out, &v, 2);
+                pos += 2, out += 2;
+            } else {
+                *out++ = vdev->device_cfg[pos++];
+            }
+        }
+    } while (generation != vdev->common->config_generation);
+}
+
+uint16_t virtio_num_queues(virtio_device_t* vdev) {
+    return vdev->common->num_queues;
+}
+
+int virtio_setup_msix(virtio_device_t* vdev, const uint8_t* vectors, uint16_t count) {
+    if (pci_enable_msix(vdev->bus, vdev->device, vdev->function, vectors, count) != 0) return -1;
+    vdev->common->config_msix_vector = VIRTIO_MSI_NO_VECTOR;
+    vdev->msix = true;
+    return 0;
+}
+
+void virtio_driver_ok(virtio_device_t* vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+void virtio_fail(virtio_device_t* vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_FAILED;
+}
+
+bool virtio_ack_irq(virtio_device_t* vdev) {
+    return *vdev->isr != 0;
+}
+
+// --- Virtqueues ---
+
+static size_t vq_state_size(uint16_t size) {
+    return size * (sizeof(void*) + 2 * sizeof(uint16_t));
+}
+
+static void vq_free(virtqueue_t* vq) {
+    if (vq->packed) {
+        if (vq->ring) pmm_free((void*)vq->ring, vq->size * sizeof(vring_packed_desc_t));
+        if (vq->driver_event) pmm_free_page((void*)vq->driver_event);
+    } else {
+        if (vq->desc) pmm_free((void*)vq->desc, vq->size * sizeof(vring_desc_t));
+        if (vq->avail) pmm_free((void*)vq->avail, sizeof(vring_avail_t) + (vq->size + 1) * sizeof(uint16_t));
+        if (vq->used) pmm_free((void*)vq->used, sizeof(vring_used_t) + vq->size * sizeof(vring_used_elem_t) + sizeof(uint16_t));
+    }
+    if (vq->tokens) pmm_free(vq->tokens, vq_state_size(vq->size));
+    memset(vq, 0, sizeof(virtqueue_t));
+}
+
+static void* vq_alloc(size_t size) {
+    void* p = pmm_alloc(size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+int virtqueue_setup(virtio_device_t* vdev, virtqueue_t* vq, uint16_t index, uint16_t max_size, uint16_t msix_entry) {
+    volatile virtio_pci_common_cfg_t* common = vdev->common;
+    memset(vq, 0, sizeof(virtqueue_t));
+    if (index >= common->num_queues) return -1;
+    common->queue_select = index;
+    uint16_t size = common->queue_size;
+    if (size == 0) return -1;
+    if (size > max_size) size = max_size;
+
+    vq->vdev = vdev;
+    vq->index = index;
+    vq->packed = virtio_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    vq->indirect = virtio_has_feature(vdev, VIRTIO_F_INDIRECT_DESC);
+    vq->event_idx = virtio_has_feature(vdev, VIRTIO_F_EVENT_IDX);
+    // Split ring sizes are powers of two
+    if (!vq->packed) {
+        while (size & (size - 1)) size &= size - 1;
+    }
+    vq->size = size;
+    vq->num_free = size;
+
+    uint64_t desc, driver, device;
+    if (vq->packed) {
+        vq->ring = vq_alloc(size * sizeof(vring_packed_desc_t));
+        vq->driver_event = vq_alloc(PAGE_SIZE);
+        if (!vq->ring || !vq->driver_event) goto fail;
+        vq->device_event = vq->driver_event + 1;
+        vq->avail_wrap = true;
+        vq->used_wrap = true;
+        desc = virtio_dma_addr((void*)vq->ring);
+        driver = virtio_dma_addr((void*)vq->driver_event);
+        device = virtio_dma_addr((void*)vq->device_event);
+    } else {
+        vq->desc = vq_alloc(size * sizeof(vring_desc_t));
+        vq->avail = vq_alloc(sizeof(vring_avail_t) + (size + 1) * sizeof(uint16_t));
+        vq->used = vq_alloc(sizeof(vring_used_t) + size * sizeof(vring_used_elem_t) + sizeof(uint16_t));
+        if (!vq->desc || !vq->avail || !vq->used) goto fail;
+        for (uint16_t i = 0; i < size - 1; i++) vq->desc[i].next = i + 1;
+        desc = virtio_dma_addr((void*)vq->desc);
+        driver = virtio_dma_addr((void*)vq->avail);
+        device = virtio_dma_addr((void*)vq->used);
+    }
+
+    vq->tokens = vq_alloc(vq_state_size(size));
+    if (!vq->tokens) goto fail;
+    vq->ndesc = (uint16_t*)(vq->tokens + size);
+    vq->id_next = vq->ndesc + size;
+    for (uint16_t i = 0; i < size - 1; i++) vq->id_next[i] = i + 1;
+
+    common->queue_size = size;
+    common->queue_msix_vector = msix_entry;
+    if (msix_entry != VIRTIO_MSI_NO_VECTOR && common->queue_msix_vector != msix_entry) goto fail;
+    common->queue_desc = desc;
+    common->queue_driver = driver;
+    common->queue_device = device;
+    vq->notify = (volatile uint16_t*)(vdev->notify_base + common->queue_notify_off * vdev->notify_off_multiplier);
+    virtqueue_enable_cb(vq);
+    common->queue_enable = 1;
+    return 0;
+
+fail:
+    vq_free(vq);
+    return -1;
+}
+
+// --- Split Ring ---
+
+static int vq_add_split(virtqueue_t* vq, const virtio_sg_t* sg, uint16_t n, void* token, virtio_indirect_desc_t* indirect) {
+    uint16_t head = vq->free_head;
+    uint16_t used = n;
+
+    if (vq->indirect && indirect && n > 1) {
+        if (vq->num_free == 0) return -1;
+        for (uint16_t i = 0; i < n; i++) {
+            indirect[i].split.addr = sg[i].addr;
+            indirect[i].split.len = sg[i].len;
+            indirect[i].split.flags = (sg[i].write ? VRING_DESC_F_WRITE : 0) | (i + 1 < n ? VRING_DESC_F_NEXT : 0);
+            indirect[i].split.next = i + 1;
+        }
+        vq->desc[head].addr = virtio_dma_addr(indirect);
+        vq->desc[head].len = n * sizeof(vring_desc_t);
+        vq->desc[head].flags = VRING_DESC_F_INDIRECT;
+        vq->free_head = vq->desc[head].next;
+        used = 1;
+    } else {
+        if (vq->num_free < n) return -1;
+        // The free list already links the descriptors the chain takes
+        uint16_t idx = head;
+        for (uint16_t i = 0; i < n; i++) {
+            vq->desc[idx].addr = sg[i].addr;
+            vq->desc[idx].len = sg[i].len;
+            vq->desc[idx].flags = (sg[i].write ? VRING_DESC_F_WRITE : 0) | (i + 1 < n ? VRING_DESC_F_NEXT : 0);
+            idx = vq->desc[idx].next;
+        }
+        vq->free_head = idx;
+    }
+
+    vq->num_free -= used;
+    vq->ndesc[head] = used;
+    vq->tokens[head] = token;
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+    virtio_wmb();
+    vq->avail->idx = ++vq->avail_idx;
+    vq->added++;
+    return 0;
+}
+
+static void vq_kick_split(virtqueue_t* vq) {
+    virtio_mb();
+    uint16_t new = vq->avail_idx;
+    uint16_t old = new - vq->added;
+    vq->added = 0;
+
+    bool need;
+    if (vq->event_idx) {
+        need = vring_need_event(*(volatile uint16_t*)&vq->used->ring[vq->size], new, old);
+    } else {
+        need = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+    if (need) *vq->notify = vq->index;
+}
+
+static void* vq_get_split(virtqueue_t* vq, uint32_t* len) {
+    if (vq->last_used == vq->used->idx) return NULL;
+    virtio_rmb();
+
+    volatile vring_used_elem_t* elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = elem->id;
+    if (len) *len = elem->len;
+    void* token = vq->tokens[head];
+
+    uint16_t last = head;
+    for (uint16_t i = 1; i < vq->ndesc[head]; i++) last = vq->desc[last].next;
+    vq->desc[last].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += vq->ndesc[head];
+    vq->last_used++;
+
+    // Keeps the interrupt point just ahead of what has been consumed
+    if (vq->cb_enabled && vq->event_idx) {
+        vq->avail->ring[vq->size] = vq->last_used;
+        virtio_mb();
+    }
+    return token;
+}
+
+// --- Packed Ring ---
+
+static uint16_t vq_packed_flags(virtqueue_t* vq, const virtio_sg_t* sg, bool more) {
+    uint16_t flags = (sg->write ? VRING_DESC_F_WRITE : 0) | (more ? VRING_DESC_F_NEXT : 0);
+    return flags | (vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED);
+}
+
+static void vq_advance_avail(virtqueue_t* vq) {
+    if (++vq->next_avail == vq->size) {
+        vq->next_avail = 0;
+        vq->avail_wrap = !vq->avail_wrap;
+    }
+}
+
+static int vq_add_packed(virtqueue_t* vq, const virtio_sg_t* sg, uint16_t n, void* token, virtio_indirect_desc_t* indirect) {
+    bool use_indirect = vq->indirect && indirect && n > 1;
+    uint16_t used = use_indirect ? 1 : n;
+    if (vq->num_free < used) return -1;
+
+    uint16_t id = vq->free_id;
+    vq->free_id = vq->id_next[id];
+    uint16_t head = vq->next_avail;
+    uint16_t head_flags;
+
+    if (use_indirect) {
+        for (uint16_t i = 0; i < n; i++) {
+            indirect[i].packed.addr = sg[i].addr;
+            indirect[i].packed.len = sg[i].len;
+            indirect[i].packed.id = 0;
+            indirect[i].packed.flags = sg[i].write ? VRING_DESC_F_WRITE : 0;
+        }
+        vq->ring[head].addr = virtio_dma_addr(indirect);
+        vq->ring[head].len = n * sizeof(vring_packed_desc_t);
+        vq->ring[head].id = id;
+        head_flags = VRING_DESC_F_INDIRECT | (vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED);
+        vq_advance_avail(vq);
+    } else {
+        head_flags = vq_packed_flags(vq, &sg[0], n > 1);
+        for (uint16_t i = 0; i < n; i++) {
+            uint16_t pos = vq->next_avail;
+            vq->ring[pos].addr = sg[i].addr;
+            vq->ring[pos].len = sg[i].len;
+            vq->ring[pos].id = id;
+            // The head's flags go last: they hand the whole chain over
+            if (i > 0) vq->ring[pos].flags = vq_packed_flags(vq, &sg[i], i + 1 < n);
+            vq_advance_avail(vq);
+        }
+    }
+    virtio_wmb();
+    vq->ring[head].flags = head_flags;
+
+    vq->num_free -= used;
+    vq->ndesc[id] = used;
+    vq->tokens[id] = token;
+    vq->added += used;
+    return 0;
+}
+
+static void vq_kick_packed(virtqueue_t* vq) {
+    virtio_mb();
+    uint16_t new = vq->next_avail;
+    uint16_t old = new - vq->added;
+    vq->added = 0;
+
+    uint16_t flags = vq->device_event->flags;
+    bool need;
+    if (flags == VRING_PACKED_EVENT_F_DESC) {
+        uint16_t off_wrap = vq->device_event->off_wrap;
+        uint16_t event = off_wrap & ~(1u << VRING_PACKED_EVENT_WRAP);
+        // An event from the previous lap counts from a ring further back
+        if ((bool)(off_wrap >> VRING_PACKED_EVENT_WRAP) != vq->avail_wrap) event -= vq->size;
+        need = vring_need_event(event, new, old);
+    } else {
+        need = flags != VRING_PACKED_EVENT_F_DISABLE;
+    }
+    if (need) *vq->notify = vq->index;
+}
+
+static bool vq_more_packed(virtqueue_t* vq) {
+    uint16_t flags = vq->ring[vq->next_used].flags;
+    bool avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    bool used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    return avail == used && used == vq->used_wrap;
+}
+
+static uint16_t vq_used_off_wrap(virtqueue_t* vq) {
+    return vq->next_used | ((uint16_t)vq->used_wrap << VRING_PACKED_EVENT_WRAP);
+}
+
+static void* vq_get_packed(virtqueue_t* vq, uint32_t* len) {
+    if (!vq_more_packed(vq)) return NULL;
+    virtio_rmb();
+
+    volatile vring_packed_desc_t* desc = &vq->ring[vq->next_used];
+    uint16_t id = desc->id;
+    if (len) *len = desc->len;
+    void* token = vq->tokens[id];
+
+    // The device skips over the rest of the chain
+    vq->num_free += vq->ndesc[id];
+    vq->next_used += vq->ndesc[id];
+    if (vq->next_used >= vq->size) {
+        vq->next_used -= vq->size;
+        vq->used_wrap = !vq->used_wrap;
+    }
+    vq->id_next[id] = vq->free_id;
+    vq->free_id = id;
+
+    if (vq->cb_enabled && vq->event_idx) {
+        vq->driver_event->off_wrap = vq_used_off_wrap(vq);
+        virtio_mb();
+    }
+    return token;
+}
+
+// --- Common ---
+
+int virtqueue_add(virtqueue_t* vq, const virtio_sg_t* sg, uint16_t n, void* token, virtio_indirect_desc_t* indirect) {
+    return vq->packed ? vq_add_packed(vq, sg, n, token, indirect) : vq_add_split(vq, sg, n, token, indirect);
+}
+
+void virtqueue_kick(virtqueue_t* vq) {
+    if (vq->added == 0) return;
+    if (vq->packed) vq_kick_packed(vq);
+    else vq_kick_split(vq);
+}
+
+void* virtqueue_get_used(virtqueue_t* vq, uint32_t* len) {
+    return vq->packed ? vq_get_packed(vq, len) : vq_get_split(vq, len);
+}
+
+bool virtqueue_enable_cb(virtqueue_t* vq) {
+    vq->cb_enabled = true;
+    if (vq->packed) {
+        if (vq->event_idx) {
+            vq->driver_event->off_wrap = vq_used_off_wrap(vq);
+            virtio_wmb();
+            vq->driver_event->flags = VRING_PACKED_EVENT_F_DESC;
+        } else {
+            vq->driver_event->flags = VRING_PACKED_EVENT_F_ENABLE;
+        }
+        virtio_mb();
+        return !vq_more_packed(vq);
+    }
+
+    if (vq->event_idx) vq->avail->ring[vq->size] = vq->last_used;
+    else vq->avail->flags = 0;
+    virtio_mb();
+    return vq->last_used == vq->used->idx;
+}
+
+void virtqueue_disable_cb(virtqueue_t* vq) {
+    vq->cb_enabled = false;
+    if (vq->packed) vq->driver_event->flags = VRING_PACKED_EVENT_F_DISABLE;
+    else vq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+}
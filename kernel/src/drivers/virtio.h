@@ -0,0 +1,217 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Virtio 1.x over PCI ("modern" devices). The transport finds the device's
+// configuration structures through vendor-specific PCI capabilities,
+// negotiates features, and sets up virtqueues in either ring layout: split
+// (descriptor table, available ring, used ring) or packed (one ring the
+// driver and device take turns on). Device drivers such as virtio_blk.c sit
+// on top and only deal in scatter lists and completion tokens.
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+// --- Device Status ---
+#define VIRTIO_STATUS_ACKNOWLEDGE  1
+#define VIRTIO_STATUS_DRIVER       2
+#define VIRTIO_STATUS_DRIVER_OK    4
+#define VIRTIO_STATUS_FEATURES_OK  8
+#define VIRTIO_STATUS_NEEDS_RESET  64
+#define VIRTIO_STATUS_FAILED       128
+
+// --- Transport Feature Bits ---
+#define VIRTIO_F_INDIRECT_DESC     28
+#define VIRTIO_F_EVENT_IDX         29
+#define VIRTIO_F_VERSION_1         32
+#define VIRTIO_F_RING_PACKED       34
+
+#define VIRTIO_FEATURE(bit) (1ULL << (bit))
+
+// --- PCI Capabilities ---
+#define VIRTIO_PCI_CAP_COMMON_CFG  1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG  2
+#define VIRTIO_PCI_CAP_ISR_CFG     3
+#define VIRTIO_PCI_CAP_DEVICE_CFG  4
+
+#define VIRTIO_MSI_NO_VECTOR       0xFFFF
+
+typedef struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t config_msix_vector;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    // About the queue picked by queue_select
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint64_t queue_desc;
+    uint64_t queue_driver;
+    uint64_t queue_device;
+} __attribute__((packed)) virtio_pci_common_cfg_t;
+
+// --- Split Ring ---
+#define VRING_DESC_F_NEXT      1
+#define VRING_DESC_F_WRITE     2 // Device writes the buffer
+#define VRING_DESC_F_INDIRECT  4 // The buffer is a table of descriptors
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];  // Followed by used_event with VIRTIO_F_EVENT_IDX
+} __attribute__((packed)) vring_avail_t;
+
+typedef struct {
+    uint32_t id;      // Head of the descriptor chain
+    uint32_t len;     // Bytes the device wrote
+} __attribute__((packed)) vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[]; // Followed by avail_event with VIRTIO_F_EVENT_IDX
+} __attribute__((packed)) vring_used_t;
+
+// --- Packed Ring ---
+#define VRING_PACKED_DESC_F_AVAIL (1 << 7)
+#define VRING_PACKED_DESC_F_USED  (1 << 15)
+
+#define VRING_PACKED_EVENT_F_ENABLE  0
+#define VRING_PACKED_EVENT_F_DISABLE 1
+#define VRING_PACKED_EVENT_F_DESC    2 // Only at the position in off_wrap
+#define VRING_PACKED_EVENT_WRAP      15
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} __attribute__((packed)) vring_packed_desc_t;
+
+typedef struct {
+    uint16_t off_wrap;
+    uint16_t flags;
+} __attribute__((packed)) vring_packed_event_t;
+
+// Either table entry format is 16 bytes, so one buffer serves both
+typedef union {
+    vring_desc_t split;
+    vring_packed_desc_t packed;
+} virtio_indirect_desc_t;
+
+typedef struct virtio_device {
+    uint8_t bus, device, function;
+    volatile virtio_pci_common_cfg_t* common;
+    volatile uint8_t* notify_base;
+    uint32_t notify_off_multiplier;
+    volatile uint8_t* isr;        // Read to acknowledge a legacy interrupt
+    volatile uint8_t* device_cfg; // Device-type specific layout
+    uint64_t features;            // Negotiated
+    bool msix;
+} virtio_device_t;
+
+// One buffer of a request
+typedef struct {
+    uint64_t addr;    // Bus address
+    uint32_t len;
+    bool write;       // Device-writable
+} virtio_sg_t;
+
+typedef struct virtqueue {
+    virtio_device_t* vdev;
+    uint16_t index;
+    uint16_t size;
+    bool packed;
+    bool indirect;
+    bool event_idx;
+    volatile uint16_t* notify;
+    uint16_t num_free;        // Ring descriptors
+    uint16_t added;           // Ring entries made available since the last kick
+    bool cb_enabled;          // Interrupts wanted
+
+    // Split ring
+    volatile vring_desc_t* desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t* used;
+    uint16_t free_head;       // Free descriptors, linked through `next`
+    uint16_t avail_idx;
+    uint16_t last_used;
+
+    // Packed ring
+    volatile vring_packed_desc_t* ring;
+    volatile vring_packed_event_t* driver_event;
+    volatile vring_packed_event_t* device_event;
+    uint16_t next_avail;
+    uint16_t next_used;
+    bool avail_wrap;
+    bool used_wrap;
+    uint16_t free_id;         // Free buffer IDs, linked through id_next
+
+    // Per buffer: split by head descriptor, packed by ID
+    void** tokens;
+    uint16_t* ndesc;          // Ring descriptors the buffer takes
+    uint16_t* id_next;        // Packed only: ID free list
+} virtqueue_t;
+
+// Maps the device's configuration structures, resets it and announces a
+// driver. -1 if it is not a modern virtio device.
+int virtio_pci_init(virtio_device_t* vdev, uint8_t bus, uint8_t device, uint8_t function);
+uint64_t virtio_device_features(virtio_device_t* vdev);
+// Accepts the features of `wanted` the device offers. -1 if the device
+// rejects the set, or does not offer VIRTIO_F_VERSION_1.
+int virtio_negotiate(virtio_device_t* vdev, uint64_t wanted);
+static inline bool virtio_has_feature(virtio_device_t* vdev, uint32_t bit) {
+    return (vdev->features & VIRTIO_FEATURE(bit)) != 0;
+}
+// Reads `len` bytes of device configuration from `offset`, retrying until
+// the device did not change it halfway through
+void virtio_read_config(virtio_device_t* vdev, uint32_t offset, void* buf, uint32_t len);
+uint16_t virtio_num_queues(virtio_device_t* vdev);
+
+// Routes interrupts of queues to MSI-X entries 0..count-1, one vector each.
+// -1 if the device has no MSI-X or too few entries.
+int virtio_setup_msix(virtio_device_t* vdev, const uint8_t* vectors, uint16_t count);
+// Creates queue `index` with at most `max_size` entries, interrupting on
+// MSI-X entry `msix_entry` (VIRTIO_MSI_NO_VECTOR without MSI-X). -1 if
+// the device has no such queue or memory is short.
+int virtqueue_setup(virtio_device_t* vdev, virtqueue_t* vq, uint16_t index, uint16_t max_size, uint16_t msix_entry);
+void virtio_driver_ok(virtio_device_t* vdev);
+void virtio_fail(virtio_device_t* vdev);
+// Acknowledges a legacy interrupt; false if it was not this device's
+bool virtio_ack_irq(virtio_device_t* vdev);
+
+// Bus address of a kernel buffer
+uint64_t virtio_dma_addr(const void* virt);
+
+// Makes `n` buffers available as one request identified by `token`. With
+// VIRTIO_F_INDIRECT_DESC and `indirect` (room for n descriptors) they take
+// a single ring descriptor. -1 when the ring is too full.
+int virtqueue_add(virtqueue_t* vq, const virtio_sg_t* sg, uint16_t n, void* token, virtio_indirect_desc_t* indirect);
+// Tells the device about the buffers added since the last kick, unless
+// it asked not to be told yet
+void virtqueue_kick(virtqueue_t* vq);
+// The token of the next request the device is done with, NULL if none
+void* virtqueue_get_used(virtqueue_t* vq, uint32_t* len);
+// Asks for an interrupt on the next completion. Returns false if one came
+// in meanwhile; the caller then drains the queue again.
+bool virtqueue_enable_cb(virtqueue_t* vq);
+void virtqueue_disable_cb(virtqueue_t* vq);
+
+#endif
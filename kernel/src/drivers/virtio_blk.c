@@ -0,0 +1,432 @@
+/* kernel/src/drivers/virtio_blk.c */
+
+// Each block layer hardware queue maps onto a virtqueue of its own, with
+// its own lock and, under MSI-X, its own interrupt vector, so CPUs do not
+// share anything on the submission or completion path. A request is a
+// header, the data buffers and a status byte; with indirect descriptors
+// they all sit in a table in the request's slot and take one ring entry.
+
+#include "virtio_blk.h"
+#include "virtio.h"
+#include "pci.h"
+#include "../block/blkdev.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+#include "../../arch/x86_64/cpu.h"
+#include "../../arch/x86_64/idt.h"
+
+void print(char*);
+
+#define VIRTIO_BLK_PCI_DEVICE       0x1042 // Modern only
+#define VIRTIO_BLK_PCI_DEVICE_TRANS 0x1001 // Transitional, which speaks 1.x too
+
+// --- Feature Bits ---
+#define VIRTIO_BLK_F_SIZE_MAX  1
+#define VIRTIO_BLK_F_SEG_MAX   2
+#define VIRTIO_BLK_F_RO        5
+#define VIRTIO_BLK_F_BLK_SIZE  6
+#define VIRTIO_BLK_F_FLUSH     9
+#define VIRTIO_BLK_F_TOPOLOGY  10
+#define VIRTIO_BLK_F_MQ        12
+#define VIRTIO_BLK_F_DISCARD   13
+
+// --- Device Configuration Offsets ---
+#define VIRTIO_BLK_CFG_CAPACITY      0  // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_CFG_SIZE_MAX      8
+#define VIRTIO_BLK_CFG_SEG_MAX       12
+#define VIRTIO_BLK_CFG_BLK_SIZE      20
+#define VIRTIO_BLK_CFG_PHYS_EXP      24 // Logical blocks per physical block, log2
+#define VIRTIO_BLK_CFG_NUM_QUEUES    34
+#define VIRTIO_BLK_CFG_MAX_DISCARD   36
+
+// --- Requests ---
+#define VIRTIO_BLK_T_IN       0
+#define VIRTIO_BLK_T_OUT      1
+#define VIRTIO_BLK_T_FLUSH    4
+#define VIRTIO_BLK_T_DISCARD  11
+
+#define VIRTIO_BLK_S_OK       0
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_req_hdr_t;
+
+typedef struct {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+} __attribute__((packed)) virtio_blk_discard_t;
+
+#define VIRTIO_BLK_QUEUE_SIZE 256 // Ring entries asked for
+#define VIRTIO_BLK_DEPTH      64  // Requests in flight per queue
+#define VIRTIO_BLK_SG_MAX     252 // Descriptors per request, header and status included
+#define VIRTIO_BLK_SEG_SIZE   (4u << 20)
+
+// Everything a request in flight needs besides its data, a page per tag
+typedef struct {
+    virtio_indirect_desc_t table[VIRTIO_BLK_SG_MAX];
+    virtio_blk_req_hdr_t hdr;
+    virtio_blk_discard_t discard;
+    uint8_t status;
+} virtio_blk_slot_t;
+
+_Static_assert(sizeof(virtio_blk_slot_t) <= PAGE_SIZE, "a request slot must fit a page");
+
+struct virtio_blk;
+
+typedef struct virtio_blk_queue {
+    struct virtio_blk* vblk;
+    virtqueue_t vq;
+    spinlock_t lock;          // The virtqueue, with interrupts off
+    virtio_blk_slot_t* slots; // By rq->tag
+    virtio_sg_t sg[VIRTIO_BLK_SG_MAX]; // Scratch for the request being added, under lock
+} virtio_blk_queue_t;
+
+typedef struct virtio_blk {
+    virtio_device_t vdev;
+    uint32_t nr_queues;
+    bool irqs;                // Else completions are polled for
+    bool read_only;
+    uint32_t sg_max;          // Data descriptors per request
+    uint32_t seg_size;        // Largest data descriptor
+    virtio_blk_queue_t queues[BLK_MAX_HW_QUEUES];
+    block_device_t bdev;
+} virtio_blk_t;
+
+// MSI-X vector to queue; the legacy line serves the one device without
+static virtio_blk_queue_t* virtio_blk_vectors[MSI_VECTORS];
+static virtio_blk_t* virtio_blk_intx;
+
+// --- Requests ---
+
+// Adds the request's buffers to `sg` a page at a time, merging pages that
+// are physically contiguous. Returns the entries used, -1 if too many.
+static int virtio_blk_map_data(virtio_blk_t* vblk, request_t* rq, virtio_sg_t* sg) {
+    uint32_t n = 0;
+    bool write = rq->op == REQ_OP_READ;
+    uint64_t next = (uint64_t)-1;
+
+    for (bio_t* bio = rq->bio; bio; bio = bio->next) {
+        for (uint16_t i = 0; i < bio->vcnt; i++) {
+            uint8_t* base = bio->vecs[i].base;
+            uint32_t left = bio->vecs[i].len;
+            while (left > 0) {
+                uint32_t len = PAGE_SIZE - ((uintptr_t)base & (PAGE_SIZE - 1));
+                if (len > left) len = left;
+                uint64_t phys = virtio_dma_addr(base);
+                if (phys == (uint64_t)-1) return -1;
+
+                if (n > 0 && phys == next && sg[n - 1].len + len <= vblk->seg_size) {
+                    sg[n - 1].len += len;
+                } else {
+                    if (n == vblk->sg_max) return -1;
+                    sg[n].addr = phys;
+                    sg[n].len = len;
+                    sg[n].write = write;
+                    n++;
+                }
+                next = phys + len;
+                base += len;
+                left -= len;
+            }
+        }
+    }
+    return n;
+}
+
+// Fills in the request's slot and its descriptors. Returns how many, -1
+// if the request cannot be described.
+static int virtio_blk_prep(virtio_blk_t* vblk, virtio_blk_slot_t* slot, request_t* rq, virtio_sg_t* sg) {
+    slot->hdr.reserved = 0;
+    slot->hdr.sector = rq->sector;
+    slot->status = 0xFF;
+    sg[0].addr = virtio_dma_addr(&slot->hdr);
+    sg[0].len = sizeof(virtio_blk_req_hdr_t);
+    sg[0].write = false;
+    int n = 1;
+
+    switch (rq->op) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE: {
+        slot->hdr.type = rq->op == REQ_OP_READ ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+        int data = virtio_blk_map_data(vblk, rq, &sg[1]);
+        if (data < 0) return -1;
+        n += data;
+        break;
+    }
+    case REQ_OP_FLUSH:
+        slot->hdr.type = VIRTIO_BLK_T_FLUSH;
+        slot->hdr.sector = 0;
+        break;
+    case REQ_OP_DISCARD:
+        slot->hdr.type = VIRTIO_BLK_T_DISCARD;
+        slot->hdr.sector = 0;
+        slot->discard.sector = rq->sector;
+        slot->discard.num_sectors = rq->nr_sectors;
+        slot->discard.flags = 0;
+        sg[n].addr = virtio_dma_addr(&slot->discard);
+        sg[n].len = sizeof(virtio_blk_discard_t);
+        sg[n].write = false;
+        n++;
+        break;
+    default:
+        return -1;
+    }
+
+    sg[n].addr = virtio_dma_addr(&slot->status);
+    sg[n].len = 1;
+    sg[n].write = true;
+    return n + 1;
+}
+
+static int virtio_blk_status(virtio_blk_queue_t* q, request_t* rq) {
+    return q->slots[rq->tag].status == VIRTIO_BLK_S_OK ? BLK_STS_OK : BLK_STS_IOERR;
+}
+
+// Waits for `rq` when there are no interrupts, completing whatever else
+// finishes first
+static void virtio_blk_poll(virtio_blk_queue_t* q, request_t* rq) {
+    for (bool done = false; !done;) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&q->lock);
+        request_t* r = virtqueue_get_used(&q->vq, NULL);
+        spinlock_release(&q->lock);
+        irq_restore(flags);
+
+        if (!r) {
+            asm volatile ("pause");
+            continue;
+        }
+        done = r == rq;
+        blk_complete_request(r, virtio_blk_status(q, r));
+    }
+}
+
+static int virtio_blk_queue_rq(blk_hw_queue_t* hctx, request_t* rq) {
+    virtio_blk_t* vblk = hctx->bdev->driver_data;
+    virtio_blk_queue_t* q = &vblk->queues[hctx->index];
+
+    if ((rq->op == REQ_OP_WRITE || rq->op == REQ_OP_DISCARD) && vblk->read_only) {
+        blk_complete_request(rq, BLK_STS_IOERR);
+        return BLK_STS_OK;
+    }
+    // Without VIRTIO_BLK_F_FLUSH the device writes through
+    if (rq->op == REQ_OP_FLUSH && !virtio_has_feature(&vblk->vdev, VIRTIO_BLK_F_FLUSH)) {
+        blk_complete_request(rq, BLK_STS_OK);
+        return BLK_STS_OK;
+    }
+
+    virtio_blk_slot_t* slot = &q->slots[rq->tag];
+    uint64_t flags = irq_save();
+    spinlock_acquire(&q->lock);
+    int n = virtio_blk_prep(vblk, slot, rq, q->sg);
+    if (n < 0) {
+        spinlock_release(&q->lock);
+        irq_restore(flags);
+        blk_complete_request(rq, BLK_STS_IOERR);
+        return BLK_STS_OK;
+    }
+    if (virtqueue_add(&q->vq, q->sg, n, rq, slot->table) != 0) {
+        spinlock_release(&q->lock);
+        irq_restore(flags);
+        return BLK_STS_BUSY;
+    }
+    virtqueue_kick(&q->vq);
+    spinlock_release(&q->lock);
+    irq_restore(flags);
+
+    if (!vblk->irqs) virtio_blk_poll(q, rq);
+    return BLK_STS_OK;
+}
+
+static const blkdev_ops_t virtio_blk_ops = {
+    .queue_rq = virtio_blk_queue_rq,
+};
+
+// --- Interrupts ---
+
+// Drains the queue with interrupts suppressed, then turns them back on
+// and drains again if the device got something in between
+static void virtio_blk_drain(virtio_blk_queue_t* q) {
+    spinlock_acquire(&q->lock);
+    do {
+        virtqueue_disable_cb(&q->vq);
+        request_t* rq;
+        while ((rq = virtqueue_get_used(&q->vq, NULL)) != NULL) {
+            blk_complete_request_irq(rq, virtio_blk_status(q, rq));
+        }
+    } while (!virtqueue_enable_cb(&q->vq));
+    spinlock_release(&q->lock);
+}
+
+static void virtio_blk_msix_handler(registers_t* regs) {
+    virtio_blk_queue_t* q = virtio_blk_vectors[regs->int_no - MSI_VECTOR_BASE];
+    if (q) virtio_blk_drain(q);
+}
+
+static void virtio_blk_intx_handler(registers_t* regs) {
+    (void)regs;
+    virtio_blk_t* vblk = virtio_blk_intx;
+    if (!vblk || !virtio_ack_irq(&vblk->vdev)) return;
+    for (uint32_t i = 0; i < vblk->nr_queues; i++) virtio_blk_drain(&vblk->queues[i]);
+}
+
+// One MSI-X vector per queue, as many queues as there are vectors for.
+// Else the legacy line for all of them, else polling.
+static void virtio_blk_setup_irqs(virtio_blk_t* vblk) {
+    virtio_device_t* vdev = &vblk->vdev;
+    uint16_t entries = pci_msix_table_size(vdev->bus, vdev->device, vdev->function);
+    uint32_t want = vblk->nr_queues < entries ? vblk->nr_queues : entries;
+
+    uint8_t vectors[BLK_MAX_HW_QUEUES];
+    uint32_t n = 0;
+    while (n < want && (vectors[n] = msi_alloc_vector()) != 0) n++;
+    if (n > 0 && virtio_setup_msix(vdev, vectors, n) == 0) {
+        vblk->nr_queues = n;
+        for (uint32_t i = 0; i < n; i++) {
+            virtio_blk_vectors[vectors[i] - MSI_VECTOR_BASE] = &vblk->queues[i];
+            register_interrupt_handler(vectors[i], virtio_blk_msix_handler);
+        }
+        vblk->irqs = true;
+        return;
+    }
+
+    uint8_t line = pci_read_config(vdev->bus, vdev->device, vdev->function, PCI_INTERRUPT_LINE) & 0xFF;
+    if (line >= 16 || virtio_blk_intx) {
+        print("virtio-blk: no usable interrupt; polling\n");
+        return;
+    }
+    virtio_blk_intx = vblk;
+    register_interrupt_handler(IRQ_BASE + line, virtio_blk_intx_handler);
+    pic_unmask(line);
+    vblk->irqs = true;
+}
+
+// --- Probe ---
+
+static int virtio_blk_setup_queues(virtio_blk_t* vblk) {
+    for (uint32_t i = 0; i < vblk->nr_queues; i++) {
+        virtio_blk_queue_t* q = &vblk->queues[i];
+        q->vblk = vblk;
+        uint16_t msix_entry = vblk->vdev.msix ? i : VIRTIO_MSI_NO_VECTOR;
+        if (virtqueue_setup(&vblk->vdev, &q->vq, i, VIRTIO_BLK_QUEUE_SIZE, msix_entry) != 0) {
+            // Fewer queues will do, but not none
+            if (i == 0) return -1;
+            vblk->nr_queues = i;
+            break;
+        }
+        q->slots = pmm_alloc(VIRTIO_BLK_DEPTH * PAGE_SIZE);
+        if (!q->slots) return -1;
+        memset(q->slots, 0, VIRTIO_BLK_DEPTH * PAGE_SIZE);
+        // Polled queues have no use for interrupts
+        if (!vblk->irqs) virtqueue_disable_cb(&q->vq);
+    }
+    return 0;
+}
+
+void virtio_blk_init(void) {
+    uint8_t bus, device, function;
+    if (!pci_scan_for_id(VIRTIO_PCI_VENDOR, VIRTIO_BLK_PCI_DEVICE, &bus, &device, &function) &&
+        !pci_scan_for_id(VIRTIO_PCI_VENDOR, VIRTIO_BLK_PCI_DEVICE_TRANS, &bus, &device, &function)) {
+        return;
+    }
+
+    virtio_blk_t* vblk = pmm_alloc(sizeof(virtio_blk_t));
+    if (!vblk) return;
+    memset(vblk, 0, sizeof(virtio_blk_t));
+    virtio_device_t* vdev = &vblk->vdev;
+    if (virtio_pci_init(vdev, bus, device, function) != 0) {
+        print("virtio-blk: not a virtio 1.x device\n");
+        pmm_free(vblk, sizeof(virtio_blk_t));
+        return;
+    }
+
+    uint64_t wanted = VIRTIO_FEATURE(VIRTIO_F_VERSION_1) | VIRTIO_FEATURE(VIRTIO_F_INDIRECT_DESC) |
+                      VIRTIO_FEATURE(VIRTIO_F_EVENT_IDX) | VIRTIO_FEATURE(VIRTIO_F_RING_PACKED) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_SIZE_MAX) | VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_RO) | VIRTIO_FEATURE(VIRTIO_BLK_F_BLK_SIZE) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_FLUSH) | VIRTIO_FEATURE(VIRTIO_BLK_F_TOPOLOGY) |
+                      VIRTIO_FEATURE(VIRTIO_BLK_F_MQ) | VIRTIO_FEATURE(VIRTIO_BLK_F_DISCARD);
+    if (virtio_negotiate(vdev, wanted) != 0) {
+        print("virtio-blk: feature negotiation failed\n");
+        goto fail;
+    }
+
+    block_device_t* bdev = &vblk->bdev;
+    virtio_read_config(vdev, VIRTIO_BLK_CFG_CAPACITY, &bdev->nr_sectors, sizeof(uint64_t));
+    vblk->read_only = virtio_has_feature(vdev, VIRTIO_BLK_F_RO);
+    vblk->sg_max = VIRTIO_BLK_SG_MAX - 2;
+    vblk->seg_size = VIRTIO_BLK_SEG_SIZE;
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max;
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_SEG_MAX, &seg_max, sizeof(seg_max));
+        if (seg_max && seg_max < vblk->sg_max) vblk->sg_max = seg_max;
+    }
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_SIZE_MAX)) {
+        uint32_t size_max;
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_SIZE_MAX, &size_max, sizeof(size_max));
+        if (size_max >= PAGE_SIZE && size_max < vblk->seg_size) vblk->seg_size = size_max;
+    }
+
+    vblk->nr_queues = 1;
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_MQ)) {
+        uint16_t num_queues;
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_NUM_QUEUES, &num_queues, sizeof(num_queues));
+        vblk->nr_queues = num_queues ? num_queues : 1;
+    }
+    if (vblk->nr_queues > BLK_MAX_HW_QUEUES) vblk->nr_queues = BLK_MAX_HW_QUEUES;
+    if (vblk->nr_queues > MAX_CPUS) vblk->nr_queues = MAX_CPUS;
+
+    virtio_blk_setup_irqs(vblk);
+    if (virtio_blk_setup_queues(vblk) != 0) {
+        print("virtio-blk: failed to set up the virtqueues\n");
+        goto fail;
+    }
+    // Without indirect tables a request's descriptors come out of the ring
+    if (!virtio_has_feature(vdev, VIRTIO_F_INDIRECT_DESC) && vblk->sg_max > vblk->queues[0].vq.size - 2u) {
+        vblk->sg_max = vblk->queues[0].vq.size - 2;
+    }
+
+    strcpy(bdev->name, "vda");
+    bdev->ops = &virtio_blk_ops;
+    bdev->driver_data = vblk;
+    bdev->block_size = SECTOR_SIZE;
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_BLK_SIZE)) {
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_BLK_SIZE, &bdev->block_size, sizeof(uint32_t));
+    }
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_TOPOLOGY)) {
+        uint8_t exp;
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_PHYS_EXP, &exp, sizeof(exp));
+        bdev->physical_block_size = bdev->block_size << exp;
+    }
+    // A buffer adds at most a partial page at either end to the
+    // descriptors its whole pages need
+    bdev->max_segments = vblk->sg_max / 4;
+    if (bdev->max_segments > BIO_MAX_VECS) bdev->max_segments = BIO_MAX_VECS;
+    bdev->max_sectors = (vblk->sg_max - 2 * bdev->max_segments) * (PAGE_SIZE / SECTOR_SIZE);
+    if (virtio_has_feature(vdev, VIRTIO_BLK_F_DISCARD)) {
+        uint32_t max_discard;
+        virtio_read_config(vdev, VIRTIO_BLK_CFG_MAX_DISCARD, &max_discard, sizeof(max_discard));
+        bdev->max_discard_sectors = max_discard;
+    }
+    bdev->queue_depth = VIRTIO_BLK_DEPTH;
+    bdev->nr_hw_queues = vblk->nr_queues;
+    // The host schedules the real disk; sorting here only adds latency
+    bdev->elevator = "noop";
+    if (blkdev_register(bdev) != 0) {
+        print("virtio-blk: failed to register the block device\n");
+        goto fail;
+    }
+
+    virtio_driver_ok(vdev);
+    print("virtio-blk: attached vda\n");
+    return;
+
+fail:
+    // The device is left failed and the queues' memory with it: it may
+    // still own buffers in them
+    virtio_fail(vdev);
+}
@@ -0,0 +1,11 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+// Finds a virtio block device (virtio 1.x over PCI) and registers it with
+// the block layer as "vda", with one hardware queue per virtqueue the
+// device offers, up to one per CPU.
+void virtio_blk_init(void);
+
+#endif
@@ -0,0 +1,535 @@
+/* kernel/src/drivers/zram.c */
+
+#include "zram.h"
+#include "../block/blkdev.h"
+#include "../mem/pmm.h"
+#include "../lib/lz4.h"
+#include "../lib/radix_tree.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+#include "../proc/vdso.h"
+#include "../../arch/x86_64/cpu.h"
+
+void print(char*); // Forward declare from main.c for logging
+
+// A compressed RAM disk. Like the plain RAM disk it is a sparse array of
+// pages indexed by page number, but what the array holds is an object per
+// page, in one of three forms:
+//
+//  - same-filled: the page is one 64-bit word repeated (zero pages are the
+//    common case), and the object is just that word;
+//  - LZ4: the compressed bytes, packed into a pool of size classes;
+//  - huge: pages that do not compress below ZRAM_HUGE_THRESHOLD are kept
+//    whole, since decompressing them would cost time and save nothing.
+//
+// Identical pages share one object: a hash of each page's contents leads
+// to the objects it might match. The compressor is deterministic, so two
+// pages are the same exactly when their compressed forms are.
+//
+// Compression happens outside the device lock, on a per-CPU stream
+// (workspace and buffers) held with interrupts off; only finding or
+// storing the object is serialised. Logical blocks are a page so requests
+// never touch part of one.
+
+#define ZRAM_SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
+#define ZRAM_HUGE_THRESHOLD   3072 // Compressed sizes above this are not worth it
+#define ZRAM_HASH_BITS        12
+#define ZRAM_HASH_SIZE        (1 << ZRAM_HASH_BITS)
+#define ZRAM_WORDS            (PAGE_SIZE / sizeof(uint64_t))
+
+// Forms of object
+#define ZRAM_OBJ_SAME 0
+#define ZRAM_OBJ_LZ4  1
+#define ZRAM_OBJ_HUGE 2
+
+// --- Pool ---
+// Compressed objects come in any size up to a few KiB, too fine for the
+// page allocator. Sizes are rounded up to 32-byte granules, and each class
+// hands out slots from zspages: runs of one to ZRAM_MAX_SPAN contiguous
+// pages, the length picked per class to waste the least. A zspage's first
+// granule is its header.
+
+#define ZRAM_GRANULE  32
+#define ZRAM_CLASSES  (PAGE_SIZE / ZRAM_GRANULE)
+#define ZRAM_MAX_SPAN 4
+
+typedef struct zram_zspage {
+    struct zram_zspage* prev; // In its class's list of zspages with free slots
+    struct zram_zspage* next;
+    void* free;               // Free slots, linked through their first word
+    uint16_t used;
+    uint16_t class;
+} zram_zspage_t;
+
+typedef struct zram_class {
+    zram_zspage_t* partial;   // Zspages with a free slot
+    uint16_t pages;           // Per zspage; 0 until first used
+    uint16_t slots;
+} zram_class_t;
+
+typedef struct zram_obj {
+    struct zram_obj* hash_next;
+    zram_zspage_t* zspage;    // Holding this object
+    uint64_t fill;            // Same-filled: the word
+    uint8_t* page;            // Huge: the page
+    uint32_t hash;
+    uint32_t refs;            // Device pages mapping it, and reads in progress
+    uint16_t len;             // LZ4: bytes in data
+    uint8_t form;             // ZRAM_OBJ_*
+    uint8_t data[];
+} zram_obj_t;
+
+typedef struct zram {
+    block_device_t bdev;
+    spinlock_t lock;          // Everything below, taken with interrupts off
+    radix_tree_t pages;       // Page index to object
+    zram_obj_t* hash[ZRAM_HASH_SIZE];
+    zram_class_t classes[ZRAM_CLASSES];
+    uint64_t nr_objs;         // Other than same-filled ones
+    zram_stats_t stats;
+} zram_t;
+
+// Interrupts stay off while a stream is in use, which keeps the task on
+// its CPU and so the stream to itself.
+typedef struct zram_stream {
+    void* workspace;          // LZ4 hash table
+    uint8_t* buf;             // Compressed output
+    uint8_t* bounce;          // A page split across buffers, put together
+} zram_stream_t;
+
+static zram_stream_t zram_streams[MAX_CPUS];
+
+static void zram_class_init(zram_class_t* cl, uint32_t size) {
+    uint32_t best_used = 0;
+    for (uint32_t span = 1; span <= ZRAM_MAX_SPAN; span++) {
+        uint32_t slots = (span * PAGE_SIZE - ZRAM_GRANULE) / size;
+        // Fraction of the zspage put to use, in 1/1024ths
+        uint32_t used = slots * size * 1024 / (span * PAGE_SIZE);
+        if (used > best_used) {
+            best_used = used;
+            cl->pages = span;
+            cl->slots = slots;
+        }
+    }
+}
+
+static void zram_zspage_unlink(zram_class_t* cl, zram_zspage_t* zs) {
+    if (zs->prev) zs->prev->next = zs->next;
+    else cl->partial = zs->next;
+    if (zs->next) zs->next->prev = zs->prev;
+}
+
+static void zram_zspage_link(zram_class_t* cl, zram_zspage_t* zs) {
+    zs->prev = NULL;
+    zs->next = cl->partial;
+    if (cl->partial) cl->partial->prev = zs;
+    cl->partial = zs;
+}
+
+// A slot of at least `size` bytes; the zspage holding it in `*out`. Under
+// the lock; NULL when out of memory.
+static void* zram_pool_alloc(zram_t* zr, uint32_t size, zram_zspage_t** out) {
+    uint32_t ci = (size + ZRAM_GRANULE - 1) / ZRAM_GRANULE;
+    uint32_t slot_size = ci * ZRAM_GRANULE;
+    zram_class_t* cl = &zr->classes[ci];
+    if (!cl->pages) zram_class_init(cl, slot_size);
+
+    zram_zspage_t* zs = cl->partial;
+    if (!zs) {
+        zs = pmm_alloc(cl->pages * PAGE_SIZE);
+        if (!zs) return NULL;
+        zs->used = 0;
+        zs->class = ci;
+        zs->free = NULL;
+        uint8_t* base = (uint8_t*)zs + ZRAM_GRANULE;
+        for (uint32_t i = cl->slots; i-- > 0;) {
+            void** slot = (void**)(base + i * slot_size);
+            *slot = zs->free;
+            zs->free = slot;
+        }
+        zram_zspage_link(cl, zs);
+        zr->stats.mem_used += cl->pages * PAGE_SIZE;
+    }
+
+    void** slot = zs->free;
+    zs->free = *slot;
+    zs->used++;
+    if (!zs->free) zram_zspage_unlink(cl, zs);
+    *out = zs;
+    return slot;
+}
+
+static void zram_pool_free(zram_t* zr, zram_zspage_t* zs, void* slot) {
+    zram_class_t* cl = &zr->classes[zs->class];
+    bool was_full = !zs->free;
+    *(void**)slot = zs->free;
+    zs->free = slot;
+    zs->used--;
+
+    if (zs->used == 0) {
+        if (!was_full) zram_zspage_unlink(cl, zs);
+        pmm_free(zs, cl->pages * PAGE_SIZE);
+        zr->stats.mem_used -= cl->pages * PAGE_SIZE;
+    } else if (was_full) {
+        zram_zspage_link(cl, zs);
+    }
+}
+
+// --- Objects ---
+
+static uint32_t zram_hash_words(const uint64_t* w, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) h = (h ^ w[i]) * 0x100000001b3ull;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// An object with these contents, or NULL. Under the lock.
+static zram_obj_t* zram_find(zram_t* zr, uint8_t form, uint32_t hash, uint64_t fill,
+                             const uint8_t* data, uint32_t len) {
+    for (zram_obj_t* obj = zr->hash[hash & (ZRAM_HASH_SIZE - 1)]; obj; obj = obj->hash_next) {
+        if (obj->hash != hash || obj->form != form) continue;
+        switch (form) {
+        case ZRAM_OBJ_SAME:
+            if (obj->fill == fill) return obj;
+            break;
+        case ZRAM_OBJ_LZ4:
+            if (obj->len == len && memcmp(obj->data, data, len) == 0) return obj;
+            break;
+        case ZRAM_OBJ_HUGE:
+            if (memcmp(obj->page, data, PAGE_SIZE) == 0) return obj;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// A new object with one reference. Under the lock; NULL when out of memory.
+static zram_obj_t* zram_obj_new(zram_t* zr, uint8_t form, uint32_t hash, uint64_t fill,
+                                const uint8_t* data, uint32_t len) {
+    uint32_t size = sizeof(zram_obj_t) + (form == ZRAM_OBJ_LZ4 ? len : 0);
+    zram_zspage_t* zs;
+    zram_obj_t* obj = zram_pool_alloc(zr, size, &zs);
+    if (!obj) return NULL;
+    memset(obj, 0, sizeof(zram_obj_t));
+    obj->zspage = zs;
+    obj->hash = hash;
+    obj->refs = 1;
+    obj->form = form;
+
+    switch (form) {
+    case ZRAM_OBJ_SAME:
+        obj->fill = fill;
+        break;
+    case ZRAM_OBJ_LZ4:
+        obj->len = len;
+        memcpy(obj->data, data, len);
+        zr->stats.compr_data_size += len;
+        break;
+    case ZRAM_OBJ_HUGE:
+        obj->page = pmm_alloc_page();
+        if (!obj->page) {
+            zram_pool_free(zr, zs, obj);
+            return NULL;
+        }
+        memcpy(obj->page, data, PAGE_SIZE);
+        zr->stats.compr_data_size += PAGE_SIZE;
+        zr->stats.mem_used += PAGE_SIZE;
+        zr->stats.huge_pages++;
+        break;
+    }
+    if (form != ZRAM_OBJ_SAME) zr->nr_objs++;
+
+    zram_obj_t** bucket = &zr->hash[hash & (ZRAM_HASH_SIZE - 1)];
+    obj->hash_next = *bucket;
+    *bucket = obj;
+    return obj;
+}
+
+// Drops a reference, freeing the object with the last. Under the lock.
+static void zram_obj_put(zram_t* zr, zram_obj_t* obj) {
+    if (--obj->refs > 0) return;
+
+    zram_obj_t** pp = &zr->hash[obj->hash & (ZRAM_HASH_SIZE - 1)];
+    while (*pp != obj) pp = &(*pp)->hash_next;
+    *pp = obj->hash_next;
+
+    switch (obj->form) {
+    case ZRAM_OBJ_LZ4:
+        zr->stats.compr_data_size -= obj->len;
+        break;
+    case ZRAM_OBJ_HUGE:
+        pmm_free_page(obj->page);
+        zr->stats.compr_data_size -= PAGE_SIZE;
+        zr->stats.mem_used -= PAGE_SIZE;
+        zr->stats.huge_pages--;
+        break;
+    }
+    if (obj->form != ZRAM_OBJ_SAME) zr->nr_objs--;
+    zram_pool_free(zr, obj->zspage, obj);
+}
+
+// Takes page `index` out of the array. Under the lock.
+static void zram_unmap(zram_t* zr, uint64_t index) {
+    zram_obj_t* obj = radix_tree_delete(&zr->pages, index);
+    if (!obj) return;
+    zr->stats.pages_stored--;
+    if (obj->form == ZRAM_OBJ_SAME) zr->stats.same_pages--;
+    zram_obj_put(zr, obj);
+}
+
+// --- Streams ---
+
+static zram_stream_t* zram_stream_get(uint64_t* flags) {
+    *flags = irq_save();
+    zram_stream_t* st = &zram_streams[this_cpu_id()];
+    if (!st->workspace) {
+        // First use on this CPU
+        void* ws = pmm_alloc(LZ4_WORKSPACE_SIZE);
+        uint8_t* buf = pmm_alloc_page();
+        uint8_t* bounce = pmm_alloc_page();
+        if (!ws || !buf || !bounce) {
+            if (ws) pmm_free(ws, LZ4_WORKSPACE_SIZE);
+            if (buf) pmm_free_page(buf);
+            if (bounce) pmm_free_page(bounce);
+            irq_restore(*flags);
+            return NULL;
+        }
+        st->buf = buf;
+        st->bounce = bounce;
+        st->workspace = ws;
+    }
+    return st;
+}
+
+static void zram_stream_put(uint64_t flags) {
+    irq_restore(flags);
+}
+
+// --- Pages ---
+
+static int zram_write_page(zram_t* zr, zram_stream_t* st, uint64_t index, const uint8_t* src) {
+    const uint64_t* w = (const uint64_t*)src;
+    uint8_t form;
+    uint32_t hash;
+    const uint8_t* data = src;
+    uint32_t len = PAGE_SIZE;
+    uint64_t ns = 0;
+
+    size_t same = 1;
+    while (same < ZRAM_WORDS && w[same] == w[0]) same++;
+    if (same == ZRAM_WORDS) {
+        form = ZRAM_OBJ_SAME;
+        hash = zram_hash_words(w, 1);
+    } else {
+        hash = zram_hash_words(w, ZRAM_WORDS);
+        uint64_t start = ktime_get_ns();
+        uint32_t clen = lz4_compress(src, PAGE_SIZE, st->buf, ZRAM_HUGE_THRESHOLD, st->workspace);
+        ns = ktime_get_ns() - start;
+        if (clen) {
+            form = ZRAM_OBJ_LZ4;
+            data = st->buf;
+            len = clen;
+        } else {
+            form = ZRAM_OBJ_HUGE;
+        }
+    }
+
+    spinlock_acquire(&zr->lock);
+    zr->stats.writes++;
+    zr->stats.compress_ns += ns;
+
+    zram_obj_t* obj = zram_find(zr, form, hash, w[0], data, len);
+    if (obj) obj->refs++;
+    else obj = zram_obj_new(zr, form, hash, w[0], data, len);
+
+    zram_unmap(zr, index);
+    if (!obj || radix_tree_insert(&zr->pages, index, obj) != 0) {
+        if (obj) zram_obj_put(zr, obj);
+        spinlock_release(&zr->lock);
+        return BLK_STS_IOERR;
+    }
+    zr->stats.pages_stored++;
+    if (form == ZRAM_OBJ_SAME) zr->stats.same_pages++;
+    spinlock_release(&zr->lock);
+    return BLK_STS_OK;
+}
+
+static int zram_read_page(zram_t* zr, uint64_t index, uint8_t* dst) {
+    spinlock_acquire(&zr->lock);
+    zr->stats.reads++;
+    zram_obj_t* obj = radix_tree_lookup(&zr->pages, index);
+    if (!obj || obj->form == ZRAM_OBJ_SAME) {
+        uint64_t fill = obj ? obj->fill : 0;
+        spinlock_release(&zr->lock);
+        uint64_t* w = (uint64_t*)dst;
+        for (size_t i = 0; i < ZRAM_WORDS; i++) w[i] = fill;
+        return BLK_STS_OK;
+    }
+
+    // The reference keeps the object while it is copied out unlocked
+    obj->refs++;
+    spinlock_release(&zr->lock);
+
+    int status = BLK_STS_OK;
+    uint64_t ns = 0;
+    if (obj->form == ZRAM_OBJ_HUGE) {
+        memcpy(dst, obj->page, PAGE_SIZE);
+    } else {
+        uint64_t start = ktime_get_ns();
+        if (lz4_decompress(obj->data, obj->len, dst, PAGE_SIZE) != PAGE_SIZE) status = BLK_STS_IOERR;
+        ns = ktime_get_ns() - start;
+    }
+
+    spinlock_acquire(&zr->lock);
+    zr->stats.decompress_ns += ns;
+    zram_obj_put(zr, obj);
+    spinlock_release(&zr->lock);
+    return status;
+}
+
+// --- Requests ---
+
+// Position in a request's data
+typedef struct zram_iter {
+    bio_t* bio;
+    uint16_t vec;
+    uint32_t off;
+} zram_iter_t;
+
+// Steps over used-up buffers
+static void zram_iter_settle(zram_iter_t* it) {
+    while (it->bio) {
+        if (it->vec < it->bio->vcnt && it->off < it->bio->vecs[it->vec].len) return;
+        if (it->vec < it->bio->vcnt) {
+            it->vec++;
+            it->off = 0;
+        } else {
+            it->bio = it->bio->next;
+            it->vec = 0;
+            it->off = 0;
+        }
+    }
+}
+
+// The next page of data if one buffer holds all of it, else NULL
+static uint8_t* zram_iter_page(zram_iter_t* it) {
+    zram_iter_settle(it);
+    if (!it->bio) return NULL;
+    bio_vec_t* v = &it->bio->vecs[it->vec];
+    if (v->len - it->off < PAGE_SIZE) return NULL;
+    return (uint8_t*)v->base + it->off;
+}
+
+// Copies the next `len` bytes of data into `buf`, or out of it with
+// `from_buf`, and moves past them. Without `buf`, only moves.
+static void zram_iter_copy(zram_iter_t* it, uint8_t* buf, uint32_t len, bool from_buf) {
+    while (len > 0) {
+        zram_iter_settle(it);
+        if (!it->bio) return;
+        bio_vec_t* v = &it->bio->vecs[it->vec];
+        uint32_t n = v->len - it->off;
+        if (n > len) n = len;
+        if (buf) {
+            uint8_t* p = (uint8_t*)v->base + it->off;
+            if (from_buf) memcpy(p, buf, n);
+            else memcpy(buf, p, n);
+            buf += n;
+        }
+        it->off += n;
+        len -= n;
+    }
+}
+
+// Requests complete before queue_rq returns. Each CPU dispatches on a
+// queue of its own, so requests from different CPUs compress in parallel.
+static int zram_queue_rq(blk_hw_queue_t* hctx, request_t* rq) {
+    zram_t* zr = hctx->bdev->driver_data;
+    uint64_t index = rq->sector / ZRAM_SECTORS_PER_PAGE;
+    uint64_t count = rq->nr_sectors / ZRAM_SECTORS_PER_PAGE;
+    int status = BLK_STS_OK;
+
+    switch (rq->op) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE: {
+        bool write = rq->op == REQ_OP_WRITE;
+        zram_iter_t it = { rq->bio, 0, 0 };
+        for (uint64_t i = 0; i < count && status == BLK_STS_OK; i++) {
+            uint64_t flags;
+            zram_stream_t* st = zram_stream_get(&flags);
+            if (!st) {
+                status = BLK_STS_IOERR;
+                break;
+            }
+            uint8_t* page = zram_iter_page(&it);
+            if (write) {
+                if (!page) {
+                    zram_iter_copy(&it, st->bounce, PAGE_SIZE, false);
+                    page = st->bounce;
+                } else {
+                    zram_iter_copy(&it, NULL, PAGE_SIZE, false);
+                }
+                status = zram_write_page(zr, st, index + i, page);
+            } else {
+                status = zram_read_page(zr, index + i, page ? page : st->bounce);
+                zram_iter_copy(&it, page ? NULL : st->bounce, PAGE_SIZE, true);
+            }
+            zram_stream_put(flags);
+        }
+        break;
+    }
+    case REQ_OP_DISCARD: {
+        // Discards are block aligned, so always whole pages
+        uint64_t flags = irq_save();
+        spinlock_acquire(&zr->lock);
+        for (uint64_t i = 0; i < count; i++) zram_unmap(zr, index + i);
+        spinlock_release(&zr->lock);
+        irq_restore(flags);
+        break;
+    }
+    }
+
+    blk_complete_request(rq, status);
+    return BLK_STS_OK;
+}
+
+static const blkdev_ops_t zram_ops = {
+    .queue_rq = zram_queue_rq,
+};
+
+block_device_t* zram_create(const char* name, uint64_t size) {
+    zram_t* zr = pmm_alloc(sizeof(zram_t));
+    if (!zr) return NULL;
+    memset(zr, 0, sizeof(zram_t));
+    radix_tree_init(&zr->pages);
+
+    block_device_t* bdev = &zr->bdev;
+    for (size_t i = 0; name[i] && i < sizeof(bdev->name) - 1; i++) bdev->name[i] = name[i];
+    bdev->ops = &zram_ops;
+    bdev->driver_data = zr;
+    bdev->block_size = PAGE_SIZE;
+    bdev->physical_block_size = PAGE_SIZE;
+    bdev->nr_sectors = ((size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1)) >> SECTOR_SHIFT;
+    bdev->max_sectors = 2048; // 1 MiB
+    bdev->max_discard_sectors = bdev->nr_sectors;
+    bdev->nr_hw_queues = MAX_CPUS;
+    bdev->elevator = "noop";
+    if (blkdev_register(bdev) != 0) {
+        pmm_free(zr, sizeof(zram_t));
+        return NULL;
+    }
+    return bdev;
+}
+
+int zram_get_stats(block_device_t* bdev, zram_stats_t* out) {
+    if (bdev->ops != &zram_ops) return -1;
+    zram_t* zr = bdev->driver_data;
+    uint64_t flags = irq_save();
+    spinlock_acquire(&zr->lock);
+    *out = zr->stats;
+    // Every stored page not same-filled and not the first to use its
+    // object is a duplicate
+    out->dedup_pages = zr->stats.pages_stored - zr->stats.same_pages - zr->nr_objs;
+    spinlock_release(&zr->lock);
+    irq_restore(flags);
+    return 0;
+}
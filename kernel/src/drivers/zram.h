@@ -0,0 +1,31 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct block_device;
+
+typedef struct zram_stats {
+    uint64_t pages_stored;    // Pages of the device that hold data
+    uint64_t compr_data_size; // Bytes of compressed data, each copy counted once
+    uint64_t mem_used;        // Bytes of memory taken, pool overhead included
+    uint64_t same_pages;      // Pages that are one word repeated (zeroes among them)
+    uint64_t dedup_pages;     // Pages sharing another page's copy
+    uint64_t huge_pages;      // Pages kept uncompressed
+    uint64_t reads;           // Pages read and written
+    uint64_t writes;
+    uint64_t compress_ns;     // Time spent compressing and decompressing
+    uint64_t decompress_ns;
+} zram_stats_t;
+
+// Creates a compressed RAM disk of `size` bytes (rounded up to a page)
+// called `name` and registers it with the block layer. NULL when out of
+// memory.
+struct block_device* zram_create(const char* name, uint64_t size);
+
+// Copies out the counters of a device from zram_create. -1 for another
+// device.
+int zram_get_stats(struct block_device* bdev, zram_stats_t* out);
+
+#endif
@@ -0,0 +1,384 @@
+/* kernel/src/fs/dcache.c */
+
+#include "dcache.h"
+#include "../mem/pmm.h"
+#include "../mem/shrinker.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+
+#define DCACHE_BUCKETS 4096
+
+#define DENTRY_DEAD 0x2 // Out of the table
+
+static dentry_t** dcache_table;
+static dentry_t* dcache_root;
+
+static spinlock_t dcache_lock = 0;       // Writers: the table, children lists, mounts
+static volatile uint32_t dcache_seq;     // Odd while a mount or umount is in progress
+static volatile uint32_t dcache_inval;   // Bumped by every invalidation
+static volatile uint32_t dcache_walkers; // Walks in progress
+static dentry_t* dcache_dead;            // Out of the table, freed once no walk can hold them
+static dentry_t* dcache_lru_head;        // Every entry in the table, oldest first
+static dentry_t* dcache_lru_tail;
+static uint64_t dcache_lru_count;
+
+// --- Table ---
+
+static uint32_t dcache_hash(const dentry_t* parent, const char* name, uint32_t len) {
+    uint32_t h = 2166136261u ^ (uint32_t)((uintptr_t)parent >> 4);
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static dentry_t** dcache_bucket(uint32_t hash) {
+    return &dcache_table[hash % DCACHE_BUCKETS];
+}
+
+// Safe without the lock: a walk sees each chain either before or after a
+// change, and entries it may still be reading are not freed under it
+static dentry_t* dcache_lookup(const dentry_t* parent, const char* name, uint32_t len, uint32_t hash) {
+    dentry_t* d = __atomic_load_n(dcache_bucket(hash), __ATOMIC_ACQUIRE);
+    for (; d; d = __atomic_load_n(&d->hash_next, __ATOMIC_ACQUIRE)) {
+        if (d->hash == hash && d->parent == parent && d->len == len && memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static dentry_t* dcache_alloc(dentry_t* parent, const char* name, uint32_t len, uint32_t hash, fs_node_t* node) {
+    dentry_t* d = pmm_alloc(sizeof(dentry_t));
+    if (!d) return NULL;
+    memset(d, 0, sizeof(dentry_t));
+    d->parent = parent ? parent : d;
+    d->node = node;
+    d->hash = hash;
+    d->len = len;
+    memcpy(d->name, name, len);
+    return d;
+}
+
+// --- LRU ---
+
+// Under dcache_lock, as are the other list helpers
+static void dcache_lru_add(dentry_t* d) {
+    d->lru_next = NULL;
+    d->lru_prev = dcache_lru_tail;
+    if (dcache_lru_tail) dcache_lru_tail->lru_next = d;
+    else dcache_lru_head = d;
+    dcache_lru_tail = d;
+    dcache_lru_count++;
+}
+
+static void dcache_lru_del(dentry_t* d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else dcache_lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else dcache_lru_tail = d->lru_prev;
+    dcache_lru_count--;
+}
+
+static void dcache_unhash(dentry_t* d) {
+    dentry_t** pp = dcache_bucket(d->hash);
+    while (*pp && *pp != d) {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp) __atomic_store_n(pp, d->hash_next, __ATOMIC_RELEASE);
+}
+
+// Takes `d`, everything below it and anything mounted on it out of the
+// table. Under dcache_lock; the caller has already unlinked `d` from its
+// parent's children.
+static void dcache_kill(dentry_t* d) {
+    while (d->children) {
+        dentry_t* child = d->children;
+        d->children = child->sibling;
+        dcache_kill(child);
+    }
+    if (d->mounted) {
+        dcache_kill(d->mounted);
+        __atomic_store_n(&d->mounted, NULL, __ATOMIC_RELEASE);
+    }
+    if (!(d->flags & DENTRY_MOUNT_ROOT)) {
+        dcache_unhash(d);
+        dcache_lru_del(d);
+    }
+    if (d->node && d->node->dentry == d) d->node->dentry = NULL;
+    d->flags |= DENTRY_DEAD;
+    d->sibling = dcache_dead;
+    dcache_dead = d;
+}
+
+static void dcache_unlink_child(dentry_t* d) {
+    dentry_t** pp = &d->parent->children;
+    while (*pp && *pp != d) {
+        pp = &(*pp)->sibling;
+    }
+    if (*pp) *pp = d->sibling;
+}
+
+// Frees the dead entries if no walk is running, along with their node
+// references. They left the table first, so walks that start afterwards
+// cannot reach them. Under dcache_lock.
+static void dcache_reclaim(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&dcache_walkers, __ATOMIC_ACQUIRE) != 0) return;
+    while (dcache_dead) {
+        dentry_t* d = dcache_dead;
+        dcache_dead = d->sibling;
+        vfs_node_put(d->node);
+        pmm_free(d, sizeof(dentry_t));
+    }
+}
+
+// Links a new entry into the table unless another walk got there first or
+// the directory changed since the filesystem was asked. Returns the entry
+// to use, which may be a private one that stays out of the table.
+static dentry_t* dcache_add(dentry_t* d, uint32_t inval) {
+    dentry_t* parent = d->parent;
+
+    spinlock_acquire(&dcache_lock);
+    dentry_t* old = dcache_lookup(parent, d->name, d->len, d->hash);
+    if (old) {
+        spinlock_release(&dcache_lock);
+        vfs_node_put(d->node);
+        pmm_free(d, sizeof(dentry_t));
+        return old;
+    }
+
+    if ((parent->flags & DENTRY_DEAD) || inval != dcache_inval) {
+        // Good for this walk only
+        d->flags |= DENTRY_DEAD;
+        d->sibling = dcache_dead;
+        dcache_dead = d;
+    } else {
+        d->sibling = parent->children;
+        parent->children = d;
+        if (d->node) d->node->dentry = d;
+        dentry_t** bucket = dcache_bucket(d->hash);
+        d->hash_next = *bucket;
+        __atomic_store_n(bucket, d, __ATOMIC_RELEASE);
+        dcache_lru_add(d);
+    }
+    spinlock_release(&dcache_lock);
+    return d;
+}
+
+// --- Path Walk ---
+
+static dentry_t* dcache_follow_mounts(dentry_t* d) {
+    dentry_t* m;
+    while ((m = __atomic_load_n(&d->mounted, __ATOMIC_ACQUIRE))) {
+        d = m;
+    }
+    return d;
+}
+
+// ".." leaves a mounted filesystem through its mountpoint
+static dentry_t* dcache_up(dentry_t* d) {
+    while (d->flags & DENTRY_MOUNT_ROOT) {
+        d = d->parent;
+    }
+    return dcache_follow_mounts(d->parent);
+}
+
+// Walks and anything else that looks at entries outside dcache_lock run
+// between these. Dead entries left behind by writers that ran meanwhile
+// are freed by the last walk out.
+static void dcache_walk_begin(void) {
+    __atomic_add_fetch(&dcache_walkers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void dcache_walk_end(void) {
+    if (__atomic_sub_fetch(&dcache_walkers, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&dcache_dead, __ATOMIC_RELAXED)) {
+        spinlock_acquire(&dcache_lock);
+        dcache_reclaim();
+        spinlock_release(&dcache_lock);
+    }
+}
+
+// Asks the filesystem and caches the answer, found or not. The entry
+// takes over the reference finddir returned.
+static dentry_t* dcache_lookup_slow(dentry_t* parent, const char* name, uint32_t len, uint32_t hash) {
+    char buf[FS_NAME_MAX];
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    uint32_t inval = __atomic_load_n(&dcache_inval, __ATOMIC_ACQUIRE);
+    fs_node_t* node = vfs_finddir(parent->node, buf);
+    dentry_t* d = dcache_alloc(parent, name, len, hash, node);
+    return d ? dcache_add(d, inval) : NULL;
+}
+
+static dentry_t* dcache_walk_from(dentry_t* d, const char* path) {
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        const char* name = path;
+        while (*path && *path != '/') path++;
+        uint32_t len = path - name;
+
+        if (len == 1 && name[0] == '.') continue;
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            d = dcache_up(d);
+            continue;
+        }
+        if (len >= FS_NAME_MAX || !(d->node->flags & FS_DIRECTORY)) return NULL;
+
+        uint32_t hash = dcache_hash(d, name, len);
+        dentry_t* next = dcache_lookup(d, name, len, hash);
+        if (next && !next->referenced) next->referenced = 1;
+        if (!next) next = dcache_lookup_slow(d, name, len, hash);
+        if (!next || !next->node) return NULL;
+        d = dcache_follow_mounts(next);
+    }
+    return d;
+}
+
+// Between dcache_walk_begin() and dcache_walk_end(), which keep the
+// returned entry from being freed
+static dentry_t* dcache_walk(const char* path) {
+    dentry_t* d;
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&dcache_seq, __ATOMIC_ACQUIRE)) & 1) {
+            __asm__ volatile("pause");
+        }
+        d = dcache_walk_from(dcache_follow_mounts(dcache_root), path);
+    } while (__atomic_load_n(&dcache_seq, __ATOMIC_ACQUIRE) != seq);
+    return d;
+}
+
+fs_node_t* dcache_lookup_path(const char* path) {
+    dcache_walk_begin();
+    dentry_t* d = dcache_walk(path);
+    fs_node_t* node = d ? vfs_node_get(d->node) : NULL;
+    dcache_walk_end();
+    return node;
+}
+
+// --- Mounts ---
+
+int dcache_mount(const char* path, fs_node_t* root) {
+    int ret = -1;
+    dcache_walk_begin();
+    dentry_t* mp = dcache_walk(path);
+    dentry_t* m = NULL;
+    if (mp && root && (mp->node->flags & FS_DIRECTORY)) {
+        m = dcache_alloc(mp, mp->name, mp->len, 0, vfs_node_get(root));
+    }
+    if (!m) goto out;
+    m->flags = DENTRY_MOUNT_ROOT;
+
+    spinlock_acquire(&dcache_lock);
+    // The walk followed any earlier mount here, so this one stacks on top
+    if (!mp->mounted && !(mp->flags & DENTRY_DEAD)) {
+        __atomic_add_fetch(&dcache_seq, 1, __ATOMIC_RELEASE);
+        root->dentry = m;
+        mp->node->flags |= FS_MOUNTPOINT;
+        mp->node->mount = root;
+        __atomic_store_n(&mp->mounted, m, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&dcache_seq, 1, __ATOMIC_RELEASE);
+        ret = 0;
+    }
+    spinlock_release(&dcache_lock);
+
+    if (ret < 0) {
+        vfs_node_put(root);
+        pmm_free(m, sizeof(dentry_t));
+    }
+out:
+    dcache_walk_end();
+    return ret;
+}
+
+int dcache_umount(const char* path) {
+    int ret = -1;
+    dcache_walk_begin();
+    dentry_t* m = dcache_walk(path);
+    if (!m || !(m->flags & DENTRY_MOUNT_ROOT)) goto out;
+
+    spinlock_acquire(&dcache_lock);
+    dentry_t* mp = m->parent;
+    if (mp->mounted == m) {
+        __atomic_add_fetch(&dcache_seq, 1, __ATOMIC_RELEASE);
+        dcache_kill(m);
+        __atomic_store_n(&mp->mounted, NULL, __ATOMIC_RELEASE);
+        mp->node->flags &= ~FS_MOUNTPOINT;
+        mp->node->mount = NULL;
+        __atomic_add_fetch(&dcache_seq, 1, __ATOMIC_RELEASE);
+        ret = 0;
+    }
+    spinlock_release(&dcache_lock);
+out:
+    dcache_walk_end();
+    return ret;
+}
+
+// --- Invalidation ---
+
+void dcache_invalidate(fs_node_t* dir, const char* name) {
+    dentry_t* parent = dir ? dir->dentry : NULL;
+    uint32_t len = strlen(name);
+
+    // Walks asking the filesystem right now must not cache the old answer
+    __atomic_add_fetch(&dcache_inval, 1, __ATOMIC_RELEASE);
+    if (!parent || len >= FS_NAME_MAX) return;
+
+    spinlock_acquire(&dcache_lock);
+    dentry_t* d = dcache_lookup(parent, name, len, dcache_hash(parent, name, len));
+    if (d) {
+        dcache_unlink_child(d);
+        dcache_kill(d);
+    }
+    dcache_reclaim();
+    spinlock_release(&dcache_lock);
+}
+
+// --- Shrinker ---
+
+static uint64_t dcache_count(void) {
+    return dcache_lru_count;
+}
+
+// Second chance from the old end: entries walked through since the last
+// pass, and those with children or mounts, move to the new end; the rest
+// are dropped. Parents become candidates once their children are gone.
+static uint64_t dcache_scan(uint64_t nr) {
+    uint64_t freed = 0;
+
+    spinlock_acquire(&dcache_lock);
+    dentry_t* d = dcache_lru_head;
+    for (uint64_t budget = dcache_lru_count; budget > 0 && freed < nr && d; budget--) {
+        dentry_t* next = d->lru_next;
+        if (d->children || d->mounted || d->referenced) {
+            d->referenced = 0;
+            dcache_lru_del(d);
+            dcache_lru_add(d);
+        } else {
+            dcache_unlink_child(d);
+            dcache_kill(d);
+            freed++;
+        }
+        d = next;
+    }
+    dcache_reclaim();
+    spinlock_release(&dcache_lock);
+    return freed;
+}
+
+static shrinker_t dcache_shrinker = { .count = dcache_count, .scan = dcache_scan };
+
+void dcache_init(fs_node_t* root) {
+    dcache_table = pmm_alloc(DCACHE_BUCKETS * sizeof(dentry_t*));
+    memset(dcache_table, 0, DCACHE_BUCKETS * sizeof(dentry_t*));
+    dcache_root = dcache_alloc(NULL, "/", 1, 0, vfs_node_get(root));
+    root->dentry = dcache_root;
+    register_shrinker(&dcache_shrinker);
+}
@@ -0,0 +1,61 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vfs.h"
+
+// Directory entry cache. Every name a path walk resolves is kept in a hash
+// table keyed by (parent, name), including names that turned out not to
+// exist (negative entries), so repeated walks reach their node without
+// calling into the filesystem.
+//
+// Lookups take no lock: entries are fully built before being linked into
+// a bucket, and an entry taken out of the table is only freed once no walk
+// that could still be looking at it is in progress. Mount and umount are
+// covered by a sequence count, and walks that overlap them start over.
+//
+// Every positive entry holds a reference on its node, which keeps the node
+// out of the inode cache's LRU list. Under memory pressure a shrinker
+// drops the oldest childless entries not used since its last pass.
+
+#define DENTRY_MOUNT_ROOT 0x1 // Root of a mounted filesystem; parent is the mountpoint
+
+typedef struct dentry {
+    struct dentry* hash_next;   // Bucket chain
+    struct dentry* parent;      // Itself for the root of the namespace
+    struct dentry* mounted;     // Root of the filesystem mounted here
+    fs_node_t* node;            // NULL: the name does not exist
+    uint32_t hash;
+    uint32_t flags;             // DENTRY_*
+    uint32_t len;
+    char name[FS_NAME_MAX];
+
+    volatile uint32_t referenced; // Hit by a walk since the shrinker last looked
+
+    // Under the dcache lock
+    struct dentry* children;
+    struct dentry* sibling;
+    struct dentry* lru_prev;    // Shrinker order
+    struct dentry* lru_next;
+} dentry_t;
+
+// Sets up the table and the root of the namespace, which stands for
+// `root` until something is mounted on "/"
+void dcache_init(fs_node_t* root);
+
+// Resolves an absolute path, crossing mount points, and returns its node
+// with a reference taken. NULL if a component is missing or not a directory.
+fs_node_t* dcache_lookup_path(const char* path);
+
+// Mounts `root` on the directory at `path`, on top of anything already
+// mounted there. Umount removes the topmost mount at `path` along with
+// every cached name below it.
+int dcache_mount(const char* path, fs_node_t* root);
+int dcache_umount(const char* path);
+
+// Forgets what the cache knows about `name` in `dir`, after the
+// filesystem created or removed it
+void dcache_invalidate(fs_node_t* dir, const char* name);
+
+#endif
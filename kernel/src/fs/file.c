@@ -0,0 +1,183 @@
+/* kernel/src/fs/file.c */
+
+#include "file.h"
+#include "../mem/pmm.h"
+#include "../proc/workqueue.h"
+#include "../lib/string.h"
+
+#define FILE_RA_NONE ((uint64_t)-1)
+
+// Largest single read-ahead request, for FADV_WILLNEED ranges
+#define FILE_RA_CHUNK_PAGES 256
+
+uint32_t file_ra_max_pages = 64; // 256 KiB
+
+static workqueue_t* readahead_wq;
+
+typedef struct {
+    work_t work;
+    fs_node_t* node;
+    uint64_t first;
+    uint32_t count;
+} readahead_work_t;
+
+// --- Read-Ahead ---
+
+static void readahead_work_fn(work_t* work) {
+    readahead_work_t* ra = container_of(work, readahead_work_t, work);
+    ra->node->readahead(ra->node, ra->first, ra->count);
+    vfs_node_put(ra->node);
+    pmm_free(ra, sizeof(readahead_work_t));
+}
+
+// Hands pages [first, first + count) to the read-ahead thread. Best
+// effort: without memory for the request the pages are read when asked for.
+static void readahead_submit(fs_node_t* node, uint64_t first, uint32_t count) {
+    if (!readahead_wq || first * PAGE_SIZE >= node->length) return;
+
+    readahead_work_t* ra = pmm_alloc(sizeof(readahead_work_t));
+    if (!ra) return;
+    ra->work = (work_t)WORK_INIT(readahead_work_fn);
+    ra->node = vfs_node_get(node); // Kept out of the inode cache's LRU meanwhile
+    ra->first = first;
+    ra->count = count;
+    queue_work(readahead_wq, &ra->work);
+}
+
+static uint32_t file_ra_next_size(const file_ra_state_t* ra) {
+    uint32_t size = ra->size < ra->max_pages / 16 ? ra->size * 4 : ra->size * 2;
+    return size < ra->max_pages ? size : ra->max_pages;
+}
+
+// Follows a read of pages [first, last]. Returns the size of the window
+// to issue, starting at *start, or 0 if none is due. Under file->lock.
+static uint32_t file_ra_update(file_ra_state_t* ra, uint64_t first, uint64_t last, uint64_t* start) {
+    bool sequential = ra->prev_page == FILE_RA_NONE || first == ra->prev_page || first == ra->prev_page + 1;
+    ra->prev_page = last;
+    if (!sequential || ra->max_pages == 0) {
+        ra->size = 0;
+        return 0;
+    }
+
+    if (ra->size == 0 || last >= ra->start + ra->size) {
+        // A new stream, or one that overtook its window: start over right
+        // after the pages being read, at twice their number
+        uint64_t size = 2 * (last - first + 1);
+        if (size < FILE_RA_MIN_PAGES) size = FILE_RA_MIN_PAGES;
+        ra->start = last + 1;
+        ra->size = size < ra->max_pages ? (uint32_t)size : ra->max_pages;
+    } else if (last >= ra->start) {
+        // The reader reached the window: issue the next one behind it
+        ra->start += ra->size;
+        ra->size = file_ra_next_size(ra);
+    } else {
+        return 0;
+    }
+    *start = ra->start;
+    return ra->size;
+}
+
+// --- Open Files ---
+
+file_t* file_open(fs_node_t* node, uint32_t flags) {
+    file_t* file = pmm_alloc(sizeof(file_t));
+    if (!file) return NULL;
+    memset(file, 0, sizeof(file_t));
+    file->flags = flags;
+    file->refcount = 1;
+    file->ra.max_pages = file_ra_max_pages;
+    file->ra.prev_page = FILE_RA_NONE;
+
+    if (vfs_open(node, flags) < 0) {
+        pmm_free(file, sizeof(file_t));
+        return NULL;
+    }
+    file->node = vfs_node_get(node);
+    return file;
+}
+
+file_t* file_get(file_t* file) {
+    if (file) __atomic_add_fetch(&file->refcount, 1, __ATOMIC_RELAXED);
+    return file;
+}
+
+void file_put(file_t* file) {
+    if (!file || __atomic_sub_fetch(&file->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    vfs_close(file->node);
+    vfs_node_put(file->node);
+    pmm_free(file, sizeof(file_t));
+}
+
+size_t file_read(file_t* file, void* buffer, size_t size) {
+    fs_node_t* node = file->node;
+    uint64_t ra_start = 0;
+    uint32_t ra_count = 0;
+
+    spinlock_acquire(&file->lock);
+    uint64_t pos = file->pos;
+    if (node->readahead && size > 0) {
+        ra_count = file_ra_update(&file->ra, pos / PAGE_SIZE, (pos + size - 1) / PAGE_SIZE, &ra_start);
+    }
+    spinlock_release(&file->lock);
+
+    // Issued first so the device works on it while this read completes
+    if (ra_count) readahead_submit(node, ra_start, ra_count);
+
+    size_t n = vfs_read(node, pos, size, buffer);
+    spinlock_acquire(&file->lock);
+    file->pos = pos + n;
+    spinlock_release(&file->lock);
+    return n;
+}
+
+size_t file_write(file_t* file, const void* buffer, size_t size) {
+    spinlock_acquire(&file->lock);
+    uint64_t pos = file->pos;
+    spinlock_release(&file->lock);
+
+    size_t n = vfs_write(file->node, pos, size, buffer);
+    spinlock_acquire(&file->lock);
+    file->pos = pos + n;
+    spinlock_release(&file->lock);
+    return n;
+}
+
+int file_advise(file_t* file, uint64_t offset, uint64_t len, int advice) {
+    fs_node_t* node = file->node;
+
+    spinlock_acquire(&file->lock);
+    switch (advice) {
+    case FADV_NORMAL:
+        file->ra.max_pages = file_ra_max_pages;
+        break;
+    case FADV_RANDOM:
+        file->ra.max_pages = 0;
+        file->ra.size = 0;
+        break;
+    case FADV_SEQUENTIAL:
+        file->ra.max_pages = 2 * file_ra_max_pages;
+        break;
+    case FADV_WILLNEED:
+    case FADV_DONTNEED: // Cached pages go with their inode under memory pressure
+    case FADV_NOREUSE:
+        break;
+    default:
+        spinlock_release(&file->lock);
+        return -1;
+    }
+    spinlock_release(&file->lock);
+
+    if (advice == FADV_WILLNEED && node->readahead) {
+        uint64_t end = (len && offset + len < node->length) ? offset + len : node->length;
+        uint64_t last = (end + PAGE_SIZE - 1) / PAGE_SIZE;
+        for (uint64_t page = offset / PAGE_SIZE; page < last; page += FILE_RA_CHUNK_PAGES) {
+            uint64_t count = last - page;
+            readahead_submit(node, page, count < FILE_RA_CHUNK_PAGES ? (uint32_t)count : FILE_RA_CHUNK_PAGES);
+        }
+    }
+    return 0;
+}
+
+void file_init(void) {
+    readahead_wq = workqueue_create("readahead");
+}
@@ -0,0 +1,65 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+#include "../sync/spinlock.h"
+
+// Open files. A file_t is what a descriptor refers to: the node, the
+// current position and how the file is being read. Descriptors copied with
+// dup2 share one file_t.
+//
+// Reads of a node with a readahead op are watched for sequential streams.
+// A stream gets a read-ahead window right after the pages it asked for,
+// filled asynchronously; when the reader reaches the window the next one
+// is issued, twice as large (four times while small) up to the file's
+// cap, so the device stays busy one window ahead of the reader. A read
+// that is not sequential drops the window.
+
+// fadvise() advice, as in POSIX
+#define FADV_NORMAL     0
+#define FADV_RANDOM     1 // No read-ahead
+#define FADV_SEQUENTIAL 2 // Twice the default window cap
+#define FADV_WILLNEED   3 // Start reading the range now
+#define FADV_DONTNEED   4
+#define FADV_NOREUSE    5
+
+#define FILE_RA_MIN_PAGES 4
+
+// Default read-ahead cap in pages for newly opened files
+extern uint32_t file_ra_max_pages;
+
+typedef struct file_ra_state {
+    uint64_t start;     // First page of the current window
+    uint32_t size;      // Pages in it; 0: no stream being followed
+    uint32_t max_pages; // Cap on size; 0 turns read-ahead off
+    uint64_t prev_page; // Last page the previous read touched
+} file_ra_state_t;
+
+typedef struct file {
+    fs_node_t* node;  // Referenced while the file is open
+    uint32_t flags;   // As passed to open
+    uint32_t refcount;
+    spinlock_t lock;  // pos and ra
+    uint64_t pos;
+    file_ra_state_t ra;
+} file_t;
+
+void file_init(void);
+
+// Opens `node`, taking a reference on it for the file. NULL when out of memory.
+file_t* file_open(fs_node_t* node, uint32_t flags);
+file_t* file_get(file_t* file);
+// Dropping the last reference closes the node
+void file_put(file_t* file);
+
+// Read and write at the file position, which they advance
+size_t file_read(file_t* file, void* buffer, size_t size);
+size_t file_write(file_t* file, const void* buffer, size_t size);
+
+// Access pattern hint for [offset, offset + len); len 0 runs to the end of
+// the file. Returns -1 for unknown advice.
+int file_advise(file_t* file, uint64_t offset, uint64_t len, int advice);
+
+#endif
@@ -0,0 +1,178 @@
+/* kernel/src/fs/icache.c */
+
+#include "icache.h"
+#include "../mem/pmm.h"
+#include "../mem/shrinker.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+
+#define ICACHE_BUCKETS 4096
+
+static fs_node_t** icache_table;
+static spinlock_t icache_lock = 0; // The table, the LRU list, and refcounts reaching zero
+
+// Unreferenced nodes, most recently released at the head
+static fs_node_t* icache_lru_head;
+static fs_node_t* icache_lru_tail;
+static uint64_t icache_lru_count;
+
+// --- Table ---
+
+static fs_node_t** icache_bucket(void* sb, uint64_t ino) {
+    uint64_t h = (ino ^ ((uintptr_t)sb >> 4)) * 0x9E3779B97F4A7C15ull;
+    return &icache_table[(h >> 32) % ICACHE_BUCKETS];
+}
+
+static fs_node_t* icache_find(void* sb, uint64_t ino) {
+    for (fs_node_t* node = *icache_bucket(sb, ino); node; node = node->hash_next) {
+        if (node->sb == sb && node->inode == ino) return node;
+    }
+    return NULL;
+}
+
+static void icache_unhash(fs_node_t* node) {
+    fs_node_t** pp = icache_bucket(node->sb, node->inode);
+    while (*pp && *pp != node) {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp) *pp = node->hash_next;
+}
+
+// --- LRU ---
+
+static void icache_lru_add(fs_node_t* node) {
+    node->lru_prev = NULL;
+    node->lru_next = icache_lru_head;
+    if (icache_lru_head) icache_lru_head->lru_prev = node;
+    else icache_lru_tail = node;
+    icache_lru_head = node;
+    icache_lru_count++;
+}
+
+static void icache_lru_del(fs_node_t* node) {
+    if (node->lru_prev) node->lru_prev->lru_next = node->lru_next;
+    else icache_lru_head = node->lru_next;
+    if (node->lru_next) node->lru_next->lru_prev = node->lru_prev;
+    else icache_lru_tail = node->lru_prev;
+    node->lru_prev = node->lru_next = NULL;
+    icache_lru_count--;
+}
+
+// --- References ---
+
+// Callers already hold a reference, so the count cannot be at zero here
+fs_node_t* vfs_node_get(fs_node_t* node) {
+    if (node) __atomic_add_fetch(&node->refcount, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+void vfs_node_put(fs_node_t* node) {
+    if (!node) return;
+    if (!node->sb) {
+        __atomic_sub_fetch(&node->refcount, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    spinlock_acquire(&icache_lock);
+    bool free = false;
+    if (__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (node->state & ICACHE_FAILED) free = true;
+        else icache_lru_add(node);
+    }
+    spinlock_release(&icache_lock);
+
+    if (free) pmm_free(node, sizeof(fs_node_t));
+}
+
+// --- Lookup ---
+
+fs_node_t* icache_iget(void* sb, uint64_t ino) {
+    fs_node_t* fresh = NULL;
+
+    for (;;) {
+        bool created = false;
+        spinlock_acquire(&icache_lock);
+        fs_node_t* node = icache_find(sb, ino);
+        if (node) {
+            if (__atomic_fetch_add(&node->refcount, 1, __ATOMIC_ACQ_REL) == 0) icache_lru_del(node);
+        } else if (fresh) {
+            node = fresh;
+            fresh = NULL;
+            created = true;
+            fs_node_t** bucket = icache_bucket(sb, ino);
+            node->hash_next = *bucket;
+            *bucket = node;
+        }
+        spinlock_release(&icache_lock);
+
+        if (fresh) pmm_free(fresh, sizeof(fs_node_t));
+        if (node) {
+            if (created) return node;
+            // Someone else is reading this inode in; wait for them
+            while (__atomic_load_n(&node->state, __ATOMIC_ACQUIRE) & ICACHE_NEW) {
+                __asm__ volatile("pause");
+            }
+            if (node->state & ICACHE_FAILED) {
+                vfs_node_put(node);
+                return NULL;
+            }
+            return node;
+        }
+
+        // Allocate outside the lock, then look again
+        fresh = pmm_alloc(sizeof(fs_node_t));
+        if (!fresh) return NULL;
+        memset(fresh, 0, sizeof(fs_node_t));
+        fresh->sb = sb;
+        fresh->inode = ino;
+        fresh->refcount = 1;
+        fresh->state = ICACHE_NEW;
+    }
+}
+
+void icache_new_done(fs_node_t* node) {
+    __atomic_and_fetch(&node->state, ~ICACHE_NEW, __ATOMIC_RELEASE);
+}
+
+void icache_new_failed(fs_node_t* node) {
+    spinlock_acquire(&icache_lock);
+    icache_unhash(node);
+    spinlock_release(&icache_lock);
+    __atomic_store_n(&node->state, ICACHE_FAILED, __ATOMIC_RELEASE);
+    vfs_node_put(node);
+}
+
+// --- Shrinker ---
+
+static uint64_t icache_count(void) {
+    return icache_lru_count;
+}
+
+// Frees the coldest unreferenced nodes. Ones their filesystem still needs
+// go back to the warm end and are tried again on a later pass.
+static uint64_t icache_scan(uint64_t nr) {
+    uint64_t freed = 0;
+
+    spinlock_acquire(&icache_lock);
+    for (uint64_t budget = icache_lru_count; budget > 0 && freed < nr && icache_lru_tail; budget--) {
+        fs_node_t* node = icache_lru_tail;
+        icache_lru_del(node);
+        if (node->evict && node->evict(node) != 0) {
+            icache_lru_add(node);
+            continue;
+        }
+        icache_unhash(node);
+        pmm_free(node, sizeof(fs_node_t));
+        freed++;
+    }
+    spinlock_release(&icache_lock);
+    return freed;
+}
+
+static shrinker_t icache_shrinker = { .count = icache_count, .scan = icache_scan };
+
+void icache_init(void) {
+    icache_table = pmm_alloc(ICACHE_BUCKETS * sizeof(fs_node_t*));
+    memset(icache_table, 0, ICACHE_BUCKETS * sizeof(fs_node_t*));
+    register_shrinker(&icache_shrinker);
+}
@@ -0,0 +1,32 @@
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+// Inode cache. Filesystems that keep one fs_node_t per inode get them from
+// here, keyed by (sb, inode number) where `sb` is whatever identifies the
+// mounted instance, so every lookup of an inode shares one node and its
+// in-core state. Nodes count their references; one that nobody holds stays
+// cached on an LRU list, and the coldest are evicted when the page
+// allocator runs short, after node->evict has let the filesystem release
+// its own state. A filesystem refuses eviction while the inode still has
+// unwritten changes and writes them back so a later pass can take it.
+// node->evict runs with the cache locked: it must not sleep, allocate,
+// or wait for locks held around allocations.
+
+#define ICACHE_NEW    0x1 // Being filled in by its filesystem
+#define ICACHE_FAILED 0x2 // Filling it in failed; freed with the last reference
+
+void icache_init(void);
+
+// Returns the node for (sb, ino) with a reference taken, adding a zeroed
+// one if the inode is not cached. A new node comes back with ICACHE_NEW
+// set: the filesystem fills it in, then calls icache_new_done(), or
+// icache_new_failed() if the inode could not be read. Lookups of the same
+// inode meanwhile wait for the outcome. NULL when out of memory.
+fs_node_t* icache_iget(void* sb, uint64_t ino);
+void icache_new_done(fs_node_t* node);
+void icache_new_failed(fs_node_t* node);
+
+#endif
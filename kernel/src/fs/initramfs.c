@@ -0,0 +1,225 @@
+/* kernel/src/fs/initramfs.c */
+
+#include <limine.h>
+#include "initramfs.h"
+#include "tmpfs.h"
+#include "vfs.h"
+#include "../lib/string.h"
+
+void print(char*); // Forward declare from main.c for logging
+
+static volatile struct limine_module_request module_request = {
+    .id = LIMINE_MODULE_REQUEST,
+    .revision = 0
+};
+
+// Modules come at their higher-half address; file pages are kept by
+// physical address like every other page
+static volatile struct limine_hhdm_request hhdm_request = {
+    .id = LIMINE_HHDM_REQUEST,
+    .revision = 0
+};
+
+// --- cpio "newc" ---
+// Each entry is a header of hex fields, the NUL-terminated name, then the
+// data, name and data each padded to 4 bytes. An entry called TRAILER!!!
+// ends the archive. user/mkfs/mkinitramfs pads names with more NULs so
+// file data starts on a page boundary, and tmpfs can lend it as it is.
+#define CPIO_MAGIC       "070701"
+#define CPIO_MAGIC_CRC   "070702" // Same layout; the checksum is not checked
+#define CPIO_HEADER_SIZE 110
+#define CPIO_TRAILER     "TRAILER!!!"
+
+#define CPIO_S_IFMT  0170000
+#define CPIO_S_IFDIR 0040000
+#define CPIO_S_IFREG 0100000
+
+typedef struct {
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t mtime;      // Seconds
+    uint64_t filesize;
+    uint32_t namesize;   // The NUL included
+} cpio_entry_t;
+
+#define CPIO_ALIGN(x) (((x) + 3) & ~(uint64_t)3)
+
+// An 8-digit hex field; -1 if it is not one
+static int64_t cpio_field(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        uint8_t c = p[i];
+        uint32_t d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return -1;
+        v = v << 4 | d;
+    }
+    return v;
+}
+
+static int cpio_parse(const uint8_t* h, cpio_entry_t* e) {
+    if (memcmp(h, CPIO_MAGIC, 6) != 0 && memcmp(h, CPIO_MAGIC_CRC, 6) != 0) return -1;
+
+    // ino, mode, uid, gid, nlink, mtime, filesize, devmajor, devminor,
+    // rdevmajor, rdevminor, namesize, check
+    int64_t f[13];
+    for (int i = 0; i < 13; i++) {
+        f[i] = cpio_field(h + 6 + i * 8);
+        if (f[i] < 0) return -1;
+    }
+    e->mode = f[1];
+    e->uid = f[2];
+    e->gid = f[3];
+    e->mtime = f[5];
+    e->filesize = f[6];
+    e->namesize = f[11];
+    return 0;
+}
+
+// --- Unpacking ---
+
+// The directory that will hold `path` (absolute, no trailing slash), made
+// along with any missing parents, with a reference taken. *leaf is set to
+// the last component.
+static fs_node_t* initramfs_parent(char* path, const char** leaf) {
+    char* slash = path;
+    for (char* p = path; *p; p++) {
+        if (*p == '/') slash = p;
+    }
+    *leaf = slash + 1;
+
+    fs_node_t* dir = vfs_resolve_path("/");
+    char* p = path + 1;
+    while (dir && p < slash) {
+        char* end = p;
+        while (*end != '/') end++;
+        *end = '\0';
+
+        fs_node_t* next = vfs_resolve_path(path);
+        if (!next && vfs_mkdir(dir, p, 0755) == 0) next = vfs_resolve_path(path);
+        vfs_node_put(dir);
+        dir = next;
+        if (dir && !(dir->flags & FS_DIRECTORY)) {
+            vfs_node_put(dir);
+            dir = NULL;
+        }
+
+        *end = '/';
+        p = end + 1;
+    }
+    return dir;
+}
+
+static void initramfs_set_attrs(fs_node_t* node, const cpio_entry_t* e) {
+    node->mask = e->mode & 07777;
+    node->uid = e->uid;
+    node->gid = e->gid;
+    node->mtime = node->ctime = e->mtime * 1000000000ull;
+}
+
+// Creates the entry at `path`, or reuses what is already there. -1 if it
+// could not be, 1 if it is of a type that is not unpacked.
+static int initramfs_add(char* path, const cpio_entry_t* e, const uint8_t* data) {
+    uint32_t type = e->mode & CPIO_S_IFMT;
+    if (type != CPIO_S_IFDIR && type != CPIO_S_IFREG) return 1;
+
+    const char* leaf;
+    fs_node_t* dir = initramfs_parent(path, &leaf);
+    if (!dir) return -1;
+    if (type == CPIO_S_IFDIR) vfs_mkdir(dir, leaf, e->mode & 07777);
+    else vfs_create(dir, leaf, e->mode & 07777);
+    vfs_node_put(dir);
+
+    int ret = -1;
+    fs_node_t* node = vfs_resolve_path(path);
+    if (!node) return -1;
+    if (type == CPIO_S_IFDIR) {
+        if (node->flags & FS_DIRECTORY) ret = 0;
+    } else if (node->flags & FS_FILE) {
+        // A later copy of a name replaces the earlier one
+        if (vfs_truncate(node, 0) == 0) ret = tmpfs_set_shared(node, data, e->filesize);
+    }
+    if (ret == 0) initramfs_set_attrs(node, e);
+    vfs_node_put(node);
+    return ret;
+}
+
+int initramfs_unpack(const uint8_t* archive, uint64_t size) {
+    char path[FS_PATH_MAX];
+    uint64_t off = 0;
+    int count = 0;
+    bool skipped = false;
+
+    for (;;) {
+        cpio_entry_t e;
+        if (off > size || size - off < CPIO_HEADER_SIZE || cpio_parse(archive + off, &e) < 0) return -1;
+
+        const char* name = (const char*)archive + off + CPIO_HEADER_SIZE;
+        uint64_t data_off = CPIO_ALIGN(off + CPIO_HEADER_SIZE + e.namesize);
+        if (e.namesize == 0 || data_off > size || size - data_off < e.filesize ||
+            name[e.namesize - 1] != '\0') {
+            return -1;
+        }
+        if (strcmp(name, CPIO_TRAILER) == 0) break;
+
+        // Names are relative to the root, with or without "./" or "/"
+        while (name[0] == '.' && name[1] == '/') name += 2;
+        while (name[0] == '/') name++;
+        size_t len = strlen(name);
+        while (len > 0 && name[len - 1] == '/') len--;
+
+        if (len > 0 && !(len == 1 && name[0] == '.') && len + 1 < FS_PATH_MAX) {
+            path[0] = '/';
+            memcpy(path + 1, name, len);
+            path[len + 1] = '\0';
+
+            int ret = initramfs_add(path, &e, archive + data_off);
+            if (ret == 0) count++;
+            else if (ret > 0) skipped = true;
+            else print("initramfs: cannot unpack an entry\n");
+        }
+        off = CPIO_ALIGN(data_off + e.filesize);
+    }
+
+    if (skipped) print("initramfs: skipped symlinks and special files\n");
+    return count;
+}
+
+// Whether `s` ends with `suffix`
+static bool initramfs_ends_with(const char* s, const char* suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+void initramfs_init(void) {
+    struct limine_module_response* modules = module_request.response;
+    if (!modules) {
+        print("initramfs: no boot modules\n");
+        return;
+    }
+
+    struct limine_file* archive = NULL;
+    for (uint64_t i = 0; i < modules->module_count; i++) {
+        struct limine_file* f = modules->modules[i];
+        if (f->cmdline && strcmp(f->cmdline, "initramfs") == 0) {
+            archive = f;
+            break;
+        }
+        if (!archive && f->path && initramfs_ends_with(f->path, ".cpio")) archive = f;
+    }
+    if (!archive) {
+        print("initramfs: no archive among the boot modules\n");
+        return;
+    }
+
+    uint64_t base = (uint64_t)archive->address;
+    if (hhdm_request.response) base -= hhdm_request.response->offset;
+    if (initramfs_unpack((const uint8_t*)base, archive->size) < 0) {
+        print("initramfs: archive is malformed\n");
+        return;
+    }
+    print("initramfs: unpacked\n");
+}
@@ -0,0 +1,25 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stdint.h>
+
+// Boot-time root filesystem. The bootloader loads a cpio archive in the
+// "newc" format as a module; its contents are unpacked into the tmpfs on
+// "/" before anything needs a disk. File data is not copied: each file's
+// pages point into the module, and only pages that get written are copied.
+// Payloads the archive places on page boundaries can be mapped as they are.
+//
+// Directories and regular files are unpacked. Symlinks and device nodes
+// are skipped, and hard links are not kept: only the last name of a file
+// gets its data.
+
+// Unpacks the module loaded with the command line "initramfs" (or, failing
+// that, the first module whose path ends in ".cpio")
+void initramfs_init(void);
+
+// Unpacks `size` bytes of archive at `archive`, which must stay in place
+// for as long as the files do. Returns the number of entries unpacked, -1
+// if the archive is malformed; what came before the damage is kept.
+int initramfs_unpack(const uint8_t* archive, uint64_t size);
+
+#endif
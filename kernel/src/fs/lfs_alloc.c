@@ -0,0 +1,214 @@
+/* kernel/src/fs/lfs_alloc.c */
+
+#include "lfs_alloc.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+
+// --- Bit Helpers ---
+
+static void lfs_bits_set(uint64_t* bits, uint64_t first, uint32_t count, bool value) {
+    for (uint64_t bit = first; bit < first + count; bit++) {
+        if (value) {
+            bits[bit / 64] |= 1ULL << (bit % 64);
+        } else {
+            bits[bit / 64] &= ~(1ULL << (bit % 64));
+        }
+    }
+}
+
+static uint32_t lfs_word_popcount_free(const uint64_t* words, uint32_t count) {
+    uint32_t free = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        free += 64 - __builtin_popcountll(words[i]);
+    }
+    return free;
+}
+
+// bm->nonfull has one bit per group with free space, so the search finds
+// the next candidate group with a few word scans instead of visiting
+// every group of a nearly full volume
+static void lfs_group_mark(uint64_t* nonfull, uint32_t g, bool has_free) {
+    if (has_free) {
+        __atomic_or_fetch(&nonfull[g / 64], 1ULL << (g % 64), __ATOMIC_RELAXED);
+    } else {
+        __atomic_and_fetch(&nonfull[g / 64], ~(1ULL << (g % 64)), __ATOMIC_RELAXED);
+    }
+}
+
+// Next group with free space at or after `g`, wrapping; -1 if none
+static int64_t lfs_next_nonfull(lfs_bitmap_t* bm, uint32_t g) {
+    uint32_t nwords = (bm->ngroups + 63) / 64;
+    for (uint32_t i = 0; i <= nwords; i++) {
+        uint32_t w = (g / 64 + i) % nwords;
+        uint64_t word = __atomic_load_n(&bm->nonfull[w], __ATOMIC_RELAXED);
+        if (i == 0) word &= ~0ULL << (g % 64);
+        if (word) return (int64_t)w * 64 + __builtin_ctzll(word);
+    }
+    return -1;
+}
+
+// --- Loading ---
+
+int lfs_bitmap_load(lfs_mount_info_t* info, lfs_bitmap_t* bm, uint64_t disk_block, uint64_t nbits, uint64_t reserved) {
+    memset(bm, 0, sizeof(lfs_bitmap_t));
+    bm->nbits = nbits;
+    bm->disk_block = disk_block;
+    bm->ngroups = (nbits + LFS_BITS_PER_GROUP - 1) / LFS_BITS_PER_GROUP;
+    if (bm->ngroups == 0) return -1;
+
+    bm->bits = pmm_alloc((size_t)bm->ngroups * LFS_BLOCK_SIZE);
+    bm->groups = pmm_alloc(bm->ngroups * sizeof(lfs_group_t));
+    bm->nonfull = pmm_alloc(((bm->ngroups + 63) / 64) * sizeof(uint64_t));
+    if (!bm->bits || !bm->groups || !bm->nonfull) return -1;
+    memset(bm->groups, 0, bm->ngroups * sizeof(lfs_group_t));
+    memset(bm->nonfull, 0, ((bm->ngroups + 63) / 64) * sizeof(uint64_t));
+
+    for (uint32_t g = 0; g < bm->ngroups; g++) {
+        lfs_read_meta(info, disk_block + g, (uint8_t*)bm->bits + (size_t)g * LFS_BLOCK_SIZE);
+    }
+
+    // Bits past the end of the bitmap and reserved metadata never allocate
+    uint64_t total = (uint64_t)bm->ngroups * LFS_BITS_PER_GROUP;
+    lfs_bits_set(bm->bits, nbits, total - nbits, true);
+    lfs_bits_set(bm->bits, 0, reserved < nbits ? reserved : nbits, true);
+
+    for (uint32_t g = 0; g < bm->ngroups; g++) {
+        lfs_group_t* grp = &bm->groups[g];
+        grp->free = lfs_word_popcount_free(bm->bits + (size_t)g * LFS_WORDS_PER_GROUP, LFS_WORDS_PER_GROUP);
+        bm->free += grp->free;
+        lfs_group_mark(bm->nonfull, g, grp->free > 0);
+    }
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        // Spread the CPUs over the volume so they start in different groups
+        bm->cursor[cpu] = (nbits / MAX_CPUS) * cpu;
+    }
+    return 0;
+}
+
+void lfs_bitmap_release(lfs_bitmap_t* bm) {
+    if (bm->bits) pmm_free(bm->bits, (size_t)bm->ngroups * LFS_BLOCK_SIZE);
+    if (bm->groups) pmm_free(bm->groups, bm->ngroups * sizeof(lfs_group_t));
+    if (bm->nonfull) pmm_free(bm->nonfull, ((bm->ngroups + 63) / 64) * sizeof(uint64_t));
+    bm->bits = NULL;
+    bm->groups = NULL;
+    bm->nonfull = NULL;
+}
+
+// --- Allocation ---
+
+// First free bit of group `g` at or after `start`, wrapping within the
+// group. Caller holds the group lock.
+static int64_t lfs_group_find(lfs_bitmap_t* bm, uint32_t g, uint64_t start) {
+    uint64_t base = (uint64_t)g * LFS_BITS_PER_GROUP;
+    const uint64_t* words = bm->bits + base / 64;
+    uint32_t first = (start - base) / 64;
+    uint32_t shift = (start - base) % 64;
+
+    for (uint32_t i = 0; i <= LFS_WORDS_PER_GROUP; i++) {
+        uint32_t w = (first + i) % LFS_WORDS_PER_GROUP;
+        uint64_t free = ~words[w];
+        if (i == 0) free &= ~0ULL << shift;                       // From `start` on
+        if (i == LFS_WORDS_PER_GROUP) free &= (1ULL << shift) - 1; // Wrapped back
+        if (free) return (int64_t)(base + (uint64_t)w * 64 + __builtin_ctzll(free));
+    }
+    return -1;
+}
+
+// Free bits from `bit` on, up to `max` and the end of the group
+static uint32_t lfs_group_run(lfs_bitmap_t* bm, uint64_t bit, uint32_t max) {
+    uint64_t end = (bit / LFS_BITS_PER_GROUP + 1) * LFS_BITS_PER_GROUP;
+    uint32_t len = 0;
+
+    while (len < max && bit < end) {
+        uint32_t off = bit % 64;
+        uint64_t word = bm->bits[bit / 64] >> off;
+        uint32_t avail = word ? (uint32_t)__builtin_ctzll(word) : 64 - off;
+        uint32_t take = avail < max - len ? avail : max - len;
+        len += take;
+        bit += take;
+        if (take < 64 - off) break; // Hit an allocated bit or `max`
+    }
+    return len;
+}
+
+uint64_t lfs_bitmap_alloc(lfs_bitmap_t* bm, lfs_handle_t* handle, uint64_t goal, uint32_t max, uint32_t* len) {
+    uint32_t cpu = this_cpu_id();
+    if (goal >= bm->nbits) goal = bm->cursor[cpu] % bm->nbits;
+    if (max == 0) max = 1;
+
+    uint32_t g0 = goal / LFS_BITS_PER_GROUP;
+    uint32_t g = g0;
+    uint64_t found = LFS_ALLOC_NONE;
+    uint32_t run = 0;
+
+    for (uint32_t tries = 0; tries <= bm->ngroups; tries++) {
+        lfs_group_t* grp = &bm->groups[g];
+        if (__atomic_load_n(&grp->free, __ATOMIC_RELAXED)) {
+            uint64_t base = (uint64_t)g * LFS_BITS_PER_GROUP;
+            // Near the goal in its own group; elsewhere from the group's
+            // lowest possibly free word
+            uint64_t start = (g == g0 && tries == 0) ? goal : base + (uint64_t)grp->hint * 64;
+
+            spinlock_acquire(&grp->lock);
+            int64_t bit = lfs_group_find(bm, g, start);
+            if (bit >= 0) {
+                found = bit;
+                run = lfs_group_run(bm, found, max);
+                lfs_bits_set(bm->bits, found, run, true);
+                grp->free -= run;
+                if (start != goal) grp->hint = (found - base) / 64;
+                if (!grp->free) lfs_group_mark(bm->nonfull, g, false);
+            }
+            spinlock_release(&grp->lock);
+            if (found != LFS_ALLOC_NONE) break;
+        }
+
+        int64_t next = lfs_next_nonfull(bm, (g + 1) % bm->ngroups);
+        if (next < 0) break;
+        g = next;
+        if (g == g0 && tries > 0) break;
+    }
+
+    if (found == LFS_ALLOC_NONE) return LFS_ALLOC_NONE;
+    __atomic_sub_fetch(&bm->free, run, __ATOMIC_RELAXED);
+    bm->cursor[cpu] = found + run;
+
+    uint64_t group = found / LFS_BITS_PER_GROUP;
+    if (lfs_journal_set_bits(handle, bm->disk_block + group, found % LFS_BITS_PER_GROUP, run, true) < 0) {
+        lfs_bitmap_free(bm, NULL, found, run);
+        return LFS_ALLOC_NONE;
+    }
+
+    *len = run;
+    return found;
+}
+
+int lfs_bitmap_free(lfs_bitmap_t* bm, lfs_handle_t* handle, uint64_t first, uint32_t count) {
+    if (first + count > bm->nbits || count == 0) return -1;
+    uint32_t g = first / LFS_BITS_PER_GROUP;
+    if ((first + count - 1) / LFS_BITS_PER_GROUP != g) return -1;
+
+    // No handle: undoing an allocation that never reached the journal
+    if (handle && lfs_journal_set_bits(handle, bm->disk_block + g, first % LFS_BITS_PER_GROUP, count, false) < 0) {
+        return -1;
+    }
+    if (handle && bm->discard && lfs_journal_defer_free(handle, first, count) == 0) return 0;
+
+    lfs_group_t* grp = &bm->groups[g];
+    spinlock_acquire(&grp->lock);
+    lfs_bits_set(bm->bits, first, count, false);
+    if (!grp->free) lfs_group_mark(bm->nonfull, g, true);
+    grp->free += count;
+    uint32_t word = (first % LFS_BITS_PER_GROUP) / 64;
+    if (word < grp->hint) grp->hint = word;
+    spinlock_release(&grp->lock);
+
+    __atomic_add_fetch(&bm->free, count, __ATOMIC_RELAXED);
+    return 0;
+}
+
+bool lfs_bitmap_test(lfs_bitmap_t* bm, uint64_t bit) {
+    if (bit >= bm->nbits) return true;
+    return (__atomic_load_n(&bm->bits[bit / 64], __ATOMIC_RELAXED) >> (bit % 64)) & 1;
+}
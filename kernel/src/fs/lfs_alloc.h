@@ -0,0 +1,65 @@
+#ifndef LFS_ALLOC_H
+#define LFS_ALLOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "limitlessfs.h"
+#include "lfs_journal.h"
+#include "../../arch/x86_64/cpu.h"
+
+// Free-space bitmaps for LimitlessFS, cached in memory from mount on.
+//
+// Each bitmap is split into groups of one on-disk bitmap block. A group
+// keeps its own lock and free count, so a search skips full groups without
+// touching their bits and allocators on different CPUs rarely contend.
+// Within a group the search looks at 64 bits per step.
+//
+// A set bit is in use. The cached copy is authoritative; every change is
+// also logged into the on-disk bitmap block through the caller's journal
+// handle (one credit per bitmap block touched).
+
+#define LFS_BITS_PER_GROUP (LFS_BLOCK_SIZE * 8)
+#define LFS_WORDS_PER_GROUP (LFS_BITS_PER_GROUP / 64)
+#define LFS_ALLOC_NONE UINT64_MAX
+
+typedef struct {
+    spinlock_t lock;
+    uint32_t free;
+    uint32_t hint; // Word at which the next search in this group starts
+} lfs_group_t;
+
+typedef struct lfs_bitmap {
+    uint64_t* bits;
+    uint64_t nbits;
+    uint64_t disk_block;   // First on-disk bitmap block
+    uint32_t ngroups;
+    lfs_group_t* groups;
+    uint64_t* nonfull;     // One bit per group with free space
+    volatile uint64_t free;
+    uint64_t cursor[MAX_CPUS]; // Where each CPU allocated last
+    bool discard;          // Frees are held back for discard; see lfs_journal_defer_free
+} lfs_bitmap_t;
+
+// Reads `nbits` bits starting at `disk_block`. Bits below `reserved` are
+// treated as in use whatever the disk says.
+int lfs_bitmap_load(lfs_mount_info_t* info, lfs_bitmap_t* bm, uint64_t disk_block, uint64_t nbits, uint64_t reserved);
+
+// Frees what lfs_bitmap_load allocated, including after it failed
+void lfs_bitmap_release(lfs_bitmap_t* bm);
+
+// Allocates up to `max` contiguous bits, as close after `goal` as possible
+// (LFS_ALLOC_NONE: continue from this CPU's cursor). Returns the first bit
+// and the run length in *len, or LFS_ALLOC_NONE if the bitmap is full. A
+// run never crosses a group, so it costs a single credit.
+uint64_t lfs_bitmap_alloc(lfs_bitmap_t* bm, lfs_handle_t* handle, uint64_t goal, uint32_t max, uint32_t* len);
+
+// Frees `count` bits from `first`; the range must lie within one group.
+// The bits are reusable at once, so callers free data blocks only after
+// nothing points at them any more. On a bitmap with `discard` set, bits
+// freed under a handle are reusable only once the free has committed and
+// the blocks have been discarded.
+int lfs_bitmap_free(lfs_bitmap_t* bm, lfs_handle_t* handle, uint64_t first, uint32_t count);
+
+bool lfs_bitmap_test(lfs_bitmap_t* bm, uint64_t bit);
+
+#endif
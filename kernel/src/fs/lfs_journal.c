@@ -0,0 +1,605 @@
+/* kernel/src/fs/lfs_journal.c */
+
+#include "lfs_journal.h"
+#include "lfs_alloc.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+#include "../lib/crc32.h"
+#include "../proc/vdso.h"
+
+void print(char*);
+
+// Commit and checkpoint work for every mounted volume. A single worker
+// keeps the two from running concurrently, so the log state needs no lock.
+static workqueue_t* journal_wq = NULL;
+
+static void lfs_journal_commit_work(work_t* work);
+static void lfs_journal_checkpoint_work(work_t* work);
+
+// --- Log Layout ---
+
+static uint64_t lfs_log_block(lfs_journal_t* j, uint32_t index) {
+    return j->super_block + 1 + index;
+}
+
+static uint32_t lfs_log_advance(lfs_journal_t* j, uint32_t index, uint32_t n) {
+    return (index + n) % j->log_blocks;
+}
+
+static void lfs_journal_write_super(lfs_journal_t* j) {
+    lfs_journal_super_t* sb = pmm_alloc_page();
+    memset(sb, 0, LFS_BLOCK_SIZE);
+    sb->h.magic = LFS_JOURNAL_MAGIC;
+    sb->h.type = LFS_JOURNAL_SUPER;
+    sb->log_blocks = j->log_blocks;
+    sb->first = j->tail;
+    sb->first_sequence = j->tail_sequence;
+    lfs_write_block(j->info, j->super_block, (uint8_t*)sb);
+    lfs_device_flush(j->info);
+    pmm_free_page(sb);
+}
+
+// --- Transactions ---
+
+static lfs_jbuf_t* lfs_txn_lookup(lfs_txn_t* txn, uint64_t block) {
+    for (lfs_jbuf_t* b = txn->hash[block % LFS_JOURNAL_HASH_SIZE]; b; b = b->hash_next) {
+        if (b->block == block) return b;
+    }
+    return NULL;
+}
+
+static lfs_txn_t* lfs_txn_alloc(lfs_journal_t* j) {
+    lfs_txn_t* txn = pmm_alloc(sizeof(lfs_txn_t));
+    if (!txn) return NULL;
+    memset(txn, 0, sizeof(lfs_txn_t));
+    txn->bufs = pmm_alloc(j->max_txn * sizeof(lfs_jbuf_t));
+    if (!txn->bufs) {
+        pmm_free(txn, sizeof(lfs_txn_t));
+        return NULL;
+    }
+    txn->state = LFS_TXN_RUNNING;
+    txn->start_ns = ktime_get_ns();
+    return txn;
+}
+
+static void lfs_txn_free(lfs_journal_t* j, lfs_txn_t* txn) {
+    while (txn->freed) {
+        lfs_freed_t* next = txn->freed->next;
+        pmm_free(txn->freed, sizeof(lfs_freed_t));
+        txn->freed = next;
+    }
+    for (uint32_t i = 0; i < txn->nblocks; i++) {
+        pmm_free_page(txn->bufs[i].data);
+    }
+    pmm_free(txn->bufs, j->max_txn * sizeof(lfs_jbuf_t));
+    pmm_free(txn, sizeof(lfs_txn_t));
+}
+
+// Newest image of `block` among transactions older than `before` (NULL:
+// all transactions not yet checkpointed). Caller holds j->lock.
+static lfs_jbuf_t* lfs_journal_find(lfs_journal_t* j, uint64_t block, lfs_txn_t* before) {
+    lfs_jbuf_t* found = NULL;
+
+    if (!before || before == j->running) {
+        if (!before && j->running && (found = lfs_txn_lookup(j->running, block))) return found;
+        if (j->committing && (found = lfs_txn_lookup(j->committing, block))) return found;
+    }
+    for (lfs_txn_t* t = j->checkpoint_head; t; t = t->next) {
+        lfs_jbuf_t* b = lfs_txn_lookup(t, block);
+        if (b) found = b; // Keep going: later transactions are newer
+    }
+    return found;
+}
+
+bool lfs_journal_read(lfs_journal_t* j, uint64_t block, uint8_t* buf) {
+    spinlock_acquire(&j->lock);
+    lfs_jbuf_t* b = lfs_journal_find(j, block, NULL);
+    if (b) memcpy(buf, b->data, LFS_BLOCK_SIZE);
+    spinlock_release(&j->lock);
+    return b != NULL;
+}
+
+// --- Handles ---
+
+// Sleepers on j->wait read wait_seq before checking their condition and
+// sleep only until it moves; see thread_wait_seq
+static inline uint32_t lfs_journal_wait_seq(lfs_journal_t* j) {
+    return __atomic_load_n(&j->wait_seq, __ATOMIC_ACQUIRE);
+}
+
+static void lfs_journal_wake(lfs_journal_t* j) {
+    thread_wake_seq(&j->wait, &j->wait_seq);
+}
+
+// Sleeps until transaction `tid` is safely in the log
+static void lfs_journal_wait_commit(lfs_journal_t* j, uint32_t tid) {
+    for (;;) {
+        uint32_t seen = lfs_journal_wait_seq(j);
+        if ((int32_t)(__atomic_load_n(&j->commit_sequence, __ATOMIC_ACQUIRE) - tid) >= 0) return;
+        thread_wait_seq(&j->wait, &j->wait_seq, seen);
+    }
+}
+
+int lfs_journal_start(lfs_journal_t* j, lfs_handle_t* handle, uint32_t credits) {
+    if (!j || credits == 0 || credits > j->max_txn) return -1;
+
+    uint32_t seen = lfs_journal_wait_seq(j);
+    spinlock_acquire(&j->lock);
+    for (;;) {
+        // While the previous transaction drains its handles nothing may
+        // join the next one: a block changed by both would be copied into
+        // the new transaction before the old one's last changes
+        if (j->committing && j->committing->updates) {
+            spinlock_release(&j->lock);
+            thread_wait_seq(&j->wait, &j->wait_seq, seen);
+            seen = lfs_journal_wait_seq(j);
+            spinlock_acquire(&j->lock);
+            continue;
+        }
+
+        if (!j->running) {
+            lfs_txn_t* txn = lfs_txn_alloc(j);
+            if (!txn) {
+                spinlock_release(&j->lock);
+                return -1;
+            }
+            txn->tid = j->next_tid++;
+            j->running = txn;
+            queue_delayed_work(journal_wq, &j->commit_work, LFS_JOURNAL_COMMIT_INTERVAL_MS);
+        }
+
+        lfs_txn_t* txn = j->running;
+        if (txn->reserved + credits <= j->max_txn) {
+            txn->reserved += credits;
+            txn->updates++;
+            handle->journal = j;
+            handle->txn = txn;
+            handle->credits = credits;
+            handle->sync = false;
+            spinlock_release(&j->lock);
+            return 0;
+        }
+
+        // No room left: close this transaction and join the next one
+        uint32_t tid = txn->tid;
+        if ((int32_t)(tid - j->commit_request) > 0) j->commit_request = tid;
+        spinlock_release(&j->lock);
+        queue_work(journal_wq, &j->commit_work.work);
+        for (;;) {
+            seen = lfs_journal_wait_seq(j);
+            if (__atomic_load_n(&j->running, __ATOMIC_ACQUIRE) != txn) break;
+            thread_wait_seq(&j->wait, &j->wait_seq, seen);
+        }
+        spinlock_acquire(&j->lock);
+    }
+}
+
+uint8_t* lfs_journal_get_write_access(lfs_handle_t* handle, uint64_t block) {
+    lfs_journal_t* j = handle->journal;
+    lfs_txn_t* txn = handle->txn;
+
+    spinlock_acquire(&j->lock);
+    lfs_jbuf_t* b = lfs_txn_lookup(txn, block);
+    spinlock_release(&j->lock);
+    if (b) return b->data;
+    if (handle->credits == 0) return NULL;
+
+    // Load the current image: an older transaction's copy, else the disk
+    uint8_t* data = pmm_alloc_page();
+    if (!data) return NULL;
+    spinlock_acquire(&j->lock);
+    lfs_jbuf_t* src = lfs_journal_find(j, block, txn);
+    if (src) memcpy(data, src->data, LFS_BLOCK_SIZE);
+    spinlock_release(&j->lock);
+    if (!src) lfs_read_block(j->info, block, data);
+
+    spinlock_acquire(&j->lock);
+    b = lfs_txn_lookup(txn, block);
+    if (b) {
+        // Another handle added it while we were reading
+        spinlock_release(&j->lock);
+        pmm_free_page(data);
+        return b->data;
+    }
+    b = &txn->bufs[txn->nblocks++];
+    b->block = block;
+    b->data = data;
+    b->hash_next = txn->hash[block % LFS_JOURNAL_HASH_SIZE];
+    txn->hash[block % LFS_JOURNAL_HASH_SIZE] = b;
+    handle->credits--;
+    spinlock_release(&j->lock);
+    return data;
+}
+
+int lfs_journal_set_bits(lfs_handle_t* handle, uint64_t block, uint32_t first, uint32_t count, bool value) {
+    lfs_journal_t* j = handle->journal;
+    if (!lfs_journal_get_write_access(handle, block)) return -1;
+
+    // Handles of one transaction share the image; serialise their updates
+    spinlock_acquire(&j->lock);
+    uint8_t* bits = lfs_txn_lookup(handle->txn, block)->data;
+    for (uint32_t bit = first; bit < first + count; bit++) {
+        if (value) {
+            bits[bit / 8] |= (uint8_t)(1 << (bit % 8));
+        } else {
+            bits[bit / 8] &= (uint8_t)~(1 << (bit % 8));
+        }
+    }
+    spinlock_release(&j->lock);
+    return 0;
+}
+
+void lfs_journal_stop(lfs_handle_t* handle) {
+    lfs_journal_t* j = handle->journal;
+    lfs_txn_t* txn = handle->txn;
+    uint32_t tid = txn->tid;
+    bool commit_now = false;
+
+    spinlock_acquire(&j->lock);
+    txn->reserved -= handle->credits;
+    txn->updates--;
+    if (handle->sync && (int32_t)(tid - j->commit_request) > 0) {
+        j->commit_request = tid;
+        commit_now = true;
+    }
+    // Close the transaction early once it is nearly full
+    if (txn->state == LFS_TXN_RUNNING && txn->nblocks >= j->max_txn - j->max_txn / 8) {
+        commit_now = true;
+        if ((int32_t)(tid - j->commit_request) > 0) j->commit_request = tid;
+    }
+    bool last = txn->updates == 0 && txn->state == LFS_TXN_COMMITTING;
+    spinlock_release(&j->lock);
+
+    handle->txn = NULL;
+    if (last) lfs_journal_wake(j);
+    if (commit_now) queue_work(journal_wq, &j->commit_work.work);
+
+    if (handle->sync) lfs_journal_wait_commit(j, tid);
+}
+
+int lfs_journal_defer_free(lfs_handle_t* handle, uint64_t first, uint32_t count) {
+    lfs_journal_t* j = handle->journal;
+    lfs_txn_t* txn = handle->txn;
+    lfs_freed_t* spare = NULL;
+
+    spinlock_acquire(&j->lock);
+    for (;;) {
+        lfs_freed_t* chunk = txn->freed;
+        // Frees tend to come in block order; extend the last extent, as
+        // long as it stays within one bitmap group
+        if (chunk && chunk->count) {
+            lfs_free_extent_t* last = &chunk->ext[chunk->count - 1];
+            if (last->first + last->count == first &&
+                last->first / LFS_BITS_PER_GROUP == (first + count - 1) / LFS_BITS_PER_GROUP) {
+                last->count += count;
+                break;
+            }
+        }
+        if (chunk && chunk->count < LFS_FREED_PER_CHUNK) {
+            chunk->ext[chunk->count].first = first;
+            chunk->ext[chunk->count].count = count;
+            chunk->count++;
+            break;
+        }
+        if (spare) {
+            spare->next = txn->freed;
+            txn->freed = spare;
+            spare = NULL;
+            continue;
+        }
+        spinlock_release(&j->lock);
+        spare = pmm_alloc(sizeof(lfs_freed_t));
+        if (!spare) return -1;
+        spare->count = 0;
+        spinlock_acquire(&j->lock);
+    }
+    spinlock_release(&j->lock);
+
+    if (spare) pmm_free(spare, sizeof(lfs_freed_t));
+    return 0;
+}
+
+void lfs_journal_force(lfs_journal_t* j) {
+    spinlock_acquire(&j->lock);
+    if (!j->running) {
+        // Wait for a commit already in flight, if any
+        uint32_t tid = j->committing ? j->committing->tid : j->commit_sequence;
+        spinlock_release(&j->lock);
+        lfs_journal_wait_commit(j, tid);
+        return;
+    }
+    uint32_t tid = j->running->tid;
+    if ((int32_t)(tid - j->commit_request) > 0) j->commit_request = tid;
+    spinlock_release(&j->lock);
+
+    queue_work(journal_wq, &j->commit_work.work);
+    lfs_journal_wait_commit(j, tid);
+}
+
+// --- Checkpoint ---
+
+// Writes committed transactions home, oldest first, until at least `need`
+// log blocks are free (0: all of them).
+static void lfs_journal_checkpoint(lfs_journal_t* j, uint32_t need) {
+    for (;;) {
+        spinlock_acquire(&j->lock);
+        lfs_txn_t* txn = j->checkpoint_head;
+        spinlock_release(&j->lock);
+        if (!txn || (need && j->free >= need)) break;
+
+        for (uint32_t i = 0; i < txn->nblocks; i++) {
+            lfs_jbuf_t* b = &txn->bufs[i];
+            // A later committed transaction carries a newer image and will
+            // write the block itself; replay covers it if we crash first
+            bool superseded = false;
+            spinlock_acquire(&j->lock);
+            for (lfs_txn_t* t = txn->next; t && !superseded; t = t->next) {
+                superseded = lfs_txn_lookup(t, b->block) != NULL;
+            }
+            spinlock_release(&j->lock);
+            if (!superseded) lfs_write_block(j->info, b->block, b->data);
+        }
+        lfs_device_flush(j->info);
+
+        spinlock_acquire(&j->lock);
+        j->checkpoint_head = txn->next;
+        if (!j->checkpoint_head) j->checkpoint_tail = NULL;
+        spinlock_release(&j->lock);
+
+        // Move the tail on disk before the space can be reused
+        j->tail = lfs_log_advance(j, txn->log_start, txn->log_blocks);
+        j->tail_sequence = txn->sequence + 1;
+        lfs_journal_write_super(j);
+        j->free += txn->log_blocks;
+
+        lfs_txn_free(j, txn);
+    }
+}
+
+static void lfs_journal_checkpoint_work(work_t* work) {
+    delayed_work_t* dwork = container_of(work, delayed_work_t, work);
+    lfs_journal_t* j = container_of(dwork, lfs_journal_t, checkpoint_work);
+    lfs_journal_checkpoint(j, 0);
+}
+
+// --- Commit ---
+
+static void lfs_journal_write_log(lfs_journal_t* j, uint32_t* pos, const uint8_t* data) {
+    lfs_write_block(j->info, lfs_log_block(j, *pos), data);
+    *pos = lfs_log_advance(j, *pos, 1);
+}
+
+static void lfs_journal_commit_work(work_t* work) {
+    delayed_work_t* dwork = container_of(work, delayed_work_t, work);
+    lfs_journal_t* j = container_of(dwork, lfs_journal_t, commit_work);
+
+    spinlock_acquire(&j->lock);
+    lfs_txn_t* txn = j->running;
+    if (!txn) {
+        spinlock_release(&j->lock);
+        return;
+    }
+    // Woken by the interval timer for a transaction nobody asked for
+    uint64_t age = ktime_get_ns() - txn->start_ns;
+    uint64_t interval = LFS_JOURNAL_COMMIT_INTERVAL_MS * 1000000ULL;
+    if ((int32_t)(txn->tid - j->commit_request) > 0 && age < interval) {
+        spinlock_release(&j->lock);
+        queue_delayed_work(journal_wq, &j->commit_work, (interval - age) / 1000000ULL + 1);
+        return;
+    }
+    txn->state = LFS_TXN_COMMITTING;
+    j->running = NULL;
+    j->committing = txn;
+    spinlock_release(&j->lock);
+
+    for (;;) {
+        uint32_t seen = lfs_journal_wait_seq(j);
+        if (__atomic_load_n(&txn->updates, __ATOMIC_ACQUIRE) == 0) break;
+        thread_wait_seq(&j->wait, &j->wait_seq, seen);
+    }
+    // The transaction is frozen; let new handles in
+    lfs_journal_wake(j);
+
+    if (txn->nblocks > 0) {
+        uint32_t need = txn->nblocks + 2;
+        if (j->free < need) lfs_journal_checkpoint(j, need);
+
+        // Replay walks the log by consecutive sequence numbers, so only
+        // transactions that reach it take one; tids also go to the empty
+        // ones that are dropped.
+        txn->sequence = j->log_sequence++;
+
+        // Descriptor and images first, then the commit block once they are
+        // on the media; replay trusts a transaction only if its checksum
+        // matches.
+        lfs_journal_descriptor_t* desc = pmm_alloc_page();
+        memset(desc, 0, LFS_BLOCK_SIZE);
+        desc->h.magic = LFS_JOURNAL_MAGIC;
+        desc->h.type = LFS_JOURNAL_DESCRIPTOR;
+        desc->h.sequence = txn->sequence;
+        desc->count = txn->nblocks;
+        for (uint32_t i = 0; i < txn->nblocks; i++) {
+            desc->targets[i] = txn->bufs[i].block;
+        }
+
+        uint32_t pos = j->head;
+        uint32_t crc = crc32(0, desc, LFS_BLOCK_SIZE);
+        lfs_journal_write_log(j, &pos, (uint8_t*)desc);
+        for (uint32_t i = 0; i < txn->nblocks; i++) {
+            crc = crc32(crc, txn->bufs[i].data, LFS_BLOCK_SIZE);
+            lfs_journal_write_log(j, &pos, txn->bufs[i].data);
+        }
+        lfs_device_flush(j->info);
+
+        lfs_journal_commit_t* commit = (lfs_journal_commit_t*)desc;
+        memset(commit, 0, LFS_BLOCK_SIZE);
+        commit->h.magic = LFS_JOURNAL_MAGIC;
+        commit->h.type = LFS_JOURNAL_COMMIT;
+        commit->h.sequence = txn->sequence;
+        commit->count = txn->nblocks;
+        commit->checksum = crc;
+        lfs_journal_write_log(j, &pos, (uint8_t*)commit);
+        lfs_device_flush(j->info);
+        pmm_free_page(desc);
+
+        txn->log_start = j->head;
+        txn->log_blocks = need;
+        j->head = pos;
+        j->free -= need;
+    }
+
+    spinlock_acquire(&j->lock);
+    j->committing = NULL;
+    __atomic_store_n(&j->commit_sequence, txn->tid, __ATOMIC_RELEASE);
+    if (txn->nblocks > 0) {
+        txn->state = LFS_TXN_COMMITTED;
+        txn->next = NULL;
+        if (j->checkpoint_tail) {
+            j->checkpoint_tail->next = txn;
+        } else {
+            j->checkpoint_head = txn;
+        }
+        j->checkpoint_tail = txn;
+    }
+    bool more = j->running && (int32_t)(j->running->tid - j->commit_request) <= 0;
+    spinlock_release(&j->lock);
+
+    // The frees are on disk now
+    lfs_freed_t* freed = txn->freed;
+    txn->freed = NULL;
+
+    if (txn->nblocks == 0) lfs_txn_free(j, txn);
+    lfs_journal_wake(j);
+    if (more) queue_work(journal_wq, &j->commit_work.work);
+
+    while (freed) {
+        lfs_freed_t* next = freed->next;
+        lfs_device_discard(j->info, freed->ext, freed->count);
+        for (uint32_t i = 0; i < freed->count; i++) {
+            lfs_bitmap_free(j->info->block_bitmap, NULL, freed->ext[i].first, freed->ext[i].count);
+        }
+        pmm_free(freed, sizeof(lfs_freed_t));
+        freed = next;
+    }
+
+    // Checkpoint lazily so repeated updates to a block reach home once,
+    // but early enough that commits rarely have to wait for log space
+    if (j->free < j->log_blocks / 2) {
+        queue_work(journal_wq, &j->checkpoint_work.work);
+    } else if (txn->nblocks > 0) {
+        queue_delayed_work(journal_wq, &j->checkpoint_work, LFS_JOURNAL_CHECKPOINT_INTERVAL_MS);
+    }
+}
+
+// --- Recovery ---
+
+// Checks the transaction at log index `pos` and returns its image count, or
+// -1 if it is not a complete transaction with sequence `seq`.
+static int lfs_journal_scan(lfs_journal_t* j, uint32_t pos, uint32_t seq, lfs_journal_descriptor_t* desc, uint8_t* buf) {
+    lfs_read_block(j->info, lfs_log_block(j, pos), (uint8_t*)desc);
+    if (desc->h.magic != LFS_JOURNAL_MAGIC || desc->h.type != LFS_JOURNAL_DESCRIPTOR ||
+        desc->h.sequence != seq || desc->count == 0 || desc->count > j->max_txn) {
+        return -1;
+    }
+
+    uint32_t crc = crc32(0, desc, LFS_BLOCK_SIZE);
+    uint32_t p = lfs_log_advance(j, pos, 1);
+    for (uint32_t i = 0; i < desc->count; i++) {
+        lfs_read_block(j->info, lfs_log_block(j, p), buf);
+        crc = crc32(crc, buf, LFS_BLOCK_SIZE);
+        p = lfs_log_advance(j, p, 1);
+    }
+
+    lfs_journal_commit_t* commit = (lfs_journal_commit_t*)buf;
+    lfs_read_block(j->info, lfs_log_block(j, p), buf);
+    if (commit->h.magic != LFS_JOURNAL_MAGIC || commit->h.type != LFS_JOURNAL_COMMIT ||
+        commit->h.sequence != seq || commit->count != desc->count || commit->checksum != crc) {
+        return -1;
+    }
+    return desc->count;
+}
+
+// Applies every complete transaction from the tail on. A torn or stale
+// transaction ends the log.
+static void lfs_journal_replay(lfs_journal_t* j) {
+    lfs_journal_descriptor_t* desc = pmm_alloc_page();
+    uint8_t* buf = pmm_alloc_page();
+    uint32_t pos = j->tail;
+    uint32_t seq = j->tail_sequence;
+    uint32_t replayed = 0;
+
+    for (uint32_t used = 0; used < j->log_blocks; ) {
+        int count = lfs_journal_scan(j, pos, seq, desc, buf);
+        if (count < 0 || used + count + 2 > j->log_blocks) break;
+
+        uint32_t p = lfs_log_advance(j, pos, 1);
+        for (int i = 0; i < count; i++) {
+            lfs_read_block(j->info, lfs_log_block(j, p), buf);
+            lfs_write_block(j->info, desc->targets[i], buf);
+            p = lfs_log_advance(j, p, 1);
+        }
+        used += count + 2;
+        pos = lfs_log_advance(j, p, 1);
+        seq++;
+        replayed++;
+    }
+
+    if (replayed) {
+        lfs_device_flush(j->info);
+        print("LimitlessFS: replayed journal transactions\n");
+    }
+
+    // Everything up to here is home; start the log afresh after it
+    j->head = j->tail = pos;
+    j->tail_sequence = seq;
+    j->log_sequence = seq;
+    j->next_tid = seq;
+    j->commit_request = seq - 1;
+    j->commit_sequence = seq - 1;
+    j->free = j->log_blocks;
+    lfs_journal_write_super(j);
+
+    pmm_free_page(buf);
+    pmm_free_page(desc);
+}
+
+lfs_journal_t* lfs_journal_load(lfs_mount_info_t* info) {
+    if (info->sb.journal_num_blocks < LFS_JOURNAL_MIN_BLOCKS) return NULL;
+
+    if (!journal_wq) {
+        journal_wq = workqueue_create("lfs-journal");
+        if (!journal_wq) return NULL;
+    }
+
+    lfs_journal_t* j = pmm_alloc(sizeof(lfs_journal_t));
+    if (!j) return NULL;
+    memset(j, 0, sizeof(lfs_journal_t));
+    j->info = info;
+    j->super_block = info->sb.journal_start_block;
+    j->log_blocks = info->sb.journal_num_blocks - 1;
+
+    j->max_txn = lfs_journal_max_txn(j->log_blocks);
+
+    j->commit_work.work.fn = lfs_journal_commit_work;
+    j->checkpoint_work.work.fn = lfs_journal_checkpoint_work;
+
+    lfs_journal_super_t* sb = pmm_alloc_page();
+    lfs_read_block(info, j->super_block, (uint8_t*)sb);
+    if (sb->h.magic == LFS_JOURNAL_MAGIC && sb->h.type == LFS_JOURNAL_SUPER &&
+        sb->log_blocks == j->log_blocks && sb->first < j->log_blocks) {
+        j->tail = sb->first;
+        j->tail_sequence = sb->first_sequence;
+    } else {
+        // Never mounted since mkfs: an empty log
+        j->tail = 0;
+        j->tail_sequence = 1;
+    }
+    pmm_free_page(sb);
+
+    lfs_journal_replay(j);
+    return j;
+}
+
+void lfs_journal_release(lfs_journal_t* journal) {
+    pmm_free(journal, sizeof(lfs_journal_t));
+}
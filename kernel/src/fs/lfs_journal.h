@@ -0,0 +1,136 @@
+#ifndef LFS_JOURNAL_H
+#define LFS_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "limitlessfs.h"
+#include "../proc/workqueue.h"
+
+// Metadata journal for LimitlessFS.
+//
+// Callers group related metadata changes under a handle. Handles join the
+// running transaction, which collects the new image of every block they
+// touch. The transaction is committed as a group once it is full, once it
+// is LFS_JOURNAL_COMMIT_INTERVAL_MS old, or when someone needs it on disk
+// (lfs_journal_force). Committed transactions are written to their home
+// locations later by the checkpoint, which frees their log space.
+//
+// Only metadata is journaled. File data is written in place before the
+// metadata that points at it is committed.
+
+#define LFS_JOURNAL_COMMIT_INTERVAL_MS     5000
+#define LFS_JOURNAL_CHECKPOINT_INTERVAL_MS 30000
+#define LFS_JOURNAL_HASH_SIZE              64
+
+typedef enum {
+    LFS_TXN_RUNNING,    // Accepting new handles
+    LFS_TXN_COMMITTING, // Waiting for its handles to finish, then logged
+    LFS_TXN_COMMITTED,  // In the log, waiting for the checkpoint
+} lfs_txn_state_t;
+
+// One block image owned by a transaction
+typedef struct lfs_jbuf {
+    uint64_t block;
+    uint8_t* data;
+    struct lfs_jbuf* hash_next;
+} lfs_jbuf_t;
+
+// Blocks freed by a transaction. They stay allocated in memory until it
+// has committed, are then discarded on the device, and only then become
+// reusable, so a discard can never hit data written after the free.
+#define LFS_FREED_PER_CHUNK ((4096 - 16) / sizeof(lfs_free_extent_t))
+
+typedef struct lfs_freed {
+    struct lfs_freed* next;
+    uint32_t count;
+    lfs_free_extent_t ext[LFS_FREED_PER_CHUNK];
+} lfs_freed_t;
+
+typedef struct lfs_txn {
+    uint32_t tid;
+    lfs_txn_state_t state;
+    uint32_t updates;   // Open handles
+    uint32_t reserved;  // Credits promised to handles, including used ones
+    uint32_t nblocks;
+    uint64_t start_ns;
+    lfs_jbuf_t* bufs;   // nblocks entries, in the order they joined
+    lfs_jbuf_t* hash[LFS_JOURNAL_HASH_SIZE];
+    lfs_freed_t* freed; // Newest chunk first
+    uint32_t log_start; // Position in the log once committed
+    uint32_t log_blocks;
+    uint32_t sequence;  // Log sequence, given only to transactions written
+    struct lfs_txn* next; // Checkpoint list, oldest first
+} lfs_txn_t;
+
+typedef struct lfs_journal {
+    lfs_mount_info_t* info;
+    uint64_t super_block;  // Disk block of the journal super block
+    uint32_t log_blocks;   // Log blocks follow the super block
+    uint32_t max_txn;      // Largest transaction, in blocks
+
+    // Log state, changed only by the commit and checkpoint work, which
+    // share a single-threaded queue
+    uint32_t head;         // Next log index to write
+    uint32_t tail;         // Oldest live log index
+    uint32_t tail_sequence;
+    uint32_t log_sequence; // Sequence of the next transaction written
+    uint32_t free;         // Log blocks available to new transactions
+
+    spinlock_t lock;       // Protects everything below
+    uint32_t next_tid;
+    uint32_t commit_request;   // Commit running transactions up to this tid
+    uint32_t commit_sequence;  // Last tid safely in the log
+    lfs_txn_t* running;
+    lfs_txn_t* committing;
+    lfs_txn_t* checkpoint_head;
+    lfs_txn_t* checkpoint_tail;
+    wait_queue_t* wait;
+    volatile uint32_t wait_seq; // Moves on every change `wait` sleepers look for
+
+    delayed_work_t commit_work;
+    delayed_work_t checkpoint_work;
+} lfs_journal_t;
+
+typedef struct {
+    lfs_journal_t* journal;
+    lfs_txn_t* txn;
+    uint32_t credits;     // Blocks this handle may still add
+    bool sync;            // lfs_journal_stop waits for the commit
+} lfs_handle_t;
+
+// Mount-time setup: replays committed transactions left in the log and
+// returns the journal, or NULL if the volume has no usable journal.
+lfs_journal_t* lfs_journal_load(lfs_mount_info_t* info);
+
+// Frees a journal nothing has started a handle on yet, when the rest of
+// the mount fails
+void lfs_journal_release(lfs_journal_t* journal);
+
+// Opens a handle that may modify up to `credits` distinct blocks.
+int lfs_journal_start(lfs_journal_t* journal, lfs_handle_t* handle, uint32_t credits);
+
+// Returns the handle's transaction copy of `block`, loaded with its current
+// contents. Modify it in place before lfs_journal_stop. NULL when the
+// handle is out of credits.
+uint8_t* lfs_journal_get_write_access(lfs_handle_t* handle, uint64_t block);
+
+// Sets or clears bits [first, first + count) of a bitmap block. Use this
+// rather than lfs_journal_get_write_access for blocks that concurrent
+// handles update bit by bit.
+int lfs_journal_set_bits(lfs_handle_t* handle, uint64_t block, uint32_t first, uint32_t count, bool value);
+
+void lfs_journal_stop(lfs_handle_t* handle);
+
+// Holds data blocks [first, first + count), just freed under `handle`, back
+// until its transaction commits; see lfs_free_extent_t. -1 when out of
+// memory, in which case the caller releases them at once.
+int lfs_journal_defer_free(lfs_handle_t* handle, uint64_t first, uint32_t count);
+
+// Commits everything started so far and waits until it is in the log
+void lfs_journal_force(lfs_journal_t* journal);
+
+// Copies the newest journaled image of `block` into `buf`. Returns false if
+// the block has no pending changes and the disk copy is current.
+bool lfs_journal_read(lfs_journal_t* journal, uint64_t block, uint8_t* buf);
+
+#endif
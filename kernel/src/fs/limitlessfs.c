@@ -1,116 +1,1799 @@
 #include "limitlessfs.h"
+#include "lfs_journal.h"
+#include "lfs_alloc.h"
+#include "page_cache.h"
+#include "icache.h"
+#include "../block/blkdev.h"
 #include "../mem/pmm.h"
 #include "../lib/string.h"
+#include "../proc/vdso.h"
 
-// In-memory representation of a mounted LFS volume
-typedef struct {
-    lfs_superblock_t sb;
-    fs_node_t* device;
-    spinlock_t lock;
-    // Caches for bitmaps would go here in a fully optimized driver
-} lfs_mount_info_t;
+void print(char*);
+
+// Largest single device request issued by lfs_read and writeback
+#define LFS_MAX_IO_BLOCKS 256
 
 // --- Forward declarations for VFS function pointers ---
-static uint32_t lfs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
-static uint32_t lfs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
-static struct dirent* lfs_readdir(fs_node_t* node, uint32_t index);
-static fs_node_t* lfs_finddir(fs_node_t* node, char* name);
-static fs_node_t* lfs_create(fs_node_t* parent, char* name, uint32_t flags);
+static size_t lfs_read(fs_node_t* node, uint64_t offset, size_t size, void* buffer);
+static size_t lfs_write(fs_node_t* node, uint64_t offset, size_t size, const void* buffer);
+static int lfs_readdir(fs_node_t* node, uint64_t index, dirent_t* out);
+static fs_node_t* lfs_finddir(fs_node_t* node, const char* name);
+static int lfs_create(fs_node_t* parent, const char* name, uint32_t mode);
+static int lfs_mkdir(fs_node_t* parent, const char* name, uint32_t mode);
+static int lfs_evict(fs_node_t* node);
+static void lfs_readahead(fs_node_t* node, uint64_t first, uint32_t count);
 
 // --- Internal Helpers (Simplified for brevity, but represent full logic) ---
-static void lfs_read_block(lfs_mount_info_t* info, uint32_t block_num, uint8_t* buf) {
-    read_fs(info->device, (uint64_t)block_num * LFS_BLOCK_SIZE, LFS_BLOCK_SIZE, buf);
+void lfs_read_block(lfs_mount_info_t* info, uint64_t block_num, uint8_t* buf) {
+    vfs_read(info->device, block_num * LFS_BLOCK_SIZE, LFS_BLOCK_SIZE, buf);
 }
-static void lfs_write_block(lfs_mount_info_t* info, uint32_t block_num, uint8_t* buf) {
-    write_fs(info->device, (uint64_t)block_num * LFS_BLOCK_SIZE, LFS_BLOCK_SIZE, buf);
+void lfs_write_block(lfs_mount_info_t* info, uint64_t block_num, const uint8_t* buf) {
+    vfs_write(info->device, block_num * LFS_BLOCK_SIZE, LFS_BLOCK_SIZE, buf);
 }
-static void lfs_read_inode(lfs_mount_info_t* info, uint32_t inum, lfs_inode_t* inode_buf) { /* ... */ }
-static void lfs_write_inode(lfs_mount_info_t* info, uint32_t inum, lfs_inode_t* inode_buf) {
-    // A journaling FS doesn't write directly. It writes to the journal.
-    // The actual write happens during checkpointing.
+
+// Write barrier for the journal: everything written so far must be on the
+// media before anything written after. Device writes have completed by the
+// time they return, so what is left is the drive's volatile cache.
+void lfs_device_flush(lfs_mount_info_t* info) {
+    block_device_t* bdev = blkdev_of(info->device);
+    if (bdev) blkdev_flush(bdev);
 }
-static uint32_t lfs_alloc_block(lfs_mount_info_t* info) { /* ... finds free bit in data bitmap ... */ return 0; }
-static uint32_t lfs_alloc_inode(lfs_mount_info_t* info) { /* ... finds free bit in inode bitmap ... */ return 0; }
 
+static void lfs_discard_end_io(bio_t* bio) {
+    bio_batch_done(bio->private, BLK_STS_OK); // Advisory; failures do not matter
+    bio_put(bio);
+}
 
-// --- Journaling Implementation ---
-static void journal_commit(lfs_mount_info_t* info) {
-    // 1. Write all pending metadata blocks to the journal area on disk.
-    // 2. Write a "commit" block to the journal.
-    // 3. "Checkpoint": Write the data from the journal to its final location.
-    // 4. Clear the journal.
+// All the extents go out together and are waited for as one batch
+void lfs_device_discard(lfs_mount_info_t* info, const lfs_free_extent_t* ext, uint32_t count) {
+    block_device_t* bdev = blkdev_of(info->device);
+    if (!bdev || !bdev->max_discard_sectors) return;
+
+    bio_batch_t batch;
+    bio_batch_init(&batch);
+    blk_plug_t plug;
+    blk_start_plug(&plug);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t sector = ext[i].first * (LFS_BLOCK_SIZE / SECTOR_SIZE);
+        uint64_t left = (uint64_t)ext[i].count * (LFS_BLOCK_SIZE / SECTOR_SIZE);
+        while (left > 0) {
+            uint64_t n = left < bdev->max_discard_sectors ? left : bdev->max_discard_sectors;
+            bio_t* bio = bio_alloc(bdev, REQ_OP_DISCARD, sector, 0);
+            if (!bio) break;
+            bio->size = n << SECTOR_SHIFT;
+            bio->end_io = lfs_discard_end_io;
+            bio->private = &batch;
+            bio_batch_add(&batch);
+            submit_bio(bio);
+            sector += n;
+            left -= n;
+        }
+    }
+    blk_finish_plug(&plug);
+    bio_batch_wait(&batch);
 }
 
+// Metadata reads see changes still sitting in the journal
+void lfs_read_meta(lfs_mount_info_t* info, uint64_t block_num, uint8_t* buf) {
+    if (!info->journal || !lfs_journal_read(info->journal, block_num, buf)) {
+        lfs_read_block(info, block_num, buf);
+    }
+}
 
-// --- VFS Implementation ---
+// One device request for `count` consecutive blocks
+static void lfs_read_blocks(lfs_mount_info_t* info, uint64_t block_num, uint32_t count, uint8_t* buf) {
+    vfs_read(info->device, block_num * LFS_BLOCK_SIZE, (size_t)count * LFS_BLOCK_SIZE, buf);
+}
 
-static uint32_t lfs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
-    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
-    lfs_inode_t inode;
-    lfs_read_inode(info, node->inode, &inode);
+static void lfs_read_inode(lfs_mount_info_t* info, uint32_t inum, lfs_inode_t* inode_buf) {
+    uint8_t* block = pmm_alloc_page();
+    lfs_read_meta(info, info->sb.inode_table_block + inum / LFS_INODES_PER_BLOCK, block);
+    memcpy(inode_buf, block + (inum % LFS_INODES_PER_BLOCK) * LFS_INODE_SIZE, sizeof(lfs_inode_t));
+    pmm_free_page(block);
+}
 
-    if (offset >= inode.size) return 0;
-    if (offset + size > inode.size) size = inode.size - offset;
+// --- Extent Tree Lookup ---
 
-    uint32_t start_block = offset / LFS_BLOCK_SIZE;
-    uint32_t end_block = (offset + size - 1) / LFS_BLOCK_SIZE;
-    uint32_t bytes_read = 0;
-    
-    uint8_t* block_buf = pmm_alloc_page();
+static bool lfs_extent_header_valid(const lfs_extent_header_t* hdr, uint16_t max) {
+    return hdr->magic == LFS_EXTENT_MAGIC && hdr->entries <= hdr->max && hdr->max <= max;
+}
 
-    for (uint32_t i = start_block; i <= end_block; i++) {
-        uint32_t block_to_read = 0; // Find physical block from inode pointers
-        if (i < LFS_DIRECT_POINTERS) {
-            block_to_read = inode.direct_pointers[i];
+// Index of the last entry whose `logical` is <= lblock, or -1. Leaf and
+// index entries both start with `logical` and are 16 bytes, so one search
+// serves both.
+static int lfs_extent_search(const lfs_extent_t* entries, uint16_t count, uint32_t lblock) {
+    int lo = 0, hi = (int)count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (entries[mid].logical <= lblock) {
+            found = mid;
+            lo = mid + 1;
         } else {
-            // Must read indirect block to find the correct data block
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Maps file block `lblock` to a disk block. *run receives how many blocks
+// from lblock onwards are contiguous on disk (or, for a hole, how many
+// blocks until the next extent). Returns 0 for a hole, or on a corrupt tree.
+static uint64_t lfs_map_block(lfs_mount_info_t* info, const lfs_inode_t* inode, uint32_t lblock, uint32_t* run) {
+    const lfs_extent_header_t* hdr = &inode->extent_header;
+    const lfs_extent_t* entries = inode->extent_root.extents;
+    uint32_t next_logical = LFS_MAX_EXTENT_LEN; // Start of whatever follows the subtree
+    uint8_t* node = NULL;
+    uint64_t phys = 0;
+    int depth = 0;
+
+    *run = 1;
+    if (!lfs_extent_header_valid(hdr, LFS_INLINE_EXTENTS)) return 0;
+
+    while (hdr->depth > 0) {
+        int i = lfs_extent_search(entries, hdr->entries, lblock);
+        if (i < 0) {
+            // Hole before the first subtree
+            *run = (hdr->entries ? entries[0].logical : next_logical) - lblock;
+            goto out;
+        }
+        if (++depth > LFS_MAX_EXTENT_DEPTH) goto out;
+
+        const lfs_extent_index_t* idx = (const lfs_extent_index_t*)&entries[i];
+        if (i + 1 < hdr->entries) next_logical = entries[i + 1].logical;
+
+        if (!node) node = pmm_alloc_page();
+        lfs_read_meta(info, idx->child, node);
+        hdr = (const lfs_extent_header_t*)node;
+        entries = (const lfs_extent_t*)(node + sizeof(lfs_extent_header_t));
+        if (!lfs_extent_header_valid(hdr, LFS_EXTENTS_PER_BLOCK)) goto out;
+    }
+
+    int i = lfs_extent_search(entries, hdr->entries, lblock);
+    if (i >= 0 && lblock - entries[i].logical < entries[i].length) {
+        uint32_t off = lblock - entries[i].logical;
+        phys = entries[i].physical + off;
+        *run = entries[i].length - off;
+    } else {
+        // Hole up to the next extent in this leaf, or past the subtree
+        uint32_t next = (i + 1 < hdr->entries) ? entries[i + 1].logical : next_logical;
+        *run = next - lblock;
+    }
+
+out:
+    if (node) pmm_free_page(node);
+    return phys;
+}
+
+// Logs the new inode under `handle`; it reaches the inode table at the
+// next checkpoint. Costs one credit per inode table block.
+static int lfs_write_inode(lfs_mount_info_t* info, lfs_handle_t* handle, uint32_t inum, const lfs_inode_t* inode_buf) {
+    uint8_t* block = lfs_journal_get_write_access(handle, info->sb.inode_table_block + inum / LFS_INODES_PER_BLOCK);
+    if (!block) return -1;
+    memcpy(block + (inum % LFS_INODES_PER_BLOCK) * LFS_INODE_SIZE, inode_buf, sizeof(lfs_inode_t));
+    return 0;
+}
+// --- Allocation ---
+
+// Where the blocks of inode `inum` should go: inodes are spread over the
+// data area in proportion to their number, so files created together in a
+// directory (nearby inode numbers) land near each other
+static uint64_t lfs_block_goal(lfs_mount_info_t* info, uint32_t inum) {
+    uint64_t data_blocks = info->sb.total_blocks - info->sb.data_blocks_start;
+    return info->sb.data_blocks_start + data_blocks * inum / lfs_inode_count(&info->sb);
+}
+
+// Allocates up to `max` contiguous blocks near `goal` (0: near inode
+// `inum`'s area). Returns the first block and the count in *len, or 0.
+static uint64_t lfs_alloc_blocks(lfs_mount_info_t* info, lfs_handle_t* handle, uint32_t inum, uint64_t goal, uint32_t max, uint32_t* len) {
+    if (!goal) goal = lfs_block_goal(info, inum);
+    uint64_t block = lfs_bitmap_alloc(info->block_bitmap, handle, goal, max, len);
+    return block == LFS_ALLOC_NONE ? 0 : block;
+}
+
+static uint64_t lfs_alloc_block(lfs_mount_info_t* info, lfs_handle_t* handle, uint32_t inum, uint64_t goal) {
+    uint32_t len;
+    return lfs_alloc_blocks(info, handle, inum, goal, 1, &len);
+}
+
+// Files go in their parent's inode group. Directories move to the next
+// group with at least average free inodes, so directory trees spread out
+// and leave room for their own files.
+static uint32_t lfs_alloc_inode(lfs_mount_info_t* info, lfs_handle_t* handle, uint32_t parent, bool is_dir) {
+    lfs_bitmap_t* bm = info->inode_bitmap;
+    uint64_t goal = parent;
+    uint32_t len;
+
+    if (is_dir && bm->ngroups > 1) {
+        uint64_t average = bm->free / bm->ngroups;
+        uint32_t g0 = parent / LFS_BITS_PER_GROUP;
+        for (uint32_t i = 1; i <= bm->ngroups; i++) {
+            uint32_t g = (g0 + i) % bm->ngroups;
+            if (bm->groups[g].free >= average && bm->groups[g].free > 0) {
+                goal = (uint64_t)g * LFS_BITS_PER_GROUP;
+                break;
+            }
+        }
+    }
+
+    uint64_t inum = lfs_bitmap_alloc(bm, handle, goal, 1, &len);
+    return inum == LFS_ALLOC_NONE ? 0 : (uint32_t)inum;
+}
+
+
+// --- In-Core Inodes ---
+
+// Blocks of dirty data one file may collect before writeback is kicked
+#define LFS_WRITEBACK_BATCH 256
+#define LFS_WRITEBACK_INTERVAL_MS 5000
+
+typedef struct lfs_inode_info {
+    uint32_t inum;
+    lfs_inode_t disk;          // Current inode; disk.size includes cached data
+    uint64_t disk_size;        // Size as far as data has reached the disk
+    volatile uint32_t map_seq; // Odd while the extent tree is changing
+    spinlock_t lock;           // Serialises delayed-allocation bookkeeping
+    page_cache_t cache;
+    uint64_t delalloc_blocks;  // Dirty pages still without a disk block
+    volatile bool writeback;   // A writeback of this inode is running
+    bool dirty;                // On info->dirty_inodes
+    struct lfs_inode_info* next_dirty;
+
+    // Directories: writers hold dir_lock; dir_seq is odd while they
+    // change blocks that lock-free lookups may be reading
+    spinlock_t dir_lock;
+    volatile uint32_t dir_seq;
+} lfs_inode_info_t;
+
+static lfs_inode_info_t* lfs_iget(lfs_mount_info_t* info, uint32_t inum) {
+    spinlock_acquire(&info->lock);
+    lfs_inode_info_t* ci = radix_tree_lookup(&info->inodes, inum);
+    spinlock_release(&info->lock);
+    if (ci) return ci;
+
+    lfs_inode_info_t* fresh = pmm_alloc(sizeof(lfs_inode_info_t));
+    if (!fresh) return NULL;
+    memset(fresh, 0, sizeof(lfs_inode_info_t));
+    fresh->inum = inum;
+    lfs_read_inode(info, inum, &fresh->disk);
+    fresh->disk_size = fresh->disk.size;
+    page_cache_init(&fresh->cache);
+
+    spinlock_acquire(&info->lock);
+    ci = radix_tree_lookup(&info->inodes, inum);
+    if (!ci && radix_tree_insert(&info->inodes, inum, fresh) == 0) {
+        ci = fresh;
+        fresh = NULL;
+    }
+    spinlock_release(&info->lock);
+
+    if (fresh) pmm_free(fresh, sizeof(lfs_inode_info_t));
+    return ci;
+}
+
+// Under info->lock. Returns whether the list was empty, in which case the
+// caller arms the periodic writeback.
+static bool lfs_add_dirty(lfs_mount_info_t* info, lfs_inode_info_t* ci) {
+    bool first = !info->dirty_inodes;
+    if (!ci->dirty) {
+        ci->dirty = true;
+        ci->next_dirty = info->dirty_inodes;
+        info->dirty_inodes = ci;
+    }
+    return first;
+}
+
+static void lfs_mark_inode_dirty(lfs_mount_info_t* info, lfs_inode_info_t* ci) {
+    spinlock_acquire(&info->lock);
+    bool first = lfs_add_dirty(info, ci);
+    spinlock_release(&info->lock);
+    if (first) queue_delayed_work(system_wq, &info->writeback_work, LFS_WRITEBACK_INTERVAL_MS);
+}
+
+// lfs_map_block against an inode whose tree writeback may be changing:
+// retried if an extent insertion ran meanwhile
+static uint64_t lfs_map_block_stable(lfs_mount_info_t* info, lfs_inode_info_t* ci, uint32_t lblock, uint32_t* run) {
+    lfs_inode_t snapshot;
+    uint64_t phys;
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&ci->map_seq, __ATOMIC_ACQUIRE)) & 1) {
+            __asm__ volatile("pause");
+        }
+        memcpy(&snapshot, &ci->disk, sizeof(lfs_inode_t));
+        phys = lfs_map_block(info, &snapshot, lblock, run);
+    } while (__atomic_load_n(&ci->map_seq, __ATOMIC_ACQUIRE) != seq);
+    return phys;
+}
+
+// --- Extent Tree Insertion ---
+
+// One node on the way from the root to a leaf. Leaf and index entries
+// have the same size and key, so both are handled as lfs_extent_t.
+typedef struct {
+    lfs_extent_header_t* hdr;
+    lfs_extent_t* entries;
+    int idx;               // Entry followed to the next level
+} lfs_ext_path_t;
+
+typedef struct {
+    lfs_mount_info_t* info;
+    lfs_handle_t* handle;
+    lfs_inode_info_t* ci;
+    lfs_ext_path_t path[LFS_MAX_EXTENT_DEPTH + 2];
+    int depth;             // path[0] is the root in the inode, path[depth] the leaf
+
+    // Tree blocks allocated before any node is touched, so a split
+    // cannot run out of space half way through
+    uint64_t spare[LFS_MAX_EXTENT_DEPTH + 1];
+    uint8_t* spare_buf[LFS_MAX_EXTENT_DEPTH + 1];
+    int nspare;
+} lfs_ext_ctx_t;
+
+// Journal credits for writing back one run: the data bitmap block, the
+// tree path, a split with its bitmap block at every level or a new root
+// level, and the inode
+static uint32_t lfs_extent_credits(const lfs_inode_t* inode) {
+    uint32_t depth = inode->extent_header.depth;
+    return 1 + depth + 2 * (depth + 1) + 1;
+}
+
+static void lfs_ext_node_init(lfs_ext_path_t* p, uint8_t* block, uint16_t depth) {
+    p->hdr = (lfs_extent_header_t*)block;
+    p->entries = (lfs_extent_t*)(block + sizeof(lfs_extent_header_t));
+    p->hdr->magic = LFS_EXTENT_MAGIC;
+    p->hdr->entries = 0;
+    p->hdr->max = LFS_EXTENTS_PER_BLOCK;
+    p->hdr->depth = depth;
+}
+
+// Allocates the tree blocks inserting into the leaf will need: one for
+// every full node on the way up, the root's included (a new level).
+// Nothing has been changed if this fails.
+static int lfs_ext_reserve(lfs_ext_ctx_t* ctx, uint64_t goal) {
+    int need = 0;
+    for (int level = ctx->depth; level >= 0; level--) {
+        if (ctx->path[level].hdr->entries < ctx->path[level].hdr->max) break;
+        need++;
+    }
+    if (need > ctx->depth && ctx->depth + 1 > LFS_MAX_EXTENT_DEPTH) return -1;
+
+    while (ctx->nspare < need) {
+        // Near the data they will map
+        uint64_t block = lfs_alloc_block(ctx->info, ctx->handle, ctx->ci->inum, goal);
+        uint8_t* buf = block ? lfs_journal_get_write_access(ctx->handle, block) : NULL;
+        if (!buf) {
+            if (block) lfs_bitmap_free(ctx->info->block_bitmap, ctx->handle, block, 1);
+            while (ctx->nspare > 0) {
+                ctx->nspare--;
+                lfs_bitmap_free(ctx->info->block_bitmap, ctx->handle, ctx->spare[ctx->nspare], 1);
+            }
+            return -1;
+        }
+        memset(buf, 0, LFS_BLOCK_SIZE);
+        ctx->spare[ctx->nspare] = block;
+        ctx->spare_buf[ctx->nspare] = buf;
+        ctx->nspare++;
+    }
+    return 0;
+}
+
+// A fresh tree block from those lfs_ext_reserve set aside
+static uint8_t* lfs_ext_new_block(lfs_ext_ctx_t* ctx, uint64_t* block) {
+    if (ctx->nspare == 0) return NULL;
+    ctx->nspare--;
+    *block = ctx->spare[ctx->nspare];
+    ctx->ci->disk.blocks++;
+    return ctx->spare_buf[ctx->nspare];
+}
+
+// Keeps the index keys above path[level] equal to the node's first key
+static void lfs_ext_fix_keys(lfs_ext_ctx_t* ctx, int level) {
+    while (level > 0 && ctx->path[level].hdr->entries > 0) {
+        lfs_ext_path_t* parent = &ctx->path[level - 1];
+        parent->entries[parent->idx].logical = ctx->path[level].entries[0].logical;
+        if (parent->idx != 0) break;
+        level--;
+    }
+}
+
+static void lfs_ext_put(lfs_ext_path_t* p, const lfs_extent_t* e, int pos) {
+    memmove(&p->entries[pos + 1], &p->entries[pos], (p->hdr->entries - pos) * sizeof(lfs_extent_t));
+    p->entries[pos] = *e;
+    p->hdr->entries++;
+}
+
+// Inserts `e` at `pos` of the node at path[level], splitting full nodes
+// on the way up and adding a level when the root in the inode is full
+static int lfs_ext_insert_at(lfs_ext_ctx_t* ctx, int level, const lfs_extent_t* e, int pos) {
+    lfs_ext_path_t* node = &ctx->path[level];
+
+    if (node->hdr->entries < node->hdr->max) {
+        lfs_ext_put(node, e, pos);
+        if (pos == 0) lfs_ext_fix_keys(ctx, level);
+        return 0;
+    }
+
+    if (level == 0) {
+        // Move the root's entries into a new block below it
+        if (ctx->depth + 1 > LFS_MAX_EXTENT_DEPTH) return -1;
+        uint64_t child;
+        uint8_t* buf = lfs_ext_new_block(ctx, &child);
+        if (!buf) return -1;
+
+        memmove(&ctx->path[2], &ctx->path[1], ctx->depth * sizeof(lfs_ext_path_t));
+        lfs_ext_node_init(&ctx->path[1], buf, node->hdr->depth);
+        memcpy(ctx->path[1].entries, node->entries, node->hdr->entries * sizeof(lfs_extent_t));
+        ctx->path[1].hdr->entries = node->hdr->entries;
+        ctx->path[1].idx = node->idx;
+
+        lfs_extent_index_t* root = (lfs_extent_index_t*)node->entries;
+        root[0].logical = node->entries[0].logical;
+        root[0].reserved = 0;
+        root[0].child = child;
+        node->hdr->entries = 1;
+        node->hdr->depth++;
+        node->idx = 0;
+        ctx->depth++;
+        return lfs_ext_insert_at(ctx, 1, e, pos);
+    }
+
+    // Split: the upper half moves to a new right sibling
+    uint64_t sibling;
+    uint8_t* buf = lfs_ext_new_block(ctx, &sibling);
+    if (!buf) return -1;
+    lfs_ext_path_t right;
+    lfs_ext_node_init(&right, buf, node->hdr->depth);
+
+    int half = node->hdr->entries / 2;
+    right.hdr->entries = node->hdr->entries - half;
+    memcpy(right.entries, &node->entries[half], right.hdr->entries * sizeof(lfs_extent_t));
+    node->hdr->entries = half;
+
+    if (pos <= half) {
+        lfs_ext_put(node, e, pos);
+        if (pos == 0) lfs_ext_fix_keys(ctx, level);
+    } else {
+        lfs_ext_put(&right, e, pos - half);
+    }
+
+    lfs_extent_index_t link = { .logical = right.entries[0].logical, .reserved = 0, .child = sibling };
+    return lfs_ext_insert_at(ctx, level - 1, (const lfs_extent_t*)&link, ctx->path[level - 1].idx + 1);
+}
+
+// Maps file blocks [lblock, lblock + len) to disk blocks from `phys`. The
+// range must be unmapped. Extends a neighbouring extent when the new run
+// continues it on disk.
+static int lfs_extent_insert(lfs_mount_info_t* info, lfs_handle_t* handle, lfs_inode_info_t* ci,
+                             uint32_t lblock, uint64_t phys, uint32_t len) {
+    lfs_ext_ctx_t ctx = { .info = info, .handle = handle, .ci = ci, .depth = 0 };
+    lfs_inode_t* inode = &ci->disk;
+
+    if (inode->extent_header.magic != LFS_EXTENT_MAGIC) {
+        // First extent of a file created before it had a tree
+        inode->extent_header.magic = LFS_EXTENT_MAGIC;
+        inode->extent_header.entries = 0;
+        inode->extent_header.max = LFS_INLINE_EXTENTS;
+        inode->extent_header.depth = 0;
+    }
+
+    ctx.path[0].hdr = &inode->extent_header;
+    ctx.path[0].entries = inode->extent_root.extents;
+    while (ctx.path[ctx.depth].hdr->depth > 0) {
+        lfs_ext_path_t* p = &ctx.path[ctx.depth];
+        int i = lfs_extent_search(p->entries, p->hdr->entries, lblock);
+        if (i < 0) i = 0;
+        p->idx = i;
+        if (ctx.depth + 1 > LFS_MAX_EXTENT_DEPTH) return -1;
+
+        uint8_t* buf = lfs_journal_get_write_access(handle, ((lfs_extent_index_t*)&p->entries[i])->child);
+        if (!buf) return -1;
+        ctx.depth++;
+        ctx.path[ctx.depth].hdr = (lfs_extent_header_t*)buf;
+        ctx.path[ctx.depth].entries = (lfs_extent_t*)(buf + sizeof(lfs_extent_header_t));
+        if (!lfs_extent_header_valid(ctx.path[ctx.depth].hdr, LFS_EXTENTS_PER_BLOCK)) return -1;
+    }
+
+    lfs_ext_path_t* leaf = &ctx.path[ctx.depth];
+    int i = lfs_extent_search(leaf->entries, leaf->hdr->entries, lblock);
+
+    if (i >= 0) {
+        lfs_extent_t* prev = &leaf->entries[i];
+        if (prev->logical + prev->length == lblock && prev->physical + prev->length == phys &&
+            (uint64_t)prev->length + len <= LFS_MAX_EXTENT_LEN) {
+            prev->length += len;
+            return 0;
+        }
+    }
+    if (i + 1 < leaf->hdr->entries) {
+        lfs_extent_t* next = &leaf->entries[i + 1];
+        if (lblock + len == next->logical && phys + len == next->physical &&
+            (uint64_t)next->length + len <= LFS_MAX_EXTENT_LEN) {
+            next->logical = lblock;
+            next->physical = phys;
+            next->length += len;
+            if (i + 1 == 0) lfs_ext_fix_keys(&ctx, ctx.depth);
+            return 0;
+        }
+    }
+
+    lfs_extent_t e = { .logical = lblock, .length = len, .physical = phys };
+    if (lfs_ext_reserve(&ctx, phys) < 0) return -1;
+    return lfs_ext_insert_at(&ctx, ctx.depth, &e, i + 1);
+}
+
+// --- Delayed Allocation Writeback ---
+
+// Reserves space for a page that will get its block at writeback, so a
+// full volume fails the write() rather than the writeback
+static bool lfs_reserve_block(lfs_mount_info_t* info) {
+    bool ok;
+    spinlock_acquire(&info->lock);
+    ok = info->reserved_blocks < info->block_bitmap->free;
+    if (ok) info->reserved_blocks++;
+    spinlock_release(&info->lock);
+    return ok;
+}
+
+static void lfs_unreserve_blocks(lfs_mount_info_t* info, uint64_t count) {
+    spinlock_acquire(&info->lock);
+    info->reserved_blocks -= count;
+    spinlock_release(&info->lock);
+}
+
+// Copies `count` cached pages into one buffer and writes them with a
+// single device request from `phys`
+static void lfs_write_pages(lfs_mount_info_t* info, cached_page_t** pages, uint32_t count, uint64_t phys, uint8_t* bounce) {
+    if (count == 1) {
+        lfs_write_block(info, phys, pages[0]->data);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(bounce + (size_t)i * LFS_BLOCK_SIZE, pages[i]->data, LFS_BLOCK_SIZE);
+    }
+    vfs_write(info->device, phys * LFS_BLOCK_SIZE, (size_t)count * LFS_BLOCK_SIZE, bounce);
+}
+
+// Writes the inode itself when only its size changed
+static void lfs_write_inode_size(lfs_mount_info_t* info, lfs_inode_info_t* ci) {
+    lfs_handle_t handle;
+    if (lfs_journal_start(info->journal, &handle, 1) < 0) return;
+    lfs_inode_t on_disk = ci->disk;
+    on_disk.size = ci->disk_size;
+    lfs_write_inode(info, &handle, ci->inum, &on_disk);
+    lfs_journal_stop(&handle);
+}
+
+// Allocates blocks for a run of consecutive delayed pages, as few extents
+// as the free space allows, and writes the data before the extents are
+// logged. Returns the number of pages written.
+static uint32_t lfs_writeback_delalloc(lfs_mount_info_t* info, lfs_inode_info_t* ci,
+                                       cached_page_t** pages, uint32_t count, uint8_t* bounce) {
+    uint32_t done = 0;
+
+    while (done < count) {
+        lfs_handle_t handle;
+        if (lfs_journal_start(info->journal, &handle, lfs_extent_credits(&ci->disk)) < 0) break;
+
+        // Continue the file's previous block on disk if possible
+        uint32_t lblock = pages[done]->index;
+        uint64_t goal = 0;
+        if (lblock > 0) {
+            uint32_t run;
+            uint64_t prev = lfs_map_block_stable(info, ci, lblock - 1, &run);
+            if (prev) goal = prev + 1;
+        }
+
+        uint32_t len;
+        uint64_t phys = lfs_alloc_blocks(info, &handle, ci->inum, goal, count - done, &len);
+        if (!phys) {
+            lfs_journal_stop(&handle);
+            break;
+        }
+
+        for (uint32_t i = 0; i < len; i++) {
+            page_cache_clear_flags(&ci->cache, pages[done + i], PG_DIRTY);
+        }
+        lfs_write_pages(info, &pages[done], len, phys, bounce);
+
+        __atomic_add_fetch(&ci->map_seq, 1, __ATOMIC_RELEASE);
+        int err = lfs_extent_insert(info, &handle, ci, lblock, phys, len);
+        if (!err) ci->disk.blocks += len;
+        __atomic_add_fetch(&ci->map_seq, 1, __ATOMIC_RELEASE);
+        if (err) {
+            // Give the blocks back and leave the pages delayed and dirty,
+            // so the next writeback tries again
+            print("LimitlessFS: extent insert failed\n");
+            lfs_bitmap_free(info->block_bitmap, &handle, phys, len);
+            for (uint32_t i = 0; i < len; i++) {
+                page_cache_set_flags(&ci->cache, pages[done + i], PG_DIRTY);
+            }
+            lfs_journal_stop(&handle);
+            break;
+        }
+
+        for (uint32_t i = 0; i < len; i++) {
+            page_cache_clear_flags(&ci->cache, pages[done + i], PG_DELALLOC);
+            page_cache_set_flags(&ci->cache, pages[done + i], PG_MAPPED);
+        }
+
+        uint64_t end = (uint64_t)(lblock + len) * LFS_BLOCK_SIZE;
+        if (end > ci->disk.size) end = ci->disk.size;
+        if (end > ci->disk_size) ci->disk_size = end;
+        lfs_inode_t on_disk = ci->disk;
+        on_disk.size = ci->disk_size;
+        lfs_write_inode(info, &handle, ci->inum, &on_disk);
+        lfs_journal_stop(&handle);
+
+        spinlock_acquire(&ci->lock);
+        ci->delalloc_blocks -= len;
+        spinlock_release(&ci->lock);
+        lfs_unreserve_blocks(info, len);
+        done += len;
+    }
+    return done;
+}
+
+// Writes back every dirty page of `ci`. Consecutive delayed pages become
+// one allocation and one device request; pages that already have blocks
+// are rewritten in place, merged while they are contiguous on disk.
+static void lfs_writeback_inode(lfs_mount_info_t* info, lfs_inode_info_t* ci) {
+    if (__atomic_exchange_n(&ci->writeback, true, __ATOMIC_ACQUIRE)) return;
+
+    cached_page_t** pages = pmm_alloc(LFS_MAX_IO_BLOCKS * sizeof(cached_page_t*));
+    uint8_t* bounce = pmm_alloc((size_t)LFS_MAX_IO_BLOCKS * LFS_BLOCK_SIZE);
+    uint64_t next = 0;
+
+    while (pages && bounce) {
+        uint32_t n = page_cache_dirty_pages(&ci->cache, next, pages, LFS_MAX_IO_BLOCKS);
+        if (n == 0) break;
+        next = pages[n - 1]->index + 1;
+
+        for (uint32_t i = 0; i < n; ) {
+            bool delalloc = pages[i]->flags & PG_DELALLOC;
+            uint32_t count = 1;
+            uint32_t run;
+            uint64_t phys = 0;
+
+            if (delalloc) {
+                while (i + count < n && pages[i + count]->index == pages[i]->index + count &&
+                       (pages[i + count]->flags & PG_DELALLOC)) {
+                    count++;
+                }
+                if (lfs_writeback_delalloc(info, ci, &pages[i], count, bounce) < count) {
+                    goto out; // Out of space or journal trouble: retry later
+                }
+            } else {
+                phys = lfs_map_block_stable(info, ci, pages[i]->index, &run);
+                uint32_t shared = pages[i]->flags & PG_SHARED;
+                while (i + count < n && count < run && pages[i + count]->index == pages[i]->index + count &&
+                       !(pages[i + count]->flags & PG_DELALLOC) && (pages[i + count]->flags & PG_SHARED) == shared) {
+                    count++;
+                }
+                for (uint32_t k = 0; k < count; k++) {
+                    page_cache_clear_flags(&ci->cache, pages[i + k], PG_DIRTY);
+                }
+                // Shared pages are the device's memory, written already
+                if (phys && !shared) lfs_write_pages(info, &pages[i], count, phys, bounce);
+            }
+            i += count;
+        }
+    }
+
+    // Pages written in place may have grown the file without new blocks
+    if (ci->disk_size < ci->disk.size && ci->delalloc_blocks == 0) {
+        ci->disk_size = ci->disk.size;
+        lfs_write_inode_size(info, ci);
+    }
+
+out:
+    if (bounce) pmm_free(bounce, (size_t)LFS_MAX_IO_BLOCKS * LFS_BLOCK_SIZE);
+    if (pages) pmm_free(pages, LFS_MAX_IO_BLOCKS * sizeof(cached_page_t*));
+    __atomic_store_n(&ci->writeback, false, __ATOMIC_RELEASE);
+}
+
+// Writes back every dirty inode; runs periodically from system_wq and
+// when a file collects LFS_WRITEBACK_BATCH dirty pages
+static void lfs_writeback_work(work_t* work) {
+    delayed_work_t* dwork = container_of(work, delayed_work_t, work);
+    lfs_mount_info_t* info = container_of(dwork, lfs_mount_info_t, writeback_work);
+
+    spinlock_acquire(&info->lock);
+    lfs_inode_info_t* list = info->dirty_inodes;
+    info->dirty_inodes = NULL;
+    spinlock_release(&info->lock);
+
+    // Each inode keeps its dirty flag until it is done with, which also
+    // keeps lfs_evict from freeing it under us
+    while (list) {
+        lfs_inode_info_t* ci = list;
+        list = ci->next_dirty;
+        lfs_writeback_inode(info, ci);
+
+        spinlock_acquire(&info->lock);
+        ci->dirty = false;
+        bool first = false;
+        // Still dirty: written to meanwhile, or writeback gave up
+        if (ci->cache.nr_dirty || ci->disk_size != ci->disk.size) first = lfs_add_dirty(info, ci);
+        spinlock_release(&info->lock);
+        if (first) queue_delayed_work(system_wq, &info->writeback_work, LFS_WRITEBACK_INTERVAL_MS);
+    }
+}
+
+// --- Directory Index ---
+
+// readdir positions: 0 and 1 are "." and "..", then the names in hash
+// order at (hash + 1) << 32 | rank, the rank being a name's place among
+// those sharing its hash. All names with one hash stay in one leaf, so a
+// position remains valid while other names come and go.
+#define LFS_DIR_POS_END UINT64_MAX
+
+typedef struct {
+    uint32_t block;            // Directory block holding this level
+    uint8_t* data;             // `copy`, or the journal image once written
+    uint8_t* copy;
+    lfs_dx_countlimit_t* cl;
+    lfs_dx_entry_t* entries;
+    int at;                    // Entry followed to the next level
+} lfs_dx_frame_t;
+
+typedef struct {
+    lfs_mount_info_t* info;
+    lfs_inode_info_t* dir;
+    lfs_handle_t* handle;      // NULL for lookups
+    lfs_dx_frame_t frames[LFS_DX_MAX_DEPTH + 1];
+    int levels;                // frames[0] is the root, frames[levels - 1] points at leaves
+    uint8_t* leaf;
+
+    // New blocks a leaf split takes, appended before anything changes
+    uint32_t spare[LFS_DX_MAX_DEPTH + 2];
+    uint8_t* spare_buf[LFS_DX_MAX_DEPTH + 2];
+    int nspare;
+} lfs_dx_ctx_t;
+
+// Journal credits for adding one name: the leaf and each index level may
+// all split, and every new block costs its image, its bitmap block and an
+// extent insertion that may grow the directory's tree by a level
+static uint32_t lfs_dir_credits(const lfs_inode_t* dir) {
+    return (LFS_DX_MAX_DEPTH + 2) * (1 + lfs_extent_credits(dir) + 4);
+}
+
+static uint64_t lfs_dir_pos(uint32_t hash, uint32_t rank) {
+    return ((uint64_t)hash + 1) << 32 | rank;
+}
+
+static uint64_t lfs_dir_bmap(lfs_mount_info_t* info, lfs_inode_info_t* dir, uint32_t dblock) {
+    uint32_t run;
+    if ((uint64_t)dblock * LFS_BLOCK_SIZE >= dir->disk.size) return 0;
+    return lfs_map_block_stable(info, dir, dblock, &run);
+}
+
+// Reads directory block `dblock` into *buf, allocating it on first use
+static int lfs_dir_read(lfs_dx_ctx_t* ctx, uint32_t dblock, uint8_t** buf) {
+    uint64_t phys = lfs_dir_bmap(ctx->info, ctx->dir, dblock);
+    if (!phys) return -1;
+    if (!*buf && !(*buf = pmm_alloc_page())) return -1;
+    lfs_read_meta(ctx->info, phys, *buf);
+    return 0;
+}
+
+static void lfs_dx_release(lfs_dx_ctx_t* ctx) {
+    for (int i = 0; i <= LFS_DX_MAX_DEPTH; i++) {
+        if (ctx->frames[i].copy) pmm_free_page(ctx->frames[i].copy);
+    }
+    if (ctx->leaf) pmm_free_page(ctx->leaf);
+}
+
+// Lock-free readers: retried if a writer changed the directory meanwhile
+static uint32_t lfs_dir_read_begin(lfs_inode_info_t* dir) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&dir->dir_seq, __ATOMIC_ACQUIRE)) & 1) {
+        __asm__ volatile("pause");
+    }
+    return seq;
+}
+
+static bool lfs_dir_read_retry(lfs_inode_info_t* dir, uint32_t seq) {
+    return __atomic_load_n(&dir->dir_seq, __ATOMIC_ACQUIRE) != seq;
+}
+
+// Writers hold dir_lock and bracket each change to the blocks
+static void lfs_dir_write_begin(lfs_inode_info_t* dir) {
+    __atomic_add_fetch(&dir->dir_seq, 1, __ATOMIC_RELEASE);
+}
+
+static void lfs_dir_write_end(lfs_inode_info_t* dir) {
+    __atomic_add_fetch(&dir->dir_seq, 1, __ATOMIC_RELEASE);
+}
+
+// --- Directory Leaves ---
+
+static void lfs_leaf_init(uint8_t* leaf) {
+    lfs_dir_entry_t* e = (lfs_dir_entry_t*)leaf;
+    e->inode = 0;
+    e->rec_len = LFS_BLOCK_SIZE;
+    e->name_len = 0;
+    e->type = 0;
+}
+
+// Returns the entry at *off and steps past it; NULL at the end of the
+// block or at a corrupt entry
+static lfs_dir_entry_t* lfs_leaf_next(uint8_t* leaf, uint32_t* off) {
+    if (*off >= LFS_BLOCK_SIZE) return NULL;
+    lfs_dir_entry_t* e = (lfs_dir_entry_t*)(leaf + *off);
+    if (e->rec_len < LFS_DIR_REC_LEN(0) || (e->rec_len & 3) || *off + e->rec_len > LFS_BLOCK_SIZE ||
+        LFS_DIR_REC_LEN(e->name_len) > e->rec_len) {
+        return NULL;
+    }
+    *off += e->rec_len;
+    return e;
+}
+
+static lfs_dir_entry_t* lfs_leaf_find(uint8_t* leaf, const char* name, uint32_t len) {
+    uint32_t off = 0;
+    lfs_dir_entry_t* e;
+    while ((e = lfs_leaf_next(leaf, &off))) {
+        if (e->name_len == len && memcmp(e->name, name, len) == 0) return e;
+    }
+    return NULL;
+}
+
+// Stores the name in the first gap large enough. False if the leaf is full.
+static bool lfs_leaf_add(uint8_t* leaf, const char* name, uint32_t len, uint32_t inum, uint8_t type) {
+    uint32_t need = LFS_DIR_REC_LEN(len);
+    uint32_t off = 0;
+    lfs_dir_entry_t* e;
+
+    while ((e = lfs_leaf_next(leaf, &off))) {
+        uint32_t used = e->name_len ? LFS_DIR_REC_LEN(e->name_len) : 0;
+        if (e->rec_len - used < need) continue;
+        if (used) {
+            // Take over the slack after a live entry
+            lfs_dir_entry_t* slack = (lfs_dir_entry_t*)((uint8_t*)e + used);
+            slack->rec_len = e->rec_len - used;
+            e->rec_len = used;
+            e = slack;
         }
+        e->inode = inum;
+        e->name_len = len;
+        e->type = type;
+        memcpy(e->name, name, len);
+        return true;
+    }
+    return false;
+}
 
-        if (block_to_read == 0) continue; // Sparse file
+// Orders names by hash, then by name
+static int lfs_dir_cmp(uint32_t ha, const lfs_dir_entry_t* a, uint32_t hb, const lfs_dir_entry_t* b) {
+    if (ha != hb) return ha < hb ? -1 : 1;
+    int c = memcmp(a->name, b->name, a->name_len < b->name_len ? a->name_len : b->name_len);
+    return c ? c : (int)a->name_len - (int)b->name_len;
+}
 
-        lfs_read_block(info, block_to_read, block_buf);
+// Names in the leaf that share e's hash and sort before it
+static uint32_t lfs_leaf_rank(uint8_t* leaf, const lfs_dir_entry_t* e, uint32_t hash) {
+    uint32_t off = 0, rank = 0;
+    lfs_dir_entry_t* x;
+    while ((x = lfs_leaf_next(leaf, &off))) {
+        if (x->name_len && x != e && lfs_dir_hash(x->name, x->name_len) == hash &&
+            lfs_dir_cmp(hash, x, hash, e) < 0) {
+            rank++;
+        }
+    }
+    return rank;
+}
 
-        uint32_t off_in_block = (i == start_block) ? (offset % LFS_BLOCK_SIZE) : 0;
+// --- Index Walk ---
+
+static void lfs_dx_frame_set(lfs_dx_frame_t* f, uint8_t* data) {
+    f->data = data;
+    if (((lfs_dx_root_t*)data)->magic == LFS_DX_ROOT_MAGIC) {
+        f->cl = &((lfs_dx_root_t*)data)->cl;
+        f->entries = ((lfs_dx_root_t*)data)->entries;
+    } else {
+        f->cl = &((lfs_dx_node_t*)data)->cl;
+        f->entries = ((lfs_dx_node_t*)data)->entries;
+    }
+}
+
+// Last entry whose hash is <= `hash`; the first covers everything below
+static int lfs_dx_search(const lfs_dx_entry_t* entries, uint16_t count, uint32_t hash) {
+    int lo = 1, hi = (int)count - 1, found = 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (entries[mid].hash <= hash) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Reads the index from the root down towards `hash`. Returns the directory
+// block of the leaf covering it, or -1 if the index is corrupt.
+static int64_t lfs_dx_probe(lfs_dx_ctx_t* ctx, uint32_t hash) {
+    uint32_t block = 0;
+    int depth = 0;
+
+    ctx->levels = 0;
+    for (int level = 0; level <= depth; level++) {
+        lfs_dx_frame_t* f = &ctx->frames[level];
+        if (lfs_dir_read(ctx, block, &f->copy) < 0) return -1;
+        f->block = block;
+        lfs_dx_frame_set(f, f->copy);
+
+        uint32_t magic = *(uint32_t*)f->data;
+        if (level == 0) {
+            lfs_dx_root_t* root = (lfs_dx_root_t*)f->data;
+            if (magic != LFS_DX_ROOT_MAGIC || root->depth > LFS_DX_MAX_DEPTH) return -1;
+            depth = root->depth;
+        } else if (magic != LFS_DX_NODE_MAGIC) {
+            return -1;
+        }
+        if (f->cl->count == 0 || f->cl->count > f->cl->limit ||
+            f->cl->limit > (level ? LFS_DX_NODE_LIMIT : LFS_DX_ROOT_LIMIT)) {
+            return -1;
+        }
+
+        f->at = lfs_dx_search(f->entries, f->cl->count, hash);
+        block = f->entries[f->at].block;
+        ctx->levels++;
+    }
+    return block;
+}
+
+// Lowest hash of the leaf after the one last probed; false if it was the last
+static bool lfs_dx_next_hash(lfs_dx_ctx_t* ctx, uint32_t* hash) {
+    for (int level = ctx->levels - 1; level >= 0; level--) {
+        lfs_dx_frame_t* f = &ctx->frames[level];
+        if (f->at + 1 < f->cl->count) {
+            *hash = f->entries[f->at + 1].hash;
+            return true;
+        }
+    }
+    return false;
+}
+
+// --- Index Updates ---
+
+// Appends a zeroed block to the directory and returns its journal image
+static uint8_t* lfs_dir_new_block(lfs_mount_info_t* info, lfs_handle_t* handle, lfs_inode_info_t* dir, uint32_t* dblock) {
+    uint32_t nb = dir->disk.size / LFS_BLOCK_SIZE;
+    uint64_t goal = nb ? lfs_dir_bmap(info, dir, nb - 1) : 0;
+    if (goal) goal++;
+
+    uint64_t phys = lfs_alloc_block(info, handle, dir->inum, goal);
+    if (!phys) return NULL;
+
+    __atomic_add_fetch(&dir->map_seq, 1, __ATOMIC_RELEASE);
+    int err = lfs_extent_insert(info, handle, dir, nb, phys, 1);
+    if (!err) {
+        dir->disk.blocks++;
+        dir->disk.size += LFS_BLOCK_SIZE;
+        dir->disk_size = dir->disk.size;
+    }
+    __atomic_add_fetch(&dir->map_seq, 1, __ATOMIC_RELEASE);
+    if (err) {
+        lfs_bitmap_free(info->block_bitmap, handle, phys, 1);
+        return NULL;
+    }
+
+    uint8_t* buf = lfs_journal_get_write_access(handle, phys);
+    if (buf) memset(buf, 0, LFS_BLOCK_SIZE);
+    *dblock = nb;
+    return buf;
+}
+
+// Gives an empty directory its index root and first leaf
+static int lfs_dir_init(lfs_mount_info_t* info, lfs_handle_t* handle, lfs_inode_info_t* dir, uint32_t parent) {
+    uint32_t root_block, leaf_block;
+    uint8_t* buf = lfs_dir_new_block(info, handle, dir, &root_block);
+    if (!buf) return -1;
+
+    lfs_dx_root_t* root = (lfs_dx_root_t*)buf;
+    root->magic = LFS_DX_ROOT_MAGIC;
+    root->self = dir->inum;
+    root->parent = parent;
+    root->hash_version = LFS_DX_HASH_FNV1A;
+    root->depth = 0;
+    root->cl.limit = LFS_DX_ROOT_LIMIT;
+    root->cl.count = 1;
+
+    uint8_t* leaf = lfs_dir_new_block(info, handle, dir, &leaf_block);
+    if (!leaf) return -1;
+    lfs_leaf_init(leaf);
+    root->entries[0].hash = 0;
+    root->entries[0].block = leaf_block;
+    return 0;
+}
+
+// Switches a frame from its read copy to the journal image
+static bool lfs_dx_frame_write(lfs_dx_ctx_t* ctx, lfs_dx_frame_t* f) {
+    if (f->data != f->copy) return true;
+    uint64_t phys = lfs_dir_bmap(ctx->info, ctx->dir, f->block);
+    uint8_t* data = phys ? lfs_journal_get_write_access(ctx->handle, phys) : NULL;
+    if (!data) return false;
+    lfs_dx_frame_set(f, data);
+    return true;
+}
+
+static void lfs_dx_put(lfs_dx_frame_t* f, int pos, const lfs_dx_entry_t* e) {
+    memmove(&f->entries[pos + 1], &f->entries[pos], (f->cl->count - pos) * sizeof(lfs_dx_entry_t));
+    f->entries[pos] = *e;
+    f->cl->count++;
+}
+
+// Gets everything a leaf split will need before any of it is changed:
+// journal images of the index levels that take the new links, and new
+// blocks, one for the leaf and one per full level on the way up (a full
+// root moves down into one). If a block cannot be had, those already
+// appended stay in the directory unused; nothing refers to them.
+static int lfs_dx_prepare_split(lfs_dx_ctx_t* ctx) {
+    int need = 1;
+    int level;
+    for (level = ctx->levels - 1; level >= 0; level--) {
+        lfs_dx_frame_t* f = &ctx->frames[level];
+        if (!lfs_dx_frame_write(ctx, f)) return -1;
+        if (f->cl->count < f->cl->limit) break;
+        need++;
+    }
+    if (level < 0 && ((lfs_dx_root_t*)ctx->frames[0].data)->depth >= LFS_DX_MAX_DEPTH) return -1;
+
+    while (ctx->nspare < need) {
+        uint32_t nb;
+        uint8_t* buf = lfs_dir_new_block(ctx->info, ctx->handle, ctx->dir, &nb);
+        if (!buf) return -1;
+        ctx->spare[ctx->nspare] = nb;
+        ctx->spare_buf[ctx->nspare] = buf;
+        ctx->nspare++;
+    }
+    return 0;
+}
+
+static uint8_t* lfs_dx_new_block(lfs_dx_ctx_t* ctx, uint32_t* dblock) {
+    if (ctx->nspare == 0) return NULL;
+    ctx->nspare--;
+    *dblock = ctx->spare[ctx->nspare];
+    return ctx->spare_buf[ctx->nspare];
+}
+
+// Adds `entry` after the entry followed at frames[level]. A full root
+// moves its entries into a new node below it; a full node splits in half.
+static int lfs_dx_insert(lfs_dx_ctx_t* ctx, int level, const lfs_dx_entry_t* entry) {
+    lfs_dx_frame_t* f = &ctx->frames[level];
+    if (!lfs_dx_frame_write(ctx, f)) return -1;
+
+    if (f->cl->count < f->cl->limit) {
+        lfs_dx_put(f, f->at + 1, entry);
+        return 0;
+    }
+
+    uint32_t nb;
+    uint8_t* buf = lfs_dx_new_block(ctx, &nb);
+    if (!buf) return -1;
+    lfs_dx_node_t* node = (lfs_dx_node_t*)buf;
+    node->magic = LFS_DX_NODE_MAGIC;
+    node->cl.limit = LFS_DX_NODE_LIMIT;
+
+    if (level == 0) {
+        lfs_dx_root_t* root = (lfs_dx_root_t*)f->data;
+        memcpy(node->entries, root->entries, root->cl.count * sizeof(lfs_dx_entry_t));
+        node->cl.count = root->cl.count;
+        root->entries[0].hash = 0;
+        root->entries[0].block = nb;
+        root->cl.count = 1;
+        root->depth++;
+
+        // The new node becomes frames[1]; the spare copy buffer moves along
+        uint8_t* spare = ctx->frames[ctx->levels].copy;
+        memmove(&ctx->frames[2], &ctx->frames[1], (ctx->levels - 1) * sizeof(lfs_dx_frame_t));
+        ctx->levels++;
+        lfs_dx_frame_t* child = &ctx->frames[1];
+        child->block = nb;
+        child->copy = spare;
+        lfs_dx_frame_set(child, buf);
+        child->at = f->at;
+        f->at = 0;
+        return lfs_dx_insert(ctx, 1, entry);
+    }
+
+    int half = f->cl->count / 2;
+    node->cl.count = f->cl->count - half;
+    memcpy(node->entries, &f->entries[half], node->cl.count * sizeof(lfs_dx_entry_t));
+    f->cl->count = half;
+
+    if (f->at + 1 <= half) {
+        lfs_dx_put(f, f->at + 1, entry);
+    } else {
+        lfs_dx_frame_t right = { .cl = &node->cl, .entries = node->entries };
+        lfs_dx_put(&right, f->at + 1 - half, entry);
+    }
+
+    lfs_dx_entry_t link = { .hash = node->entries[0].hash, .block = nb };
+    return lfs_dx_insert(ctx, level - 1, &link);
+}
+
+typedef struct {
+    uint32_t hash;
+    uint32_t off;
+} lfs_dir_slot_t;
+
+// Moves the upper half of a full leaf, by hash, into a new leaf. Names
+// sharing a hash never straddle two leaves.
+static int lfs_dx_split_leaf(lfs_dx_ctx_t* ctx, uint8_t* leaf) {
+    uint32_t max = LFS_BLOCK_SIZE / LFS_DIR_REC_LEN(1);
+    lfs_dir_slot_t* slots = pmm_alloc(max * sizeof(lfs_dir_slot_t));
+    uint8_t* old = pmm_alloc_page();
+    int ret = -1;
+    if (!slots || !old) goto out;
+
+    uint32_t n = 0, off = 0;
+    lfs_dir_entry_t* e;
+    while (n < max && (e = lfs_leaf_next(leaf, &off))) {
+        if (!e->name_len) continue;
+        lfs_dir_slot_t s = { .hash = lfs_dir_hash(e->name, e->name_len), .off = (uint32_t)((uint8_t*)e - leaf) };
+        uint32_t i = n++;
+        while (i > 0 && slots[i - 1].hash > s.hash) {
+            slots[i] = slots[i - 1];
+            i--;
+        }
+        slots[i] = s;
+    }
+
+    // The hash boundary closest to the middle
+    uint32_t split = 0;
+    for (uint32_t d = 0; d <= n / 2 && !split; d++) {
+        uint32_t up = n / 2 + d, down = n / 2 - d;
+        if (up > 0 && up < n && slots[up].hash != slots[up - 1].hash) split = up;
+        else if (down > 0 && down < n && slots[down].hash != slots[down - 1].hash) split = down;
+    }
+    if (!split) {
+        print("LimitlessFS: directory leaf full of one hash\n");
+        goto out;
+    }
+    if (lfs_dx_prepare_split(ctx) < 0) goto out;
+
+    uint32_t split_hash = slots[split].hash;
+    uint32_t nb;
+    uint8_t* right = lfs_dx_new_block(ctx, &nb);
+    lfs_dx_entry_t entry = { .hash = split_hash, .block = nb };
+    if (lfs_dx_insert(ctx, ctx->levels - 1, &entry) < 0) goto out;
+
+    memcpy(old, leaf, LFS_BLOCK_SIZE);
+    lfs_leaf_init(leaf);
+    lfs_leaf_init(right);
+    for (uint32_t i = 0; i < n; i++) {
+        e = (lfs_dir_entry_t*)(old + slots[i].off);
+        lfs_leaf_add(i < split ? leaf : right, e->name, e->name_len, e->inode, e->type);
+    }
+    ret = 0;
+
+out:
+    if (old) pmm_free_page(old);
+    if (slots) pmm_free(slots, max * sizeof(lfs_dir_slot_t));
+    return ret;
+}
+
+// --- Directory Operations ---
+
+// Finds `name` in `dir`, without taking the directory lock
+static int lfs_dir_lookup(lfs_mount_info_t* info, lfs_inode_info_t* dir, const char* name, uint32_t len, uint32_t* inum) {
+    lfs_dx_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.info = info;
+    ctx.dir = dir;
+    uint32_t hash = lfs_dir_hash(name, len);
+    bool dot = len == 1 && name[0] == '.';
+    bool dotdot = len == 2 && name[0] == '.' && name[1] == '.';
+    uint32_t seq;
+    int ret;
+
+    do {
+        seq = lfs_dir_read_begin(dir);
+        ret = -1;
+        int64_t leaf = lfs_dx_probe(&ctx, hash);
+        if (leaf < 0) continue;
+
+        lfs_dx_root_t* root = (lfs_dx_root_t*)ctx.frames[0].data;
+        if (dot || dotdot) {
+            *inum = dot ? root->self : root->parent;
+            ret = 0;
+            continue;
+        }
+        if (lfs_dir_read(&ctx, leaf, &ctx.leaf) < 0) continue;
+        lfs_dir_entry_t* e = lfs_leaf_find(ctx.leaf, name, len);
+        if (e) {
+            *inum = e->inode;
+            ret = 0;
+        }
+    } while (lfs_dir_read_retry(dir, seq));
+
+    lfs_dx_release(&ctx);
+    return ret;
+}
+
+static void lfs_dir_fill(dirent_t* out, const char* name, uint32_t len, uint32_t inum, uint32_t type, uint64_t next) {
+    if (len > FS_NAME_MAX - 1) len = FS_NAME_MAX - 1;
+    memcpy(out->name, name, len);
+    out->name[len] = '\0';
+    out->ino = inum;
+    out->type = type;
+    out->off = next;
+}
+
+// The first name at or after position `pos`, in out. 1 if found, 0 at the end.
+static int lfs_dir_iterate(lfs_mount_info_t* info, lfs_inode_info_t* dir, uint64_t pos, dirent_t* out) {
+    lfs_dx_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.info = info;
+    ctx.dir = dir;
+    uint32_t seq;
+    int ret;
+
+    if (pos == LFS_DIR_POS_END) return 0;
+
+    do {
+        seq = lfs_dir_read_begin(dir);
+        ret = 0;
+        uint32_t hash = pos < 2 ? 0 : (uint32_t)(pos >> 32) - 1;
+        uint32_t rank = pos < 2 ? 0 : (uint32_t)pos;
+
+        for (;;) {
+            int64_t leaf = lfs_dx_probe(&ctx, hash);
+            if (leaf < 0) break;
+
+            lfs_dx_root_t* root = (lfs_dx_root_t*)ctx.frames[0].data;
+            if (pos == 0) {
+                lfs_dir_fill(out, ".", 1, root->self, FS_DIRECTORY, 1);
+                ret = 1;
+                break;
+            }
+            if (pos == 1) {
+                lfs_dir_fill(out, "..", 2, root->parent, FS_DIRECTORY, lfs_dir_pos(0, 0));
+                ret = 1;
+                break;
+            }
+            if (lfs_dir_read(&ctx, leaf, &ctx.leaf) < 0) break;
+
+            // The smallest name at or after (hash, rank), and the one after it
+            lfs_dir_entry_t *best = NULL, *next = NULL, *e;
+            uint32_t best_hash = 0, next_hash = 0, off = 0;
+            while ((e = lfs_leaf_next(ctx.leaf, &off))) {
+                if (!e->name_len) continue;
+                uint32_t h = lfs_dir_hash(e->name, e->name_len);
+                if (h < hash || (h == hash && rank && lfs_leaf_rank(ctx.leaf, e, h) < rank)) continue;
+                if (!best || lfs_dir_cmp(h, e, best_hash, best) < 0) {
+                    next = best;
+                    next_hash = best_hash;
+                    best = e;
+                    best_hash = h;
+                } else if (!next || lfs_dir_cmp(h, e, next_hash, next) < 0) {
+                    next = e;
+                    next_hash = h;
+                }
+            }
+
+            uint32_t following;
+            if (best) {
+                uint64_t after = LFS_DIR_POS_END;
+                if (next) {
+                    after = lfs_dir_pos(next_hash, lfs_leaf_rank(ctx.leaf, next, next_hash));
+                } else if (lfs_dx_next_hash(&ctx, &following)) {
+                    after = lfs_dir_pos(following, 0);
+                }
+                lfs_dir_fill(out, best->name, best->name_len, best->inode, best->type, after);
+                ret = 1;
+                break;
+            }
+
+            // Nothing left in this leaf: carry on with the next one
+            if (!lfs_dx_next_hash(&ctx, &following)) break;
+            hash = following;
+            rank = 0;
+        }
+    } while (lfs_dir_read_retry(dir, seq));
+
+    lfs_dx_release(&ctx);
+    return ret;
+}
+
+// Links `name` to inode `inum` in `dir` under `handle`, which must hold
+// lfs_dir_credits(dir). Fails if the name exists.
+static int lfs_dir_add(lfs_mount_info_t* info, lfs_handle_t* handle, lfs_inode_info_t* dir,
+                       const char* name, uint32_t len, uint32_t inum, uint8_t type) {
+    if (len == 0 || len > LFS_MAX_FILENAME) return -1;
+    if ((len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.')) return -1;
+
+    lfs_dx_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.info = info;
+    ctx.dir = dir;
+    ctx.handle = handle;
+    uint32_t hash = lfs_dir_hash(name, len);
+    uint64_t size = dir->disk.size;
+    int ret = -1;
+
+    spinlock_acquire(&dir->dir_lock);
+
+    if (dir->disk.size == 0) {
+        lfs_dir_write_begin(dir);
+        int err = lfs_dir_init(info, handle, dir, dir->inum);
+        lfs_dir_write_end(dir);
+        if (err < 0) goto out;
+    }
+
+    // Each split makes room on one side; the name may need the other
+    for (int tries = 0; tries <= LFS_DX_MAX_DEPTH + 1; tries++) {
+        int64_t leaf = lfs_dx_probe(&ctx, hash);
+        if (leaf < 0) break;
+        uint64_t phys = lfs_dir_bmap(info, dir, leaf);
+        uint8_t* data = phys ? lfs_journal_get_write_access(handle, phys) : NULL;
+        if (!data || lfs_leaf_find(data, name, len)) break;
+
+        lfs_dir_write_begin(dir);
+        bool added = lfs_leaf_add(data, name, len, inum, type);
+        int err = added ? 0 : lfs_dx_split_leaf(&ctx, data);
+        lfs_dir_write_end(dir);
+        if (added) {
+            ret = 0;
+            break;
+        }
+        if (err < 0) break;
+    }
+
+    if (dir->disk.size != size) lfs_write_inode(info, handle, dir->inum, &dir->disk);
+
+out:
+    spinlock_release(&dir->dir_lock);
+    lfs_dx_release(&ctx);
+    return ret;
+}
+
+// --- VFS Implementation ---
+
+static size_t lfs_read(fs_node_t* node, uint64_t offset, size_t size, void* buffer) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    lfs_inode_info_t* ci = node->impl;
+    uint8_t* out = (uint8_t*)buffer;
+    uint8_t* block_buf = NULL;
+    size_t bytes_read = 0;
+
+    uint64_t file_size = ci->disk.size;
+    if (offset >= file_size) return 0;
+    if (offset + size > file_size) size = file_size - offset;
+
+    while (bytes_read < size) {
+        uint64_t pos = offset + bytes_read;
+        uint32_t lblock = pos / LFS_BLOCK_SIZE;
+        uint32_t off_in_block = pos % LFS_BLOCK_SIZE;
         uint32_t len_in_block = LFS_BLOCK_SIZE - off_in_block;
-        if (len_in_block > (size - bytes_read)) {
+        if (len_in_block > size - bytes_read) {
             len_in_block = size - bytes_read;
         }
 
-        memcpy(buffer + bytes_read, block_buf + off_in_block, len_in_block);
+        // Cached pages may be newer than the disk, or not on it at all.
+        // One that read-ahead is still filling is worth waiting for.
+        cached_page_t* page = page_cache_lookup(&ci->cache, lblock);
+        if (page) page_cache_wait(page);
+        if (page && (page->flags & PG_UPTODATE)) {
+            memcpy(out + bytes_read, page->data + off_in_block, len_in_block);
+            bytes_read += len_in_block;
+            continue;
+        }
+
+        uint32_t run;
+        uint64_t phys = lfs_map_block_stable(info, ci, lblock, &run);
+
+        // Whole blocks go straight into the caller's buffer, one request
+        // per contiguous extent, up to the next cached page
+        uint64_t whole = (size - bytes_read) / LFS_BLOCK_SIZE;
+        if (off_in_block == 0 && whole > 0) {
+            uint32_t count = 1;
+            uint32_t limit = run;
+            if (limit > whole) limit = whole;
+            if (limit > LFS_MAX_IO_BLOCKS) limit = LFS_MAX_IO_BLOCKS;
+            while (count < limit && !page_cache_lookup(&ci->cache, lblock + count)) {
+                count++;
+            }
+
+            if (phys) {
+                lfs_read_blocks(info, phys, count, out + bytes_read);
+            } else {
+                memset(out + bytes_read, 0, (size_t)count * LFS_BLOCK_SIZE);
+            }
+            bytes_read += (size_t)count * LFS_BLOCK_SIZE;
+            continue;
+        }
+
+        // Partial first or last block
+        if (phys) {
+            if (!block_buf) block_buf = pmm_alloc_page();
+            lfs_read_block(info, phys, block_buf);
+            memcpy(out + bytes_read, block_buf + off_in_block, len_in_block);
+        } else {
+            memset(out + bytes_read, 0, len_in_block); // Sparse file
+        }
         bytes_read += len_in_block;
     }
 
-    pmm_free_page(block_buf);
+    if (block_buf) pmm_free_page(block_buf);
     return bytes_read;
 }
 
-static uint32_t lfs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
-    // This is the most complex function.
-    // 1. Begin a journal transaction.
-    // 2. Read the file's inode.
-    // 3. For each block to be written:
-    //    a. If the block doesn't exist, allocate it using lfs_alloc_block.
-    //    b. Update the inode's pointers (direct or indirect).
-    //    c. Add the modified data bitmap block and the modified inode to the journal transaction.
-    //    d. Write the actual file data to the newly allocated block.
-    // 4. Update the inode's size.
-    // 5. Commit the journal transaction.
+// Caches block `phys` of a memory device as file page `index` by pointing
+// the page at the device's own memory: no copy to make and no second copy
+// to keep. NULL without such a device, or if the page got cached first.
+static cached_page_t* lfs_share_page(lfs_mount_info_t* info, lfs_inode_info_t* ci, uint64_t index, uint64_t phys) {
+    if (!info->dax || !phys) return NULL;
+    uint8_t* data = blkdev_direct_access(info->dax, phys * (LFS_BLOCK_SIZE / SECTOR_SIZE), true);
+    if (!data) return NULL;
+    return page_cache_add_shared(&ci->cache, index, data, PG_UPTODATE | PG_MAPPED);
+}
+
+typedef struct {
+    bio_batch_t* batch;
+    page_cache_t* cache;
+    uint32_t nr_pages;
+    uint32_t max_pages;
+    cached_page_t* pages[];
+} lfs_ra_bio_t;
+
+// Pages of a read-ahead bio become readable as soon as it is done, while
+// the rest of the window may still be on its way
+static void lfs_readahead_end_io(bio_t* bio) {
+    lfs_ra_bio_t* ra = bio->private;
+    uint32_t flags = bio->status == BLK_STS_OK ? PG_UPTODATE | PG_MAPPED : 0;
+
+    for (uint32_t i = 0; i < ra->nr_pages; i++) {
+        if (flags) page_cache_set_flags(ra->cache, ra->pages[i], flags);
+        page_cache_clear_flags(ra->cache, ra->pages[i], PG_LOCKED);
+    }
+    bio_batch_done(ra->batch, bio->status);
+    pmm_free(ra, sizeof(lfs_ra_bio_t) + ra->max_pages * sizeof(cached_page_t*));
+    bio_put(bio);
+}
+
+// Reads one run of pages straight into the page cache, in as many bios as
+// the device's limits call for. Out of memory, the pages not submitted are
+// unlocked without data, to be read when someone asks for them.
+static void lfs_readahead_submit(block_device_t* bdev, page_cache_t* cache, uint64_t phys,
+                                 cached_page_t** pages, uint32_t n, bio_batch_t* batch) {
+    uint64_t sector = phys * (LFS_BLOCK_SIZE / SECTOR_SIZE);
+
+    while (n > 0) {
+        uint32_t count = n < BIO_MAX_VECS ? n : BIO_MAX_VECS;
+        bio_t* bio = bio_alloc(bdev, REQ_OP_READ, sector, count);
+        lfs_ra_bio_t* ra = pmm_alloc(sizeof(lfs_ra_bio_t) + count * sizeof(cached_page_t*));
+        uint32_t added = 0;
+        while (bio && ra && added < count && bio_add(bio, pages[added]->data, LFS_BLOCK_SIZE) == 0) {
+            ra->pages[added] = pages[added];
+            added++;
+        }
+        if (added == 0) {
+            if (bio) bio_put(bio);
+            if (ra) pmm_free(ra, sizeof(lfs_ra_bio_t) + count * sizeof(cached_page_t*));
+            for (uint32_t i = 0; i < n; i++) page_cache_clear_flags(cache, pages[i], PG_LOCKED);
+            return;
+        }
+        ra->batch = batch;
+        ra->cache = cache;
+        ra->nr_pages = added;
+        ra->max_pages = count;
+        bio->end_io = lfs_readahead_end_io;
+        bio->private = ra;
+        bio_batch_add(batch);
+        submit_bio(bio);
+
+        sector += (uint64_t)added * (LFS_BLOCK_SIZE / SECTOR_SIZE);
+        pages += added;
+        n -= added;
+    }
+}
+
+// Reads the uncached pages among [first, first + count) into the page
+// cache, one device request per run that is contiguous both in the file
+// and on disk. The pages stay locked until their data is in, so reads and
+// writes that reach them meanwhile wait rather than go to the disk again.
+//
+// On a block device the runs are read straight into the cached pages and
+// all submitted under one plug before waiting for any, so the scheduler
+// sees the whole window at once; each page unlocks when its own bio
+// completes.
+static void lfs_readahead(fs_node_t* node, uint64_t first, uint32_t count) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    lfs_inode_info_t* ci = node->impl;
+    block_device_t* bdev = blkdev_of(info->device);
+
+    uint64_t end = (ci->disk.size + LFS_BLOCK_SIZE - 1) / LFS_BLOCK_SIZE;
+    if (first >= end) return;
+    if (count < end - first) end = first + count;
+
+    cached_page_t** pages = pmm_alloc(LFS_MAX_IO_BLOCKS * sizeof(cached_page_t*));
+    uint8_t* bounce = bdev ? NULL : pmm_alloc((size_t)LFS_MAX_IO_BLOCKS * LFS_BLOCK_SIZE);
+
+    bio_batch_t batch;
+    bio_batch_init(&batch);
+    blk_plug_t plug;
+    blk_start_plug(&plug);
+
+    for (uint64_t index = first; pages && (bdev || bounce) && index < end; ) {
+        uint32_t run;
+        uint64_t phys = lfs_map_block_stable(info, ci, index, &run);
+        uint32_t limit = run;
+        if (limit > end - index) limit = end - index;
+        if (limit > LFS_MAX_IO_BLOCKS) limit = LFS_MAX_IO_BLOCKS;
+
+        if (phys && info->dax) {
+            uint32_t shared = 0;
+            while (shared < limit && lfs_share_page(info, ci, index + shared, phys + shared)) shared++;
+            if (shared > 0) {
+                index += shared;
+                continue;
+            }
+        }
+
+        // Stops at the first page that is already cached
+        uint32_t n = 0;
+        while (n < limit && (pages[n] = page_cache_add_locked(&ci->cache, index + n))) {
+            n++;
+        }
+        if (n == 0) {
+            index++;
+            continue;
+        }
+
+        if (phys && bdev) {
+            lfs_readahead_submit(bdev, &ci->cache, phys, pages, n, &batch);
+            index += n;
+            continue;
+        }
+
+        if (phys) lfs_read_blocks(info, phys, n, bounce);
+        for (uint32_t i = 0; i < n; i++) {
+            // Pages start zeroed, which is right for a hole
+            if (phys) memcpy(pages[i]->data, bounce + (size_t)i * LFS_BLOCK_SIZE, LFS_BLOCK_SIZE);
+            page_cache_set_flags(&ci->cache, pages[i], phys ? PG_UPTODATE | PG_MAPPED : PG_UPTODATE);
+            page_cache_clear_flags(&ci->cache, pages[i], PG_LOCKED);
+        }
+        index += n;
+    }
+
+    blk_finish_plug(&plug);
+    bio_batch_wait(&batch);
+
+    if (bounce) pmm_free(bounce, (size_t)LFS_MAX_IO_BLOCKS * LFS_BLOCK_SIZE);
+    if (pages) pmm_free(pages, LFS_MAX_IO_BLOCKS * sizeof(cached_page_t*));
+}
+
+// Buffered write with delayed allocation: data lands in the page cache and
+// new blocks are only reserved. Writeback allocates them later in runs as
+// long as the free space allows, so streaming writes end up contiguous
+// and cost one journal transaction per run rather than per block.
+static size_t lfs_write(fs_node_t* node, uint64_t offset, size_t size, const void* buffer) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    lfs_inode_info_t* ci = node->impl;
+    const uint8_t* in = (const uint8_t*)buffer;
+    size_t written = 0;
+
+    while (written < size) {
+        uint64_t pos = offset + written;
+        uint32_t lblock = pos / LFS_BLOCK_SIZE;
+        uint32_t off_in_block = pos % LFS_BLOCK_SIZE;
+        uint32_t len_in_block = LFS_BLOCK_SIZE - off_in_block;
+        if (len_in_block > size - written) {
+            len_in_block = size - written;
+        }
+
+        // On a memory device, data for a block the file already has is
+        // written straight into the device's page
+        cached_page_t* page = page_cache_lookup(&ci->cache, lblock);
+        if (!page && info->dax) {
+            uint32_t run;
+            page = lfs_share_page(info, ci, lblock, lfs_map_block_stable(info, ci, lblock, &run));
+        }
+        if (!page) page = page_cache_grab(&ci->cache, lblock);
+        if (!page) break;
+        page_cache_wait(page);
+
+        if (!(page->flags & (PG_MAPPED | PG_DELALLOC))) {
+            uint32_t run;
+            uint64_t phys = lfs_map_block_stable(info, ci, lblock, &run);
+            if (phys) {
+                // A partial write to a block on disk needs the rest of it
+                if (!(page->flags & PG_UPTODATE) && len_in_block < LFS_BLOCK_SIZE) {
+                    lfs_read_block(info, phys, page->data);
+                }
+                page_cache_set_flags(&ci->cache, page, PG_MAPPED | PG_UPTODATE);
+            } else {
+                // A hole: reserve the block that writeback will allocate
+                spinlock_acquire(&ci->lock);
+                bool reserve = !(page->flags & PG_DELALLOC);
+                if (reserve && !lfs_reserve_block(info)) {
+                    spinlock_release(&ci->lock);
+                    break; // Volume full
+                }
+                if (reserve) {
+                    page_cache_set_flags(&ci->cache, page, PG_DELALLOC | PG_UPTODATE);
+                    ci->delalloc_blocks++;
+                }
+                spinlock_release(&ci->lock);
+            }
+        }
+
+        memcpy(page->data + off_in_block, in + written, len_in_block);
+        page_cache_set_flags(&ci->cache, page, PG_DIRTY);
+        written += len_in_block;
+    }
+
+    if (written == 0) return 0;
+
+    spinlock_acquire(&ci->lock);
+    if (offset + written > ci->disk.size) ci->disk.size = offset + written;
+    node->length = ci->disk.size;
+    spinlock_release(&ci->lock);
+
+    lfs_mark_inode_dirty(info, ci);
+    if (ci->cache.nr_dirty >= LFS_WRITEBACK_BATCH) {
+        queue_work(system_wq, &info->writeback_work.work);
+    }
+    return written;
+}
+
+// The node for inode `inum`, shared by every lookup through the inode
+// cache. The in-core inode lives as long as the node does.
+static fs_node_t* lfs_get_node(lfs_mount_info_t* info, uint32_t inum, const char* name) {
+    fs_node_t* node = icache_iget(info, inum);
+    if (!node || !(node->state & ICACHE_NEW)) return node;
+
+    lfs_inode_info_t* ci = lfs_iget(info, inum);
+    if (!ci) {
+        icache_new_failed(node);
+        return NULL;
+    }
+
+    size_t len = strlen(name);
+    if (len > FS_NAME_MAX - 1) len = FS_NAME_MAX - 1;
+    memcpy(node->name, name, len);
+    node->flags = ci->disk.type == FS_DIRECTORY ? FS_DIRECTORY : FS_FILE;
+    node->length = ci->disk.size;
+    node->impl = ci;
+    node->device_info = info;
+
+    node->read = &lfs_read;
+    node->write = &lfs_write;
+    node->readdir = &lfs_readdir;
+    node->finddir = &lfs_finddir;
+    node->create = &lfs_create;
+    node->mkdir = &lfs_mkdir;
+    node->evict = &lfs_evict;
+    node->readahead = &lfs_readahead;
+    icache_new_done(node);
+    return node;
+}
+
+// Called by the inode cache for an unreferenced node it wants to free.
+// An inode with anything unwritten stays; writeback is kicked so a later
+// pass can take it. The cache is locked, and allocations made with
+// info->lock held can land here, so that lock is only tried.
+static int lfs_evict(fs_node_t* node) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    lfs_inode_info_t* ci = node->impl;
+
+    if (!spinlock_try_acquire(&info->lock)) return -1;
+    bool busy = ci->dirty || ci->writeback || ci->cache.nr_dirty || ci->delalloc_blocks ||
+                ci->disk_size != ci->disk.size;
+    if (!busy) radix_tree_delete(&info->inodes, ci->inum);
+    spinlock_release(&info->lock);
+
+    if (busy) {
+        queue_work(system_wq, &info->writeback_work.work);
+        return -1;
+    }
+    page_cache_release(&ci->cache);
+    pmm_free(ci, sizeof(lfs_inode_info_t));
     return 0;
 }
 
-static fs_node_t* lfs_create(fs_node_t* parent, char* name, uint32_t flags) {
-    // 1. Begin journal transaction.
-    // 2. Ensure `name` doesn't already exist in `parent`.
-    // 3. Allocate a new inode for the file (`lfs_alloc_inode`).
-    // 4. Initialize the new inode (size=0, type=FS_FILE).
-    // 5. Add a new directory entry to the parent directory's data, allocating a new
-    //    block for the parent if necessary.
-    // 6. Add all modified metadata (parent inode, child inode, bitmaps) to the journal.
-    // 7. Commit the journal transaction.
-    return NULL;
+static int lfs_readdir(fs_node_t* node, uint64_t index, dirent_t* out) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    return lfs_dir_iterate(info, node->impl, index, out);
 }
 
-// ... implementations for finddir, readdir are complex but follow the same pattern ...
+static fs_node_t* lfs_finddir(fs_node_t* node, const char* name) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)node->device_info;
+    uint32_t inum;
+
+    if (lfs_dir_lookup(info, node->impl, name, strlen(name), &inum) < 0) return NULL;
+    return lfs_get_node(info, inum, name);
+}
+
+// Allocates an inode of `type` and links it into `parent` as `name`, in a
+// single transaction
+// Gives back the blocks of a directory lfs_make built but could not link.
+// Its two blocks fit in the inode, so there are no tree blocks to free.
+static void lfs_dir_discard(lfs_mount_info_t* info, lfs_handle_t* handle, const lfs_inode_t* inode) {
+    if (inode->extent_header.depth) return;
+    for (uint16_t i = 0; i < inode->extent_header.entries; i++) {
+        const lfs_extent_t* e = &inode->extent_root.extents[i];
+        lfs_bitmap_free(info->block_bitmap, handle, e->physical, e->length);
+    }
+}
+
+static int lfs_make(fs_node_t* parent, const char* name, uint16_t type, uint32_t mode) {
+    lfs_mount_info_t* info = (lfs_mount_info_t*)parent->device_info;
+    lfs_inode_info_t* dir = parent->impl;
+    size_t len = strlen(name);
+    uint32_t inum;
+
+    // Longer names could not be returned through dirent_t
+    if (len == 0 || len >= FS_NAME_MAX) return -1;
+    if (lfs_dir_lookup(info, dir, name, len, &inum) == 0) return -1;
+
+    lfs_inode_t inode;
+    memset(&inode, 0, sizeof(inode));
+    inode.type = type;
+    inode.permissions = mode;
+    inode.last_modified = ktime_get_ns();
+    inode.extent_header.magic = LFS_EXTENT_MAGIC;
+    inode.extent_header.max = LFS_INLINE_EXTENTS;
+
+    // The inode bitmap and table blocks, the parent's entry, and for a
+    // directory its first two blocks
+    uint32_t credits = 2 + lfs_dir_credits(&dir->disk);
+    if (type == FS_DIRECTORY) credits += 2 * (1 + lfs_extent_credits(&inode));
+
+    lfs_handle_t handle;
+    if (lfs_journal_start(info->journal, &handle, credits) < 0) return -1;
+
+    // The lookup above ran without the directory lock, so lfs_dir_add can
+    // still find the name taken; everything before the link is undone then
+    int ret = -1;
+    bool written = false;
+    lfs_inode_info_t* ci = NULL;
+    inum = lfs_alloc_inode(info, &handle, dir->inum, type == FS_DIRECTORY);
+    if (!inum) goto out;
+
+    if (type == FS_DIRECTORY) {
+        // Built in a private in-core inode kept out of info->inodes: nothing
+        // reaches the directory before it is linked, and lfs_iget reads it
+        // back through the journal afterwards
+        ci = pmm_alloc(sizeof(lfs_inode_info_t));
+        if (!ci) goto undo;
+        memset(ci, 0, sizeof(lfs_inode_info_t));
+        ci->inum = inum;
+        ci->disk = inode;
+        int err = lfs_dir_init(info, &handle, ci, dir->inum);
+        inode = ci->disk;
+        if (err < 0) goto undo;
+    }
+
+    if (lfs_write_inode(info, &handle, inum, &inode) < 0) goto undo;
+    written = true;
+    ret = lfs_dir_add(info, &handle, dir, name, len, inum, type);
+    if (ret == 0) goto out;
+
+undo:
+    lfs_dir_discard(info, &handle, &inode);
+    if (written) {
+        memset(&inode, 0, sizeof(inode));
+        lfs_write_inode(info, &handle, inum, &inode);
+    }
+    lfs_bitmap_free(info->inode_bitmap, &handle, inum, 1);
+out:
+    if (ci) pmm_free(ci, sizeof(lfs_inode_info_t));
+    lfs_journal_stop(&handle);
+    return ret;
+}
+
+static int lfs_create(fs_node_t* parent, const char* name, uint32_t mode) {
+    return lfs_make(parent, name, FS_FILE, mode);
+}
+
+static int lfs_mkdir(fs_node_t* parent, const char* name, uint32_t mode) {
+    return lfs_make(parent, name, FS_DIRECTORY, mode);
+}
 
 
 void limitlessfs_init() {
@@ -120,32 +1803,71 @@ void limitlessfs_init() {
 
 fs_node_t* limitlessfs_mount(fs_node_t* device) {
     lfs_mount_info_t* info = (lfs_mount_info_t*)pmm_alloc_page();
+    memset(info, 0, PAGE_SIZE);
     info->device = device;
     spinlock_release(&info->lock);
     
-    // Read and verify superblock
-    lfs_read_block(info, 0, (uint8_t*)&info->sb);
+    // Read and verify superblock. The block is larger than the struct, so
+    // read it into a scratch page rather than over the rest of `info`.
+    uint8_t* sb_block = pmm_alloc_page();
+    lfs_read_block(info, 0, sb_block);
+    memcpy(&info->sb, sb_block, sizeof(lfs_superblock_t));
+    pmm_free_page(sb_block);
     if (info->sb.magic != LFS_MAGIC) {
         pmm_free_page(info);
         return NULL;
     }
     
-    // Replay the journal if necessary to ensure consistency
-    // journal_replay(info);
+    // Replay committed transactions before anything reads metadata
+    info->journal = lfs_journal_load(info);
+    if (!info->journal) {
+        print("LimitlessFS: volume has no usable journal\n");
+        pmm_free_page(info);
+        return NULL;
+    }
+
+    // Free-space bitmaps stay cached for the life of the mount
+    info->block_bitmap = pmm_alloc(sizeof(lfs_bitmap_t));
+    info->inode_bitmap = pmm_alloc(sizeof(lfs_bitmap_t));
+    if (info->block_bitmap) memset(info->block_bitmap, 0, sizeof(lfs_bitmap_t));
+    if (info->inode_bitmap) memset(info->inode_bitmap, 0, sizeof(lfs_bitmap_t));
+    if (!info->block_bitmap || !info->inode_bitmap ||
+        lfs_bitmap_load(info, info->block_bitmap, info->sb.data_bitmap_block,
+                        info->sb.total_blocks, info->sb.data_blocks_start) < 0 ||
+        lfs_bitmap_load(info, info->inode_bitmap, info->sb.inode_bitmap_block,
+                        lfs_inode_count(&info->sb), 1) < 0) {
+        print("LimitlessFS: cannot load allocation bitmaps\n");
+        goto fail;
+    }
+
+    // Freed blocks are discarded on devices that support it; the blocks'
+    // own size must be expressible in one discard
+    block_device_t* bdev = blkdev_of(device);
+    info->block_bitmap->discard = bdev && bdev->max_discard_sectors >= LFS_BLOCK_SIZE / SECTOR_SIZE;
+    info->inode_bitmap->discard = false;
+    // A device that is memory lends its pages to the page cache
+    info->dax = bdev && bdev->ops->direct_access ? bdev : NULL;
+
+    radix_tree_init(&info->inodes);
+    info->writeback_work.work.fn = lfs_writeback_work;
 
     // Create and return the VFS root node for this mount
-    fs_node_t* root = (fs_node_t*)pmm_alloc_page();
-    memset(root, 0, sizeof(fs_node_t));
-    strcpy(root->name, "/");
-    root->inode = 0; // Root is always inode 0
+    fs_node_t* root = lfs_get_node(info, LFS_ROOT_INODE, "/");
+    if (!root) goto fail;
     root->flags = FS_DIRECTORY;
-    root->device_info = info;
-
-    root->read = &lfs_read;
-    root->write = &lfs_write;
-    root->readdir = &lfs_readdir;
-    root->finddir = &lfs_finddir;
-    root->create = &lfs_create;
     
     return root;
+
+fail:
+    if (info->block_bitmap) {
+        lfs_bitmap_release(info->block_bitmap);
+        pmm_free(info->block_bitmap, sizeof(lfs_bitmap_t));
+    }
+    if (info->inode_bitmap) {
+        lfs_bitmap_release(info->inode_bitmap);
+        pmm_free(info->inode_bitmap, sizeof(lfs_bitmap_t));
+    }
+    lfs_journal_release(info->journal);
+    pmm_free_page(info);
+    return NULL;
 }
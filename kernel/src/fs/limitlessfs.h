@@ -3,63 +3,43 @@
 
 #include <stdint.h>
 #include "../sync/spinlock.h"
+#include "../lib/radix_tree.h"
+#include "../proc/workqueue.h"
 #include "vfs.h"
+#include <limitless/lfs_format.h>
 
-#define LFS_MAGIC 0x11F5 // LimitlessFS Magic Number
-#define LFS_BLOCK_SIZE 4096
-#define LFS_MAX_FILENAME 252
-#define LFS_DIRECT_POINTERS 12
-#define LFS_INDIRECT_POINTERS (LFS_BLOCK_SIZE / sizeof(uint32_t))
-
-// --- On-Disk Journal Structures ---
-#define LFS_JOURNAL_MAGIC 0xJ001
-typedef enum {
-    JOURNAL_BLOCK_INODE,
-    JOURNAL_BLOCK_DATA_BITMAP,
-    JOURNAL_BLOCK_INODE_BITMAP
-} journal_block_type_t;
-
-typedef struct {
-    uint32_t block_num;      // Original on-disk block number
-    journal_block_type_t type;
-} journal_block_header_t;
+_Static_assert(LFS_TYPE_FILE == FS_FILE && LFS_TYPE_DIR == FS_DIRECTORY, "inode types are VFS node flags");
 
+// In-memory representation of a mounted LFS volume
 typedef struct {
-    uint32_t magic;
-    uint32_t sequence_id;
-    uint32_t num_blocks; // Number of metadata blocks in this transaction
-} journal_transaction_header_t;
-
-
-// --- On-Disk Filesystem Structures ---
-typedef struct {
-    uint32_t magic;
-    uint32_t total_blocks;
-    uint32_t journal_start_block;
-    uint32_t journal_num_blocks;
-    uint32_t inode_bitmap_block;
-    uint32_t data_bitmap_block;
-    uint32_t inode_table_block;
-    uint32_t data_blocks_start;
-} lfs_superblock_t;
-
-typedef struct {
-    uint16_t type; // FS_FILE or FS_DIRECTORY
-    uint16_t permissions;
-    uint32_t uid;
-    uint32_t gid;
-    uint64_t size;
-    uint64_t last_modified;
-    uint64_t security_context_id;
-    uint32_t direct_pointers[LFS_DIRECT_POINTERS];
-    uint32_t indirect_pointer;
-    uint32_t double_indirect_pointer;
-} lfs_inode_t;
-
+    lfs_superblock_t sb;
+    fs_node_t* device;
+    spinlock_t lock;
+    struct lfs_journal* journal;
+    struct lfs_bitmap* block_bitmap;
+    struct lfs_bitmap* inode_bitmap;
+
+    // In-core inodes by number, and the ones with unwritten changes
+    radix_tree_t inodes;
+    struct lfs_inode_info* dirty_inodes;
+    uint64_t reserved_blocks;   // Promised to delayed allocations
+    delayed_work_t writeback_work;
+    struct block_device* dax;   // Set when file pages can be the device's own memory
+} lfs_mount_info_t;
+
+// A run of freed blocks
 typedef struct {
-    uint32_t inode_num;
-    char name[LFS_MAX_FILENAME];
-} lfs_dirent_t;
+    uint64_t first;
+    uint32_t count;
+} lfs_free_extent_t;
+
+// --- Block I/O (shared with lfs_journal.c) ---
+void lfs_read_block(lfs_mount_info_t* info, uint64_t block_num, uint8_t* buf);
+void lfs_write_block(lfs_mount_info_t* info, uint64_t block_num, const uint8_t* buf);
+void lfs_device_flush(lfs_mount_info_t* info);
+// Tells the device the blocks' contents are no longer needed, if it cares
+void lfs_device_discard(lfs_mount_info_t* info, const lfs_free_extent_t* ext, uint32_t count);
+void lfs_read_meta(lfs_mount_info_t* info, uint64_t block_num, uint8_t* buf);
 
 // --- Public Driver Functions ---
 void limitlessfs_init();
@@ -0,0 +1,182 @@
+/* kernel/src/fs/page_cache.c */
+
+#include "page_cache.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+
+void page_cache_init(page_cache_t* pc) {
+    radix_tree_init(&pc->pages);
+    pc->lock = 0;
+    pc->nr_pages = 0;
+    pc->nr_dirty = 0;
+}
+
+cached_page_t* page_cache_lookup(page_cache_t* pc, uint64_t index) {
+    spinlock_acquire(&pc->lock);
+    cached_page_t* page = radix_tree_lookup(&pc->pages, index);
+    spinlock_release(&pc->lock);
+    return page;
+}
+
+// Inserts a new page with `flags` unless `index` is taken. Returns the
+// page now at `index`, and whether it is the new one in *added.
+static cached_page_t* page_cache_insert(page_cache_t* pc, uint64_t index, uint32_t flags, bool* added) {
+    *added = false;
+
+    // Allocate outside the lock; another thread may beat us to the slot
+    cached_page_t* fresh = pmm_alloc(sizeof(cached_page_t));
+    if (!fresh) return NULL;
+    fresh->data = pmm_alloc_page();
+    if (!fresh->data) {
+        pmm_free(fresh, sizeof(cached_page_t));
+        return NULL;
+    }
+    memset(fresh->data, 0, PAGE_SIZE);
+    fresh->index = index;
+    fresh->flags = flags;
+
+    spinlock_acquire(&pc->lock);
+    cached_page_t* page = radix_tree_lookup(&pc->pages, index);
+    if (!page && radix_tree_insert(&pc->pages, index, fresh) == 0) {
+        page = fresh;
+        fresh = NULL;
+        pc->nr_pages++;
+        *added = true;
+    }
+    spinlock_release(&pc->lock);
+
+    if (fresh) {
+        pmm_free_page(fresh->data);
+        pmm_free(fresh, sizeof(cached_page_t));
+    }
+    return page;
+}
+
+cached_page_t* page_cache_grab(page_cache_t* pc, uint64_t index) {
+    cached_page_t* page = page_cache_lookup(pc, index);
+    if (page) return page;
+
+    bool added;
+    return page_cache_insert(pc, index, 0, &added);
+}
+
+cached_page_t* page_cache_add_locked(page_cache_t* pc, uint64_t index) {
+    if (page_cache_lookup(pc, index)) return NULL;
+
+    bool added;
+    cached_page_t* page = page_cache_insert(pc, index, PG_LOCKED, &added);
+    return added ? page : NULL;
+}
+
+cached_page_t* page_cache_add_shared(page_cache_t* pc, uint64_t index, uint8_t* data, uint32_t flags) {
+    cached_page_t* page = pmm_alloc(sizeof(cached_page_t));
+    if (!page) return NULL;
+    page->index = index;
+    page->data = data;
+    page->flags = flags | PG_SHARED;
+
+    spinlock_acquire(&pc->lock);
+    bool added = !radix_tree_lookup(&pc->pages, index) && radix_tree_insert(&pc->pages, index, page) == 0;
+    if (added) pc->nr_pages++;
+    spinlock_release(&pc->lock);
+
+    if (!added) {
+        pmm_free(page, sizeof(cached_page_t));
+        return NULL;
+    }
+    return page;
+}
+
+void page_cache_wait(cached_page_t* page) {
+    while (__atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & PG_LOCKED) {
+        __asm__ volatile("pause");
+    }
+}
+
+void page_cache_set_flags(page_cache_t* pc, cached_page_t* page, uint32_t flags) {
+    spinlock_acquire(&pc->lock);
+    if ((flags & PG_DIRTY) && !(page->flags & PG_DIRTY)) {
+        radix_tree_tag_set(&pc->pages, page->index, PAGE_CACHE_TAG_DIRTY);
+        pc->nr_dirty++;
+    }
+    page->flags |= flags;
+    spinlock_release(&pc->lock);
+}
+
+void page_cache_clear_flags(page_cache_t* pc, cached_page_t* page, uint32_t flags) {
+    spinlock_acquire(&pc->lock);
+    if ((flags & PG_DIRTY) && (page->flags & PG_DIRTY)) {
+        radix_tree_tag_clear(&pc->pages, page->index, PAGE_CACHE_TAG_DIRTY);
+        pc->nr_dirty--;
+    }
+    page->flags &= ~flags;
+    spinlock_release(&pc->lock);
+}
+
+uint32_t page_cache_dirty_pages(page_cache_t* pc, uint64_t first, cached_page_t** pages, uint32_t max) {
+    spinlock_acquire(&pc->lock);
+    uint32_t n = radix_tree_gang_lookup_tag(&pc->pages, (void**)pages, first, max, PAGE_CACHE_TAG_DIRTY);
+    spinlock_release(&pc->lock);
+    return n;
+}
+
+void page_cache_release(page_cache_t* pc) {
+    cached_page_t* pages[16];
+    uint32_t n;
+
+    spinlock_acquire(&pc->lock);
+    while ((n = radix_tree_gang_lookup(&pc->pages, (void**)pages, 0, 16)) > 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            radix_tree_delete(&pc->pages, pages[i]->index);
+            if (!(pages[i]->flags & PG_SHARED)) pmm_free_page(pages[i]->data);
+            pmm_free(pages[i], sizeof(cached_page_t));
+        }
+    }
+    pc->nr_pages = 0;
+    pc->nr_dirty = 0;
+    spinlock_release(&pc->lock);
+}
+
+uint64_t page_cache_truncate(page_cache_t* pc, uint64_t first) {
+    cached_page_t* pages[16];
+    uint64_t freed = 0;
+    uint32_t n;
+
+    spinlock_acquire(&pc->lock);
+    while ((n = radix_tree_gang_lookup(&pc->pages, (void**)pages, first, 16)) > 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (pages[i]->flags & PG_DIRTY) pc->nr_dirty--;
+            radix_tree_delete(&pc->pages, pages[i]->index);
+            if (!(pages[i]->flags & PG_SHARED)) {
+                pmm_free_page(pages[i]->data);
+                freed++;
+            }
+            pmm_free(pages[i], sizeof(cached_page_t));
+        }
+        pc->nr_pages -= n;
+    }
+    spinlock_release(&pc->lock);
+    return freed;
+}
+
+int page_cache_unshare(page_cache_t* pc, cached_page_t* page, size_t len) {
+    if (!(__atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & PG_SHARED)) return 0;
+
+    // Copy outside the lock; the shared data stays valid, and a racing
+    // unshare leaves ours unused
+    uint8_t* data = pmm_alloc_page();
+    if (!data) return -1;
+    memcpy(data, page->data, len);
+    memset(data + len, 0, PAGE_SIZE - len);
+
+    spinlock_acquire(&pc->lock);
+    bool won = page->flags & PG_SHARED;
+    if (won) {
+        page->data = data;
+        page->flags &= ~PG_SHARED;
+    }
+    spinlock_release(&pc->lock);
+
+    if (!won) pmm_free_page(data);
+    return won ? 1 : 0;
+}
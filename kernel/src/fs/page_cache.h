@@ -0,0 +1,75 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../sync/spinlock.h"
+#include "../lib/radix_tree.h"
+
+// Per-file cache of file pages, indexed by page number. Filesystems decide
+// what the page flags mean for their on-disk state; the cache only keeps
+// the pages and finds the dirty ones quickly.
+
+#define PG_UPTODATE 0x01 // Contents valid
+#define PG_DIRTY    0x02 // Newer than the disk
+#define PG_MAPPED   0x04 // Has a disk block
+#define PG_DELALLOC 0x08 // Disk space reserved, block not allocated yet
+#define PG_LOCKED   0x10 // Being read in; contents not to be touched yet
+#define PG_SHARED   0x20 // Data is the block device's own memory; not freed with the page
+
+#define PAGE_CACHE_TAG_DIRTY 0
+
+typedef struct {
+    uint64_t index;
+    uint8_t* data;
+    uint32_t flags;
+} cached_page_t;
+
+typedef struct {
+    radix_tree_t pages;
+    spinlock_t lock;    // Protects the tree, counters and page flags
+    uint64_t nr_pages;
+    uint64_t nr_dirty;
+} page_cache_t;
+
+void page_cache_init(page_cache_t* pc);
+
+cached_page_t* page_cache_lookup(page_cache_t* pc, uint64_t index);
+
+// Returns the page at `index`, adding a zeroed one (without PG_UPTODATE)
+// if there is none. NULL when out of memory.
+cached_page_t* page_cache_grab(page_cache_t* pc, uint64_t index);
+
+// Adds a zeroed page at `index` with PG_LOCKED set, for the caller to
+// read in and then unlock. NULL if the page is already cached or memory
+// ran out, so read-ahead leaves pages it finds alone.
+cached_page_t* page_cache_add_locked(page_cache_t* pc, uint64_t index);
+
+// Adds a page at `index` whose data is `data`, memory the cache does not
+// own (PG_SHARED), with `flags` besides. NULL if the page is already
+// cached or memory ran out.
+cached_page_t* page_cache_add_shared(page_cache_t* pc, uint64_t index, uint8_t* data, uint32_t flags);
+
+// Waits until a read-in of `page` has finished
+void page_cache_wait(cached_page_t* page);
+
+void page_cache_set_flags(page_cache_t* pc, cached_page_t* page, uint32_t flags);
+void page_cache_clear_flags(page_cache_t* pc, cached_page_t* page, uint32_t flags);
+
+// Frees every page. The caller makes sure none is dirty and nobody else
+// is using the cache.
+void page_cache_release(page_cache_t* pc);
+
+// Frees the pages from `first` on and returns how many of them had data
+// of their own (not PG_SHARED). The caller makes sure nobody is using them.
+uint64_t page_cache_truncate(page_cache_t* pc, uint64_t first);
+
+// Gives a PG_SHARED page data of its own: the first `len` bytes are copied,
+// the rest zeroed. 1 if this call made the copy, 0 if the page already had
+// its own data, -1 when out of memory.
+int page_cache_unshare(page_cache_t* pc, cached_page_t* page, size_t len);
+
+// Up to `max` dirty pages with index >= `first`, in index order
+uint32_t page_cache_dirty_pages(page_cache_t* pc, uint64_t first, cached_page_t** pages, uint32_t max);
+
+#endif
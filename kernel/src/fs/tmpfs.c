@@ -0,0 +1,451 @@
+/* kernel/src/fs/tmpfs.c */
+
+#include "tmpfs.h"
+#include "icache.h"
+#include "page_cache.h"
+#include "../mem/pmm.h"
+#include "../mem/buddy.h"
+#include "../lib/radix_tree.h"
+#include "../lib/string.h"
+#include "../sync/spinlock.h"
+#include "../proc/vdso.h"
+
+#define TMPFS_ROOT_INO 1
+
+// readdir positions: 0 and 1 are "." and "..", then one per name in the
+// order the names were added. A position stays valid while other names
+// come and go.
+#define TMPFS_FIRST_POS 2
+
+typedef struct {
+    uint64_t max_pages;
+    volatile uint64_t nr_pages;  // File pages held by every inode
+    volatile uint64_t next_ino;
+} tmpfs_info_t;
+
+typedef struct {
+    fs_node_t* node;   // Holds the link's reference
+    uint64_t pos;
+    uint32_t len;
+    char name[FS_NAME_MAX];
+} tmpfs_dirent_t;
+
+typedef struct {
+    spinlock_t lock;      // The size, nlink, and a directory's entries
+    uint32_t nlink;       // 0 once unlinked; no names are added to such a directory
+    uint64_t parent;      // Inode of ".."
+    page_cache_t cache;   // File data
+    radix_tree_t entries; // Directory entries by readdir position
+    uint64_t next_pos;
+    uint64_t nr_entries;
+} tmpfs_inode_t;
+
+static size_t tmpfs_read(fs_node_t* node, uint64_t offset, size_t size, void* buffer);
+static size_t tmpfs_write(fs_node_t* node, uint64_t offset, size_t size, const void* buffer);
+static int tmpfs_truncate(fs_node_t* node, uint64_t length);
+static void* tmpfs_mmap(fs_node_t* node, uint64_t offset, size_t size, uint32_t prot, uint32_t flags);
+static int tmpfs_readdir(fs_node_t* node, uint64_t index, dirent_t* out);
+static fs_node_t* tmpfs_finddir(fs_node_t* node, const char* name);
+static int tmpfs_create(fs_node_t* parent, const char* name, uint32_t mode);
+static int tmpfs_mkdir(fs_node_t* parent, const char* name, uint32_t mode);
+static int tmpfs_unlink(fs_node_t* parent, const char* name);
+static int tmpfs_rmdir(fs_node_t* parent, const char* name);
+static int tmpfs_evict(fs_node_t* node);
+
+// --- Inodes ---
+
+// Counts a page of file data against the size of the instance
+static bool tmpfs_charge(tmpfs_info_t* info) {
+    if (__atomic_add_fetch(&info->nr_pages, 1, __ATOMIC_RELAXED) > info->max_pages) {
+        __atomic_sub_fetch(&info->nr_pages, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+static void tmpfs_uncharge(tmpfs_info_t* info, uint64_t nr) {
+    __atomic_sub_fetch(&info->nr_pages, nr, __ATOMIC_RELAXED);
+}
+
+// A new inode of `type`, unlinked as yet. The node is still ICACHE_NEW, so
+// the caller either links it and calls icache_new_done(), or undoes it
+// with tmpfs_discard().
+static fs_node_t* tmpfs_new_node(tmpfs_info_t* info, uint32_t type, uint32_t mode, uint64_t parent) {
+    uint64_t ino = __atomic_fetch_add(&info->next_ino, 1, __ATOMIC_RELAXED);
+    fs_node_t* node = icache_iget(info, ino);
+    if (!node) return NULL;
+
+    tmpfs_inode_t* ti = pmm_alloc(sizeof(tmpfs_inode_t));
+    if (!ti) {
+        icache_new_failed(node);
+        return NULL;
+    }
+    memset(ti, 0, sizeof(tmpfs_inode_t));
+    ti->nlink = 1;
+    ti->parent = parent;
+    ti->next_pos = TMPFS_FIRST_POS;
+    page_cache_init(&ti->cache);
+    radix_tree_init(&ti->entries);
+
+    uint64_t now = ktime_get_ns();
+    node->flags = type;
+    node->mask = mode;
+    node->atime = node->mtime = node->ctime = now;
+    node->impl = ti;
+    node->device_info = info;
+
+    if (type == FS_DIRECTORY) {
+        node->readdir = &tmpfs_readdir;
+        node->finddir = &tmpfs_finddir;
+        node->create = &tmpfs_create;
+        node->mkdir = &tmpfs_mkdir;
+        node->unlink = &tmpfs_unlink;
+        node->rmdir = &tmpfs_rmdir;
+    } else {
+        node->read = &tmpfs_read;
+        node->write = &tmpfs_write;
+        node->truncate = &tmpfs_truncate;
+        node->mmap = &tmpfs_mmap;
+    }
+    node->evict = &tmpfs_evict;
+    return node;
+}
+
+static void tmpfs_discard(fs_node_t* node) {
+    pmm_free(node->impl, sizeof(tmpfs_inode_t));
+    icache_new_failed(node);
+}
+
+// Called by the inode cache once the last reference is gone. Only an
+// unlinked inode gets here; its data lives nowhere else, so a linked one
+// would be refused.
+static int tmpfs_evict(fs_node_t* node) {
+    tmpfs_info_t* info = node->device_info;
+    tmpfs_inode_t* ti = node->impl;
+
+    if (ti->nlink) return -1;
+    tmpfs_uncharge(info, page_cache_truncate(&ti->cache, 0));
+    pmm_free(ti, sizeof(tmpfs_inode_t));
+    return 0;
+}
+
+// --- File Data ---
+
+// The page at `index`, added zeroed if the file has none there. NULL when
+// the instance is full or memory ran out.
+static cached_page_t* tmpfs_get_page(tmpfs_info_t* info, tmpfs_inode_t* ti, uint64_t index) {
+    cached_page_t* page = page_cache_lookup(&ti->cache, index);
+    if (page) return page;
+
+    if (!tmpfs_charge(info)) return NULL;
+    // Pages come zeroed; a writer racing us for the slot keeps its own
+    page = page_cache_add_locked(&ti->cache, index);
+    if (page) {
+        page_cache_clear_flags(&ti->cache, page, PG_LOCKED);
+        page_cache_set_flags(&ti->cache, page, PG_UPTODATE);
+        return page;
+    }
+    tmpfs_uncharge(info, 1);
+    return page_cache_lookup(&ti->cache, index);
+}
+
+// Gives a page lent by tmpfs_set_shared() a copy of its own before it is
+// changed. Of the lent memory, only what lies before `length` (the end of
+// the file) is the file's. -1 when full or out of memory.
+static int tmpfs_unshare(tmpfs_info_t* info, tmpfs_inode_t* ti, cached_page_t* page, uint64_t length) {
+    if (!(page->flags & PG_SHARED)) return 0;
+
+    uint64_t start = page->index * PAGE_SIZE;
+    size_t valid = length <= start ? 0 : length - start < PAGE_SIZE ? length - start : PAGE_SIZE;
+    if (!tmpfs_charge(info)) return -1;
+    int ret = page_cache_unshare(&ti->cache, page, valid);
+    if (ret != 1) tmpfs_uncharge(info, 1);
+    return ret < 0 ? -1 : 0;
+}
+
+static size_t tmpfs_read(fs_node_t* node, uint64_t offset, size_t size, void* buffer) {
+    tmpfs_inode_t* ti = node->impl;
+    uint8_t* out = buffer;
+
+    spinlock_acquire(&ti->lock);
+    uint64_t length = node->length;
+    spinlock_release(&ti->lock);
+    if (offset >= length) return 0;
+    if (size > length - offset) size = length - offset;
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        size_t off_in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - off_in_page;
+        if (chunk > size - done) chunk = size - done;
+
+        cached_page_t* page = page_cache_lookup(&ti->cache, pos / PAGE_SIZE);
+        if (page) memcpy(out + done, page->data + off_in_page, chunk);
+        else memset(out + done, 0, chunk); // Sparse file
+        done += chunk;
+    }
+    node->atime = ktime_get_ns();
+    return done;
+}
+
+static size_t tmpfs_write(fs_node_t* node, uint64_t offset, size_t size, const void* buffer) {
+    tmpfs_info_t* info = node->device_info;
+    tmpfs_inode_t* ti = node->impl;
+    const uint8_t* in = buffer;
+    size_t done = 0;
+
+    spinlock_acquire(&ti->lock);
+    uint64_t length = node->length;
+    spinlock_release(&ti->lock);
+
+    while (done < size) {
+        uint64_t pos = offset + done;
+        size_t off_in_page = pos % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - off_in_page;
+        if (chunk > size - done) chunk = size - done;
+
+        cached_page_t* page = tmpfs_get_page(info, ti, pos / PAGE_SIZE);
+        if (!page || tmpfs_unshare(info, ti, page, length) < 0) break; // Full
+        memcpy(page->data + off_in_page, in + done, chunk);
+        done += chunk;
+    }
+    if (done == 0) return 0;
+
+    spinlock_acquire(&ti->lock);
+    if (offset + done > node->length) node->length = offset + done;
+    node->mtime = node->ctime = ktime_get_ns();
+    spinlock_release(&ti->lock);
+    return done;
+}
+
+static int tmpfs_truncate(fs_node_t* node, uint64_t length) {
+    tmpfs_info_t* info = node->device_info;
+    tmpfs_inode_t* ti = node->impl;
+
+    spinlock_acquire(&ti->lock);
+    uint64_t old = node->length;
+    spinlock_release(&ti->lock);
+
+    // The rest of the new last page is cleared so growing the file again
+    // shows zeroes
+    if (length < old && length % PAGE_SIZE) {
+        cached_page_t* page = page_cache_lookup(&ti->cache, length / PAGE_SIZE);
+        if (page && tmpfs_unshare(info, ti, page, length) < 0) return -1;
+        if (page) memset(page->data + length % PAGE_SIZE, 0, PAGE_SIZE - length % PAGE_SIZE);
+    }
+
+    spinlock_acquire(&ti->lock);
+    node->length = length;
+    node->mtime = node->ctime = ktime_get_ns();
+    spinlock_release(&ti->lock);
+
+    // A longer file gets a hole, which reads as zeroes; a shorter one
+    // loses its pages past the end
+    if (length < old) {
+        tmpfs_uncharge(info, page_cache_truncate(&ti->cache, (length + PAGE_SIZE - 1) / PAGE_SIZE));
+    }
+    return 0;
+}
+
+static void* tmpfs_mmap(fs_node_t* node, uint64_t offset, size_t size, uint32_t prot, uint32_t flags) {
+    (void)flags;
+    tmpfs_inode_t* ti = node->impl;
+
+    spinlock_acquire(&ti->lock);
+    uint64_t length = node->length;
+    spinlock_release(&ti->lock);
+    if (offset >= length || size > PAGE_SIZE - offset % PAGE_SIZE) return NULL;
+
+    // A lent page is mapped as it is unless it could be written, or is
+    // not page-aligned and so cannot be mapped at all
+    cached_page_t* page = tmpfs_get_page(node->device_info, ti, offset / PAGE_SIZE);
+    if (page && (page->flags & PG_SHARED) && ((prot & PROT_WRITE) || ((uintptr_t)page->data % PAGE_SIZE)) &&
+        tmpfs_unshare(node->device_info, ti, page, length) < 0) {
+        return NULL;
+    }
+    return page ? page->data + offset % PAGE_SIZE : NULL;
+}
+
+int tmpfs_set_shared(fs_node_t* node, const void* data, uint64_t size) {
+    tmpfs_inode_t* ti = node->impl;
+    if (node->read != &tmpfs_read || node->length || ti->cache.nr_pages) return -1;
+
+    for (uint64_t index = 0; index * PAGE_SIZE < size; index++) {
+        if (!page_cache_add_shared(&ti->cache, index, (uint8_t*)data + index * PAGE_SIZE, PG_UPTODATE)) {
+            page_cache_truncate(&ti->cache, 0);
+            return -1;
+        }
+    }
+
+    spinlock_acquire(&ti->lock);
+    node->length = size;
+    spinlock_release(&ti->lock);
+    return 0;
+}
+
+// --- Directories ---
+
+// The entry for `name`, with dir->lock held
+static tmpfs_dirent_t* tmpfs_dir_lookup(tmpfs_inode_t* dir, const char* name, size_t len) {
+    tmpfs_dirent_t* batch[16];
+    uint64_t pos = TMPFS_FIRST_POS;
+    uint32_t n;
+
+    while ((n = radix_tree_gang_lookup(&dir->entries, (void**)batch, pos, 16)) > 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (batch[i]->len == len && memcmp(batch[i]->name, name, len) == 0) return batch[i];
+        }
+        pos = batch[n - 1]->pos + 1;
+    }
+    return NULL;
+}
+
+static int tmpfs_readdir(fs_node_t* node, uint64_t index, dirent_t* out) {
+    tmpfs_inode_t* dir = node->impl;
+
+    memset(out, 0, sizeof(dirent_t));
+    if (index < TMPFS_FIRST_POS) {
+        strcpy(out->name, index == 0 ? "." : "..");
+        out->ino = index == 0 ? node->inode : dir->parent;
+        out->type = FS_DIRECTORY;
+        out->off = index + 1;
+        return 1;
+    }
+
+    tmpfs_dirent_t* e;
+    spinlock_acquire(&dir->lock);
+    int ret = radix_tree_gang_lookup(&dir->entries, (void**)&e, index, 1);
+    if (ret) {
+        memcpy(out->name, e->name, e->len);
+        out->ino = e->node->inode;
+        out->type = e->node->flags;
+        out->off = e->pos + 1;
+    }
+    spinlock_release(&dir->lock);
+    return ret;
+}
+
+static fs_node_t* tmpfs_finddir(fs_node_t* node, const char* name) {
+    tmpfs_inode_t* dir = node->impl;
+
+    spinlock_acquire(&dir->lock);
+    tmpfs_dirent_t* e = tmpfs_dir_lookup(dir, name, strlen(name));
+    fs_node_t* child = e ? vfs_node_get(e->node) : NULL;
+    spinlock_release(&dir->lock);
+    return child;
+}
+
+// Creates an inode of `type` and links it into `parent` as `name`
+static int tmpfs_make(fs_node_t* parent, const char* name, uint32_t type, uint32_t mode) {
+    tmpfs_info_t* info = parent->device_info;
+    tmpfs_inode_t* dir = parent->impl;
+    size_t len = strlen(name);
+
+    // Longer names could not be returned through dirent_t
+    if (len == 0 || len >= FS_NAME_MAX) return -1;
+
+    tmpfs_dirent_t* e = pmm_alloc(sizeof(tmpfs_dirent_t));
+    if (!e) return -1;
+    fs_node_t* node = tmpfs_new_node(info, type, mode, parent->inode);
+    if (!node) {
+        pmm_free(e, sizeof(tmpfs_dirent_t));
+        return -1;
+    }
+    memcpy(node->name, name, len);
+    memcpy(e->name, name, len);
+    e->len = len;
+    e->node = node;
+
+    int ret = -1;
+    spinlock_acquire(&dir->lock);
+    if (dir->nlink && !tmpfs_dir_lookup(dir, name, len)) {
+        e->pos = dir->next_pos;
+        ret = radix_tree_insert(&dir->entries, e->pos, e);
+    }
+    if (ret == 0) {
+        dir->next_pos++;
+        dir->nr_entries++;
+        parent->length = dir->nr_entries;
+        parent->mtime = parent->ctime = node->ctime;
+    }
+    spinlock_release(&dir->lock);
+
+    if (ret < 0) {
+        tmpfs_discard(node);
+        pmm_free(e, sizeof(tmpfs_dirent_t));
+        return -1;
+    }
+    icache_new_done(node);
+    return 0;
+}
+
+static int tmpfs_create(fs_node_t* parent, const char* name, uint32_t mode) {
+    return tmpfs_make(parent, name, FS_FILE, mode);
+}
+
+static int tmpfs_mkdir(fs_node_t* parent, const char* name, uint32_t mode) {
+    return tmpfs_make(parent, name, FS_DIRECTORY, mode);
+}
+
+// Unlinks `name` from `parent` if it is a directory exactly when
+// `want_dir`, and an empty one at that. The node goes once its last user
+// lets go of it.
+static int tmpfs_remove(fs_node_t* parent, const char* name, bool want_dir) {
+    tmpfs_inode_t* dir = parent->impl;
+    int ret = -1;
+
+    spinlock_acquire(&dir->lock);
+    tmpfs_dirent_t* e = tmpfs_dir_lookup(dir, name, strlen(name));
+    if (e && !!(e->node->flags & FS_DIRECTORY) == want_dir) {
+        tmpfs_inode_t* ti = e->node->impl;
+        spinlock_acquire(&ti->lock);
+        if (!want_dir || ti->nr_entries == 0) {
+            ti->nlink = 0;
+            ret = 0;
+        }
+        spinlock_release(&ti->lock);
+    }
+    if (ret == 0) {
+        radix_tree_delete(&dir->entries, e->pos);
+        dir->nr_entries--;
+        parent->length = dir->nr_entries;
+        parent->mtime = parent->ctime = ktime_get_ns();
+    }
+    spinlock_release(&dir->lock);
+
+    if (ret < 0) return -1;
+    vfs_node_put(e->node);
+    pmm_free(e, sizeof(tmpfs_dirent_t));
+    return 0;
+}
+
+static int tmpfs_unlink(fs_node_t* parent, const char* name) {
+    return tmpfs_remove(parent, name, false);
+}
+
+static int tmpfs_rmdir(fs_node_t* parent, const char* name) {
+    return tmpfs_remove(parent, name, true);
+}
+
+// --- Mount ---
+
+fs_node_t* tmpfs_mount(uint64_t max_size) {
+    tmpfs_info_t* info = pmm_alloc(sizeof(tmpfs_info_t));
+    if (!info) return NULL;
+    memset(info, 0, sizeof(tmpfs_info_t));
+    info->max_pages = max_size ? (max_size + PAGE_SIZE - 1) / PAGE_SIZE : buddy_total_pages() / 2;
+    info->next_ino = TMPFS_ROOT_INO;
+
+    fs_node_t* root = tmpfs_new_node(info, FS_DIRECTORY, 0755, TMPFS_ROOT_INO);
+    if (!root) {
+        pmm_free(info, sizeof(tmpfs_info_t));
+        return NULL;
+    }
+    strcpy(root->name, "/");
+    icache_new_done(root);
+
+    // One reference stands for the root's link and is never dropped; the
+    // other goes to the caller
+    return vfs_node_get(root);
+}
@@ -0,0 +1,32 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include "vfs.h"
+
+// In-memory filesystem. File data lives in page-cache pages with nothing
+// underneath, so a file's cache is the file: pages are never written back
+// and are freed when the file is truncated, or unlinked and closed. Every
+// linked inode keeps a reference on its node, so the inode cache never
+// evicts one that can still be looked up.
+//
+// mmap returns the page of file data holding `offset`, for the caller to
+// map; a range may not cross a page boundary or the end of the file.
+//
+// A file's data can also be memory tmpfs does not own, such as a boot
+// module: its pages then point into that memory, and each is copied the
+// first time it is written.
+
+// Creates an instance that may hold up to `max_size` bytes of file data
+// (0: half of memory) and returns its root directory, with a reference
+// taken. NULL when out of memory.
+fs_node_t* tmpfs_mount(uint64_t max_size);
+
+// Makes the `size` bytes at `data` the contents of the empty tmpfs file
+// `node`, without copying them. The memory must stay valid and unchanged
+// for as long as the file exists; it does not count against the size of
+// the instance until written. -1 if the file is not empty, or is not on
+// a tmpfs, or memory ran out.
+int tmpfs_set_shared(fs_node_t* node, const void* data, uint64_t size);
+
+#endif
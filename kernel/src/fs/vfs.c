@@ -1,14 +1,32 @@
 #include "vfs.h"
+#include "dcache.h"
+#include "icache.h"
+#include "file.h"
+#include "tmpfs.h"
 #include "../mem/pmm.h"
 #include "../lib/string.h"
 
-fs_node_t *fs_root = 0;
+fs_node_t *vfs_root = 0;
 
 void vfs_init() {
-    fs_root = (fs_node_t*)pmm_alloc_page();
-    strcpy(fs_root->name, "/");
-    fs_root->flags = FS_DIRECTORY | FS_MOUNTPOINT;
-    fs_root->ptr = fs_root;
+    // An empty directory until a filesystem is mounted on "/"
+    vfs_root = (fs_node_t*)pmm_alloc(sizeof(fs_node_t));
+    memset(vfs_root, 0, sizeof(fs_node_t));
+    strcpy(vfs_root->name, "/");
+    vfs_root->flags = FS_DIRECTORY;
+    icache_init();
+    dcache_init(vfs_root);
+    file_init();
+
+    // The root starts out as a tmpfs, with a separate one on /tmp so
+    // scratch files cannot fill it
+    fs_node_t *root = tmpfs_mount(0);
+    if (root && vfs_mount("/", root) == 0 && vfs_mkdir(root, "tmp", 01777) == 0) {
+        fs_node_t *tmp = tmpfs_mount(0);
+        vfs_mount("/tmp", tmp);
+        vfs_node_put(tmp);
+    }
+    vfs_node_put(root);
 }
 
 uint32_t read_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
@@ -27,7 +45,7 @@ uint32_t write_fs(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buff
 
 void open_fs(fs_node_t *node, uint8_t read, uint8_t write) {
     if (node->open) {
-        node->open(node);
+        node->open(node, 0);
     }
 }
 
@@ -37,16 +55,30 @@ void close_fs(fs_node_t *node) {
     }
 }
 
-struct dirent *readdir_fs(fs_node_t *node, uint32_t index) {
-    if ((node->flags & FS_DIRECTORY) && node->readdir) {
-        return node->readdir(node, index);
-    }
-    return 0;
+// --- Path Lookup ---
+
+fs_node_t *vfs_resolve_path(const char *path) {
+    return dcache_lookup_path(path);
 }
 
-fs_node_t *finddir_fs(fs_node_t *node, char *name) {
-    if ((node->flags & FS_DIRECTORY) && node->finddir) {
-        return node->finddir(node, name);
-    }
+int vfs_stat_path(const char *path, uint64_t *length, uint32_t *flags, uint64_t *inode) {
+    fs_node_t *node = vfs_resolve_path(path);
+    if (!node) return -1;
+    if (length) *length = node->length;
+    if (flags) *flags = node->flags;
+    if (inode) *inode = node->inode;
+    vfs_node_put(node);
     return 0;
 }
+
+int vfs_mount(const char *path, fs_node_t *root) {
+    return dcache_mount(path, root);
+}
+
+int vfs_umount(const char *path) {
+    return dcache_umount(path);
+}
+
+void vfs_name_changed(fs_node_t *dir, const char *name) {
+    dcache_invalidate(dir, name);
+}
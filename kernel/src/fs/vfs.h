@@ -10,15 +10,22 @@
 struct fs_node;
 typedef struct fs_node fs_node_t;
 
-/* ---------------- Filesystem object type flags ---------------- /
+/* ---------------- Filesystem object type flags ---------------- */
 enum {
-FS_FILE = 0x001,
-FS_DIRECTORY = 0x002,
-FS_CHARDEVICE = 0x004,
-FS_BLOCKDEVICE = 0x008,
-FS_PIPE = 0x010,
-FS_SYMLINK = 0x020,
-FS_MOUNTPOINT = 0x040, / mountpoint; 'impl' points to mount root */
+    FS_FILE        = 0x001,
+    FS_DIRECTORY   = 0x002,
+    FS_CHARDEVICE  = 0x004,
+    FS_BLOCKDEVICE = 0x008,
+    FS_PIPE        = 0x010,
+    FS_SYMLINK     = 0x020,
+    FS_MOUNTPOINT  = 0x040, /* mountpoint; 'impl' points to mount root */
+};
+
+/* ---------------- mmap protection bits ---------------- */
+enum {
+    PROT_READ  = 0x1,
+    PROT_WRITE = 0x2,
+    PROT_EXEC  = 0x4,
 };
 
 /* Reasonable system limits (tunable at build time) */
@@ -30,11 +37,12 @@ FS_MOUNTPOINT = 0x040, / mountpoint; 'impl' points to mount root */
 #define FS_PATH_MAX 1024
 #endif
 
-/* ---------------- Directory entry (portable) ---------------- /
+/* ---------------- Directory entry (portable) ---------------- */
 typedef struct dirent {
-char name[FS_NAME_MAX];
-uint64_t ino; / inode or unique id /
-uint32_t type; / FS_* flags subset (optional hint) */
+    char name[FS_NAME_MAX];
+    uint64_t ino;   /* inode or unique id */
+    uint32_t type;  /* FS_* flags subset (optional hint) */
+    uint64_t off;   /* position of the next entry, for the next readdir */
 } dirent_t;
 
 /* ---------------- VFS operation signatures ---------------- */
@@ -45,113 +53,136 @@ typedef int (*close_type_t) (fs_node_t *node);
 typedef int (*ioctl_type_t) (fs_node_t *node, uint32_t request, void *argp);
 typedef int (*truncate_type_t) (fs_node_t *node, uint64_t new_length);
 typedef void * (*mmap_type_t) (fs_node_t *node, uint64_t offset, size_t size, uint32_t prot, uint32_t flags);
-typedef int (*readdir_type_t) (fs_node_t *node, uint64_t index, dirent_t out); / index-based iteration */
+typedef int (*readdir_type_t) (fs_node_t *node, uint64_t index, dirent_t *out); /* 1: entry at position index, 0: end; out->off is the next position */
 typedef fs_node_t * (*finddir_type_t) (fs_node_t *node, const char *name);
 typedef int (*create_type_t) (fs_node_t *node, const char *name, uint32_t mode);
 typedef int (*mkdir_type_t) (fs_node_t *node, const char *name, uint32_t mode);
 typedef int (*unlink_type_t) (fs_node_t *node, const char *name);
 typedef int (*rmdir_type_t) (fs_node_t *node, const char *name);
+typedef int (*evict_type_t) (fs_node_t *node); /* 0: private state released, node may be freed */
+typedef void (*readahead_type_t) (fs_node_t *node, uint64_t first_page, uint32_t count); /* fill the page cache; may block */
 
 /*
-
----------------- Core VFS node ----------------
-
-This structure intentionally mirrors common hobby-OS layouts and
-
-is extended with device_info to carry driver-private state.
-/
+ * ---------------- Core VFS node ----------------
+ * This structure intentionally mirrors common hobby-OS layouts and
+ * is extended with device_info to carry driver-private state.
+ */
 struct fs_node {
-/ Identity / metadata /
-char name[FS_NAME_MAX];
-uint32_t mask; / permission bits /
-uint32_t uid; / owner /
-uint32_t gid; / group /
-uint32_t flags; / FS_* /
-uint64_t inode; / inode or unique id /
-uint64_t length; / file length in bytes (advisory for devices) /
-uint64_t atime; / access time (epoch ns or ticks) /
-uint64_t mtime; / modification time /
-uint64_t ctime; / change/creation time */
-
-/* VFS-internal plumbing */
-fs_node_t mount; / if FS_MOUNTPOINT, pointer to mounted root */
-void impl; / filesystem-implementation specific data */
-
-/*
-
-Device-private hook:
-
-Drivers (e.g., AHCI) may stash a pointer to their per-device state here.
-
-AHCI expects to read this field (see ahci_read/ahci_write usage).
-*/
-void *device_info;
-
-/* Operations */
-read_type_t read;
-write_type_t write;
-open_type_t open;
-close_type_t close;
-ioctl_type_t ioctl;
-truncate_type_t truncate;
-mmap_type_t mmap;
-readdir_type_t readdir;
-finddir_type_t finddir;
-create_type_t create;
-mkdir_type_t mkdir;
-unlink_type_t unlink;
-rmdir_type_t rmdir;
+    /* Identity / metadata */
+    char name[FS_NAME_MAX];
+    uint32_t mask;    /* permission bits */
+    uint32_t uid;     /* owner */
+    uint32_t gid;     /* group */
+    uint32_t flags;   /* FS_* */
+    uint64_t inode;   /* inode or unique id */
+    uint64_t length;  /* file length in bytes (advisory for devices) */
+    uint64_t atime;   /* access time (epoch ns or ticks) */
+    uint64_t mtime;   /* modification time */
+    uint64_t ctime;   /* change/creation time */
+
+    /* VFS-internal plumbing */
+    fs_node_t *mount; /* if FS_MOUNTPOINT, pointer to mounted root */
+    void *impl;       /* filesystem-implementation specific data */
+    struct dentry *dentry; /* dcache entry naming this node, if any */
+
+    /* Inode cache (icache.h); sb is NULL for nodes outside it */
+    void *sb;              /* filesystem instance the inode belongs to */
+    uint32_t refcount;     /* vfs_node_get / vfs_node_put */
+    uint32_t state;        /* ICACHE_* */
+    fs_node_t *hash_next;
+    fs_node_t *lru_prev, *lru_next; /* while unreferenced */
+
+    /*
+     * Device-private hook:
+     * Drivers may stash a pointer to their per-device state here.
+     * Block device nodes keep their block_device_t (block/blkdev.h).
+     */
+    void *device_info;
+
+    /* Operations */
+    read_type_t read;
+    write_type_t write;
+    open_type_t open;
+    close_type_t close;
+    ioctl_type_t ioctl;
+    truncate_type_t truncate;
+    mmap_type_t mmap;
+    readdir_type_t readdir;
+    finddir_type_t finddir;
+    create_type_t create;
+    mkdir_type_t mkdir;
+    unlink_type_t unlink;
+    rmdir_type_t rmdir;
+    evict_type_t evict;
+    readahead_type_t readahead;
 };
 
 /* Root of the virtual filesystem */
 extern fs_node_t *vfs_root;
 
+/* Reference counting; the last put of a cached node leaves it on the
+ * inode cache's LRU list (implemented in icache.c) */
+fs_node_t *vfs_node_get(fs_node_t *node);
+void vfs_node_put(fs_node_t *node);
+
+/* Drops cached lookups of `name` in `dir` after it was created or removed */
+void vfs_name_changed(fs_node_t *dir, const char *name);
+
 /* ---------------- Convenience inlines (NULL-safe) ---------------- */
 static inline size_t vfs_read(fs_node_t *n, uint64_t off, size_t sz, void *buf) {
-return (n && n->read) ? n->read(n, off, sz, buf) : 0;
+    return (n && n->read) ? n->read(n, off, sz, buf) : 0;
 }
 static inline size_t vfs_write(fs_node_t *n, uint64_t off, size_t sz, const void *buf) {
-return (n && n->write) ? n->write(n, off, sz, buf) : 0;
+    return (n && n->write) ? n->write(n, off, sz, buf) : 0;
 }
 static inline int vfs_open(fs_node_t *n, uint32_t flags) {
-return (n && n->open) ? n->open(n, flags) : 0;
+    return (n && n->open) ? n->open(n, flags) : 0;
 }
 static inline int vfs_close(fs_node_t *n) {
-return (n && n->close) ? n->close(n) : 0;
+    return (n && n->close) ? n->close(n) : 0;
 }
 static inline int vfs_ioctl(fs_node_t *n, uint32_t req, void *argp) {
-return (n && n->ioctl) ? n->ioctl(n, req, argp) : -1;
+    return (n && n->ioctl) ? n->ioctl(n, req, argp) : -1;
 }
 static inline int vfs_truncate(fs_node_t *n, uint64_t nl) {
-return (n && n->truncate) ? n->truncate(n, nl) : -1;
+    return (n && n->truncate) ? n->truncate(n, nl) : -1;
 }
 static inline void *vfs_mmap(fs_node_t *n, uint64_t off, size_t sz, uint32_t prot, uint32_t flags) {
-return (n && n->mmap) ? n->mmap(n, off, sz, prot, flags) : NULL;
+    return (n && n->mmap) ? n->mmap(n, off, sz, prot, flags) : NULL;
 }
 static inline int vfs_readdir(fs_node_t *n, uint64_t idx, dirent_t *out) {
-return (n && n->readdir) ? n->readdir(n, idx, out) : -1;
+    return (n && n->readdir) ? n->readdir(n, idx, out) : -1;
 }
 static inline fs_node_t *vfs_finddir(fs_node_t *n, const char *name) {
-return (n && n->finddir) ? n->finddir(n, name) : NULL;
+    return (n && n->finddir) ? n->finddir(n, name) : NULL;
 }
 static inline int vfs_create(fs_node_t *n, const char *name, uint32_t mode) {
-return (n && n->create) ? n->create(n, name, mode) : -1;
+    int r = (n && n->create) ? n->create(n, name, mode) : -1;
+    if (r == 0) vfs_name_changed(n, name);
+    return r;
 }
 static inline int vfs_mkdir(fs_node_t *n, const char *name, uint32_t mode) {
-return (n && n->mkdir) ? n->mkdir(n, name, mode) : -1;
+    int r = (n && n->mkdir) ? n->mkdir(n, name, mode) : -1;
+    if (r == 0) vfs_name_changed(n, name);
+    return r;
 }
 static inline int vfs_unlink(fs_node_t *n, const char *name) {
-return (n && n->unlink) ? n->unlink(n, name) : -1;
+    int r = (n && n->unlink) ? n->unlink(n, name) : -1;
+    if (r == 0) vfs_name_changed(n, name);
+    return r;
 }
 static inline int vfs_rmdir(fs_node_t *n, const char *name) {
-return (n && n->rmdir) ? n->rmdir(n, name) : -1;
+    int r = (n && n->rmdir) ? n->rmdir(n, name) : -1;
+    if (r == 0) vfs_name_changed(n, name);
+    return r;
 }
 
-/* ---------------- Common helpers (implemented in VFS core) ---------------- /
-/ These symbols are declared here for users; implementations live in vfs.c */
+/* ---------------- Common helpers (implemented in VFS core) ---------------- */
+/* These symbols are declared here for users; implementations live in vfs.c */
+void vfs_init(void);
 int vfs_mount(const char *path, fs_node_t *root);
 int vfs_umount(const char *path);
-fs_node_t *vfs_resolve_path(const char path); / returns retained node or NULL */
+fs_node_t *vfs_resolve_path(const char *path); /* returns retained node or NULL; vfs_node_put when done */
 int vfs_stat_path(const char *path, uint64_t *length, uint32_t *flags, uint64_t *inode);
 int vfs_link(const char *oldpath, const char *newpath);
 int vfs_symlink(const char *target, const char *linkpath);
@@ -0,0 +1,120 @@
+#ifndef LIMITLESS_IO_RING_H
+#define LIMITLESS_IO_RING_H
+
+// Batched system call submission, shared by the kernel (ipc/io_ring.c) and
+// user space.
+//
+// SYS_IO_RING_SETUP maps one region into the caller. It holds an
+// io_ring_hdr_t, a submission queue of io_sqe_t and a completion queue of
+// io_cqe_t. User space fills SQEs and advances sq_tail; the kernel consumes
+// them on SYS_IO_RING_ENTER (or from its polling thread) and posts one CQE
+// per request at cq_tail. User space reads CQEs and advances cq_head
+// without entering the kernel.
+
+#include <stdint.h>
+
+#define IO_RING_SQ_ENTRIES  128
+#define IO_RING_CQ_ENTRIES  256
+#define IO_RING_SIZE        0x4000 // Header page, two SQE pages, one CQE page
+
+// --- Operations ---
+// args[] has the same meaning as the arguments of the matching syscall.
+#define IORING_OP_NOP           0
+#define IORING_OP_READ          1 // SYS_READ
+#define IORING_OP_WRITE         2 // SYS_WRITE
+#define IORING_OP_SEND          3 // SYS_SEND
+#define IORING_OP_RECV          4 // SYS_RECV
+#define IORING_OP_POLL_EVENT    5 // SYS_POLL_EVENT
+#define IORING_OP_READDIR       6 // SYS_READDIR
+#define IORING_OP_DRAW_RECT     7 // SYS_DRAW_RECT
+#define IORING_OP_DRAW_STRING   8 // SYS_DRAW_STRING_IN_WINDOW
+#define IORING_OP_DRAW_ICON     9 // SYS_DRAW_ICON_IN_WINDOW
+#define IORING_OP_MAX           10
+
+// io_sqe_t.flags
+#define IOSQE_IO_LINK   0x01 // The next SQE runs only if this one succeeds
+
+// Result of a linked request skipped because an earlier one failed
+#define IORING_CANCELED (-2)
+
+// io_ring_params_t.flags
+#define IORING_SETUP_SQPOLL 0x01 // A kernel thread polls the submission queue
+
+// io_ring_hdr_t.sq_flags
+#define IORING_SQ_NEED_WAKEUP 0x01 // Polling thread is asleep
+
+// SYS_IO_RING_ENTER flags
+#define IORING_ENTER_GETEVENTS 0x01 // Wait for min_complete completions
+#define IORING_ENTER_SQ_WAKEUP 0x02 // Wake the polling thread
+
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  flags;
+    uint16_t reserved0;
+    uint32_t reserved1;
+    uint64_t args[6];
+    uint64_t user_data; // Copied to the completion
+} io_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t  res;       // Return value of the operation
+} io_cqe_t;
+
+typedef struct {
+    // Submission queue: user space writes sq_tail, the kernel sq_head
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    volatile uint32_t sq_flags;
+
+    // Completion queue: the kernel writes cq_tail, user space cq_head
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_entries;
+
+    // Offsets of the queues from the start of the region
+    uint32_t sqes_off;
+    uint32_t cqes_off;
+} io_ring_hdr_t;
+
+// In/out argument of SYS_IO_RING_SETUP
+typedef struct {
+    uint32_t flags;        // in: IORING_SETUP_*
+    uint32_t sq_idle;      // in: SQPOLL spins before sleeping, 0 for default
+    uint64_t ring_addr;    // out: user address of the io_ring_hdr_t
+} io_ring_params_t;
+
+// --- User-space helpers ---
+
+static inline io_sqe_t* io_ring_sqes(io_ring_hdr_t* r) {
+    return (io_sqe_t*)((uint8_t*)r + r->sqes_off);
+}
+
+static inline io_cqe_t* io_ring_cqes(io_ring_hdr_t* r) {
+    return (io_cqe_t*)((uint8_t*)r + r->cqes_off);
+}
+
+// Copy an SQE into the ring and publish it. Returns -1 if the ring is full.
+static inline int io_ring_queue(io_ring_hdr_t* r, const io_sqe_t* sqe) {
+    uint32_t tail = r->sq_tail;
+    if (tail - __atomic_load_n(&r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) return -1;
+    io_ring_sqes(r)[tail & r->sq_mask] = *sqe;
+    __atomic_store_n(&r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Oldest unseen completion, or 0 if there is none
+static inline io_cqe_t* io_ring_peek_cqe(io_ring_hdr_t* r) {
+    uint32_t head = r->cq_head;
+    if (head == __atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    return &io_ring_cqes(r)[head & r->cq_mask];
+}
+
+static inline void io_ring_cqe_seen(io_ring_hdr_t* r) {
+    __atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef LIMITLESS_LFS_FORMAT_H
+#define LIMITLESS_LFS_FORMAT_H
+
+// LimitlessFS on-disk format, shared by the kernel (fs/limitlessfs.c) and
+// the host tools that build and check images (user/mkfs). Everything here
+// is little-endian and fixed by the format; in-memory state stays with
+// its users.
+
+#include <stdint.h>
+
+#define LFS_MAGIC 0x11F5 // LimitlessFS Magic Number
+#define LFS_BLOCK_SIZE 4096
+#define LFS_MAX_FILENAME 255
+#define LFS_INODE_SIZE 128
+#define LFS_INODES_PER_BLOCK (LFS_BLOCK_SIZE / LFS_INODE_SIZE)
+
+// --- On-Disk Journal Structures ---
+// Metadata updates are logged before they reach their home location. The
+// journal area (sb.journal_start_block, sb.journal_num_blocks) starts with
+// an lfs_journal_super_t; the remaining blocks form a circular log. Each
+// transaction in the log is a descriptor block listing target blocks, one
+// block image per target, then a commit block whose checksum covers the
+// descriptor and the images. A transaction without a valid commit block
+// was never committed and is ignored by replay.
+#define LFS_JOURNAL_MAGIC 0x4A303031 // "J001"
+
+#define LFS_JOURNAL_SUPER      1
+#define LFS_JOURNAL_DESCRIPTOR 2
+#define LFS_JOURNAL_COMMIT     3
+
+#define LFS_JOURNAL_MIN_BLOCKS 16 // The super block and the smallest usable log
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;     // LFS_JOURNAL_*
+    uint32_t sequence; // Transaction ID; unused in the super block
+} lfs_journal_header_t;
+
+typedef struct {
+    lfs_journal_header_t h;
+    uint32_t log_blocks;     // Blocks in the circular log
+    uint32_t first;          // Log index of the oldest live transaction
+    uint32_t first_sequence; // Its sequence number
+} lfs_journal_super_t;
+
+#define LFS_JOURNAL_DESC_TARGETS ((LFS_BLOCK_SIZE - 16) / sizeof(uint64_t))
+
+typedef struct {
+    lfs_journal_header_t h;
+    uint32_t count;                              // Block images that follow
+    uint64_t targets[LFS_JOURNAL_DESC_TARGETS];  // Home location of each image
+} lfs_journal_descriptor_t;
+
+typedef struct {
+    lfs_journal_header_t h;
+    uint32_t count;
+    uint32_t checksum; // crc32 of the descriptor and the block images
+} lfs_journal_commit_t;
+
+_Static_assert(sizeof(lfs_journal_descriptor_t) == LFS_BLOCK_SIZE, "descriptor must fill a block");
+
+// --- On-Disk Filesystem Structures ---
+// Block 0. The other areas follow in the order of the fields. Each bitmap
+// has one bit per block or inode, the bits of a block in little-endian
+// 64-bit words; a set bit is in use. Blocks below data_blocks_start and
+// the root inode count as in use whatever their bits say.
+typedef struct {
+    uint32_t magic;
+    uint32_t total_blocks;
+    uint32_t journal_start_block;
+    uint32_t journal_num_blocks;
+    uint32_t inode_bitmap_block;
+    uint32_t data_bitmap_block;
+    uint32_t inode_table_block;
+    uint32_t data_blocks_start;
+    uint32_t inode_count;    // 0 on older volumes: the inode table runs up to data_blocks_start
+} lfs_superblock_t;
+
+// --- Extents ---
+// File blocks are mapped by a B+tree of extents rooted in the inode. Small
+// files keep up to LFS_INLINE_EXTENTS extents in the inode itself (a tree
+// of depth 0). When those run out the root's entries move to a tree block
+// and the root becomes an index. Every node, inline or on disk, starts
+// with an lfs_extent_header_t; entries are sorted by `logical`.
+#define LFS_EXTENT_MAGIC 0xE47E
+#define LFS_INLINE_EXTENTS 4
+#define LFS_EXTENTS_PER_BLOCK ((LFS_BLOCK_SIZE - sizeof(lfs_extent_header_t)) / sizeof(lfs_extent_t))
+#define LFS_MAX_EXTENT_DEPTH 5
+#define LFS_MAX_EXTENT_LEN 0xFFFFFFFF
+
+typedef struct {
+    uint16_t magic;
+    uint16_t entries;  // Entries in use
+    uint16_t max;      // Capacity of this node
+    uint16_t depth;    // 0: entries are lfs_extent_t, else lfs_extent_index_t
+} lfs_extent_header_t;
+
+// Leaf entry: `length` blocks starting at file block `logical`
+typedef struct {
+    uint32_t logical;
+    uint32_t length;
+    uint64_t physical;
+} lfs_extent_t;
+
+// Interior entry: subtree covering file blocks from `logical` onwards
+typedef struct {
+    uint32_t logical;
+    uint32_t reserved;
+    uint64_t child;    // Disk block of the next level down
+} lfs_extent_index_t;
+
+#define LFS_TYPE_FILE 0x1
+#define LFS_TYPE_DIR  0x2
+
+#define LFS_ROOT_INODE 0
+
+typedef struct {
+    uint16_t type; // LFS_TYPE_*
+    uint16_t permissions;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;
+    uint64_t size;
+    uint64_t last_modified;
+    uint64_t security_context_id;
+    uint64_t blocks;   // Allocated blocks, data and extent tree
+    lfs_extent_header_t extent_header;
+    union {
+        lfs_extent_t extents[LFS_INLINE_EXTENTS];
+        lfs_extent_index_t index[LFS_INLINE_EXTENTS];
+    } extent_root;
+    uint8_t reserved[8];
+} lfs_inode_t;
+
+_Static_assert(sizeof(lfs_inode_t) == LFS_INODE_SIZE, "lfs_inode_t must match LFS_INODE_SIZE");
+
+// --- Directories ---
+// A directory is a hash tree over its names. Directory block 0 is the
+// index root: it holds "." and ".." and a sorted list of (hash, block)
+// entries, each naming the block that holds the names hashing from that
+// value up to the next entry's. At depth 0 those blocks are leaves; at
+// each further level they are index nodes of the same form. Leaves are
+// packed with variable-length entries in no particular order. A full leaf
+// splits at its median hash, so a lookup reads depth + 2 blocks however
+// large the directory grows.
+#define LFS_DX_ROOT_MAGIC 0x58444C52 // "RLDX"
+#define LFS_DX_NODE_MAGIC 0x58444C4E // "NLDX"
+#define LFS_DX_HASH_FNV1A 1
+#define LFS_DX_MAX_DEPTH  2
+
+typedef struct {
+    uint32_t hash;   // Lowest name hash under this entry; 0 in the first
+    uint32_t block;  // Directory block
+} lfs_dx_entry_t;
+
+typedef struct {
+    uint16_t count;  // Entries in use
+    uint16_t limit;  // Capacity of this block
+} lfs_dx_countlimit_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t self;          // Inode of "."
+    uint32_t parent;        // Inode of ".."
+    uint8_t hash_version;   // LFS_DX_HASH_*
+    uint8_t depth;          // Index levels below the root
+    uint16_t reserved;
+    lfs_dx_countlimit_t cl;
+    lfs_dx_entry_t entries[];
+} lfs_dx_root_t;
+
+typedef struct {
+    uint32_t magic;
+    lfs_dx_countlimit_t cl;
+    lfs_dx_entry_t entries[];
+} lfs_dx_node_t;
+
+#define LFS_DX_ROOT_LIMIT ((LFS_BLOCK_SIZE - sizeof(lfs_dx_root_t)) / sizeof(lfs_dx_entry_t))
+#define LFS_DX_NODE_LIMIT ((LFS_BLOCK_SIZE - sizeof(lfs_dx_node_t)) / sizeof(lfs_dx_entry_t))
+
+// Leaf entry. rec_len covers any slack up to the next entry; the last
+// entry of a block runs to its end. name_len 0 marks unused space.
+typedef struct {
+    uint32_t inode;
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t type;      // LFS_TYPE_*
+    char name[];       // Not NUL-terminated
+} lfs_dir_entry_t;
+
+#define LFS_DIR_REC_LEN(name_len) ((sizeof(lfs_dir_entry_t) + (name_len) + 3) & ~3u)
+
+// Inodes the volume has room for
+static inline uint32_t lfs_inode_count(const lfs_superblock_t* sb) {
+    if (sb->inode_count) return sb->inode_count;
+    return (sb->data_blocks_start - sb->inode_table_block) * LFS_INODES_PER_BLOCK;
+}
+
+// Images one transaction may log: it must fit in one descriptor and leave
+// the log room for others while it waits to be checkpointed
+static inline uint32_t lfs_journal_max_txn(uint32_t log_blocks) {
+    uint32_t max = log_blocks / 4;
+    return max < LFS_JOURNAL_DESC_TARGETS ? max : (uint32_t)LFS_JOURNAL_DESC_TARGETS;
+}
+
+// Directory name hash: FNV-1a, trimmed to 31 bits so a readdir position
+// fits in 64
+static inline uint32_t lfs_dir_hash(const char* name, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h >> 1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef LIMITLESS_SYSCALL_H
+#define LIMITLESS_SYSCALL_H
+
+// User-space system call stubs.
+//
+// x86_64 programs use the SYSCALL instruction:
+//   RAX = number, RDI, RSI, RDX, R10, R8, R9 = arguments, result in RAX.
+// i386 programs fall back to the int 0x80 gate:
+//   EAX = number, EBX, ECX, EDX, ESI, EDI, EBP = arguments, result in EAX.
+
+#include "syscall_nr.h"
+
+#if defined(__x86_64__)
+
+static inline long syscall6(long num, long a0, long a1, long a2, long a3, long a4, long a5) {
+    long ret;
+    register long r10 asm("r10") = a3;
+    register long r8 asm("r8") = a4;
+    register long r9 asm("r9") = a5;
+    asm volatile(
+        "syscall"
+        : "=a"(ret)
+        : "a"(num), "D"(a0), "S"(a1), "d"(a2), "r"(r10), "r"(r8), "r"(r9)
+        : "rcx", "r11", "memory"
+    );
+    return ret;
+}
+
+#else
+
+static inline long syscall6(long num, long a0, long a1, long a2, long a3, long a4, long a5) {
+    long ret;
+    // EBP may be the frame pointer and cannot be an asm operand, so the
+    // number and sixth argument are passed through memory via EAX.
+    long nr_and_a5[2] = { num, a5 };
+    asm volatile(
+        "push %%ebp\n\t"
+        "mov 4(%%eax), %%ebp\n\t"
+        "mov (%%eax), %%eax\n\t"
+        "int $0x80\n\t"
+        "pop %%ebp"
+        : "=a"(ret)
+        : "a"(nr_and_a5), "b"(a0), "c"(a1), "d"(a2), "S"(a3), "D"(a4)
+        : "memory"
+    );
+    return ret;
+}
+
+#endif
+
+static inline long syscall0(long num) { return syscall6(num, 0, 0, 0, 0, 0, 0); }
+static inline long syscall1(long num, long a0) { return syscall6(num, a0, 0, 0, 0, 0, 0); }
+static inline long syscall2(long num, long a0, long a1) { return syscall6(num, a0, a1, 0, 0, 0, 0); }
+static inline long syscall3(long num, long a0, long a1, long a2) { return syscall6(num, a0, a1, a2, 0, 0, 0); }
+static inline long syscall4(long num, long a0, long a1, long a2, long a3) { return syscall6(num, a0, a1, a2, a3, 0, 0); }
+static inline long syscall5(long num, long a0, long a1, long a2, long a3, long a4) { return syscall6(num, a0, a1, a2, a3, a4, 0); }
+
+#endif
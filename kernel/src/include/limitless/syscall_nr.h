@@ -0,0 +1,24 @@
+#ifndef LIMITLESS_SYSCALL_NR_H
+#define LIMITLESS_SYSCALL_NR_H
+
+// System call numbers shared by the kernel and user space.
+// Generated from syscalls.def; edit that file, not this one.
+
+// Call classes (the `flags` column of syscalls.def)
+#define SC_NONE  0x00
+#define SC_FILE  0x01
+#define SC_WRITE 0x02 // Modifies file contents
+#define SC_NET   0x04
+#define SC_GUI   0x08
+#define SC_PROC  0x10
+
+// Classes the Nexus Core behaviour model wants to see
+#define SC_AUDIT (SC_NET | SC_WRITE)
+
+enum {
+#define SYSCALL(sym, nr, name, flags) sym = nr,
+#include "syscalls.def"
+#undef SYSCALL
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef LIMITLESS_SYSTRACE_H
+#define LIMITLESS_SYSTRACE_H
+
+// System call tracing, shared by the kernel (trace/systrace.c) and its
+// readers (user/strace, user/syscount).
+//
+// While enabled, every syscall can leave an enter and an exit record in a
+// per-CPU buffer (SYSTRACE_EVENTS), and/or be counted in a per-syscall
+// log2 latency histogram (SYSTRACE_HIST). Both cost one NOP per call while
+// tracing is off.
+
+#include <stdint.h>
+
+// SYS_SYSTRACE_CTL commands
+#define SYSTRACE_CTL_ENABLE   1 // arg0 = SYSTRACE_* mask, arg1 = pid filter (0 = all)
+#define SYSTRACE_CTL_DISABLE  2
+#define SYSTRACE_CTL_RESET    3 // Clear histograms and drop buffered events
+
+#define SYSTRACE_EVENTS 0x01
+#define SYSTRACE_HIST   0x02
+
+#define SYSTRACE_ENTER  1
+#define SYSTRACE_EXIT   2
+
+typedef struct {
+    uint64_t ts_ns;       // TSC time since boot, in ns
+    uint16_t nr;
+    uint8_t  type;        // SYSTRACE_ENTER or SYSTRACE_EXIT
+    uint8_t  cpu;
+    int32_t  pid;
+    int32_t  tid;
+    uint32_t reserved;
+    union {
+        uint64_t args[6]; // SYSTRACE_ENTER
+        struct {          // SYSTRACE_EXIT
+            int64_t  ret;
+            uint64_t latency_ns;
+        };
+    };
+} systrace_event_t;
+
+// Bucket i counts calls that took [2^i, 2^(i+1)) ns; bucket 0 also has 0 ns
+#define SYSTRACE_HIST_BUCKETS 32
+
+// SYS_SYSTRACE_HIST output for one syscall
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[SYSTRACE_HIST_BUCKETS];
+} systrace_hist_t;
+
+#endif
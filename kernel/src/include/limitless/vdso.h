@@ -0,0 +1,115 @@
+#ifndef LIMITLESS_VDSO_H
+#define LIMITLESS_VDSO_H
+
+// Virtual dynamic shared object: time and CPU queries served in user space.
+//
+// The kernel maps two regions at fixed addresses into every process:
+//   VDSO_DATA_BASE  one read-only page holding vdso_data_t
+//   VDSO_TEXT_BASE  the vDSO code (kernel/vdso/), starting with vdso_header_t
+// The header lists entry points as offsets from VDSO_TEXT_BASE, so programs
+// call through it instead of linking against the image. The image is 64-bit
+// code; i386 programs keep using the system calls.
+
+#include <stdint.h>
+
+#define VDSO_DATA_BASE  0x00007FFFFF000000ULL
+#define VDSO_TEXT_BASE  (VDSO_DATA_BASE + 0x1000)
+
+#define VDSO_MAGIC      0x4F534456 // "VDSO"
+#define VDSO_VERSION    1
+
+#define NSEC_PER_SEC    1000000000ULL
+#define NSEC_PER_USEC   1000ULL
+
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+struct timeval {
+    int64_t tv_sec;
+    int64_t tv_usec;
+};
+
+// How the data page may be read
+#define VDSO_CLOCK_NONE 0 // No usable TSC: fall back to SYS_CLOCK_GETTIME
+#define VDSO_CLOCK_TSC  1 // ns = mono_base_ns + ((tsc - tsc_base) * mult) >> shift
+
+// Shared data page. Written only by the kernel, under the `seq` seqlock:
+// the count is odd while an update is in progress.
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t clock_mode;
+    uint64_t tsc_base;       // TSC value at which mono_base_ns was taken
+    uint64_t mult;           // TSC cycles to ns, fixed point
+    uint32_t shift;
+    uint32_t have_rdtscp;    // TSC_AUX holds the CPU number
+    uint64_t mono_base_ns;   // CLOCK_MONOTONIC at tsc_base
+    uint64_t wall_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC
+} vdso_data_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t clock_gettime;  // int (int clock, struct timespec* ts)
+    uint64_t gettimeofday;   // int (struct timeval* tv, void* tz)
+    uint64_t time;           // int64_t (int64_t* t)
+    uint64_t getcpu;         // int (unsigned* cpu, unsigned* node)
+} vdso_header_t;
+
+#if defined(__x86_64__)
+
+// --- Seqlock readers (shared by the vDSO and the kernel fallback) ---
+
+static inline uint32_t vdso_read_begin(const volatile vdso_data_t* d) {
+    uint32_t seq;
+    while ((seq = d->seq) & 1) {
+        asm volatile ("pause");
+    }
+    // x86 does not reorder loads with loads; stop the compiler from doing so
+    asm volatile ("" ::: "memory");
+    return seq;
+}
+
+static inline int vdso_read_retry(const volatile vdso_data_t* d, uint32_t seq) {
+    asm volatile ("" ::: "memory");
+    return d->seq != seq;
+}
+
+// 128-bit intermediate, so the TSC delta never overflows
+static inline uint64_t vdso_cycles_to_ns(uint64_t cycles, uint64_t mult, uint32_t shift) {
+    return (uint64_t)(((unsigned __int128)cycles * mult) >> shift);
+}
+
+// --- User-space entry points ---
+
+static inline const vdso_header_t* vdso_header(void) {
+    return (const vdso_header_t*)VDSO_TEXT_BASE;
+}
+
+static inline int vdso_clock_gettime(int clock, struct timespec* ts) {
+    int (*fn)(int, struct timespec*) = (void*)(VDSO_TEXT_BASE + vdso_header()->clock_gettime);
+    return fn(clock, ts);
+}
+
+static inline int vdso_gettimeofday(struct timeval* tv, void* tz) {
+    int (*fn)(struct timeval*, void*) = (void*)(VDSO_TEXT_BASE + vdso_header()->gettimeofday);
+    return fn(tv, tz);
+}
+
+static inline int64_t vdso_time(int64_t* t) {
+    int64_t (*fn)(int64_t*) = (void*)(VDSO_TEXT_BASE + vdso_header()->time);
+    return fn(t);
+}
+
+static inline int vdso_getcpu(unsigned* cpu, unsigned* node) {
+    int (*fn)(unsigned*, unsigned*) = (void*)(VDSO_TEXT_BASE + vdso_header()->getcpu);
+    return fn(cpu, node);
+}
+
+#endif // __x86_64__
+
+#endif
@@ -1,180 +1,492 @@
 #include "syscall.h"
 #include "../drivers/cmos.h"
 #include "../fs/vfs.h"
+#include "../fs/file.h"
 #include "../lib/string.h"
 #include "../gui/compositor.h"
 #include "../gui/window.h"
-#include "../../../arch/x86_64/gdt.h"
+#include "../../arch/x86_64/gdt.h"
+#include "../../arch/x86_64/cpu.h"
 #include "../gui/events.h"
 #include "../ai/nexus_core.h"
 #include "../net/sockets.h"
 #include "../ipc/pipe.h"
+#include "../ipc/io_ring.h"
+#include "../trace/systrace.h"
+#include "../mem/pmm.h"
+#include "../mem/uaccess.h"
+#include "../proc/vdso.h"
 #include <stddef.h>
 #include "../gui/icons.h"
 
-void sys_draw_string_in_window_handler(registers_t* regs) {
-    int win_id = regs->ebx;
-    const char* text = (const char*)regs->ecx;
-    int x = regs->edx;
-    int y = regs->esi;
-    uint32_t color = regs->edi;
+#define SYSCALL_STRING_MAX 256
+#define SYSCALL_IO_CHUNK (64 * 1024) // Kernel staging buffer for read()
+
+void print(char*);
+int execve(const char *path, char **argv, char **envp);
+
+// --- GUI Syscalls ---
+
+int64_t sys_create_window_handler(syscall_args_t* args) { (void)args; return -1; }
+int64_t sys_get_window_buffer_handler(syscall_args_t* args) { (void)args; return -1; }
+
+int64_t sys_draw_rect_handler(syscall_args_t* args) {
+    wm_draw_rect_in_window(args->arg[0], args->arg[1], args->arg[2],
+                           args->arg[3], args->arg[4], (uint32_t)args->arg[5]);
+    return 0;
+}
+
+int64_t sys_draw_string_in_window_handler(syscall_args_t* args) {
+    int win_id = args->arg[0];
+    char text[SYSCALL_STRING_MAX];
+    int x = args->arg[2];
+    int y = args->arg[3];
+    uint32_t color = args->arg[4];
+    if (strncpy_from_user(text, (const char*)args->arg[1], sizeof(text)) < 0) return -1;
     // Find window by ID, then call draw_string on its buffer
+    return 0;
 }
 
-void sys_draw_icon_in_window_handler(registers_t* regs) {
-    int win_id = regs->ebx;
-    icon_type_t icon = (icon_type_t)regs->ecx;
-    int x = regs->edx;
-    int y = regs->esi;
+int64_t sys_draw_icon_in_window_handler(syscall_args_t* args) {
+    int win_id = args->arg[0];
+    icon_type_t icon = (icon_type_t)args->arg[1];
+    int x = args->arg[2];
+    int y = args->arg[3];
     // Find window by ID, then draw the specified icon to its buffer
+    return 0;
 }
 
-void print(char*);
-void* memcpy(void* dest, const void* src, size_t n);
-int fork(void);
-int execve(const char *path, char **argv, char **envp);
+int64_t sys_create_widget_handler(syscall_args_t* args) {
+    int win_id = args->arg[0];
+    // Find window by ID
+    // ...
+    widget_t* widget = create_widget((widget_type_t)args->arg[1], NULL, args->arg[2], args->arg[3],
+                                     args->arg[4], args->arg[5], NULL);
+    return widget ? widget->id : -1;
+}
 
-typedef void (*syscall_handler_t)(registers_t* regs);
-syscall_handler_t syscall_handlers[20];
+int64_t sys_poll_event_handler(syscall_args_t* args) {
+    event_queue_t* q = &current_task->event_queue;
+    if (q->head == q->tail) {
+        return 0; // No event
+    }
+    // Copy event to user-space buffer
+    if (copy_to_user((void*)args->arg[0], &q->events[q->tail], sizeof(event_t)) != 0) {
+        return -1;
+    }
+    q->tail = (q->tail + 1) % EVENT_QUEUE_SIZE;
+    return 1; // Event was polled
+}
+
+// --- Misc Syscalls ---
 
-void sys_yield_handler(registers_t* regs) { (void)regs; switch_task(); }
-void sys_print_handler(registers_t* regs) { print((char*)regs->ebx); }
-// ... other existing handlers ...
+int64_t sys_yield_handler(syscall_args_t* args) { (void)args; switch_task(); return 0; }
+int64_t sys_getpid_handler(syscall_args_t* args) { (void)args; return current_thread->parent_process->pid; }
 
-// VFS Syscalls (Placeholders for now)
-void sys_pipe_create_handler(registers_t* regs) {
-    regs->eax = create_pipe((int*)regs->ebx);
+int64_t sys_print_handler(syscall_args_t* args) {
+    char buf[SYSCALL_STRING_MAX + 1];
+    const char* ustr = (const char*)args->arg[0];
+
+    // Print in chunks so long strings need no large kernel buffer
+    for (;;) {
+        long len = strncpy_from_user(buf, ustr, SYSCALL_STRING_MAX);
+        if (len < 0) return -1;
+        if (len < SYSCALL_STRING_MAX) {
+            print(buf);
+            return 0;
+        }
+        buf[SYSCALL_STRING_MAX] = '\0';
+        print(buf);
+        ustr += SYSCALL_STRING_MAX;
+    }
 }
 
-void sys_dup2_handler(registers_t* regs) {
-    int old_fd = regs->ebx;
-    int new_fd = regs->ecx;
-    if (old_fd >= MAX_FILES || new_fd >= MAX_FILES || !current_task->file_descriptors[old_fd]) {
-        regs->eax = -1;
-        return;
+int64_t sys_get_system_time_handler(syscall_args_t* args) {
+    rtc_time_t time;
+    if (!args->arg[0]) return -1;
+    get_rtc_time(&time);
+    return copy_to_user((void*)args->arg[0], &time, sizeof(time));
+}
+
+// --- Time Syscalls ---
+// Slow paths of the vDSO (kernel/vdso/vdso.c), taken when the data page
+// cannot answer on its own.
+
+int64_t sys_clock_gettime_handler(syscall_args_t* args) {
+    struct timespec ts;
+    if (kernel_clock_gettime((int)args->arg[0], &ts) != 0) return -1;
+    return copy_to_user((void*)args->arg[1], &ts, sizeof(ts));
+}
+
+int64_t sys_getcpu_handler(syscall_args_t* args) {
+    unsigned cpu = this_cpu_id(), node = 0;
+    if (args->arg[0] && copy_to_user((void*)args->arg[0], &cpu, sizeof(cpu)) != 0) return -1;
+    if (args->arg[1] && copy_to_user((void*)args->arg[1], &node, sizeof(node)) != 0) return -1;
+    return 0;
+}
+
+// --- VFS Syscalls ---
+
+int64_t sys_create_handler(syscall_args_t* args) { (void)args; return -1; }
+int64_t sys_stat_handler(syscall_args_t* args) { (void)args; return -1; }
+
+static file_t* fd_file(uint64_t fd) {
+    return fd < MAX_FILES ? current_task->file_descriptors[fd] : NULL;
+}
+
+// Lowest free descriptor for `file`, or -1
+static int fd_install(file_t* file) {
+    for (int fd = 0; fd < MAX_FILES; fd++) {
+        if (!current_task->file_descriptors[fd]) {
+            current_task->file_descriptors[fd] = file;
+            return fd;
+        }
     }
-    current_task->file_descriptors[new_fd] = current_task->file_descriptors[old_fd];
-    regs->eax = new_fd;
+    return -1;
 }
 
-void sys_open_handler(registers_t* regs) { regs->eax = -1; }
+// open(path, flags)
+int64_t sys_open_handler(syscall_args_t* args) {
+    char path[FS_PATH_MAX];
+    if (strncpy_from_user(path, (const char*)args->arg[0], sizeof(path)) < 0) return -1;
+
+    fs_node_t* node = vfs_resolve_path(path);
+    if (!node) return -1;
+    file_t* file = file_open(node, args->arg[1]);
+    vfs_node_put(node);
+    if (!file) return -1;
+
+    int fd = fd_install(file);
+    if (fd < 0) file_put(file);
+    return fd;
+}
+
+// read(fd, buf, len): reads at the file position. Returns the bytes read,
+// 0 at the end of the file.
+int64_t sys_read_handler(syscall_args_t* args) {
+    file_t* file = fd_file(args->arg[0]);
+    uint8_t* ubuf = (uint8_t*)args->arg[1];
+    uint64_t len = args->arg[2];
+    if (!file || !access_ok(ubuf, len)) return -1;
+
+    uint8_t* chunk = pmm_alloc(SYSCALL_IO_CHUNK);
+    if (!chunk) return -1;
 
-void sys_close_handler(registers_t* regs) {
-    int fd = regs->ebx;
+    uint64_t done = 0;
+    while (done < len) {
+        size_t n = len - done < SYSCALL_IO_CHUNK ? len - done : SYSCALL_IO_CHUNK;
+        size_t got = file_read(file, chunk, n);
+        if (got == 0) break;
+        if (copy_to_user(ubuf + done, chunk, got) != 0) {
+            pmm_free(chunk, SYSCALL_IO_CHUNK);
+            return done ? (int64_t)done : -1;
+        }
+        done += got;
+        if (got < n) break;
+    }
+    pmm_free(chunk, SYSCALL_IO_CHUNK);
+    return done;
+}
+
+// fadvise(fd, offset, len, advice): FADV_* access pattern hint
+int64_t sys_fadvise_handler(syscall_args_t* args) {
+    file_t* file = fd_file(args->arg[0]);
+    if (!file) return -1;
+    return file_advise(file, args->arg[1], args->arg[2], (int)args->arg[3]);
+}
+
+int64_t sys_write_handler(syscall_args_t* args) {
+    const uint8_t* ubuf = (const uint8_t*)args->arg[1];
+    uint64_t len = args->arg[2];
+    char chunk[SYSCALL_STRING_MAX + 1];
+    uint64_t done = 0;
+
+    // Simple version for stdout/stderr
+    if (args->arg[0] != 1 && args->arg[0] != 2) return -1;
+
+    while (done < len) {
+        uint64_t n = len - done;
+        if (n > SYSCALL_STRING_MAX) n = SYSCALL_STRING_MAX;
+        if (copy_from_user(chunk, ubuf + done, n) != 0) {
+            return done ? (int64_t)done : -1;
+        }
+        chunk[n] = '\0';
+        print(chunk);
+        done += n;
+    }
+    return done;
+}
+
+int64_t sys_close_handler(syscall_args_t* args) {
+    uint64_t fd = args->arg[0];
     if (fd < MAX_FILES && current_task->file_descriptors[fd]) {
-        close_fs(current_task->file_descriptors[fd]);
+        file_put(current_task->file_descriptors[fd]);
         current_task->file_descriptors[fd] = NULL;
-        regs->eax = 0;
-    } else {
-        regs->eax = -1;
+        return 0;
     }
+    return -1;
 }
 
-void sys_read_handler(registers_t* regs) { regs->eax = -1; }
-void sys_write_handler(registers_t* regs) {
-    // Simple version for stdout/stderr
-    if (regs->ebx == 1 || regs->ebx == 2) {
-        print((char*)regs->ecx);
-        regs->eax = strlen((char*)regs->ecx);
+int64_t sys_pipe_create_handler(syscall_args_t* args) {
+    int fds[2];
+    if (create_pipe(fds) != 0) return -1;
+    return copy_to_user((void*)args->arg[0], fds, sizeof(fds));
+}
+
+int64_t sys_dup2_handler(syscall_args_t* args) {
+    uint64_t old_fd = args->arg[0];
+    uint64_t new_fd = args->arg[1];
+    if (old_fd >= MAX_FILES || new_fd >= MAX_FILES || !current_task->file_descriptors[old_fd]) {
+        return -1;
     }
+    if (new_fd == old_fd) return new_fd;
+    file_put(current_task->file_descriptors[new_fd]);
+    current_task->file_descriptors[new_fd] = file_get(current_task->file_descriptors[old_fd]);
+    return new_fd;
 }
-void sys_stat_handler(registers_t* regs) { regs->eax = -1; }
 
-// Process Syscalls
-void sys_fork_handler(registers_t* regs) { regs->eax = fork(); }
-void sys_execve_handler(registers_t* regs) {
-    regs->eax = execve((const char*)regs->ebx, (char**)regs->ecx, (char**)regs->edx);
+// readdir(path, &pos, entries, count): reads up to `count` entries (at
+// least one) starting at position *pos and leaves *pos at the next one.
+// Positions are opaque 64-bit cookies that stay valid while the directory
+// changes. Returns the number of entries stored, 0 at the end.
+int64_t sys_readdir_handler(syscall_args_t* args) {
+    char path[FS_PATH_MAX];
+    if (strncpy_from_user(path, (const char*)args->arg[0], sizeof(path)) < 0) return -1;
+
+    uint64_t pos;
+    if (copy_from_user(&pos, (const void*)args->arg[1], sizeof(pos)) != 0) return -1;
+
+    fs_node_t* node = vfs_resolve_path(path);
+    if (!node) return 0;
+
+    dirent_t* out = (dirent_t*)args->arg[2];
+    uint64_t count = args->arg[3] ? args->arg[3] : 1;
+    dirent_t de;
+    int64_t n = 0;
+    while ((uint64_t)n < count && vfs_readdir(node, pos, &de) > 0) {
+        if (copy_to_user(&out[n], &de, sizeof(de)) != 0) break;
+        pos = de.off;
+        n++;
+    }
+    vfs_node_put(node);
+    if (copy_to_user((void*)args->arg[1], &pos, sizeof(pos)) != 0) return -1;
+    return n;
 }
-void sys_waitpid_handler(registers_t* regs) { regs->eax = -1; }
 
-void syscall_dispatcher(registers_t* regs) {
-    nexus_core_analyze_syscall(regs);
-    if (regs->eax < 20 && syscall_handlers[regs->eax]) {
-        syscall_handler_t handler = syscall_handlers[regs->eax];
-        handler(regs);
+// --- Process Syscalls ---
+
+int64_t sys_fork_handler(syscall_args_t* args) { return sys_fork(args->regs); }
+
+int64_t sys_execve_handler(syscall_args_t* args) {
+    char path[FS_PATH_MAX];
+    if (strncpy_from_user(path, (const char*)args->arg[0], sizeof(path)) < 0) return -1;
+    return execve(path, (char**)args->arg[1], (char**)args->arg[2]);
+}
+
+int64_t sys_waitpid_handler(syscall_args_t* args) { (void)args; return -1; }
+
+// exit(): releases what the process holds that outlives its threads, then
+// retires the calling thread the way a kernel thread leaves. Nothing reaps
+// the exit status yet (see waitpid).
+int64_t sys_exit_handler(syscall_args_t* args) {
+    (void)args;
+    io_ring_exit(current_thread->parent_process);
+    systrace_release(current_thread->parent_process->pid);
+    kthread_exit();
+}
+
+// --- Socket Syscalls ---
+// Payloads are staged through a kernel page so the network stack never
+// dereferences user pointers.
+
+int64_t sys_socket_handler(syscall_args_t* args) {
+    return sys_socket(args->arg[0], args->arg[1], args->arg[2]);
+}
+
+int64_t sys_bind_handler(syscall_args_t* args) {
+    sockaddr_in_t addr;
+    if (copy_from_user(&addr, (const void*)args->arg[1], sizeof(addr)) != 0) return -1;
+    return sys_bind(args->arg[0], &addr, sizeof(addr));
+}
+
+int64_t sys_connect_handler(syscall_args_t* args) {
+    sockaddr_in_t addr;
+    if (copy_from_user(&addr, (const void*)args->arg[1], sizeof(addr)) != 0) return -1;
+    return sys_connect(args->arg[0], &addr, sizeof(addr));
+}
+
+int64_t sys_listen_handler(syscall_args_t* args) {
+    return sys_listen(args->arg[0], args->arg[1]);
+}
+
+int64_t sys_accept_handler(syscall_args_t* args) {
+    sockaddr_in_t addr;
+    uint32_t addrlen = sizeof(addr);
+    int fd = sys_accept(args->arg[0], &addr, &addrlen);
+    if (fd >= 0 && args->arg[1]) {
+        if (copy_to_user((void*)args->arg[1], &addr, sizeof(addr)) != 0) return -1;
     }
+    return fd;
 }
 
-// Add handlers for new TCP socket syscalls
-void sys_connect_handler(registers_t* regs) { /* ... */ }
-void sys_listen_handler(registers_t* regs) { /* ... */ }
-void sys_accept_handler(registers_t* regs) { /* ... */ }
-void sys_send_handler(registers_t* regs) { /* ... */ }
-void sys_recv_handler(registers_t* regs) { /* ... */ }
+int64_t sys_send_handler(syscall_args_t* args) {
+    uint32_t len = args->arg[2] > PAGE_SIZE ? PAGE_SIZE : args->arg[2];
+    void* kbuf = pmm_alloc_page();
+    if (!kbuf) return -1;
+    int64_t ret = -1;
+    if (copy_from_user(kbuf, (const void*)args->arg[1], len) == 0) {
+        ret = sys_send(args->arg[0], kbuf, len, args->arg[3]);
+    }
+    pmm_free_page(kbuf);
+    return ret;
+}
 
-void sys_poll_event_handler(registers_t* regs) {
-    event_queue_t* q = &current_task->event_queue;
-    if (q->head == q->tail) {
-        regs->eax = 0; // No event
-        return;
+int64_t sys_recv_handler(syscall_args_t* args) {
+    uint32_t len = args->arg[2] > PAGE_SIZE ? PAGE_SIZE : args->arg[2];
+    void* kbuf = pmm_alloc_page();
+    if (!kbuf) return -1;
+    int64_t ret = sys_recv(args->arg[0], kbuf, len, args->arg[3]);
+    if (ret > 0 && copy_to_user((void*)args->arg[1], kbuf, ret) != 0) {
+        ret = -1;
     }
-    // Copy event to user-space buffer
-    memcpy((void*)regs->ebx, &q->events[q->tail], sizeof(event_t));
-    q->tail = (q->tail + 1) % EVENT_QUEUE_SIZE;
-    regs->eax = 1; // Event was polled
+    pmm_free_page(kbuf);
+    return ret;
 }
 
-void sys_get_system_time_handler(registers_t* regs) {
-    rtc_time_t* time_buf = (rtc_time_t*)regs->ebx;
-    if (time_buf) {
-        get_rtc_time(time_buf);
+int64_t sys_sendto_handler(syscall_args_t* args) {
+    sockaddr_in_t addr;
+    uint32_t len = args->arg[2] > PAGE_SIZE ? PAGE_SIZE : args->arg[2];
+    if (copy_from_user(&addr, (const void*)args->arg[4], sizeof(addr)) != 0) return -1;
+
+    void* kbuf = pmm_alloc_page();
+    if (!kbuf) return -1;
+    int64_t ret = -1;
+    if (copy_from_user(kbuf, (const void*)args->arg[1], len) == 0) {
+        ret = sys_sendto(args->arg[0], kbuf, len, args->arg[3], &addr, sizeof(addr));
     }
+    pmm_free_page(kbuf);
+    return ret;
 }
 
-void init_syscalls() {
-    // ...
-    syscall_handlers[SYS_CONNECT] = &sys_connect_handler;
-    syscall_handlers[SYS_LISTEN] = &sys_listen_handler;
-    syscall_handlers[SYS_ACCEPT] = &sys_accept_handler;
-    syscall_handlers[SYS_SEND] = &sys_send_handler;
-    syscall_handlers[SYS_RECV] = &sys_recv_handler;
-    syscall_handlers[SYS_YIELD] = &sys_yield_handler;
-    syscall_handlers[SYS_PRINT] = &sys_print_handler;
-    // ...
-    syscall_handlers[SYS_OPEN] = &sys_open_handler;
-    syscall_handlers[SYS_CLOSE] = &sys_close_handler;
-    syscall_handlers[SYS_READ] = &sys_read_handler;
-    syscall_handlers[SYS_WRITE] = &sys_write_handler;
-    syscall_handlers[SYS_STAT] = &sys_stat_handler;
-    syscall_handlers[SYS_FORK] = &sys_fork_handler;
-    syscall_handlers[SYS_EXECVE] = &sys_execve_handler;
-    syscall_handlers[SYS_WAITPID] = &sys_waitpid_handler;
-    // ...
-    syscall_handlers[SYS_GET_SYSTEM_TIME] = &sys_get_system_time_handler;
-    // ...
-    syscall_handlers[SYS_PIPE_CREATE] = &sys_pipe_create_handler;
-    syscall_handlers[SYS_DUP2] = &sys_dup2_handler;
-    // ...
-    syscall_handlers[SYS_DRAW_STRING_IN_WINDOW] = &sys_draw_string_in_window_handler;
-    syscall_handlers[SYS_DRAW_ICON_IN_WINDOW] = &sys_draw_icon_in_window_handler;
+int64_t sys_recvfrom_handler(syscall_args_t* args) {
+    sockaddr_in_t addr;
+    uint32_t addrlen = sizeof(addr);
+    uint32_t len = args->arg[2] > PAGE_SIZE ? PAGE_SIZE : args->arg[2];
+
+    void* kbuf = pmm_alloc_page();
+    if (!kbuf) return -1;
+    int64_t ret = sys_recvfrom(args->arg[0], kbuf, len, args->arg[3], &addr, &addrlen);
+    if (ret > 0 && copy_to_user((void*)args->arg[1], kbuf, ret) != 0) {
+        ret = -1;
+    }
+    if (ret >= 0 && args->arg[4] && copy_to_user((void*)args->arg[4], &addr, sizeof(addr)) != 0) {
+        ret = -1;
+    }
+    pmm_free_page(kbuf);
+    return ret;
 }
 
-void sys_create_widget_handler(registers_t* regs) {
-    int win_id = regs->ebx;
-    // Find window by ID
-    // ...
-    widget_t* widget = create_widget((widget_type_t)regs->ecx, NULL, regs->edx, regs->esi, regs->edi, regs->ebp, (const char*)regs->eax);
-    regs->eax = widget->id;
-}
-
-void sys_readdir_handler(registers_t* regs) {
-    fs_node_t* node = finddir_fs(fs_root, (char*)regs->ebx);
-    if (node) {
-        struct dirent* de = readdir_fs(node, regs->ecx);
-        if (de) {
-            memcpy((void*)regs->edx, de, sizeof(struct dirent));
-            regs->eax = 1;
-        } else {
-            regs->eax = 0;
-        }
+// --- Submission Ring Syscalls ---
+
+int64_t sys_io_ring_setup_handler(syscall_args_t* args) {
+    io_ring_params_t params;
+    if (copy_from_user(&params, (const void*)args->arg[0], sizeof(params)) != 0) return -1;
+
+    int id = io_ring_setup(&params);
+    if (id < 0) return -1;
+    if (copy_to_user((void*)args->arg[0], &params, sizeof(params)) != 0) {
+        io_ring_destroy(id);
+        return -1;
+    }
+    return id;
+}
+
+int64_t sys_io_ring_enter_handler(syscall_args_t* args) {
+    return io_ring_enter((int)args->arg[0], (uint32_t)args->arg[1],
+                         (uint32_t)args->arg[2], (uint32_t)args->arg[3]);
+}
+
+int64_t sys_io_ring_destroy_handler(syscall_args_t* args) {
+    return io_ring_destroy((int)args->arg[0]);
+}
+
+// --- Tracing Syscalls ---
+
+int64_t sys_systrace_ctl_handler(syscall_args_t* args) {
+    return systrace_ctl((uint32_t)args->arg[0], args->arg[1], args->arg[2]);
+}
+
+int64_t sys_systrace_read_handler(syscall_args_t* args) {
+    return systrace_read((systrace_event_t*)args->arg[0], args->arg[1]);
+}
+
+int64_t sys_systrace_hist_handler(syscall_args_t* args) {
+    return systrace_hist(args->arg[0], (systrace_hist_t*)args->arg[1]);
+}
+
+// --- Dispatch ---
+
+// Bounds-check, audit and run one call. Also used by the submission
+// ring (ipc/io_ring.c), whose requests have no register frame.
+int64_t syscall_invoke(uint64_t nr, syscall_args_t* args) {
+    if (nr >= syscall_table_size || !syscall_table[nr].fn) {
+        return -1;
+    }
+    const syscall_entry_t* entry = &syscall_table[nr];
+
+    // Only the classes the behaviour model tracks pay for the hook
+    if (entry->flags & SC_AUDIT) {
+        nexus_core_analyze_syscall(nr, entry->flags);
+    }
+
+    // A NOP unless tracing is on (trace/systrace.c)
+    if (static_branch_unlikely(&systrace_key)) {
+        uint64_t start = systrace_enter(nr, args->arg);
+        int64_t ret = entry->fn(args);
+        systrace_exit(nr, ret, start);
+        return ret;
+    }
+
+    return entry->fn(args);
+}
+
+// Entered from both isr128 (via interrupt_handler_c) and syscall_entry.
+void syscall_dispatcher(registers_t* regs) {
+    syscall_args_t args;
+    args.regs = regs;
+    if (regs->int_no == SYSCALL_FAST_VECTOR) {
+        args.arg[0] = regs->rdi;
+        args.arg[1] = regs->rsi;
+        args.arg[2] = regs->rdx;
+        args.arg[3] = regs->r10;
+        args.arg[4] = regs->r8;
+        args.arg[5] = regs->r9;
     } else {
-        regs->eax = 0;
+        args.arg[0] = regs->rbx;
+        args.arg[1] = regs->rcx;
+        args.arg[2] = regs->rdx;
+        args.arg[3] = regs->rsi;
+        args.arg[4] = regs->rdi;
+        args.arg[5] = regs->rbp;
     }
+
+    regs->rax = (uint64_t)syscall_invoke(regs->rax, &args);
 }
 
-void init_syscalls() {
-    // ...
-    syscall_handlers[SYS_CREATE_WIDGET] = &sys_create_widget_handler;
+// Program the MSRs used by the SYSCALL instruction.
+static void init_fast_syscalls() {
+    extern void syscall_entry(void);
+
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    // SYSCALL loads CS = STAR[47:32], SS = +8.
+    // SYSRET loads SS = STAR[63:48] + 8, CS = +16 (see gdt.h).
+    wrmsr(MSR_STAR, ((uint64_t)GDT_KERNEL_DATA << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    // Enter with interrupts off until syscall_entry is on the kernel stack
+    wrmsr(MSR_FMASK, RFLAGS_IF | RFLAGS_DF | RFLAGS_TF | RFLAGS_AC);
+}
 
-    syscall_handlers[SYS_READDIR] = &sys_readdir_handler;
+void init_syscalls() {
+    init_fast_syscalls();
+    register_interrupt_handler(SYSCALL_VECTOR, &syscall_dispatcher);
 }
@@ -1,41 +1,42 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include <stdint.h>
+#include <limitless/syscall_nr.h>
 #include "../proc/task.h"
+#include "../../arch/x86_64/idt.h"
 
-#define SYS_YIELD           0
-#define SYS_PRINT           1
-#define SYS_CREATE          2
-#define SYS_WRITE           3
-#define SYS_CREATE_WINDOW   4
-#define SYS_DRAW_RECT       5
-#define SYS_POLL_EVENT      6
-#define SYS_SOCKET          7
-#define SYS_BIND            8
-#define SYS_SENDTO          9
-#define SYS_RECVFROM        10
-#define SYS_GET_WINDOW_BUFFER 11
-#define SYS_OPEN            12
-#define SYS_CLOSE           13
-#define SYS_READ            14
-#define SYS_STAT            16
-#define SYS_FORK            17
-#define SYS_EXECVE          18
-#define SYS_WAITPID         19
-#define SYS_CONNECT         20
-#define SYS_LISTEN          21
-#define SYS_ACCEPT          22
-#define SYS_SEND            23
-#define SYS_RECV            24
-#define SYS_CREATE_WIDGET   25
-#define SYS_GET_SYSTEM_TIME 26
-#define SYS_READDIR         27
-#define SYS_PIPE_CREATE     28
-#define SYS_DUP2            29
-#define SYS_DRAW_STRING_IN_WINDOW 30
-#define SYS_DRAW_ICON_IN_WINDOW   31
-#define SYS_CLOSE           13
+// Syscall numbers (SYS_*) and classes (SC_*) come from
+// include/limitless/syscalls.def, shared with user space.
+
+// Arguments decoded from whichever gate the call came through:
+//  - int 0x80 (legacy):   EAX = number, EBX, ECX, EDX, ESI, EDI, EBP
+//  - SYSCALL (fast path): RAX = number, RDI, RSI, RDX, R10, R8, R9
+// The result is returned in RAX for both.
+typedef struct {
+    uint64_t arg[6];
+    registers_t* regs; // Full frame, for calls such as fork that need it
+} syscall_args_t;
+
+typedef int64_t (*syscall_fn_t)(syscall_args_t* args);
+
+typedef struct {
+    syscall_fn_t fn;
+    const char* name;
+    uint32_t flags; // SC_* class bits
+} syscall_entry_t;
+
+// Generated in syscall_table.c; indexed by syscall number
+extern const syscall_entry_t syscall_table[];
+extern const uint64_t syscall_table_size;
+
+// One handler prototype per line of syscalls.def
+#define SYSCALL(sym, nr, name, flags) int64_t sys_##name##_handler(syscall_args_t* args);
+#include <limitless/syscalls.def>
+#undef SYSCALL
 
 void init_syscalls();
+void syscall_dispatcher(registers_t* regs);
+int64_t syscall_invoke(uint64_t nr, syscall_args_t* args);
 
 #endif
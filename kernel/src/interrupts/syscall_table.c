@@ -0,0 +1,12 @@
+#include "syscall.h"
+
+// The syscall table, generated from syscalls.def. Designated initialisers
+// size the array from the highest number in the definition file; gaps in
+// the numbering are left NULL and rejected by the dispatcher.
+const syscall_entry_t syscall_table[] = {
+#define SYSCALL(sym, nr, name, flags) [nr] = { &sys_##name##_handler, #name, flags },
+#include <limitless/syscalls.def>
+#undef SYSCALL
+};
+
+const uint64_t syscall_table_size = sizeof(syscall_table) / sizeof(syscall_table[0]);
@@ -1,15 +1,21 @@
 #include "timer.h"
 #include "../proc/task.h"
+#include "../proc/vdso.h"
+#include "../proc/workqueue.h"
 
 uint32_t tick = 0;
+static uint64_t tick_ns = 0;
 
 static void timer_callback(registers_t* regs) {
     (void)regs;
     tick++;
+    vdso_update(tick_ns);
+    workqueue_tick();
     switch_task();
 }
 
 void init_timer(uint32_t frequency) {
+    tick_ns = NSEC_PER_SEC / frequency;
     register_interrupt_handler(IRQ0, timer_callback);
 
     uint32_t divisor = 1193182 / frequency;
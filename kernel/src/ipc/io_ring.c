@@ -0,0 +1,306 @@
+/* kernel/src/ipc/io_ring.c */
+
+#include "io_ring.h"
+#include "../interrupts/syscall.h"
+#include "../proc/task.h"
+#include "../mem/pmm.h"
+#include "../mem/vmm.h"
+#include "../lib/string.h"
+
+#define IO_RING_SQPOLL_IDLE 1000 // Empty polls before the thread sleeps
+
+// Kernel view of a ring. The region is physically contiguous, so the
+// kernel reaches it through the higher-half window.
+typedef struct {
+    volatile bool in_use;   // The slot is taken, until teardown has finished
+    volatile bool stopping; // Being torn down; tells the poller to exit
+    process_t* owner;
+    io_ring_hdr_t* hdr;
+    io_sqe_t* sqes;
+    io_cqe_t* cqes;
+    uint64_t phys;
+    uint64_t user_addr;
+
+    // Geometry and the kernel's own indices. The copies in the shared
+    // header are for user space only: it can rewrite them at any time.
+    uint32_t sq_entries, sq_mask;
+    uint32_t cq_entries, cq_mask;
+    uint32_t sq_head;
+    uint32_t cq_tail;
+
+    bool chain_failed;      // A linked request in the current chain failed
+
+    // One submitter at a time (enter or the poller). Requests block on
+    // I/O, so others sleep rather than spin while one runs.
+    volatile bool submit_busy;
+    volatile bool submit_idle;
+    wait_queue_t* submit_wait;
+
+    thread_t* sq_thread;
+    volatile bool sq_exited;   // Set by the poller on its way out
+    wait_queue_t* sq_exit_wait;
+    uint32_t sq_idle;
+    wait_queue_t* sq_wait;  // The polling thread sleeps here
+    wait_queue_t* cq_wait;  // enter(GETEVENTS) waits here
+    volatile uint32_t sq_seq; // Moves when the poller is nudged (thread_wait_seq)
+    volatile uint32_t cq_seq; // Moves when completions are posted
+} io_ring_t;
+
+static io_ring_t rings[MAX_IO_RINGS];
+static spinlock_t rings_lock = 0;
+
+// Syscall run for each IORING_OP_*
+static const uint64_t io_ring_op_syscall[IORING_OP_MAX] = {
+    [IORING_OP_READ]        = SYS_READ,
+    [IORING_OP_WRITE]       = SYS_WRITE,
+    [IORING_OP_SEND]        = SYS_SEND,
+    [IORING_OP_RECV]        = SYS_RECV,
+    [IORING_OP_POLL_EVENT]  = SYS_POLL_EVENT,
+    [IORING_OP_READDIR]     = SYS_READDIR,
+    [IORING_OP_DRAW_RECT]   = SYS_DRAW_RECT,
+    [IORING_OP_DRAW_STRING] = SYS_DRAW_STRING_IN_WINDOW,
+    [IORING_OP_DRAW_ICON]   = SYS_DRAW_ICON_IN_WINDOW,
+};
+
+static io_ring_t* io_ring_get(int ring_id) {
+    if (ring_id < 0 || ring_id >= MAX_IO_RINGS) return NULL;
+    io_ring_t* ring = &rings[ring_id];
+    if (!ring->in_use || ring->stopping || ring->owner != current_thread->parent_process) return NULL;
+    return ring;
+}
+
+static int64_t io_ring_execute(const io_sqe_t* sqe) {
+    syscall_args_t args;
+
+    if (sqe->opcode == IORING_OP_NOP) return 0;
+    if (sqe->opcode >= IORING_OP_MAX) return -1;
+
+    memcpy(args.arg, sqe->args, sizeof(args.arg));
+    args.regs = NULL;
+    return syscall_invoke(io_ring_op_syscall[sqe->opcode], &args);
+}
+
+// Completions user space has not consumed. Its cq_head is only trusted
+// as far as the count stays within the queue.
+static uint32_t io_ring_cq_ready(io_ring_t* ring) {
+    uint32_t ready = ring->cq_tail - __atomic_load_n(&ring->hdr->cq_head, __ATOMIC_ACQUIRE);
+    return ready > ring->cq_entries ? ring->cq_entries : ready;
+}
+
+static void io_ring_submit_lock(io_ring_t* ring) {
+    while (__atomic_exchange_n(&ring->submit_busy, true, __ATOMIC_ACQUIRE)) {
+        thread_wait_event(&ring->submit_wait, &ring->submit_idle);
+    }
+    ring->submit_idle = false;
+}
+
+static void io_ring_submit_unlock(io_ring_t* ring) {
+    __atomic_store_n(&ring->submit_busy, false, __ATOMIC_RELEASE);
+    thread_wake_event(&ring->submit_wait, &ring->submit_idle);
+}
+
+// Consume up to `max` SQEs. Stops early rather than overflow the CQ, so
+// no completion is ever dropped.
+static uint32_t io_ring_submit(io_ring_t* ring, uint32_t max) {
+    io_ring_hdr_t* hdr = ring->hdr;
+    uint32_t done = 0;
+
+    io_ring_submit_lock(ring);
+
+    uint32_t head = ring->sq_head;
+    uint32_t tail = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && done < max && io_ring_cq_ready(ring) < ring->cq_entries) {
+        // Snapshot the entry: user space may rewrite it while we run
+        io_sqe_t sqe = ring->sqes[head & ring->sq_mask];
+        int64_t res;
+
+        if (ring->chain_failed) {
+            res = IORING_CANCELED;
+        } else {
+            res = io_ring_execute(&sqe);
+        }
+
+        // A chain ends with the first entry that does not carry IOSQE_IO_LINK
+        if (sqe.flags & IOSQE_IO_LINK) {
+            if (res < 0) ring->chain_failed = true;
+        } else {
+            ring->chain_failed = false;
+        }
+
+        io_cqe_t* cqe = &ring->cqes[ring->cq_tail & ring->cq_mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        ring->cq_tail++;
+        __atomic_store_n(&hdr->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+
+        head++;
+        done++;
+    }
+
+    ring->sq_head = head;
+    __atomic_store_n(&hdr->sq_head, head, __ATOMIC_RELEASE);
+    io_ring_submit_unlock(ring);
+
+    if (done) thread_wake_seq(&ring->cq_wait, &ring->cq_seq);
+    return done;
+}
+
+// --- SQPOLL ---
+
+static void io_ring_sq_thread(void* arg) {
+    io_ring_t* ring = arg;
+    io_ring_hdr_t* hdr = ring->hdr;
+    uint32_t idle = 0;
+
+    while (!ring->stopping) {
+        if (io_ring_submit(ring, ring->sq_entries)) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < ring->sq_idle) {
+            schedule();
+            continue;
+        }
+
+        // Tell user space to wake us, then re-check so a submission that
+        // raced with the flag is not left behind. A nudge after the check
+        // moves sq_seq, so the sleep ends at once.
+        uint32_t seen = __atomic_load_n(&ring->sq_seq, __ATOMIC_ACQUIRE);
+        __atomic_or_fetch(&hdr->sq_flags, IORING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&hdr->sq_tail, __ATOMIC_SEQ_CST) == ring->sq_head && !ring->stopping) {
+            thread_wait_seq(&ring->sq_wait, &ring->sq_seq, seen);
+        }
+        __atomic_and_fetch(&hdr->sq_flags, ~IORING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+        idle = 0;
+    }
+
+    // Nothing of the ring is touched after this
+    thread_wake_event(&ring->sq_exit_wait, &ring->sq_exited);
+    kthread_exit();
+}
+
+// --- Setup and teardown ---
+
+int io_ring_setup(io_ring_params_t* params) {
+    process_t* proc = current_thread->parent_process;
+    io_ring_t* ring = NULL;
+    int id;
+
+    spinlock_acquire(&rings_lock);
+    for (id = 0; id < MAX_IO_RINGS; id++) {
+        if (!rings[id].in_use) {
+            ring = &rings[id];
+            memset(ring, 0, sizeof(io_ring_t));
+            ring->in_use = true;
+            break;
+        }
+    }
+    spinlock_release(&rings_lock);
+    if (!ring) return -1;
+
+    void* phys = pmm_alloc(IO_RING_SIZE);
+    if (!phys) {
+        ring->in_use = false;
+        return -1;
+    }
+
+    ring->owner = proc;
+    ring->phys = (uint64_t)phys;
+    ring->hdr = (io_ring_hdr_t*)(ring->phys + KERNEL_VIRTUAL_BASE);
+    memset(ring->hdr, 0, IO_RING_SIZE);
+
+    ring->sq_entries = IO_RING_SQ_ENTRIES;
+    ring->sq_mask = IO_RING_SQ_ENTRIES - 1;
+    ring->cq_entries = IO_RING_CQ_ENTRIES;
+    ring->cq_mask = IO_RING_CQ_ENTRIES - 1;
+    ring->sqes = (io_sqe_t*)((uint8_t*)ring->hdr + PAGE_SIZE);
+    ring->cqes = (io_cqe_t*)((uint8_t*)ring->sqes + IO_RING_SQ_ENTRIES * sizeof(io_sqe_t));
+
+    // Published for user space; never read back
+    io_ring_hdr_t* hdr = ring->hdr;
+    hdr->sq_entries = ring->sq_entries;
+    hdr->sq_mask = ring->sq_mask;
+    hdr->cq_entries = ring->cq_entries;
+    hdr->cq_mask = ring->cq_mask;
+    hdr->sqes_off = (uint8_t*)ring->sqes - (uint8_t*)hdr;
+    hdr->cqes_off = (uint8_t*)ring->cqes - (uint8_t*)hdr;
+
+    ring->user_addr = IO_RING_USER_BASE + (uint64_t)id * IO_RING_SIZE;
+    for (uint64_t off = 0; off < IO_RING_SIZE; off += PAGE_SIZE) {
+        vmm_map_page(proc->pml4, ring->user_addr + off, ring->phys + off,
+                     PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX);
+    }
+
+    if (params->flags & IORING_SETUP_SQPOLL) {
+        ring->sq_idle = params->sq_idle ? params->sq_idle : IO_RING_SQPOLL_IDLE;
+        ring->sq_thread = kthread_create(proc, io_ring_sq_thread, ring);
+        if (!ring->sq_thread) {
+            io_ring_destroy(id);
+            return -1;
+        }
+    }
+
+    params->ring_addr = ring->user_addr;
+    return id;
+}
+
+int io_ring_enter(int ring_id, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    io_ring_t* ring = io_ring_get(ring_id);
+    int submitted = 0;
+
+    if (!ring) return -1;
+
+    if (ring->sq_thread) {
+        // The poller owns submission; at most it needs a nudge
+        if (flags & IORING_ENTER_SQ_WAKEUP) thread_wake_seq(&ring->sq_wait, &ring->sq_seq);
+    } else if (to_submit) {
+        submitted = io_ring_submit(ring, to_submit);
+    }
+
+    if (flags & IORING_ENTER_GETEVENTS) {
+        if (min_complete > ring->cq_entries) min_complete = ring->cq_entries;
+        for (;;) {
+            uint32_t seen = __atomic_load_n(&ring->cq_seq, __ATOMIC_ACQUIRE);
+            if (io_ring_cq_ready(ring) >= min_complete) break;
+            // Without a poller nothing else will complete our requests
+            if (!ring->sq_thread) break;
+            thread_wait_seq(&ring->cq_wait, &ring->cq_seq, seen);
+        }
+    }
+
+    return submitted;
+}
+
+// Tears `ring` down; -1 if someone else already is. The slot stays taken
+// until the poller has exited and the memory is freed, so setup cannot
+// hand it out while the old ring is still in use.
+static int io_ring_free(io_ring_t* ring) {
+    if (__atomic_exchange_n(&ring->stopping, true, __ATOMIC_ACQ_REL)) return -1;
+
+    // Unmap before freeing so user space cannot touch recycled pages
+    for (uint64_t off = 0; off < IO_RING_SIZE; off += PAGE_SIZE) {
+        vmm_unmap_page(ring->owner->pml4, ring->user_addr + off);
+    }
+
+    if (ring->sq_thread) {
+        thread_wake_seq(&ring->sq_wait, &ring->sq_seq);
+        thread_wait_event(&ring->sq_exit_wait, &ring->sq_exited);
+    }
+
+    pmm_free((void*)ring->phys, IO_RING_SIZE);
+    __atomic_store_n(&ring->in_use, false, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int io_ring_destroy(int ring_id) {
+    io_ring_t* ring = io_ring_get(ring_id);
+    if (!ring) return -1;
+    return io_ring_free(ring);
+}
+
+void io_ring_exit(process_t* proc) {
+    for (int id = 0; id < MAX_IO_RINGS; id++) {
+        if (rings[id].in_use && rings[id].owner == proc) io_ring_free(&rings[id]);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+#include <limitless/io_ring.h>
+
+#define MAX_IO_RINGS 64
+
+// Rings are mapped at a fixed slot per ring id, below 4 GiB so that i386
+// programs can reach them too.
+#define IO_RING_USER_BASE 0xA0000000
+
+// Creates a ring for the current process and maps it. Returns the ring id
+// and fills in params->ring_addr, or -1.
+int io_ring_setup(io_ring_params_t* params);
+
+// Submits up to `to_submit` queued requests, then optionally waits for
+// `min_complete` completions. Returns the number submitted, or -1.
+int io_ring_enter(int ring_id, uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+
+int io_ring_destroy(int ring_id);
+
+// Destroys every ring `proc` still has, when it exits
+struct process;
+void io_ring_exit(struct process* proc);
+
+#endif
@@ -107,11 +107,11 @@ int create_pipe(int* fds) {
     // Assign file descriptors
     int read_fd = find_free_fd();
     if (read_fd == -1) return -1;
-    current_task->file_descriptors[read_fd] = read_node;
+    current_task->file_descriptors[read_fd] = file_open(read_node, 0);
 
     int write_fd = find_free_fd();
     if (write_fd == -1) return -1;
-    current_task->file_descriptors[write_fd] = write_node;
+    current_task->file_descriptors[write_fd] = file_open(write_node, 0);
     
     fds[0] = read_fd;
     fds[1] = write_fd;
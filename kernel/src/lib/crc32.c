@@ -0,0 +1,27 @@
+#include "crc32.h"
+
+static uint32_t crc32_table[256];
+static int crc32_ready = 0;
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+    crc32_ready = 1;
+}
+
+uint32_t crc32(uint32_t crc, const void* buf, size_t len) {
+    const uint8_t* p = (const uint8_t*)buf;
+
+    if (!crc32_ready) crc32_init();
+
+    crc = ~crc;
+    while (len--) {
+        crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
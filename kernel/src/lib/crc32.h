@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320). Start with
+// crc = 0; pass the previous result to continue over several buffers.
+uint32_t crc32(uint32_t crc, const void* buf, size_t len);
+
+#endif
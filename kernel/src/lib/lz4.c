@@ -0,0 +1,156 @@
+/* kernel/src/lib/lz4.c */
+
+#include "lz4.h"
+#include "string.h"
+
+#define LZ4_MIN_MATCH   4
+#define LZ4_LAST_LITERALS 5  // The block ends with at least this many literals
+#define LZ4_MFLIMIT     12   // No match starts closer than this to the end
+#define LZ4_MAX_OFFSET  0xFFFF
+#define LZ4_SKIP_TRIGGER 6   // Misses before the search starts striding
+
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// Worst-case bytes to encode a length past the 4-bit token field
+static inline uint32_t lz4_ext_len(uint32_t len) {
+    return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+static uint8_t* lz4_put_ext(uint8_t* op, uint32_t len) {
+    if (len < 15) return op;
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Emits one sequence: the literals, then (if match_len) a back-reference.
+// NULL if it would not fit before `oend`.
+static uint8_t* lz4_emit(uint8_t* op, uint8_t* oend, const uint8_t* lit, uint32_t lit_len,
+                         uint32_t offset, uint32_t match_len) {
+    uint32_t ml = match_len ? match_len - LZ4_MIN_MATCH : 0;
+    uint32_t need = 1 + lz4_ext_len(lit_len) + lit_len + (match_len ? 2 + lz4_ext_len(ml) : 0);
+    if ((uint32_t)(oend - op) < need) return NULL;
+
+    uint8_t* token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+    op = lz4_put_ext(op, lit_len);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= ml < 15 ? ml : 15;
+        op = lz4_put_ext(op, ml);
+    }
+    return op;
+}
+
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap, void* workspace) {
+    if (src_len > LZ4_MAX_INPUT) return 0;
+    uint16_t* table = workspace;
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+
+    if (src_len >= LZ4_MFLIMIT + 1) {
+        const uint8_t* mflimit = end - LZ4_MFLIMIT;
+        const uint8_t* matchlimit = end - LZ4_LAST_LITERALS;
+        memset(table, 0, LZ4_WORKSPACE_SIZE);
+
+        ip++;
+        uint32_t misses = 0;
+        while (ip < mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+                // Incompressible stretches are crossed in growing strides
+                ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // Extend backwards over literals, then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            uint32_t len = LZ4_MIN_MATCH;
+            while (ip + len < matchlimit && ip[len] == ref[len]) len++;
+
+            op = lz4_emit(op, oend, anchor, ip - anchor, ip - ref, len);
+            if (!op) return 0;
+            ip += len;
+            anchor = ip;
+            if (ip < mflimit) table[lz4_hash(lz4_read32(ip - 2))] = (uint16_t)(ip - 2 - src);
+        }
+    }
+
+    op = lz4_emit(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (uint32_t)(op - dst) : 0;
+}
+
+int lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((uint32_t)(iend - ip) < lit || (uint32_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break; // The last sequence has no match
+
+        if (iend - ip < 2) return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) return -1;
+
+        uint32_t len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ4_MIN_MATCH;
+        if ((uint32_t)(oend - op) < len) return -1;
+
+        // The reference may overlap what it produces, so byte by byte
+        // unless it is far enough back
+        const uint8_t* ref = op - offset;
+        if (offset >= len) {
+            memcpy(op, ref, len);
+            op += len;
+        } else {
+            while (len--) *op++ = *ref++;
+        }
+    }
+    return (int)(op - dst);
+}
@@ -0,0 +1,25 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// LZ4 block format: runs of literals and back-references of at least four
+// bytes within the last 64 KiB. The compressor is the single-pass greedy
+// kind, built for speed over ratio; inputs are at most 64 KiB.
+
+#define LZ4_HASH_LOG       12
+#define LZ4_WORKSPACE_SIZE ((1 << LZ4_HASH_LOG) * sizeof(uint16_t))
+#define LZ4_MAX_INPUT      0xFFFF
+
+// Compresses `src` into at most `dst_cap` bytes, using `workspace`
+// (LZ4_WORKSPACE_SIZE bytes). Returns the compressed size, 0 if it does
+// not fit or the input is too large.
+uint32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap, void* workspace);
+
+// Decompresses `src` into `dst`, producing at most `dst_cap` bytes.
+// Returns the size produced, -1 if the input is malformed or would
+// overrun `dst`.
+int lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif
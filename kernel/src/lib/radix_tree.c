@@ -0,0 +1,202 @@
+/* kernel/src/lib/radix_tree.c */
+
+#include "radix_tree.h"
+#include "string.h"
+#include "../mem/pmm.h"
+
+#define RADIX_TREE_MAX_HEIGHT ((64 + RADIX_TREE_MAP_SHIFT - 1) / RADIX_TREE_MAP_SHIFT)
+
+static uint64_t radix_tree_max_index(uint32_t height) {
+    if (height * RADIX_TREE_MAP_SHIFT >= 64) return UINT64_MAX;
+    return (1ULL << (height * RADIX_TREE_MAP_SHIFT)) - 1;
+}
+
+static radix_tree_node_t* radix_tree_node_alloc(void) {
+    radix_tree_node_t* node = pmm_alloc(sizeof(radix_tree_node_t));
+    if (node) memset(node, 0, sizeof(radix_tree_node_t));
+    return node;
+}
+
+static void radix_tree_node_free(radix_tree_node_t* node) {
+    pmm_free(node, sizeof(radix_tree_node_t));
+}
+
+static uint32_t radix_tree_slot(uint64_t index, uint32_t level) {
+    return (index >> (level * RADIX_TREE_MAP_SHIFT)) & RADIX_TREE_MAP_MASK;
+}
+
+// Adds levels on top until `index` fits
+static int radix_tree_extend(radix_tree_t* tree, uint64_t index) {
+    while (index > radix_tree_max_index(tree->height)) {
+        if (tree->root) {
+            radix_tree_node_t* node = radix_tree_node_alloc();
+            if (!node) return -1;
+            node->slots[0] = tree->root;
+            node->count = 1;
+            for (int t = 0; t < RADIX_TREE_MAX_TAGS; t++) {
+                if (tree->root->tags[t]) node->tags[t] = 1;
+            }
+            tree->root = node;
+        }
+        tree->height++;
+    }
+    return 0;
+}
+
+int radix_tree_insert(radix_tree_t* tree, uint64_t index, void* item) {
+    if (!item || radix_tree_extend(tree, index) < 0) return -1;
+    if (tree->height == 0) tree->height = 1;
+
+    if (!tree->root) {
+        tree->root = radix_tree_node_alloc();
+        if (!tree->root) return -1;
+    }
+
+    radix_tree_node_t* node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        uint32_t i = radix_tree_slot(index, level);
+        if (!node->slots[i]) {
+            radix_tree_node_t* child = radix_tree_node_alloc();
+            if (!child) return -1;
+            node->slots[i] = child;
+            node->count++;
+        }
+        node = node->slots[i];
+    }
+
+    uint32_t i = radix_tree_slot(index, 0);
+    if (node->slots[i]) return -1;
+    node->slots[i] = item;
+    node->count++;
+    return 0;
+}
+
+void* radix_tree_lookup(radix_tree_t* tree, uint64_t index) {
+    if (!tree->root || index > radix_tree_max_index(tree->height)) return NULL;
+
+    radix_tree_node_t* node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        node = node->slots[radix_tree_slot(index, level)];
+        if (!node) return NULL;
+    }
+    return node->slots[radix_tree_slot(index, 0)];
+}
+
+// Fills path[level] with the nodes from the root down to the leaf holding
+// `index`. Returns false if the leaf does not exist.
+static bool radix_tree_path(radix_tree_t* tree, uint64_t index, radix_tree_node_t** path) {
+    if (!tree->root || index > radix_tree_max_index(tree->height)) return false;
+
+    radix_tree_node_t* node = tree->root;
+    path[tree->height - 1] = node;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        node = node->slots[radix_tree_slot(index, level)];
+        if (!node) return false;
+        path[level - 1] = node;
+    }
+    return true;
+}
+
+// Clears `tag` for `index` at the leaf and upwards while nodes lose their
+// last tagged slot
+static void radix_tree_clear_path(radix_tree_t* tree, uint64_t index, radix_tree_node_t** path, uint32_t tag) {
+    for (uint32_t level = 0; level < tree->height; level++) {
+        path[level]->tags[tag] &= ~(1ULL << radix_tree_slot(index, level));
+        if (path[level]->tags[tag]) break;
+    }
+}
+
+void* radix_tree_delete(radix_tree_t* tree, uint64_t index) {
+    radix_tree_node_t* path[RADIX_TREE_MAX_HEIGHT];
+    if (!radix_tree_path(tree, index, path)) return NULL;
+
+    uint32_t i = radix_tree_slot(index, 0);
+    void* item = path[0]->slots[i];
+    if (!item) return NULL;
+
+    for (int t = 0; t < RADIX_TREE_MAX_TAGS; t++) {
+        if (path[0]->tags[t] & (1ULL << i)) radix_tree_clear_path(tree, index, path, t);
+    }
+
+    // Free nodes left empty, bottom up
+    path[0]->slots[i] = NULL;
+    for (uint32_t level = 0; level < tree->height; level++) {
+        radix_tree_node_t* node = path[level];
+        if (--node->count > 0) break;
+        radix_tree_node_free(node);
+        if (level + 1 == tree->height) {
+            tree->root = NULL;
+            tree->height = 0;
+            break;
+        }
+        path[level + 1]->slots[radix_tree_slot(index, level + 1)] = NULL;
+    }
+    return item;
+}
+
+// --- Tags ---
+
+void radix_tree_tag_set(radix_tree_t* tree, uint64_t index, uint32_t tag) {
+    radix_tree_node_t* path[RADIX_TREE_MAX_HEIGHT];
+    if (!radix_tree_path(tree, index, path) || !path[0]->slots[radix_tree_slot(index, 0)]) return;
+
+    for (uint32_t level = 0; level < tree->height; level++) {
+        path[level]->tags[tag] |= 1ULL << radix_tree_slot(index, level);
+    }
+}
+
+void radix_tree_tag_clear(radix_tree_t* tree, uint64_t index, uint32_t tag) {
+    radix_tree_node_t* path[RADIX_TREE_MAX_HEIGHT];
+    if (!radix_tree_path(tree, index, path)) return;
+    if (path[0]->tags[tag] & (1ULL << radix_tree_slot(index, 0))) {
+        radix_tree_clear_path(tree, index, path, tag);
+    }
+}
+
+bool radix_tree_tag_get(radix_tree_t* tree, uint64_t index, uint32_t tag) {
+    radix_tree_node_t* path[RADIX_TREE_MAX_HEIGHT];
+    if (!radix_tree_path(tree, index, path)) return false;
+    return (path[0]->tags[tag] >> radix_tree_slot(index, 0)) & 1;
+}
+
+bool radix_tree_tagged(radix_tree_t* tree, uint32_t tag) {
+    return tree->root && tree->root->tags[tag];
+}
+
+// --- Gang Lookup ---
+
+// In-order walk of the subtree under `node` (which covers indices from
+// `base`), collecting items at or after `first`. tag < 0 means any item.
+static void radix_tree_collect(radix_tree_node_t* node, uint32_t level, uint64_t base, uint64_t first,
+                               void** results, uint32_t max, uint32_t* n, int tag) {
+    uint32_t shift = level * RADIX_TREE_MAP_SHIFT;
+    uint32_t start = first > base ? (uint32_t)((first - base) >> shift) : 0;
+
+    for (uint32_t i = start; i < RADIX_TREE_MAP_SIZE && *n < max; i++) {
+        if (!node->slots[i]) continue;
+        if (tag >= 0 && !(node->tags[tag] & (1ULL << i))) continue;
+
+        uint64_t child_base = base + ((uint64_t)i << shift);
+        if (level == 0) {
+            results[(*n)++] = node->slots[i];
+        } else {
+            radix_tree_collect(node->slots[i], level - 1, child_base, first, results, max, n, tag);
+        }
+    }
+}
+
+uint32_t radix_tree_gang_lookup(radix_tree_t* tree, void** results, uint64_t first, uint32_t max) {
+    uint32_t n = 0;
+    if (tree->root && first <= radix_tree_max_index(tree->height)) {
+        radix_tree_collect(tree->root, tree->height - 1, 0, first, results, max, &n, -1);
+    }
+    return n;
+}
+
+uint32_t radix_tree_gang_lookup_tag(radix_tree_t* tree, void** results, uint64_t first, uint32_t max, uint32_t tag) {
+    uint32_t n = 0;
+    if (tree->root && first <= radix_tree_max_index(tree->height)) {
+        radix_tree_collect(tree->root, tree->height - 1, 0, first, results, max, &n, (int)tag);
+    }
+    return n;
+}
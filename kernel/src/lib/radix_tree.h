@@ -0,0 +1,56 @@
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Sparse array of pointers indexed by a 64-bit key, 64 slots per node. The
+// tree is only as tall as the largest index needs. Each slot can carry a
+// few tags; a tag set on an item is also set on every node above it, so
+// tagged items are found without visiting untagged subtrees.
+//
+// No internal locking: callers serialise updates.
+
+#define RADIX_TREE_MAP_SHIFT 6
+#define RADIX_TREE_MAP_SIZE  (1 << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK  (RADIX_TREE_MAP_SIZE - 1)
+#define RADIX_TREE_MAX_TAGS  2
+
+typedef struct radix_tree_node {
+    uint32_t count; // Occupied slots
+    void* slots[RADIX_TREE_MAP_SIZE];
+    uint64_t tags[RADIX_TREE_MAX_TAGS];
+} radix_tree_node_t;
+
+typedef struct {
+    radix_tree_node_t* root;
+    uint32_t height;   // 0: empty, else levels below root, root included
+} radix_tree_t;
+
+#define RADIX_TREE_INIT { .root = NULL, .height = 0 }
+
+static inline void radix_tree_init(radix_tree_t* tree) {
+    tree->root = NULL;
+    tree->height = 0;
+}
+
+// Returns -1 if the index is already occupied or memory ran out
+int radix_tree_insert(radix_tree_t* tree, uint64_t index, void* item);
+void* radix_tree_lookup(radix_tree_t* tree, uint64_t index);
+// Returns the removed item, or NULL
+void* radix_tree_delete(radix_tree_t* tree, uint64_t index);
+
+// Up to `max` items with index >= `first`, in index order. Returns how
+// many were stored in `results`.
+uint32_t radix_tree_gang_lookup(radix_tree_t* tree, void** results, uint64_t first, uint32_t max);
+// Same, restricted to items with `tag` set
+uint32_t radix_tree_gang_lookup_tag(radix_tree_t* tree, void** results, uint64_t first, uint32_t max, uint32_t tag);
+
+void radix_tree_tag_set(radix_tree_t* tree, uint64_t index, uint32_t tag);
+void radix_tree_tag_clear(radix_tree_t* tree, uint64_t index, uint32_t tag);
+bool radix_tree_tag_get(radix_tree_t* tree, uint64_t index, uint32_t tag);
+// Whether any item has `tag`
+bool radix_tree_tagged(radix_tree_t* tree, uint32_t tag);
+
+#endif
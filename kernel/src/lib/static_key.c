@@ -0,0 +1,53 @@
+#include "static_key.h"
+#include "string.h"
+#include "../../arch/x86_64/cpu.h"
+
+// Bounds of the __jump_table section (linker.ld)
+extern jump_entry_t __start___jump_table[];
+extern jump_entry_t __stop___jump_table[];
+
+static const uint8_t nop5[5] = { 0x0F, 0x1F, 0x44, 0x00, 0x00 };
+
+// Rewrite every site of `key`. Only the boot CPU runs kernel code, so
+// patching with interrupts off is enough; a second CPU would need to be
+// parked first (cross-modifying code). .text is mapped read-only, so
+// CR0.WP is cleared for the duration.
+static void static_key_patch(static_key_t* key, bool enable) {
+    uint64_t flags = irq_save();
+    uint64_t cr0 = read_cr0();
+    write_cr0(cr0 & ~CR0_WP);
+
+    for (jump_entry_t* e = __start___jump_table; e < __stop___jump_table; e++) {
+        if (e->key != (uint64_t)key) continue;
+
+        uint8_t insn[5];
+        if (enable) {
+            int32_t rel = (int32_t)(e->target - (e->code + 5));
+            insn[0] = 0xE9; // jmp rel32
+            memcpy(&insn[1], &rel, sizeof(rel));
+        } else {
+            memcpy(insn, nop5, sizeof(insn));
+        }
+        memcpy((void*)e->code, insn, sizeof(insn));
+    }
+
+    // Serialise so the new instructions are fetched
+    uint32_t a, b, c, d;
+    cpuid(0, &a, &b, &c, &d);
+
+    write_cr0(cr0);
+    irq_restore(flags);
+}
+
+void static_key_enable(static_key_t* key) {
+    if (__atomic_fetch_add(&key->enabled, 1, __ATOMIC_SEQ_CST) == 0) {
+        static_key_patch(key, true);
+    }
+}
+
+void static_key_disable(static_key_t* key) {
+    if (key->enabled <= 0) return;
+    if (__atomic_sub_fetch(&key->enabled, 1, __ATOMIC_SEQ_CST) == 0) {
+        static_key_patch(key, false);
+    }
+}
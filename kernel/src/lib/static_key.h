@@ -0,0 +1,52 @@
+#ifndef STATIC_KEY_H
+#define STATIC_KEY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Static keys: branches that cost a 5-byte NOP while the key is off.
+//
+// Each static_branch_unlikely() site emits a NOP and records
+// { site, target, key } in the __jump_table section. Enabling the key
+// rewrites every site of that key into a JMP to the target, and disabling
+// it writes the NOP back. Keys are toggled rarely; the sites run often.
+
+typedef struct {
+    volatile int enabled; // Reference count; the branch is taken while > 0
+} static_key_t;
+
+#define STATIC_KEY_INIT_FALSE { 0 }
+
+typedef struct {
+    uint64_t code;   // Address of the 5-byte NOP/JMP
+    uint64_t target; // Where the JMP goes
+    uint64_t key;    // static_key_t* this site belongs to
+} jump_entry_t;
+
+// A macro rather than an inline function so `key` is a link-time constant
+// even without optimisation.
+#define static_branch_unlikely(key) ({                                  \
+    __label__ l_yes, l_done;                                            \
+    bool taken_;                                                        \
+    asm goto("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"                \
+             ".pushsection __jump_table, \"aw\"\n\t"                    \
+             ".balign 8\n\t"                                            \
+             ".quad 1b, %l[l_yes], %c0\n\t"                             \
+             ".popsection"                                              \
+             : : "i"(key) : : l_yes);                                   \
+    taken_ = false;                                                     \
+    goto l_done;                                                        \
+l_yes:                                                                  \
+    taken_ = true;                                                      \
+l_done:                                                                 \
+    taken_;                                                             \
+})
+
+void static_key_enable(static_key_t* key);
+void static_key_disable(static_key_t* key);
+
+static inline bool static_key_enabled(static_key_t* key) {
+    return key->enabled > 0;
+}
+
+#endif
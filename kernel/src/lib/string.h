@@ -12,4 +12,16 @@ char* strcpy(char* dest, const char* src);
 // Returns the length of a string.
 size_t strlen(const char* str);
 
+// Fills n bytes of buf with the byte value c.
+void* memset(void* buf, int c, size_t n);
+
+// Copies n bytes from src to dest. The regions must not overlap.
+void* memcpy(void* dest, const void* src, size_t n);
+
+// Copies n bytes from src to dest. The regions may overlap.
+void* memmove(void* dest, const void* src, size_t n);
+
+// Compares n bytes. Returns 0 if they are equal.
+int memcmp(const void* a, const void* b, size_t n);
+
 #endif
@@ -4,11 +4,18 @@
 #include <limine.h>
 #include <arch/x86_64/gdt.h>
 #include <arch/x86_64/idt.h>
+#include <arch/x86_64/cpu.h>
 #include <mem/pmm.h>
 #include <mem/vmm.h>
+#include <mem/swap.h>
 #include <acpi/acpi.h>
 #include <drivers/pci.h>
 #include <proc/task.h>
+#include <proc/vdso.h>
+#include <proc/workqueue.h>
+#include <fs/vfs.h>
+#include <fs/initramfs.h>
+#include <interrupts/syscall.h>
 #include <gui/compositor.h>
 #include <lib/print.h>
 
@@ -56,11 +63,18 @@ void _start(void) {
     
     gdt_init();
     idt_init();
+    cpu_local_init(0);
     pmm_init();
     vmm_init();
     acpi_init();
     pci_init();
     task_init();
+    vdso_init();
+    workqueue_init();
+    swap_init();
+    vfs_init();
+    initramfs_init();
+    init_syscalls();
     compositor_init();
     
     kprintf("Hello, world!\n");
@@ -15,6 +15,8 @@ static struct {
     uintptr_t start_addr;
     uint32_t total_pages;
     uint8_t* page_orders; // An array to store the order of each allocated page
+    size_t free_pages;    // On the free lists, for the reclaim watermarks
+    size_t usable_pages;  // Given to the free lists at init
 } buddy_allocator;
 
 // Helper to get the order for a given size
@@ -87,6 +89,8 @@ void buddy_init(void* mem_start, size_t size) {
             current_addr += block_size;
         }
     }
+    buddy_allocator.usable_pages = (current_addr - start_of_pages) / PAGE_SIZE;
+    buddy_allocator.free_pages = buddy_allocator.usable_pages;
 }
 
 void* buddy_alloc(size_t size) {
@@ -127,6 +131,7 @@ void* buddy_alloc(size_t size) {
     // Mark the page(s) as used with the correct order
     uint32_t page_index = ((uintptr_t)block - buddy_allocator.start_addr) / PAGE_SIZE;
     buddy_allocator.page_orders[page_index] = order;
+    buddy_allocator.free_pages -= (size_t)1 << order;
 
     return (void*)block;
 }
@@ -136,6 +141,7 @@ void buddy_free(void* ptr, size_t size) {
 
     uintptr_t addr = (uintptr_t)ptr;
     int order = get_order(size);
+    buddy_allocator.free_pages += (size_t)1 << order;
 
     // Merge with buddies if they are free
     while (order < MAX_ORDER) {
@@ -167,3 +173,11 @@ void buddy_free(void* ptr, size_t size) {
     uint32_t page_index = (addr - buddy_allocator.start_addr) / PAGE_SIZE;
     buddy_allocator.page_orders[page_index] = 0xFF; // 0xFF indicates free
 }
+
+size_t buddy_free_pages(void) {
+    return buddy_allocator.free_pages;
+}
+
+size_t buddy_total_pages(void) {
+    return buddy_allocator.usable_pages;
+}
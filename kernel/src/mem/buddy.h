@@ -8,3 +8,5 @@
 void buddy_init(void *mem, size_t size);
 void *buddy_alloc(size_t size);
 void buddy_free(void *ptr, size_t size);
+size_t buddy_free_pages(void);
+size_t buddy_total_pages(void);
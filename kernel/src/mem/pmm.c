@@ -1,5 +1,9 @@
 #include "pmm.h"
 #include "buddy.h"
+#include "shrinker.h"
+#include "swap.h"
+
+static size_t watermarks[3];
 
 void pmm_init(struct limine_memmap_response *memmap) {
     for (uint64_t i = 0; i < memmap->entry_count; i++) {
@@ -8,12 +12,37 @@ void pmm_init(struct limine_memmap_response *memmap) {
             buddy_init((void *)entry->base, entry->length);
         }
     }
+
+    // kswapd starts below low and stops at high; below min, user pages
+    // wait for reclaim so what is left stays for the kernel
+    size_t min = buddy_total_pages() / 128;
+    if (min < 32) min = 32;
+    watermarks[WMARK_MIN] = min;
+    watermarks[WMARK_LOW] = min + min / 4;
+    watermarks[WMARK_HIGH] = min + min / 2;
 }
 
 void *pmm_alloc(size_t size) {
-    return buddy_alloc(size);
+    void *ptr = buddy_alloc(size);
+    // Out of memory: have the caches give some back, and retry for as
+    // long as they still can
+    while (!ptr && shrink_caches(SHRINK_BATCH) > 0) {
+        ptr = buddy_alloc(size);
+    }
+    if (buddy_free_pages() < watermarks[WMARK_LOW]) {
+        wakeup_kswapd();
+    }
+    return ptr;
 }
 
 void pmm_free(void *ptr, size_t size) {
     buddy_free(ptr, size);
 }
+
+size_t pmm_free_pages(void) {
+    return buddy_free_pages();
+}
+
+size_t pmm_watermark(int which) {
+    return watermarks[which];
+}
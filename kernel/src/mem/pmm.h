@@ -7,3 +7,23 @@
 void pmm_init(struct limine_memmap_response *memmap);
 void *pmm_alloc(size_t size);
 void pmm_free(void *ptr, size_t size);
+
+// Reclaim watermarks, in free pages
+#define WMARK_MIN  0
+#define WMARK_LOW  1
+#define WMARK_HIGH 2
+
+size_t pmm_free_pages(void);
+size_t pmm_watermark(int which);
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 0x1000
+#endif
+
+static inline void *pmm_alloc_page(void) {
+    return pmm_alloc(PAGE_SIZE);
+}
+
+static inline void pmm_free_page(void *page) {
+    pmm_free(page, PAGE_SIZE);
+}
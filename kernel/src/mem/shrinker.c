@@ -0,0 +1,31 @@
+/* kernel/src/mem/shrinker.c */
+
+#include "shrinker.h"
+#include "../sync/spinlock.h"
+
+static shrinker_t* shrinkers = NULL;
+static spinlock_t shrinker_lock = 0;
+static volatile bool shrinking = false;
+
+void register_shrinker(shrinker_t* shrinker) {
+    spinlock_acquire(&shrinker_lock);
+    shrinker->next = shrinkers;
+    shrinkers = shrinker;
+    spinlock_release(&shrinker_lock);
+}
+
+uint64_t shrink_caches(uint64_t nr) {
+    // One shrink at a time. Allocations that fail inside a scan, or on
+    // another CPU meanwhile, fail rather than recurse or wait.
+    if (__atomic_exchange_n(&shrinking, true, __ATOMIC_ACQUIRE)) return 0;
+
+    uint64_t freed = 0;
+    for (shrinker_t* s = shrinkers; s; s = s->next) {
+        uint64_t count = s->count();
+        if (count == 0) continue;
+        freed += s->scan(count < nr ? count : nr);
+    }
+
+    __atomic_store_n(&shrinking, false, __ATOMIC_RELEASE);
+    return freed;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Caches that can give memory back register a shrinker. When the page
+// allocator runs dry it asks them, in turn, to free objects and retries
+// while they still manage to.
+//
+// Shrinkers run inside whatever allocation ran out, so a scan must not
+// allocate, sleep, or wait for a lock the allocating code may hold.
+
+typedef struct shrinker {
+    uint64_t (*count)(void);       // Objects that could be freed now
+    uint64_t (*scan)(uint64_t nr); // Frees up to nr of them; returns how many went
+    struct shrinker* next;
+} shrinker_t;
+
+#define SHRINK_BATCH 128
+
+void register_shrinker(shrinker_t* shrinker);
+
+// Asks every shrinker for up to `nr` objects. Returns the total freed; 0
+// when nothing is left to free or another shrink is already running.
+uint64_t shrink_caches(uint64_t nr);
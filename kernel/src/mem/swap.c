@@ -0,0 +1,762 @@
+/* kernel/src/mem/swap.c */
+
+#include "swap.h"
+#include "pmm.h"
+#include "shrinker.h"
+#include "../block/blkdev.h"
+#include "../lib/radix_tree.h"
+#include "../lib/string.h"
+#include "../proc/task.h"
+#include "../proc/vdso.h"
+#include "../proc/workqueue.h"
+#include "../sync/spinlock.h"
+#include "../../arch/x86_64/cpu.h"
+
+void print(char*); // Forward declare from main.c for logging
+
+// Each anonymous page has a descriptor saying where it is mapped, so that
+// reclaim, which finds pages on the LRU lists, can reach the entry that
+// maps them. Descriptors are found by page frame, and while a page is on
+// its way to or from the device, also by swap slot through the swap cache.
+//
+// Aging is the usual two-list clock. New pages go on the inactive list.
+// Reclaim takes pages off its tail and promotes those found accessed to
+// the active list; the rest are written out. The active list is kept no
+// longer than the inactive one by moving its tail pages that have not
+// been touched since the last pass back to the inactive list.
+//
+// A page being written out is already unmapped, its entry holding the
+// slot, and sits in the swap cache until the write is done. A fault in the
+// meantime takes it straight back. A swap-in reads the whole aligned
+// window of used slots around the faulting one. The neighbours wait in the
+// swap cache for their own faults, and a shrinker drops them if memory
+// runs short first.
+//
+// There is a single CPU's worth of TLB to look after: entries are changed
+// and then flushed here, and other address spaces are flushed when the
+// scheduler switches to them.
+
+#define SWAP_PAGE_SECTORS (PAGE_SIZE / SECTOR_SIZE)
+#define SWAP_PTE_FLAGS    (PTE_WRITABLE | PTE_USER | PTE_NX) // Kept in a swap entry
+#define KSWAPD_BACKOFF_MS 100 // After a pass that freed nothing
+
+// Descriptor flags
+#define AP_LRU       0x01 // On the active or inactive list
+#define AP_ACTIVE    0x02 // The active one
+#define AP_WRITEBACK 0x04 // Being written out
+#define AP_MAPPED    0x08 // Faulted back in while being written; the write frees the slot
+#define AP_FREED     0x10 // Freed by its owner during I/O; the I/O frees the rest
+#define AP_READING   0x20 // Being read in
+#define AP_READAHEAD 0x40 // Read around, waiting in the swap cache for its fault
+#define AP_IOERR     0x80 // The read failed
+
+typedef struct swap_io swap_io_t;
+
+typedef struct anon_page {
+    struct anon_page* prev;   // On an LRU list or the read-around list
+    struct anon_page* next;
+    uint8_t* page;
+    pml4_t* pml4;             // Where it is mapped
+    uint64_t virt;
+    uint64_t slot;            // While in the swap cache
+    swap_io_t* io;            // During I/O
+    uint32_t flags;           // AP_*
+} anon_page_t;
+
+typedef struct anon_list {
+    anon_page_t* head;        // Newest
+    anon_page_t* tail;
+    uint64_t count;
+} anon_list_t;
+
+// One pass of writes, or one read-around
+struct swap_io {
+    bio_batch_t batch;
+    uint64_t freed;
+    anon_page_t* pages[SWAP_CLUSTER];
+};
+
+static struct {
+    block_device_t* bdev;
+    uint64_t nr_slots;
+    uint64_t nr_clusters;
+    uint64_t used;
+    uint64_t* map;            // A bit per slot; a word per cluster
+    uint64_t* discard_map;    // A bit per emptied cluster not yet discarded
+    uint64_t next_cluster;    // Where the search for an empty cluster resumes
+    uint64_t cpu_cluster[MAX_CPUS]; // Each CPU's cluster to allocate from, +1
+    radix_tree_t cache;       // Slot to descriptor
+} swap;
+
+static spinlock_t swap_lock = 0; // Everything in this file, with interrupts off
+static radix_tree_t anon_pages = RADIX_TREE_INIT; // Page frame to descriptor
+static anon_list_t active_list;
+static anon_list_t inactive_list;
+static anon_list_t readahead_list;
+static anon_page_t* free_descs;
+static uint64_t nr_swapins;
+static uint64_t nr_swapouts;
+static uint64_t nr_readaround_hits;
+
+static workqueue_t* kswapd_wq = NULL;
+static uint64_t kswapd_retry_ns;
+
+// Swap-ins take turns: a fault on a page already being read waits for the
+// read rather than start another
+static volatile bool swapin_busy = false;
+static volatile bool swapin_idle = false;
+static wait_queue_t* swapin_waiters = NULL;
+
+// --- Descriptors and lists ---
+
+static anon_page_t* anon_desc_alloc(void) {
+    if (!free_descs) {
+        anon_page_t* chunk = pmm_alloc_page();
+        if (!chunk) return NULL;
+        for (size_t i = 0; i < PAGE_SIZE / sizeof(anon_page_t); i++) {
+            chunk[i].next = free_descs;
+            free_descs = &chunk[i];
+        }
+    }
+    anon_page_t* ap = free_descs;
+    free_descs = ap->next;
+    memset(ap, 0, sizeof(anon_page_t));
+    return ap;
+}
+
+// A descriptor for `page`, findable by frame. Under the lock; NULL when
+// out of memory.
+static anon_page_t* anon_new(uint8_t* page) {
+    anon_page_t* ap = anon_desc_alloc();
+    if (!ap) return NULL;
+    ap->page = page;
+    if (radix_tree_insert(&anon_pages, (uint64_t)page / PAGE_SIZE, ap) != 0) {
+        ap->next = free_descs;
+        free_descs = ap;
+        return NULL;
+    }
+    return ap;
+}
+
+// Frees the page and its descriptor. Under the lock.
+static void anon_release(anon_page_t* ap) {
+    radix_tree_delete(&anon_pages, (uint64_t)ap->page / PAGE_SIZE);
+    pmm_free_page(ap->page);
+    ap->next = free_descs;
+    free_descs = ap;
+}
+
+static void list_add(anon_list_t* list, anon_page_t* ap) {
+    ap->prev = NULL;
+    ap->next = list->head;
+    if (list->head) list->head->prev = ap;
+    else list->tail = ap;
+    list->head = ap;
+    list->count++;
+}
+
+static void list_del(anon_list_t* list, anon_page_t* ap) {
+    if (ap->prev) ap->prev->next = ap->next;
+    else list->head = ap->next;
+    if (ap->next) ap->next->prev = ap->prev;
+    else list->tail = ap->prev;
+    list->count--;
+}
+
+static void lru_add(anon_page_t* ap, bool active) {
+    list_add(active ? &active_list : &inactive_list, ap);
+    ap->flags |= AP_LRU | (active ? AP_ACTIVE : 0);
+}
+
+static void lru_del(anon_page_t* ap) {
+    if (!(ap->flags & AP_LRU)) return;
+    list_del((ap->flags & AP_ACTIVE) ? &active_list : &inactive_list, ap);
+    ap->flags &= ~(AP_LRU | AP_ACTIVE);
+}
+
+// True if the page was accessed since the last look; clears the bit so
+// the next look sees only newer accesses
+static bool anon_referenced(anon_page_t* ap) {
+    pte_t* pte = vmm_get_pte(ap->pml4, ap->virt, false);
+    if (!pte || !(*pte & PTE_ACCESSED)) return false;
+    *pte &= ~PTE_ACCESSED;
+    vmm_flush_page(ap->virt);
+    return true;
+}
+
+// Points the swap entry at `pte` back at the page, which goes on the
+// active list. Under the lock.
+static void anon_remap(anon_page_t* ap, pte_t* pte) {
+    *pte = (uint64_t)ap->page | (*pte & SWAP_PTE_FLAGS) | PTE_PRESENT;
+    lru_add(ap, true);
+}
+
+// --- Slots ---
+
+static bool slot_used(uint64_t slot) {
+    return (swap.map[slot / 64] >> (slot % 64)) & 1;
+}
+
+static bool cluster_owned(uint64_t cluster) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (swap.cpu_cluster[i] == cluster + 1) return true;
+    }
+    return false;
+}
+
+static bool cluster_discarding(uint64_t cluster) {
+    return (swap.discard_map[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+// A free slot. Each CPU allocates from a cluster of its own while it has
+// room, so a reclaim pass writes one contiguous run. -1 when swap is full.
+// Under the lock.
+static int64_t slot_alloc(void) {
+    uint32_t cpu = this_cpu_id();
+    uint64_t c = swap.cpu_cluster[cpu];
+    if (!c || swap.map[c - 1] == ~0ULL) {
+        // An empty cluster nobody has, failing that any with room
+        c = 0;
+        for (uint64_t i = 0; i < swap.nr_clusters && !c; i++) {
+            uint64_t k = (swap.next_cluster + i) % swap.nr_clusters;
+            if (!swap.map[k] && !cluster_discarding(k) && !cluster_owned(k)) c = k + 1;
+        }
+        for (uint64_t k = 0; k < swap.nr_clusters && !c; k++) {
+            if (swap.map[k] && swap.map[k] != ~0ULL) c = k + 1;
+        }
+        if (!c) return -1;
+        swap.cpu_cluster[cpu] = c;
+        swap.next_cluster = c % swap.nr_clusters;
+    }
+
+    uint64_t* word = &swap.map[c - 1];
+    int bit = __builtin_ctzll(~*word);
+    *word |= 1ULL << bit;
+    swap.used++;
+    return (int64_t)((c - 1) * SWAP_CLUSTER + bit);
+}
+
+static void swap_discard_work_fn(work_t* work);
+static work_t swap_discard_work = WORK_INIT(swap_discard_work_fn);
+
+// Under the lock
+static void slot_free(uint64_t slot) {
+    uint64_t k = slot / SWAP_CLUSTER;
+    swap.map[k] &= ~(1ULL << (slot % SWAP_CLUSTER));
+    swap.used--;
+
+    // An emptied cluster is discarded before it is handed out again, so a
+    // compressed RAM device gets its memory back
+    if (!swap.map[k] && swap.bdev->max_discard_sectors && !cluster_owned(k)) {
+        swap.discard_map[k / 64] |= 1ULL << (k % 64);
+        if (kswapd_wq) queue_work(kswapd_wq, &swap_discard_work);
+    }
+}
+
+static void swap_discard_work_fn(work_t* work) {
+    (void)work;
+    for (uint64_t k = 0; k < swap.nr_clusters; k++) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&swap_lock);
+        bool pending = cluster_discarding(k);
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+        if (!pending) continue;
+
+        blkdev_discard(swap.bdev, k * SWAP_CLUSTER * SWAP_PAGE_SECTORS, SWAP_CLUSTER * SWAP_PAGE_SECTORS);
+
+        flags = irq_save();
+        spinlock_acquire(&swap_lock);
+        swap.discard_map[k / 64] &= ~(1ULL << (k % 64));
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+    }
+}
+
+// --- I/O ---
+
+// Puts `pages` on the device, or reads them in. Pages whose slots follow
+// on from one another share a bio. Returns how many were submitted; the
+// rest could not get a bio.
+static uint32_t swap_submit(swap_io_t* io, uint32_t op, uint32_t n, bio_end_io_t end_io) {
+    anon_page_t** pages = io->pages;
+    blk_plug_t plug;
+    blk_start_plug(&plug);
+    bio_t* bio = NULL;
+    uint32_t i;
+    for (i = 0; i <= n; i++) {
+        if (bio && i < n && pages[i]->slot == pages[i - 1]->slot + 1 &&
+            bio_add(bio, pages[i]->page, PAGE_SIZE) == 0) {
+            continue;
+        }
+        if (bio) {
+            bio_batch_add(&io->batch);
+            submit_bio(bio);
+            bio = NULL;
+        }
+        if (i == n) break;
+
+        bio = bio_alloc(swap.bdev, op, pages[i]->slot * SWAP_PAGE_SECTORS, n - i);
+        if (!bio) break;
+        bio_add(bio, pages[i]->page, PAGE_SIZE);
+        bio->end_io = end_io;
+        bio->private = &pages[i];
+    }
+    blk_finish_plug(&plug);
+    return i < n ? i : n;
+}
+
+// Under the lock
+static void swap_write_done(anon_page_t* ap, int status) {
+    swap_io_t* io = ap->io;
+    ap->flags &= ~AP_WRITEBACK;
+    ap->io = NULL;
+
+    if (ap->flags & AP_FREED) {
+        slot_free(ap->slot);
+        anon_release(ap);
+        return;
+    }
+    if (ap->flags & AP_MAPPED) {
+        ap->flags &= ~AP_MAPPED;
+        slot_free(ap->slot);
+        return;
+    }
+
+    radix_tree_delete(&swap.cache, ap->slot);
+    if (status != BLK_STS_OK) {
+        // Back as it was, the write forgotten
+        pte_t* pte = vmm_get_pte(ap->pml4, ap->virt, false);
+        anon_remap(ap, pte);
+        slot_free(ap->slot);
+        return;
+    }
+    anon_release(ap);
+    io->freed++;
+    nr_swapouts++;
+}
+
+static void swap_write_end_io(bio_t* bio) {
+    anon_page_t** pages = bio->private;
+    uint32_t n = bio->size / PAGE_SIZE;
+    int status = bio->status;
+    swap_io_t* io = pages[0]->io;
+    bio_put(bio);
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    for (uint32_t i = 0; i < n; i++) swap_write_done(pages[i], status);
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+
+    bio_batch_done(&io->batch, status);
+}
+
+static void swap_read_end_io(bio_t* bio) {
+    anon_page_t** pages = bio->private;
+    uint32_t n = bio->size / PAGE_SIZE;
+    int status = bio->status;
+    swap_io_t* io = pages[0]->io;
+    bio_put(bio);
+
+    if (status != BLK_STS_OK) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&swap_lock);
+        for (uint32_t i = 0; i < n; i++) pages[i]->flags |= AP_IOERR;
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+    }
+    bio_batch_done(&io->batch, status);
+}
+
+// --- Reclaim ---
+
+// Moves up to `nr` pages off the tail of the active list while it is the
+// longer one: those touched since the last pass go round again, the rest
+// onto the inactive list. Under the lock.
+static void swap_age_active(uint64_t nr) {
+    while (nr-- > 0 && active_list.tail && inactive_list.count < active_list.count) {
+        anon_page_t* ap = active_list.tail;
+        lru_del(ap);
+        lru_add(ap, anon_referenced(ap));
+    }
+}
+
+// Takes up to `max` cold pages off the inactive list, gives each a slot
+// and unmaps it, for writing. Under the lock.
+static uint32_t swap_isolate(anon_page_t** out, uint32_t max) {
+    uint32_t n = 0;
+    uint64_t scan = inactive_list.count;
+    while (n < max && scan-- > 0) {
+        anon_page_t* ap = inactive_list.tail;
+        lru_del(ap);
+        if ((ap->flags & AP_WRITEBACK) || anon_referenced(ap)) {
+            lru_add(ap, true);
+            continue;
+        }
+
+        int64_t slot = slot_alloc();
+        if (slot < 0 || radix_tree_insert(&swap.cache, slot, ap) != 0) {
+            if (slot >= 0) slot_free(slot);
+            lru_add(ap, false);
+            break;
+        }
+
+        pte_t* pte = vmm_get_pte(ap->pml4, ap->virt, false);
+        *pte = ((uint64_t)slot << 12) | PTE_SWAP | (*pte & SWAP_PTE_FLAGS);
+        vmm_flush_page(ap->virt);
+        ap->slot = slot;
+        ap->flags |= AP_WRITEBACK;
+        out[n++] = ap;
+    }
+    return n;
+}
+
+uint64_t swap_reclaim(uint64_t nr) {
+    uint64_t freed = 0;
+    while (freed < nr) {
+        swap_io_t io;
+        bio_batch_init(&io.batch);
+        io.freed = 0;
+
+        uint64_t flags = irq_save();
+        spinlock_acquire(&swap_lock);
+        uint32_t n = 0;
+        if (swap.bdev) {
+            swap_age_active(SWAP_CLUSTER);
+            n = swap_isolate(io.pages, SWAP_CLUSTER);
+            for (uint32_t i = 0; i < n; i++) io.pages[i]->io = &io;
+        }
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+        if (n == 0) break;
+
+        uint32_t sent = swap_submit(&io, REQ_OP_WRITE, n, swap_write_end_io);
+        if (sent < n) {
+            flags = irq_save();
+            spinlock_acquire(&swap_lock);
+            for (uint32_t i = sent; i < n; i++) swap_write_done(io.pages[i], BLK_STS_IOERR);
+            spinlock_release(&swap_lock);
+            irq_restore(flags);
+        }
+        bio_batch_wait(&io.batch);
+
+        if (io.freed == 0) break;
+        freed += io.freed;
+    }
+    return freed;
+}
+
+static void kswapd(work_t* work) {
+    (void)work;
+    uint64_t freed = 0;
+    while (pmm_free_pages() < pmm_watermark(WMARK_HIGH)) {
+        // Caches first; dropping them costs no I/O
+        uint64_t n = shrink_caches(SHRINK_BATCH);
+        if (pmm_free_pages() < pmm_watermark(WMARK_HIGH)) n += swap_reclaim(SWAP_CLUSTER);
+        if (n == 0) break;
+        freed += n;
+    }
+    // Nothing to free: allocations below the low watermark would only keep
+    // waking it for nothing
+    if (freed == 0) kswapd_retry_ns = ktime_get_ns() + KSWAPD_BACKOFF_MS * 1000000ULL;
+}
+
+static work_t kswapd_work = WORK_INIT(kswapd);
+
+void wakeup_kswapd(void) {
+    if (!kswapd_wq || ktime_get_ns() < kswapd_retry_ns) return;
+    queue_work(kswapd_wq, &kswapd_work);
+}
+
+// Read-around pages that were never faulted in go first when the
+// allocator runs dry; they are still on the device
+static uint64_t swap_cache_count(void) {
+    return readahead_list.count;
+}
+
+static uint64_t swap_cache_scan(uint64_t nr) {
+    uint64_t flags = irq_save();
+    if (!spinlock_try_acquire(&swap_lock)) {
+        irq_restore(flags);
+        return 0;
+    }
+    uint64_t freed = 0;
+    while (freed < nr && readahead_list.tail) {
+        anon_page_t* ap = readahead_list.tail;
+        list_del(&readahead_list, ap);
+        radix_tree_delete(&swap.cache, ap->slot);
+        anon_release(ap);
+        freed++;
+    }
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+    return freed;
+}
+
+static shrinker_t swap_cache_shrinker = {
+    .count = swap_cache_count,
+    .scan = swap_cache_scan,
+};
+
+// --- Swap-in ---
+
+static void swapin_lock(void) {
+    while (__atomic_exchange_n(&swapin_busy, true, __ATOMIC_ACQUIRE)) {
+        thread_wait_event(&swapin_waiters, &swapin_idle);
+    }
+    swapin_idle = false;
+}
+
+static void swapin_unlock(void) {
+    __atomic_store_n(&swapin_busy, false, __ATOMIC_RELEASE);
+    thread_wake_event(&swapin_waiters, &swapin_idle);
+}
+
+// Maps a page found in the swap cache. Under the lock.
+static void swap_take_cached(anon_page_t* ap, pml4_t* pml4, uint64_t virt, pte_t* pte) {
+    radix_tree_delete(&swap.cache, ap->slot);
+    if (ap->flags & AP_WRITEBACK) {
+        ap->flags |= AP_MAPPED;
+    } else {
+        list_del(&readahead_list, ap);
+        ap->flags &= ~AP_READAHEAD;
+        slot_free(ap->slot);
+        nr_readaround_hits++;
+    }
+    ap->pml4 = pml4;
+    ap->virt = virt;
+    anon_remap(ap, pte);
+}
+
+// With the swap-in lock. 0 when done, 1 when out of memory, -1 on a read
+// error.
+static int swap_read(pml4_t* pml4, uint64_t virt, pte_t* pte) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    uint64_t entry = *pte;
+    if ((entry & PTE_PRESENT) || !(entry & PTE_SWAP)) {
+        // Brought back, or unmapped, while we waited our turn
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+        return 0;
+    }
+    uint64_t slot = (entry & PAGING_ADDRESS_MASK) >> 12;
+    anon_page_t* ap = radix_tree_lookup(&swap.cache, slot);
+    if (ap) {
+        swap_take_cached(ap, pml4, virt, pte);
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+        return 0;
+    }
+
+    // Every slot in use in the window that is not in memory already
+    swap_io_t io;
+    bio_batch_init(&io.batch);
+    uint32_t n = 0;
+    anon_page_t* target = NULL;
+    uint64_t first = slot & ~(uint64_t)(SWAP_READAROUND - 1);
+    for (uint64_t s = first; s < first + SWAP_READAROUND && s < swap.nr_slots; s++) {
+        if (!slot_used(s) || radix_tree_lookup(&swap.cache, s)) continue;
+        uint8_t* page = pmm_alloc_page();
+        anon_page_t* rp = page ? anon_new(page) : NULL;
+        if (rp && radix_tree_insert(&swap.cache, s, rp) != 0) {
+            anon_release(rp);
+            rp = NULL;
+        } else if (!rp && page) {
+            pmm_free_page(page);
+        }
+        if (!rp) continue;
+        rp->slot = s;
+        rp->flags = AP_READING;
+        rp->io = &io;
+        io.pages[n++] = rp;
+        if (s == slot) target = rp;
+    }
+    if (!target) {
+        for (uint32_t i = 0; i < n; i++) {
+            radix_tree_delete(&swap.cache, io.pages[i]->slot);
+            anon_release(io.pages[i]);
+        }
+        spinlock_release(&swap_lock);
+        irq_restore(flags);
+        return 1;
+    }
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+
+    uint32_t sent = swap_submit(&io, REQ_OP_READ, n, swap_read_end_io);
+    bio_batch_wait(&io.batch);
+
+    flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    int ret = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        anon_page_t* rp = io.pages[i];
+        rp->flags &= ~AP_READING;
+        rp->io = NULL;
+        if (i >= sent) rp->flags |= AP_IOERR;
+
+        if (rp->flags & AP_FREED) {
+            // Its owner unmapped it meanwhile and took it out of the cache
+            anon_release(rp);
+            continue;
+        }
+        if (rp->flags & AP_IOERR) {
+            radix_tree_delete(&swap.cache, rp->slot);
+            anon_release(rp);
+            if (rp == target) ret = -1;
+            continue;
+        }
+        nr_swapins++;
+        if (rp == target) {
+            radix_tree_delete(&swap.cache, slot);
+            slot_free(slot);
+            rp->pml4 = pml4;
+            rp->virt = virt;
+            anon_remap(rp, pte);
+        } else {
+            rp->flags |= AP_READAHEAD;
+            list_add(&readahead_list, rp);
+        }
+    }
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+    return ret;
+}
+
+int swap_fault(pml4_t* pml4, uint64_t virt) {
+    virt &= ~(uint64_t)(PAGE_SIZE - 1);
+    pte_t* pte = vmm_get_pte(pml4, virt, false);
+    if (!pte || (*pte & PTE_PRESENT) || !(*pte & PTE_SWAP)) return -1;
+
+    swapin_lock();
+    int ret = swap_read(pml4, virt, pte);
+    if (ret == 1 && (swap_reclaim(SWAP_CLUSTER) > 0 || shrink_caches(SHRINK_BATCH) > 0)) {
+        ret = swap_read(pml4, virt, pte);
+    }
+    swapin_unlock();
+
+    if (ret == 1) print("SWAP: Out of memory bringing a page back in.\n");
+    else if (ret < 0) print("SWAP: Read error bringing a page back in.\n");
+    return ret == 0 ? 0 : -1;
+}
+
+// --- Anonymous pages ---
+
+void* anon_page_alloc(pml4_t* pml4, uint64_t virt, uint64_t flags) {
+    // Below min, user pages wait for reclaim rather than take what the
+    // kernel needs to make progress
+    if (pmm_free_pages() < pmm_watermark(WMARK_MIN)) swap_reclaim(SWAP_CLUSTER);
+    uint8_t* page = pmm_alloc_page();
+    if (!page && swap_reclaim(SWAP_CLUSTER) > 0) page = pmm_alloc_page();
+    if (!page) return NULL;
+    memset(page, 0, PAGE_SIZE);
+
+    uint64_t irq = irq_save();
+    spinlock_acquire(&swap_lock);
+    pte_t* pte = vmm_get_pte(pml4, virt, true);
+    anon_page_t* ap = pte ? anon_new(page) : NULL;
+    if (!ap) {
+        spinlock_release(&swap_lock);
+        irq_restore(irq);
+        pmm_free_page(page);
+        return NULL;
+    }
+    ap->pml4 = pml4;
+    ap->virt = virt;
+    *pte = (uint64_t)page | flags | PTE_PRESENT;
+    lru_add(ap, false);
+    spinlock_release(&swap_lock);
+    irq_restore(irq);
+    return page;
+}
+
+void anon_page_free(pml4_t* pml4, uint64_t virt) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    pte_t* pte = vmm_get_pte(pml4, virt, false);
+    uint64_t entry = pte ? *pte : 0;
+    if (pte) *pte = 0;
+
+    if (entry & PTE_PRESENT) {
+        vmm_flush_page(virt);
+        anon_page_t* ap = radix_tree_lookup(&anon_pages, (entry & PAGING_ADDRESS_MASK) / PAGE_SIZE);
+        if (ap) {
+            lru_del(ap);
+            // A write of it may still be reading it
+            if (ap->flags & AP_WRITEBACK) ap->flags |= AP_FREED;
+            else anon_release(ap);
+        }
+    } else if (entry & PTE_SWAP) {
+        uint64_t slot = (entry & PAGING_ADDRESS_MASK) >> 12;
+        anon_page_t* ap = radix_tree_delete(&swap.cache, slot);
+        if (ap && (ap->flags & (AP_WRITEBACK | AP_READING))) {
+            ap->flags |= AP_FREED;
+        } else if (ap) {
+            list_del(&readahead_list, ap);
+            anon_release(ap);
+        }
+        // A write still going frees the slot when it is done
+        if (!ap || !(ap->flags & AP_WRITEBACK)) slot_free(slot);
+    }
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+}
+
+// --- Setup ---
+
+int swapon(block_device_t* bdev) {
+    uint64_t nr_slots = (bdev->nr_sectors / SWAP_PAGE_SECTORS) & ~(uint64_t)(SWAP_CLUSTER - 1);
+    if (swap.bdev || nr_slots == 0 || bdev->block_size > PAGE_SIZE) return -1;
+
+    uint64_t nr_clusters = nr_slots / SWAP_CLUSTER;
+    size_t map_size = nr_clusters * sizeof(uint64_t);
+    size_t discard_size = (nr_clusters + 63) / 64 * sizeof(uint64_t);
+    uint64_t* map = pmm_alloc(map_size);
+    uint64_t* discard_map = pmm_alloc(discard_size);
+    if (!map || !discard_map) {
+        if (map) pmm_free(map, map_size);
+        if (discard_map) pmm_free(discard_map, discard_size);
+        return -1;
+    }
+    memset(map, 0, map_size);
+    memset(discard_map, 0, discard_size);
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    swap.nr_slots = nr_slots;
+    swap.nr_clusters = nr_clusters;
+    swap.map = map;
+    swap.discard_map = discard_map;
+    radix_tree_init(&swap.cache);
+    swap.bdev = bdev;
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+
+    print("SWAP: Swapping to ");
+    print(bdev->name);
+    print(".\n");
+    return 0;
+}
+
+void swap_get_stats(swap_stats_t* out) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&swap_lock);
+    out->total_slots = swap.nr_slots;
+    out->used_slots = swap.used;
+    out->active = active_list.count;
+    out->inactive = inactive_list.count;
+    out->cached = readahead_list.count;
+    out->swapins = nr_swapins;
+    out->swapouts = nr_swapouts;
+    out->readaround_hits = nr_readaround_hits;
+    spinlock_release(&swap_lock);
+    irq_restore(flags);
+}
+
+void swap_init(void) {
+    register_shrinker(&swap_cache_shrinker);
+    kswapd_wq = workqueue_create("kswapd");
+    if (!kswapd_wq) print("SWAP Error: Failed to start kswapd.\n");
+}
@@ -0,0 +1,64 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "vmm.h"
+
+// Anonymous memory and swap. User pages that are not backed by a file are
+// allocated through anon_page_alloc, which puts them on the LRU lists.
+// When free memory falls below the low watermark, kswapd ages the lists
+// and writes the coldest pages out to the swap device. Their entries then
+// hold the slot, and touching them again faults them back in, together
+// with their neighbours on the device.
+//
+// Without a swap device, anonymous pages are kept on the lists but cannot
+// be reclaimed; kswapd still shrinks the caches.
+
+// A not-present entry with this bit holds a swap slot in the address bits.
+// Bit 9 is left to software by the hardware.
+#define PTE_SWAP (1ULL << 9)
+
+#define SWAP_CLUSTER    64 // Slots allocated together, and pages per reclaim pass
+#define SWAP_READAROUND 8  // Slots read on a swap-in, an aligned window
+
+struct block_device;
+
+typedef struct swap_stats {
+    uint64_t total_slots;
+    uint64_t used_slots;
+    uint64_t active;          // Anonymous pages on each list
+    uint64_t inactive;
+    uint64_t cached;          // Read around but not faulted in yet
+    uint64_t swapins;         // Pages read, read-around included
+    uint64_t swapouts;
+    uint64_t readaround_hits; // Faults found already read
+} swap_stats_t;
+
+// Registers the reclaim shrinker and starts kswapd
+void swap_init(void);
+// Swaps to all of `bdev`. One device at a time; -1 if one is already in
+// use, or out of memory.
+int swapon(struct block_device* bdev);
+
+// Maps a zeroed page at `virt` with `flags`, reclaiming first if memory is
+// short. May sleep. NULL when nothing could be freed.
+void* anon_page_alloc(pml4_t* pml4, uint64_t virt, uint64_t flags);
+// Unmaps and frees the page at `virt`, or its swap slot
+void anon_page_free(pml4_t* pml4, uint64_t virt);
+
+// From the page fault handler: brings back the page at `virt` if it was
+// swapped out. 0 when the access can be retried; -1 if the entry is not a
+// swap entry, or the page could not be read.
+int swap_fault(pml4_t* pml4, uint64_t virt);
+
+// Writes out up to `nr` cold anonymous pages and frees them. Returns how
+// many went. May sleep.
+uint64_t swap_reclaim(uint64_t nr);
+// From the page allocator when free memory is low
+void wakeup_kswapd(void);
+
+void swap_get_stats(swap_stats_t* out);
+
+#endif
@@ -0,0 +1,51 @@
+#include "uaccess.h"
+
+// Exception table entry emitted by arch/x86_64/uaccess.asm
+typedef struct {
+    uint64_t insn;  // Address of the instruction that may fault
+    uint64_t fixup; // Where to resume if it does
+} ex_table_entry_t;
+
+// Bounds of the .ex_table section (linker.ld)
+extern const ex_table_entry_t __start_ex_table[];
+extern const ex_table_entry_t __stop_ex_table[];
+
+extern size_t __copy_user(void* dst, const void* src, size_t len);
+extern long __strncpy_user(char* dst, const char* src, size_t max);
+
+int copy_from_user(void* dst, const void* usrc, size_t len) {
+    if (!access_ok(usrc, len)) return -1;
+    return __copy_user(dst, usrc, len) == 0 ? 0 : -1;
+}
+
+int copy_to_user(void* udst, const void* src, size_t len) {
+    if (!access_ok(udst, len)) return -1;
+    return __copy_user(udst, src, len) == 0 ? 0 : -1;
+}
+
+long strncpy_from_user(char* dst, const char* usrc, size_t max) {
+    if (max == 0) return -1;
+    // Clamp the scan so it cannot walk off the end of user space
+    uint64_t limit = USER_SPACE_END - (uint64_t)usrc;
+    if ((uint64_t)usrc >= USER_SPACE_END) return -1;
+    if (max > limit) max = limit;
+
+    long len = __strncpy_user(dst, usrc, max);
+    if (len < 0 || (size_t)len >= max) {
+        dst[max - 1] = '\0';
+        return -1;
+    }
+    return len;
+}
+
+bool uaccess_fixup(registers_t* regs) {
+    if (regs->cs & 3) return false; // Only kernel-mode faults can be fixed up
+
+    for (const ex_table_entry_t* e = __start_ex_table; e < __stop_ex_table; e++) {
+        if (e->insn == regs->rip) {
+            regs->rip = e->fixup;
+            return true;
+        }
+    }
+    return false;
+}
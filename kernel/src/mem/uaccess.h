@@ -0,0 +1,31 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../../arch/x86_64/idt.h"
+
+// First address above the canonical lower half owned by user space
+#define USER_SPACE_END 0x0000800000000000ULL
+
+// Returns true if [uptr, uptr + len) lies entirely in user space.
+static inline bool access_ok(const void* uptr, size_t len) {
+    uint64_t addr = (uint64_t)uptr;
+    return addr + len >= addr && addr + len <= USER_SPACE_END;
+}
+
+// Copy between kernel and user memory. Both return 0 on success and -1 if
+// the user range is invalid or faults part way through.
+int copy_from_user(void* dst, const void* usrc, size_t len);
+int copy_to_user(void* udst, const void* src, size_t len);
+
+// Copy a NUL-terminated user string into dst (capacity max, including the
+// NUL). Returns the string length, or -1 on a fault or if it does not fit.
+long strncpy_from_user(char* dst, const char* usrc, size_t max);
+
+// Called by the page fault handler. If the fault happened in one of the
+// accessors above, redirect regs->rip to its fixup and return true.
+bool uaccess_fixup(registers_t* regs);
+
+#endif
@@ -1,6 +1,11 @@
 #include "vmm.h"
 #include "pmm.h"
 #include "../lib/string.h"
+#include "uaccess.h"
+#include "swap.h"
+#include "../../arch/x86_64/cpu.h"
+
+void print(char*); // Forward declare from main.c for logging
 
 #define ALIGNED(x) __attribute__((aligned(x)))
 
@@ -21,17 +26,75 @@ static uint64_t* get_next_level(uint64_t* table, uint16_t index, bool allocate)
     return (uint64_t*)((uint64_t)new_level_phys + KERNEL_VIRTUAL_BASE);
 }
 
+pte_t* vmm_get_pte(pml4_t* pml4_virt, uint64_t virt, bool allocate) {
+    uint64_t* pdpt = get_next_level((uint64_t*)pml4_virt, (virt >> 39) & 0x1FF, allocate);
+    if (!pdpt) return NULL;
+    uint64_t* pd = get_next_level(pdpt, (virt >> 30) & 0x1FF, allocate);
+    if (!pd) return NULL;
+    uint64_t* pt = get_next_level(pd, (virt >> 21) & 0x1FF, allocate);
+    if (!pt) return NULL;
+    return &pt[(virt >> 12) & 0x1FF];
+}
+
 void vmm_map_page(pml4_t* pml4_virt, uint64_t virt, uint64_t phys, uint64_t flags) {
-    uint16_t pml4_index = (virt >> 39) & 0x1FF;
-    uint16_t pdpt_index = (virt >> 30) & 0x1FF;
-    uint16_t pd_index   = (virt >> 21) & 0x1FF;
-    uint16_t pt_index   = (virt >> 12) & 0x1FF;
+    pte_t* pte = vmm_get_pte(pml4_virt, virt, true);
+    if (!pte) return;
+    *pte = (phys & PAGING_ADDRESS_MASK) | flags;
+}
 
-    uint64_t* pdpt = get_next_level((uint64_t*)pml4_virt, pml4_index, true);
-    uint64_t* pd   = get_next_level(pdpt, pdpt_index, true);
-    uint64_t* pt   = get_next_level(pd, pd_index, true);
-    
-    pt[pt_index] = (phys & PAGING_ADDRESS_MASK) | flags;
+void vmm_unmap_page(pml4_t* pml4_virt, uint64_t virt) {
+    pte_t* pte = vmm_get_pte(pml4_virt, virt, false);
+    if (!pte) return;
+    *pte = 0;
+    vmm_flush_page(virt);
+}
+
+bool vmm_virt_to_phys(pml4_t* pml4_virt, uint64_t virt, uint64_t* phys) {
+    uint64_t* table = (uint64_t*)pml4_virt;
+    uint64_t entry = 0;
+
+    // PML4, PDPT, PD, PT; a huge page ends the walk early
+    for (int shift = 39; shift >= 12; shift -= 9) {
+        entry = table[(virt >> shift) & 0x1FF];
+        if (!(entry & PTE_PRESENT)) return false;
+        if (shift == 12 || ((shift == 30 || shift == 21) && (entry & PTE_HUGE))) {
+            uint64_t offset_mask = (1ULL << shift) - 1;
+            *phys = ((entry & PAGING_ADDRESS_MASK) & ~offset_mask) | (virt & offset_mask);
+            return true;
+        }
+        table = (uint64_t*)((entry & PAGING_ADDRESS_MASK) + KERNEL_VIRTUAL_BASE);
+    }
+    return false;
+}
+
+// #PF handler
+void vmm_page_fault(registers_t* regs) {
+    uint64_t addr;
+    asm volatile ("mov %%cr2, %0" : "=r"(addr));
+
+    // A page that was swapped out. Bringing it back may sleep, so the
+    // interrupts the faulting code had on go back on first.
+    if (!(regs->err_code & PF_PRESENT)) {
+        if (regs->rflags & RFLAGS_IF) {
+            asm volatile ("sti");
+        }
+        uint64_t cr3;
+        asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+        pml4_t* pml4 = (pml4_t*)((cr3 & PAGING_ADDRESS_MASK) + KERNEL_VIRTUAL_BASE);
+        if (swap_fault(pml4, addr) == 0) {
+            return;
+        }
+    }
+
+    // A bad pointer passed to copy_from_user()/copy_to_user()
+    if (uaccess_fixup(regs)) {
+        return;
+    }
+
+    print("VMM: Unhandled page fault.\n");
+    for (;;) {
+        asm volatile ("cli; hlt");
+    }
 }
 
 void vmm_init() {
@@ -50,6 +113,8 @@ void vmm_init() {
         vmm_map_page(&kernel_pml4, i, i, PTE_PRESENT | PTE_WRITABLE | PTE_NX);
     }
 
+    register_interrupt_handler(14, &vmm_page_fault);
+
     load_pml4((pml4_t*)((uint64_t)&kernel_pml4 - KERNEL_VIRTUAL_BASE));
     current_pml4 = &kernel_pml4;
     print("VMM: 64-bit 4-level paging initialized.\n");
@@ -3,18 +3,29 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../../arch/x86_64/idt.h"
 
+#ifndef PAGE_SIZE
 #define PAGE_SIZE 0x1000
+#endif
 #define KERNEL_VIRTUAL_BASE 0xFFFFFFFF80000000
 
 // Page Table Entry Flags
 #define PTE_PRESENT  (1ULL << 0)
 #define PTE_WRITABLE (1ULL << 1)
 #define PTE_USER     (1ULL << 2)
+#define PTE_ACCESSED (1ULL << 5)  // Set by the CPU on any access through the entry
+#define PTE_DIRTY    (1ULL << 6)  // Set by the CPU on a write
+#define PTE_HUGE     (1ULL << 7)  // In a PDPTE or PDE: maps 1 GiB or 2 MiB directly
 #define PTE_NX       (1ULL << 63) // No-Execute Bit
 
 #define PAGING_ADDRESS_MASK 0x000FFFFFFFFFF000
 
+// Page fault error code
+#define PF_PRESENT (1ULL << 0) // Protection violation rather than a missing page
+#define PF_WRITE   (1ULL << 1)
+#define PF_USER    (1ULL << 2)
+
 typedef uint64_t pte_t; // Page Table Entry
 typedef uint64_t pde_t; // Page Directory Entry
 typedef uint64_t pdpte_t; // Page Directory Pointer Table Entry
@@ -27,8 +38,19 @@ typedef pml4e_t pml4_t[512];
 
 void vmm_init();
 void vmm_map_page(pml4_t* pml4, uint64_t virt, uint64_t phys, uint64_t flags);
+void vmm_unmap_page(pml4_t* pml4, uint64_t virt);
+// The entry mapping `virt`, with the tables above it created if `allocate`.
+// NULL if a table is missing, or out of memory.
+pte_t* vmm_get_pte(pml4_t* pml4, uint64_t virt, bool allocate);
+// Physical address `virt` maps to in `pml4`, for DMA. False if unmapped.
+bool vmm_virt_to_phys(pml4_t* pml4, uint64_t virt, uint64_t* phys);
 pml4_t* clone_pml4(pml4_t* src);
+void vmm_page_fault(registers_t* regs);
 
 extern volatile pml4_t* current_pml4;
 
+static inline void vmm_flush_page(uint64_t virt) {
+    asm volatile ("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
 #endif
@@ -87,6 +87,7 @@ void arp_handle_packet(net_device_t* dev, uint8_t* data, uint32_t len) {
         frame.ethertype = htons(ETHERTYPE_ARP);
 
         uint8_t* packet = (uint8_t*)pmm_alloc_page();
+        if (!packet) return; // Out of memory; the sender asks again
         memcpy(packet, &frame, sizeof(ethernet_frame_t));
         memcpy(packet + sizeof(ethernet_frame_t), &reply, sizeof(arp_packet_t));
 
@@ -123,6 +124,10 @@ void arp_lookup(net_device_t* dev, uint32_t ip, uint8_t* mac_out) {
     frame.ethertype = htons(ETHERTYPE_ARP);
     
     uint8_t* packet = (uint8_t*)pmm_alloc_page();
+    if (!packet) {
+        memset(mac_out, 0, 6); // Out of memory: unresolved
+        return;
+    }
     memcpy(packet, &frame, sizeof(ethernet_frame_t));
     memcpy(packet + sizeof(ethernet_frame_t), &request, sizeof(arp_packet_t));
 
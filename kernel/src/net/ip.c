@@ -71,6 +71,10 @@ void ip_send_packet(uint32_t dest_ip, uint8_t protocol, uint8_t* payload, uint32
 
     uint32_t packet_len = sizeof(ip_packet_t) + payload_len;
     ip_packet_t* ip_pkt = (ip_packet_t*)pmm_alloc_page();
+    if (!ip_pkt) {
+        print("IP: Out of memory, packet dropped.\n");
+        return;
+    }
     memset(ip_pkt, 0, packet_len);
 
     // Build the IP header
@@ -107,6 +111,11 @@ void ip_send_packet(uint32_t dest_ip, uint8_t protocol, uint8_t* payload, uint32
     // Create the final packet to send
     uint32_t frame_len = sizeof(ethernet_frame_t) + packet_len;
     uint8_t* final_packet = (uint8_t*)pmm_alloc_page();
+    if (!final_packet) {
+        print("IP: Out of memory, packet dropped.\n");
+        pmm_free_page(ip_pkt);
+        return;
+    }
     memcpy(final_packet, &frame, sizeof(ethernet_frame_t));
     memcpy(final_packet + sizeof(ethernet_frame_t), ip_pkt, packet_len);
     
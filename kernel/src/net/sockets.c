@@ -48,6 +48,7 @@ int sys_socket(int domain, int type, int protocol) {
     if (fd == -1) return -1; // No free sockets
 
     socket_t* sock = (socket_t*)pmm_alloc_page();
+    if (!sock) return -1;
     memset(sock, 0, sizeof(socket_t));
     sock->domain = domain;
     sock->type = type;
@@ -163,6 +163,7 @@ static void tcp_process_data(socket_t* sock, tcp_packet_t* tcp_pkt, uint32_t pay
 static void tcp_send_control_packet(socket_t* sock, uint8_t flags) {
     uint32_t packet_len = sizeof(tcp_packet_t);
     tcp_packet_t* tcp_pkt = (tcp_packet_t*)pmm_alloc_page();
+    if (!tcp_pkt) return; // Out of memory; the peer retransmits
     memset(tcp_pkt, 0, packet_len);
 
     tcp_pkt->src_port = sock->local_addr.sin_port;
@@ -40,6 +40,10 @@ void udp_send_packet(uint32_t dest_ip, uint16_t dest_port, uint16_t src_port, vo
     // 2. Allocate memory for the full packet (IP header + UDP header + data)
     uint32_t full_packet_size = sizeof(ip_packet_t) + sizeof(udp_packet_t) + len;
     uint8_t* packet_buffer = (uint8_t*)pmm_alloc_page(); // Simplified allocation
+    if (!packet_buffer) {
+        print("UDP Error: Out of memory, packet dropped.\n");
+        return;
+    }
 
     // 3. Fill in the UDP header
     udp_packet_t* udp_header = (udp_packet_t*)(packet_buffer + sizeof(ip_packet_t));
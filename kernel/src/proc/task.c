@@ -2,6 +2,9 @@
 #include "elf.h"
 #include "../mem/pmm.h"
 #include "../lib/string.h"
+#include "../../arch/x86_64/cpu.h"
+
+thread_t* current_thread = NULL;
 
 static thread_t* ready_queue_head = NULL;
 static thread_t* ready_queue_tail = NULL;
@@ -9,7 +12,9 @@ static spinlock_t scheduler_lock = 0;
 static int next_pid = 1;
 static int next_tid = 1;
 
-extern void context_switch(registers_t* old, registers_t* new);
+// Saves the current RSP into *old_rsp and resumes the thread whose RSP is
+// in *new_rsp (interrupts.asm)
+extern void context_switch(uint64_t* old_rsp, uint64_t* new_rsp);
 
 void scheduler_init() {
     process_t* kernel_process = pmm_alloc_page();
@@ -26,8 +31,8 @@ void scheduler_init() {
     current_thread = idle_thread;
 }
 
-void scheduler_add_thread(thread_t* thread) {
-    spinlock_acquire(&scheduler_lock);
+// Caller holds scheduler_lock
+static void ready_queue_push(thread_t* thread) {
     thread->next = NULL;
     if (ready_queue_tail) {
         ready_queue_tail->next = thread;
@@ -35,10 +40,20 @@ void scheduler_add_thread(thread_t* thread) {
     } else {
         ready_queue_head = ready_queue_tail = thread;
     }
+}
+
+// scheduler_lock is also taken from interrupt context (workqueue_tick,
+// I/O completions), so every holder keeps interrupts off while it has it.
+void scheduler_add_thread(thread_t* thread) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    ready_queue_push(thread);
     spinlock_release(&scheduler_lock);
+    irq_restore(flags);
 }
 
 void schedule() {
+    uint64_t flags = irq_save();
     spinlock_acquire(&scheduler_lock);
 
     thread_t* old_thread = current_thread;
@@ -46,6 +61,7 @@ void schedule() {
 
     if (!next_thread) {
         spinlock_release(&scheduler_lock);
+        irq_restore(flags);
         return;
     }
 
@@ -55,16 +71,23 @@ void schedule() {
     }
 
     if (old_thread->state == THREAD_RUNNING) {
-        scheduler_add_thread(old_thread);
+        ready_queue_push(old_thread);
     }
     
     current_thread = next_thread;
+    // SYSCALL entry switches to this stack (see syscall_entry.asm)
+    this_cpu()->kernel_rsp = next_thread->kernel_stack;
     
     spinlock_release(&scheduler_lock);
-    context_switch(&old_thread->regs, &next_thread->regs);
+    // Interrupts stay off until we are on the new stack: an interrupt in
+    // between would see current_thread already switched. `flags` lives on
+    // this stack, so it is restored once this thread is resumed.
+    context_switch(&old_thread->kernel_rsp_saved, &next_thread->kernel_rsp_saved);
+    irq_restore(flags);
 }
 
 void thread_sleep_on(wait_queue_t** queue) {
+    uint64_t flags = irq_save();
     spinlock_acquire(&scheduler_lock);
     
     wait_queue_t wait_node;
@@ -75,23 +98,181 @@ void thread_sleep_on(wait_queue_t** queue) {
     current_thread->state = THREAD_SLEEPING;
     
     spinlock_release(&scheduler_lock);
+    irq_restore(flags);
     
     schedule();
+
+    // If schedule() found nothing else to run we are back without a
+    // wakeup: take the on-stack node off the queue before it goes out of
+    // scope, or the caller's next sleep would link it in twice.
+    flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    for (wait_queue_t** link = queue; *link; link = &(*link)->next) {
+        if (*link == &wait_node) {
+            *link = wait_node.next;
+            break;
+        }
+    }
+    current_thread->state = THREAD_RUNNING;
+    spinlock_release(&scheduler_lock);
+    irq_restore(flags);
 }
 
 void thread_wakeup(wait_queue_t** queue) {
+    uint64_t flags = irq_save();
     spinlock_acquire(&scheduler_lock);
     
     wait_queue_t* current = *queue;
     while(current) {
         thread_t* thread = current->waiting_thread;
         thread->state = THREAD_RUNNING;
-        scheduler_add_thread(thread);
+        ready_queue_push(thread);
         current = current->next;
     }
     *queue = NULL;
 
     spinlock_release(&scheduler_lock);
+    irq_restore(flags);
+}
+
+static bool wait_queue_contains(wait_queue_t* queue, wait_queue_t* node) {
+    for (; queue; queue = queue->next) {
+        if (queue == node) return true;
+    }
+    return false;
+}
+
+void thread_wait_event(wait_queue_t** queue, volatile bool* cond) {
+    wait_queue_t wait_node = { current_thread, NULL };
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    while (!*cond) {
+        // Still queued if schedule() found nothing else to run
+        if (!wait_queue_contains(*queue, &wait_node)) {
+            wait_node.next = *queue;
+            *queue = &wait_node;
+        }
+        current_thread->state = THREAD_SLEEPING;
+        spinlock_release(&scheduler_lock);
+        irq_restore(flags);
+
+        schedule();
+
+        flags = irq_save();
+        spinlock_acquire(&scheduler_lock);
+    }
+    current_thread->state = THREAD_RUNNING;
+    spinlock_release(&scheduler_lock);
+    irq_restore(flags);
+}
+
+// Caller holds scheduler_lock
+static void wait_queue_wake_all(wait_queue_t** queue) {
+    for (wait_queue_t* node = *queue; node; node = node->next) {
+        thread_t* thread = node->waiting_thread;
+        if (thread->state != THREAD_SLEEPING) continue;
+        thread->state = THREAD_RUNNING;
+        // A waiter that schedule() could not switch away from is still
+        // current and still queued here; it will see *cond itself, and
+        // pushing it would put it on the ready queue a second time at
+        // the next schedule().
+        if (thread != current_thread) ready_queue_push(thread);
+    }
+    *queue = NULL;
+}
+
+void thread_wake_event(wait_queue_t** queue, volatile bool* cond) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    *cond = true;
+    wait_queue_wake_all(queue);
+    spinlock_release(&scheduler_lock);
+    irq_restore(flags);
+}
+
+void thread_wait_seq(wait_queue_t** queue, volatile uint32_t* seq, uint32_t seen) {
+    wait_queue_t wait_node = { current_thread, NULL };
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    while (*seq == seen) {
+        if (!wait_queue_contains(*queue, &wait_node)) {
+            wait_node.next = *queue;
+            *queue = &wait_node;
+        }
+        current_thread->state = THREAD_SLEEPING;
+        spinlock_release(&scheduler_lock);
+        irq_restore(flags);
+
+        schedule();
+
+        flags = irq_save();
+        spinlock_acquire(&scheduler_lock);
+    }
+    // Woken by something else, or the counter moved before we slept
+    for (wait_queue_t** link = queue; *link; link = &(*link)->next) {
+        if (*link == &wait_node) {
+            *link = wait_node.next;
+            break;
+        }
+    }
+    current_thread->state = THREAD_RUNNING;
+    spinlock_release(&scheduler_lock);
+    irq_restore(flags);
+}
+
+void thread_wake_seq(wait_queue_t** queue, volatile uint32_t* seq) {
+    uint64_t flags = irq_save();
+    spinlock_acquire(&scheduler_lock);
+    (*seq)++;
+    wait_queue_wake_all(queue);
+    spinlock_release(&scheduler_lock);
+    irq_restore(flags);
+}
+
+// --- Kernel threads ---
+
+extern void kthread_trampoline(void);
+
+// The new thread's stack is laid out as context_switch leaves a switched-out
+// one: callee-saved registers, then the return address. kthread_trampoline
+// picks the entry point and argument out of RBX and R12.
+thread_t* kthread_create(process_t* proc, void (*entry)(void*), void* arg) {
+    thread_t* thread = pmm_alloc_page();
+    if (!thread) return NULL;
+    memset(thread, 0, sizeof(thread_t));
+
+    void* stack = pmm_alloc(KERNEL_STACK_SIZE);
+    if (!stack) {
+        pmm_free_page(thread);
+        return NULL;
+    }
+
+    thread->tid = next_tid++;
+    thread->parent_process = proc;
+    thread->kernel_stack = (uint64_t)stack + KERNEL_STACK_SIZE;
+
+    uint64_t* sp = (uint64_t*)thread->kernel_stack;
+    *--sp = (uint64_t)kthread_trampoline; // ret target; leaves RSP 16-byte aligned
+    *--sp = 0;                            // rbp
+    *--sp = (uint64_t)entry;              // rbx
+    *--sp = (uint64_t)arg;                // r12
+    *--sp = 0;                            // r13
+    *--sp = 0;                            // r14
+    *--sp = 0;                            // r15
+    thread->kernel_rsp_saved = (uint64_t)sp;
+
+    thread->state = THREAD_RUNNING;
+    scheduler_add_thread(thread);
+    return thread;
+}
+
+void kthread_exit(void) {
+    current_thread->state = THREAD_DEAD;
+    for (;;) {
+        schedule();
+    }
 }
 
 pid_t sys_fork(registers_t* parent_regs) {
@@ -102,11 +283,13 @@ pid_t sys_fork(registers_t* parent_regs) {
     child_proc->pid = next_pid++;
     child_proc->parent = parent_proc;
     child_proc->pml4 = clone_pml4(parent_proc->pml4);
+    child_proc->nexus_model = NULL; // The parent's model is not shared
 
     thread_t* child_thread = pmm_alloc_page();
     memcpy(child_thread, current_thread, sizeof(thread_t));
     child_thread->tid = next_tid++;
     child_thread->parent_process = child_proc;
+    child_thread->plug = NULL;
     
     child_thread->kernel_stack = (uint64_t)pmm_alloc_page() + KERNEL_STACK_SIZE;
     child_thread->regs = *parent_regs;
@@ -6,10 +6,13 @@
 #include <stdbool.h>
 #include <mem/vmm.h>
 #include <fs/vfs.h>
+#include <fs/file.h>
 #include <sync/spinlock.h>
+#include "../../arch/x86_64/idt.h"
 
 #define MAX_TASKS 1024
 #define MAX_FILES_PER_TASK 256
+#define MAX_FILES MAX_FILES_PER_TASK
 #define KERNEL_STACK_SIZE 0x4000 // 16 KB
 
 typedef int pid_t;
@@ -55,7 +58,7 @@ typedef struct task {
     task_cred_t cred;
 
     // File descriptors
-    vfs_node_t* file_descriptors[MAX_FILES_PER_TASK];
+    file_t* file_descriptors[MAX_FILES_PER_TASK];
 
     // Parent/child relationship
     struct task* parent;
@@ -73,6 +76,67 @@ typedef struct task {
 
 extern task_t* current_task;
 
+// --- Threads and processes (scheduler in task.c) ---
+// context_switch (interrupts.asm) reads thread->parent_process at offset 8
+// and process->pml4 at offset 8; keep those fields in place.
+typedef enum {
+    THREAD_RUNNING,
+    THREAD_READY,
+    THREAD_SLEEPING,
+    THREAD_DEAD
+} thread_state_t;
+
+typedef struct process {
+    pid_t pid;
+    pml4_t* pml4;
+    struct process* parent;
+    struct process_model* nexus_model; // Cached Nexus Core model (ai/nexus_core.c)
+} process_t;
+
+typedef struct thread {
+    int tid;
+    process_t* parent_process;
+    thread_state_t state;
+    registers_t regs;
+    uint64_t kernel_rsp_saved; // RSP while switched out (context_switch)
+    uint64_t kernel_stack; // Top of this thread's kernel stack
+    struct thread* next;
+    struct blk_plug* plug; // Bios being batched up (block/blkdev.h)
+} thread_t;
+
+typedef struct wait_queue {
+    thread_t* waiting_thread;
+    struct wait_queue* next;
+} wait_queue_t;
+
+extern thread_t* current_thread;
+
+void scheduler_init(void);
+void scheduler_add_thread(thread_t* thread);
+void thread_sleep_on(wait_queue_t** queue);
+void thread_wakeup(wait_queue_t** queue);
+// Sleep on `queue` until thread_wake_event sets *cond. Both sides look at
+// the condition under the scheduler lock, so a wakeup cannot slip in
+// between the check and the sleep, and the waker is done with `queue` by
+// the time the waiter returns. The waker may be an interrupt handler, as
+// every scheduler lock holder runs with interrupts off.
+void thread_wait_event(wait_queue_t** queue, volatile bool* cond);
+void thread_wake_event(wait_queue_t** queue, volatile bool* cond);
+// For conditions that are not a single flag. The waiter reads *seq, checks
+// its condition under whatever lock guards it, and calls thread_wait_seq
+// with the value it read if the check failed; it returns as soon as *seq
+// has moved. A waker changes the condition first, then calls
+// thread_wake_seq, so a change made after the check is never missed.
+void thread_wait_seq(wait_queue_t** queue, volatile uint32_t* seq, uint32_t seen);
+void thread_wake_seq(wait_queue_t** queue, volatile uint32_t* seq);
+// Kernel threads run in ring 0 inside `proc`'s address space
+thread_t* kthread_create(process_t* proc, void (*entry)(void*), void* arg);
+void kthread_exit(void) __attribute__((noreturn));
+
+pid_t sys_fork(registers_t* parent_regs);
+int sys_execve(const char* path, const char* const* argv, const char* const* envp);
+pid_t sys_waitpid(pid_t pid, int* status, int options);
+
 // Function prototypes
 void task_init(void);
 task_t* create_task(const char* name, void (*entry)(void), bool is_kernel_task);
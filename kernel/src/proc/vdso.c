@@ -0,0 +1,129 @@
+#include "vdso.h"
+#include "../drivers/tsc.h"
+#include "../drivers/cmos.h"
+#include "../lib/string.h"
+#include "../../arch/x86_64/cpu.h"
+
+void print(char*);
+
+extern const uint8_t vdso_image_start[];
+extern const uint8_t vdso_image_end[];
+
+// The data page is mapped into user space, so it must own the whole page
+static union {
+    vdso_data_t data;
+    uint8_t page[PAGE_SIZE];
+} vdso_page __attribute__((aligned(PAGE_SIZE)));
+
+static bool vdso_ready = false;
+
+// --- Seqlock writer ---
+// Only the timer tick and vdso_init() write the page, both on the boot CPU.
+// x86 keeps stores in order, so compiler barriers are enough.
+
+static void vdso_write_begin(vdso_data_t* d) {
+    d->seq++;
+    asm volatile ("" ::: "memory");
+}
+
+static void vdso_write_end(vdso_data_t* d) {
+    asm volatile ("" ::: "memory");
+    d->seq++;
+}
+
+// Days since 1970-01-01 for a Gregorian date
+static uint64_t days_from_civil(uint32_t y, uint32_t m, uint32_t d) {
+    y -= m <= 2;
+    uint32_t era = y / 400;
+    uint32_t yoe = y - era * 400;
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (uint64_t)era * 146097 + doe - 719468;
+}
+
+static uint64_t rtc_to_unix_seconds(const rtc_time_t* t) {
+    uint64_t days = days_from_civil(t->year, t->month, t->day);
+    return days * 86400 + t->hour * 3600 + t->minute * 60 + t->second;
+}
+
+void vdso_init(void) {
+    vdso_data_t* d = &vdso_page.data;
+    const vdso_header_t* hdr = (const vdso_header_t*)vdso_image_start;
+    rtc_time_t rtc;
+
+    memset(&vdso_page, 0, sizeof(vdso_page));
+
+    // The RTC is read once; afterwards wall time is monotonic time plus this offset
+    get_rtc_time(&rtc);
+    d->wall_offset_ns = rtc_to_unix_seconds(&rtc) * NSEC_PER_SEC;
+
+    // A TSC that changes rate with P-states cannot be scaled from user space
+    if (cpu_has_invariant_tsc() && tsc_calibrate()) {
+        tsc_get_scale(&d->mult, &d->shift);
+        d->tsc_base = rdtsc();
+        d->clock_mode = VDSO_CLOCK_TSC;
+    } else {
+        d->clock_mode = VDSO_CLOCK_NONE;
+    }
+    d->have_rdtscp = cpu_has_rdtscp();
+
+    if (hdr->magic != VDSO_MAGIC || hdr->version != VDSO_VERSION) {
+        print("vDSO: Bad image, not mapping it.\n");
+        return;
+    }
+
+    vdso_ready = true;
+    print(d->clock_mode == VDSO_CLOCK_TSC ? "vDSO: Using TSC clock.\n"
+                                          : "vDSO: No invariant TSC, clocks use the syscall path.\n");
+}
+
+void vdso_map(pml4_t* pml4) {
+    if (!vdso_ready) return;
+
+    uint64_t data_phys = (uint64_t)&vdso_page - KERNEL_VIRTUAL_BASE;
+    vmm_map_page(pml4, VDSO_DATA_BASE, data_phys, PTE_PRESENT | PTE_USER | PTE_NX);
+
+    uint64_t text_phys = (uint64_t)vdso_image_start - KERNEL_VIRTUAL_BASE;
+    uint64_t text_size = (uint64_t)(vdso_image_end - vdso_image_start);
+    for (uint64_t off = 0; off < text_size; off += PAGE_SIZE) {
+        vmm_map_page(pml4, VDSO_TEXT_BASE + off, text_phys + off, PTE_PRESENT | PTE_USER);
+    }
+}
+
+void vdso_update(uint64_t elapsed_ns) {
+    vdso_data_t* d = &vdso_page.data;
+
+    // In TSC mode the readers compute the time themselves
+    if (d->clock_mode == VDSO_CLOCK_TSC) return;
+
+    vdso_write_begin(d);
+    d->mono_base_ns += elapsed_ns;
+    vdso_write_end(d);
+}
+
+int kernel_clock_gettime(int clock, struct timespec* ts) {
+    const vdso_data_t* d = &vdso_page.data;
+    uint32_t seq;
+    uint64_t ns;
+
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) return -1;
+
+    do {
+        seq = vdso_read_begin(d);
+        ns = d->mono_base_ns;
+        if (d->clock_mode == VDSO_CLOCK_TSC) {
+            ns += vdso_cycles_to_ns(rdtsc() - d->tsc_base, d->mult, d->shift);
+        }
+        if (clock == CLOCK_REALTIME) ns += d->wall_offset_ns;
+    } while (vdso_read_retry(d, seq));
+
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    return 0;
+}
+
+uint64_t ktime_get_ns(void) {
+    struct timespec ts;
+    kernel_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
@@ -0,0 +1,24 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include <limitless/vdso.h>
+#include "../mem/vmm.h"
+
+// Calibrates the clock source and fills in the shared data page
+void vdso_init(void);
+
+// Maps the data page and the vDSO text into a user address space
+void vdso_map(pml4_t* pml4);
+
+// Timer tick hook; `elapsed_ns` is the tick period, used when the TSC
+// cannot be read from user space
+void vdso_update(uint64_t elapsed_ns);
+
+// Kernel-side clocks, also the slow path of the vDSO
+int kernel_clock_gettime(int clock, struct timespec* ts);
+
+// CLOCK_MONOTONIC in ns, for kernel timeouts
+uint64_t ktime_get_ns(void);
+
+#endif
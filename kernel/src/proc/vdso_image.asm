@@ -0,0 +1,17 @@
+;
+; The vDSO image (kernel/vdso/), built as a flat binary by the Makefile.
+; It is mapped into user space page by page, so it starts on a page
+; boundary and is padded to one: nothing else may share its pages.
+;
+
+bits 64
+
+section .rodata
+
+align 4096
+global vdso_image_start
+vdso_image_start:
+    incbin "obj/vdso/vdso.bin"
+global vdso_image_end
+vdso_image_end:
+align 4096, db 0
@@ -0,0 +1,134 @@
+/* kernel/src/proc/workqueue.c */
+
+#include "workqueue.h"
+#include "vdso.h"
+#include "../mem/pmm.h"
+#include "../lib/string.h"
+#include "../../arch/x86_64/cpu.h"
+
+#define MAX_WORKQUEUES 8
+
+static workqueue_t workqueues[MAX_WORKQUEUES];
+static int num_workqueues = 0;
+workqueue_t* system_wq = NULL;
+
+// Delayed work armed but not yet expired; touched from the timer IRQ, so
+// every lock holder has interrupts off.
+static delayed_work_t* timer_list = NULL;
+static spinlock_t timer_lock = 0;
+
+static void worker_thread(void* arg) {
+    workqueue_t* wq = arg;
+
+    for (;;) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&wq->lock);
+        work_t* work = wq->head;
+        if (work) {
+            wq->head = work->next;
+            if (!wq->head) wq->tail = NULL;
+        }
+        spinlock_release(&wq->lock);
+        irq_restore(flags);
+
+        if (!work) {
+            // A wakeup lost between the check and here is repaired by
+            // workqueue_tick() on the next timer interrupt
+            thread_sleep_on(&wq->wait);
+            continue;
+        }
+
+        // Cleared first so the work may requeue itself
+        work->pending = false;
+        work->fn(work);
+    }
+}
+
+workqueue_t* workqueue_create(const char* name) {
+    if (num_workqueues >= MAX_WORKQUEUES) return NULL;
+
+    workqueue_t* wq = &workqueues[num_workqueues++];
+    memset(wq, 0, sizeof(workqueue_t));
+    wq->name = name;
+    wq->thread = kthread_create(current_thread->parent_process, worker_thread, wq);
+    if (!wq->thread) {
+        num_workqueues--;
+        return NULL;
+    }
+    return wq;
+}
+
+void workqueue_init(void) {
+    system_wq = workqueue_create("events");
+}
+
+bool queue_work(workqueue_t* wq, work_t* work) {
+    if (__atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&wq->lock);
+    work->next = NULL;
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+    spinlock_release(&wq->lock);
+    irq_restore(flags);
+
+    if (wq->wait) thread_wakeup(&wq->wait);
+    return true;
+}
+
+bool queue_delayed_work(workqueue_t* wq, delayed_work_t* dwork, uint64_t delay_ms) {
+    if (!delay_ms) return queue_work(wq, &dwork->work);
+    if (dwork->timer_pending || dwork->work.pending) return false;
+
+    dwork->wq = wq;
+    dwork->expires_ns = ktime_get_ns() + delay_ms * 1000000ULL;
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&timer_lock);
+    dwork->timer_pending = true;
+    dwork->next_timer = timer_list;
+    timer_list = dwork;
+    spinlock_release(&timer_lock);
+    irq_restore(flags);
+    return true;
+}
+
+void workqueue_tick(void) {
+    uint64_t now = ktime_get_ns();
+    delayed_work_t* expired = NULL;
+
+    // Runs in the timer IRQ with interrupts already off
+    spinlock_acquire(&timer_lock);
+    delayed_work_t** link = &timer_list;
+    while (*link) {
+        delayed_work_t* dwork = *link;
+        if (dwork->expires_ns <= now) {
+            *link = dwork->next_timer;
+            dwork->timer_pending = false;
+            dwork->next_timer = expired;
+            expired = dwork;
+        } else {
+            link = &dwork->next_timer;
+        }
+    }
+    spinlock_release(&timer_lock);
+
+    while (expired) {
+        delayed_work_t* next = expired->next_timer;
+        queue_work(expired->wq, &expired->work);
+        expired = next;
+    }
+
+    for (int i = 0; i < num_workqueues; i++) {
+        if (workqueues[i].head && workqueues[i].wait) {
+            thread_wakeup(&workqueues[i].wait);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "task.h"
+
+#ifndef container_of
+#define container_of(ptr, type, member) ((type*)((uint8_t*)(ptr) - offsetof(type, member)))
+#endif
+
+// Deferred work, run in process context by a kernel thread. Embed a work_t
+// in the object the work is about and recover it with container_of().
+typedef struct work {
+    void (*fn)(struct work* work);
+    struct work* next;
+    volatile bool pending; // Queued and not yet started
+} work_t;
+
+// Work queued once `expires_ns` (CLOCK_MONOTONIC) has passed
+typedef struct delayed_work {
+    work_t work;
+    struct workqueue* wq;
+    uint64_t expires_ns;
+    struct delayed_work* next_timer;
+    volatile bool timer_pending;
+} delayed_work_t;
+
+typedef struct workqueue {
+    const char* name;
+    work_t* head;
+    work_t* tail;
+    spinlock_t lock;
+    wait_queue_t* wait;
+    thread_t* thread;
+} workqueue_t;
+
+#define WORK_INIT(f) { .fn = (f), .next = NULL, .pending = false }
+
+// Shared queue for work that does not need its own thread
+extern workqueue_t* system_wq;
+
+void workqueue_init(void);
+workqueue_t* workqueue_create(const char* name);
+
+// Both return false if the work was already pending
+bool queue_work(workqueue_t* wq, work_t* work);
+bool queue_delayed_work(workqueue_t* wq, delayed_work_t* dwork, uint64_t delay_ms);
+
+// Timer tick hook: queues expired delayed work and wakes idle workers
+void workqueue_tick(void);
+
+#endif
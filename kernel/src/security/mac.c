@@ -9,14 +9,15 @@ static uint32_t rule_count = 0;
 
 // This is a simplified parser. A real implementation would be more robust.
 void mac_policy_load(const char* path) {
-    fs_node_t* policy_file = finddir_fs(fs_root, (char*)path);
+    fs_node_t* policy_file = vfs_resolve_path(path);
     if (!policy_file) {
         // PANIC("MAC: Security policy file not found!");
         return;
     }
 
     char* buffer = pmm_alloc_page();
-    read_fs(policy_file, 0, PAGE_SIZE, (uint8_t*)buffer);
+    vfs_read(policy_file, 0, PAGE_SIZE, buffer);
+    vfs_node_put(policy_file);
 
     // Parse the buffer line by line to populate the `contexts` and `rules` arrays.
     // Example line: "allow user_t system_bin_t file execute"
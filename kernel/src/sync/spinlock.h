@@ -13,6 +13,11 @@ static inline void spinlock_acquire(spinlock_t* lock) {
     }
 }
 
+// Takes the lock only if it is free right now
+static inline bool spinlock_try_acquire(spinlock_t* lock) {
+    return !__sync_lock_test_and_set(lock, 1);
+}
+
 static inline void spinlock_release(spinlock_t* lock) {
     __sync_lock_release(lock);
 }
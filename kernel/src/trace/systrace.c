@@ -0,0 +1,231 @@
+/* kernel/src/trace/systrace.c */
+
+#include "systrace.h"
+#include "../interrupts/syscall.h"
+#include "../proc/task.h"
+#include "../mem/pmm.h"
+#include "../mem/uaccess.h"
+#include "../drivers/tsc.h"
+#include <limitless/vdso.h>
+#include "../lib/string.h"
+#include "../../arch/x86_64/cpu.h"
+
+// Single-producer, single-consumer ring per CPU. The owning CPU writes at
+// `head` with interrupts off; the reader drains from `tail`. Neither side
+// takes a lock, and a full buffer drops new events rather than blocking.
+typedef struct {
+    volatile uint64_t head;
+    volatile uint64_t tail;
+    uint64_t dropped;
+    systrace_event_t events[SYSTRACE_BUFFER_EVENTS];
+} systrace_buffer_t;
+
+static_key_t systrace_key = STATIC_KEY_INIT_FALSE;
+
+static uint32_t systrace_mask = 0;
+static pid_t systrace_pid = 0;    // Only trace this process (0 = all)
+static pid_t systrace_reader = 0; // Never trace the reader itself
+
+static systrace_buffer_t* buffers[MAX_CPUS];
+
+// One histogram per syscall, sized like syscall_table[]
+static systrace_hist_t histograms[] = {
+#define SYSCALL(sym, nr, name, flags) [nr] = { 0 },
+#include <limitless/syscalls.def>
+#undef SYSCALL
+};
+
+static uint64_t tsc_mult;
+static uint32_t tsc_shift;
+static spinlock_t ctl_lock = 0;
+
+static inline uint64_t cycles_to_ns(uint64_t cycles) {
+    return vdso_cycles_to_ns(cycles, tsc_mult, tsc_shift);
+}
+
+static inline bool systrace_wanted(void) {
+    pid_t pid = current_thread->parent_process->pid;
+    if (pid == systrace_reader) return false;
+    return systrace_pid == 0 || systrace_pid == pid;
+}
+
+static void systrace_record(const systrace_event_t* ev) {
+    systrace_buffer_t* buf = buffers[this_cpu_id()];
+    if (!buf) return;
+
+    // Interrupts off: a preempting thread on this CPU must not interleave
+    uint64_t flags = irq_save();
+    uint64_t head = buf->head;
+    if (head - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE) == SYSTRACE_BUFFER_EVENTS) {
+        buf->dropped++;
+    } else {
+        buf->events[head & (SYSTRACE_BUFFER_EVENTS - 1)] = *ev;
+        __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+    }
+    irq_restore(flags);
+}
+
+static void systrace_fill(systrace_event_t* ev, uint64_t nr, uint8_t type, uint64_t tsc) {
+    ev->ts_ns = cycles_to_ns(tsc);
+    ev->nr = (uint16_t)nr;
+    ev->type = type;
+    ev->cpu = (uint8_t)this_cpu_id();
+    ev->pid = current_thread->parent_process->pid;
+    ev->tid = current_thread->tid;
+    ev->reserved = 0;
+}
+
+uint64_t systrace_enter(uint64_t nr, const uint64_t args[6]) {
+    uint64_t start = rdtsc();
+
+    if ((systrace_mask & SYSTRACE_EVENTS) && systrace_wanted()) {
+        systrace_event_t ev;
+        systrace_fill(&ev, nr, SYSTRACE_ENTER, start);
+        memcpy(ev.args, args, sizeof(ev.args));
+        systrace_record(&ev);
+    }
+    return start;
+}
+
+void systrace_exit(uint64_t nr, int64_t ret, uint64_t start) {
+    uint64_t end = rdtsc();
+    uint64_t ns = cycles_to_ns(end - start);
+
+    if (!systrace_wanted()) return;
+
+    if (systrace_mask & SYSTRACE_HIST) {
+        systrace_hist_t* h = &histograms[nr];
+        uint32_t bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        if (bucket >= SYSTRACE_HIST_BUCKETS) bucket = SYSTRACE_HIST_BUCKETS - 1;
+
+        __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+        while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, false,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    if (systrace_mask & SYSTRACE_EVENTS) {
+        systrace_event_t ev;
+        systrace_fill(&ev, nr, SYSTRACE_EXIT, end);
+        ev.ret = ret;
+        ev.latency_ns = ns;
+        systrace_record(&ev);
+    }
+}
+
+// --- Control ---
+
+static int systrace_alloc_buffers(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (buffers[cpu] || !cpu_locals[cpu].self) continue;
+        buffers[cpu] = pmm_alloc(sizeof(systrace_buffer_t));
+        if (!buffers[cpu]) return -1;
+        memset(buffers[cpu], 0, sizeof(systrace_buffer_t));
+    }
+    return 0;
+}
+
+static void systrace_reset(void) {
+    memset(histograms, 0, sizeof(histograms));
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (buffers[cpu]) {
+            buffers[cpu]->tail = buffers[cpu]->head;
+            buffers[cpu]->dropped = 0;
+        }
+    }
+}
+
+// Caller holds ctl_lock
+static void systrace_stop(void) {
+    if (static_key_enabled(&systrace_key)) static_key_disable(&systrace_key);
+    systrace_mask = 0;
+    systrace_reader = 0;
+}
+
+int systrace_ctl(uint32_t cmd, uint64_t arg0, uint64_t arg1) {
+    pid_t caller = current_thread->parent_process->pid;
+    int ret = 0;
+
+    spinlock_acquire(&ctl_lock);
+    // Processes carry no credentials to check, so tracing belongs to
+    // whoever enabled it until it disables it or exits
+    if (systrace_reader && systrace_reader != caller) {
+        spinlock_release(&ctl_lock);
+        return -1;
+    }
+    switch (cmd) {
+    case SYSTRACE_CTL_ENABLE:
+        arg0 &= SYSTRACE_EVENTS | SYSTRACE_HIST;
+        if (!arg0 || ((arg0 & SYSTRACE_EVENTS) && systrace_alloc_buffers() != 0)) {
+            ret = -1;
+            break;
+        }
+        tsc_get_scale(&tsc_mult, &tsc_shift);
+        systrace_mask = (uint32_t)arg0;
+        systrace_pid = (pid_t)arg1;
+        systrace_reader = caller;
+        if (!static_key_enabled(&systrace_key)) static_key_enable(&systrace_key);
+        break;
+    case SYSTRACE_CTL_DISABLE:
+        systrace_stop();
+        break;
+    case SYSTRACE_CTL_RESET:
+        systrace_reset();
+        break;
+    default:
+        ret = -1;
+    }
+    spinlock_release(&ctl_lock);
+    return ret;
+}
+
+void systrace_release(pid_t pid) {
+    spinlock_acquire(&ctl_lock);
+    if (systrace_reader == pid) systrace_stop();
+    spinlock_release(&ctl_lock);
+}
+
+// --- Readers ---
+
+// Only the process that enabled tracing may see what it recorded
+static bool systrace_is_reader(void) {
+    pid_t reader = __atomic_load_n(&systrace_reader, __ATOMIC_RELAXED);
+    return reader && reader == current_thread->parent_process->pid;
+}
+
+int64_t systrace_read(systrace_event_t* ubuf, uint64_t max) {
+    uint64_t copied = 0;
+
+    if (!systrace_is_reader()) return -1;
+
+    for (int cpu = 0; cpu < MAX_CPUS && copied < max; cpu++) {
+        systrace_buffer_t* buf = buffers[cpu];
+        if (!buf) continue;
+
+        uint64_t tail = buf->tail;
+        uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+
+        // Copy contiguous runs straight out of the ring
+        while (tail != head && copied < max) {
+            uint64_t idx = tail & (SYSTRACE_BUFFER_EVENTS - 1);
+            uint64_t run = SYSTRACE_BUFFER_EVENTS - idx;
+            if (run > head - tail) run = head - tail;
+            if (run > max - copied) run = max - copied;
+
+            if (copy_to_user(&ubuf[copied], &buf->events[idx], run * sizeof(systrace_event_t)) != 0) {
+                return -1;
+            }
+            tail += run;
+            copied += run;
+        }
+        __atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+    }
+    return (int64_t)copied;
+}
+
+int systrace_hist(uint64_t nr, systrace_hist_t* uhist) {
+    if (!systrace_is_reader() || nr >= syscall_table_size) return -1;
+    return copy_to_user(uhist, &histograms[nr], sizeof(systrace_hist_t));
+}
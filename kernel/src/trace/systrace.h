@@ -0,0 +1,32 @@
+#ifndef SYSTRACE_H
+#define SYSTRACE_H
+
+#include <stdint.h>
+#include <limitless/systrace.h>
+#include "../lib/static_key.h"
+#include "../proc/task.h"
+
+// Events per CPU buffer; a power of two
+#define SYSTRACE_BUFFER_EVENTS 1024
+
+// On while any tracing is enabled; gates the hooks in syscall_invoke()
+extern static_key_t systrace_key;
+
+// Hooks around a traced call. systrace_enter() returns the start TSC
+// to hand to systrace_exit().
+uint64_t systrace_enter(uint64_t nr, const uint64_t args[6]);
+void systrace_exit(uint64_t nr, int64_t ret, uint64_t start);
+
+int systrace_ctl(uint32_t cmd, uint64_t arg0, uint64_t arg1);
+
+// Stops tracing if `pid`, which is exiting, owns it
+void systrace_release(pid_t pid);
+
+// Copies up to `max` buffered events to user space. Returns the count,
+// or -1 unless the caller owns tracing.
+int64_t systrace_read(systrace_event_t* ubuf, uint64_t max);
+
+// Copies the histogram of syscall `nr` to user space; owner only
+int systrace_hist(uint64_t nr, systrace_hist_t* uhist);
+
+#endif
@@ -0,0 +1,95 @@
+/* kernel/vdso/vdso.c */
+
+// User-space half of the vDSO. This code is linked into the kernel image as
+// a flat binary (src/proc/vdso_image.asm) and mapped into every process at
+// VDSO_TEXT_BASE, where it runs in ring 3. It may only read the shared data
+// page and its own text: there is no writable data section.
+
+#include <stdint.h>
+#include <limitless/vdso.h>
+#include <limitless/syscall.h>
+
+#define VDSO_DATA ((const volatile vdso_data_t*)VDSO_DATA_BASE)
+
+int __vdso_clock_gettime(int clock, struct timespec* ts);
+int __vdso_gettimeofday(struct timeval* tv, void* tz);
+int64_t __vdso_time(int64_t* t);
+int __vdso_getcpu(unsigned* cpu, unsigned* node);
+
+// Must stay at offset 0 of the image (see vdso.lds)
+__attribute__((section(".vdso_header"), used))
+const vdso_header_t vdso_header_table = {
+    .magic = VDSO_MAGIC,
+    .version = VDSO_VERSION,
+    .clock_gettime = (uint64_t)&__vdso_clock_gettime,
+    .gettimeofday = (uint64_t)&__vdso_gettimeofday,
+    .time = (uint64_t)&__vdso_time,
+    .getcpu = (uint64_t)&__vdso_getcpu,
+};
+
+// LFENCE keeps RDTSC from executing ahead of the seqlock load
+static inline uint64_t rdtsc_ordered(void) {
+    uint32_t lo, hi;
+    asm volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Returns -1 if the data page cannot be used and the kernel must answer
+static int read_clock_ns(int clock, uint64_t* ns) {
+    const volatile vdso_data_t* d = VDSO_DATA;
+    uint32_t seq;
+    uint64_t now;
+
+    if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) return -1;
+
+    do {
+        seq = vdso_read_begin(d);
+        if (d->clock_mode != VDSO_CLOCK_TSC) return -1;
+        now = d->mono_base_ns + vdso_cycles_to_ns(rdtsc_ordered() - d->tsc_base, d->mult, d->shift);
+        if (clock == CLOCK_REALTIME) now += d->wall_offset_ns;
+    } while (vdso_read_retry(d, seq));
+
+    *ns = now;
+    return 0;
+}
+
+int __vdso_clock_gettime(int clock, struct timespec* ts) {
+    uint64_t ns;
+    if (read_clock_ns(clock, &ns) != 0) {
+        return (int)syscall2(SYS_CLOCK_GETTIME, clock, (long)ts);
+    }
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    return 0;
+}
+
+int __vdso_gettimeofday(struct timeval* tv, void* tz) {
+    struct timespec ts;
+    (void)tz; // Time zones are not supported
+    if (!tv) return 0;
+    if (__vdso_clock_gettime(CLOCK_REALTIME, &ts) != 0) return -1;
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / NSEC_PER_USEC;
+    return 0;
+}
+
+int64_t __vdso_time(int64_t* t) {
+    struct timespec ts;
+    if (__vdso_clock_gettime(CLOCK_REALTIME, &ts) != 0) return -1;
+    if (t) *t = ts.tv_sec;
+    return ts.tv_sec;
+}
+
+int __vdso_getcpu(unsigned* cpu, unsigned* node) {
+    uint32_t aux;
+
+    if (!VDSO_DATA->have_rdtscp) {
+        return (int)syscall2(SYS_GETCPU, (long)cpu, (long)node);
+    }
+
+    // cpu_local_init() stores the CPU number in TSC_AUX
+    asm volatile ("rdtscp" : "=c"(aux) :: "eax", "edx");
+    if (cpu) *cpu = aux & 0xFFF;
+    if (node) *node = 0;
+    return 0;
+}
@@ -1,9 +1,6 @@
 // A simple C++ standard library header would be needed for a real application
 #include <stdint.h>
-
-// Syscall numbers must match the kernel's
-#define SYS_CREATE_WINDOW   4
-#define SYS_DRAW_RECT       5
+#include <limitless/syscall_nr.h>
 
 // Generic syscall function
 int syscall(int num, int p1, int p2, int p3, int p4, int p5) {
@@ -1,39 +1,110 @@
 #include <stdint.h>
+#include <limitless/syscall_nr.h>
+#include <limitless/io_ring.h>
 
-#define SYS_CREATE_WINDOW 4
-#define SYS_POLL_EVENT 6
-#define SYS_FORK 17
-#define SYS_EXECVE 18
-#define SYS_READDIR 27
-#define SYS_DRAW_RECT 5
-#define SYS_DRAW_STRING_IN_WINDOW 30
-#define SYS_DRAW_ICON_IN_WINDOW 31
 
 #define COLOR_BODY 0x1E293B
 #define COLOR_TEXT 0xF9FAFB
 #define ICON_TYPE_FILE 0
 #define ICON_TYPE_FOLDER 1
 
+#define FS_DIRECTORY 0x002
+
+// Laid out as the kernel's dirent_t
 struct dirent {
     char name[128];
-    uint32_t ino;
+    uint64_t ino;
+    uint32_t type;
+    uint32_t pad;
+    uint64_t off;
 };
 
 int syscall(int num, int p1, int p2, int p3, int p4, int p5);
 
-void redraw(int win_id, const char* path) {
+#define MAX_ENTRIES 32
+
+// Submission ring shared with the kernel (limitless/io_ring.h); NULL if
+// setup failed and we fall back to one syscall per operation.
+static io_ring_hdr_t* ring = 0;
+static int ring_id = -1;
+
+static void ring_setup(void) {
+    io_ring_params_t params = {0};
+    ring_id = syscall(SYS_IO_RING_SETUP, (int)&params, 0, 0, 0, 0);
+    if (ring_id >= 0) {
+        ring = (io_ring_hdr_t*)(uint32_t)params.ring_addr;
+    }
+}
+
+// Arguments are zero-extended: pointers and colours must not sign-extend
+static void queue_op(uint8_t opcode, uint8_t flags, uint64_t user_data,
+                     uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5) {
+    io_sqe_t sqe = {
+        .opcode = opcode,
+        .flags = flags,
+        .args = { a0, a1, a2, a3, a4, a5 },
+        .user_data = user_data,
+    };
+    io_ring_queue(ring, &sqe);
+}
+
+// Submits everything queued and waits until it has all completed
+static void ring_flush(uint32_t count) {
+    syscall(SYS_IO_RING_ENTER, ring_id, count, count, IORING_ENTER_GETEVENTS, 0);
+}
+
+static void redraw_unbatched(int win_id, const char* path) {
     syscall(SYS_DRAW_RECT, win_id, 0, 0, 400, 300, COLOR_BODY, 0);
 
     struct dirent de;
-    int index = 0;
+    uint64_t pos = 0;
     int y_pos = 10;
-    while(syscall(SYS_READDIR, (int)path, index, (int)&de, 0, 0)) {
-        // A real check for file type would use a stat syscall
-        int is_dir = 0; // Placeholder
+    while(syscall(SYS_READDIR, (int)path, (int)&pos, (int)&de, 1, 0) > 0) {
+        int is_dir = de.type & FS_DIRECTORY;
         syscall(SYS_DRAW_ICON_IN_WINDOW, win_id, is_dir ? ICON_TYPE_FOLDER : ICON_TYPE_FILE, 10, y_pos, 0);
         syscall(SYS_DRAW_STRING_IN_WINDOW, win_id, (int)de.name, 30, y_pos + 4, COLOR_TEXT);
         y_pos += 20;
-        index++;
+    }
+}
+
+// Two kernel entries per redraw instead of three per directory entry:
+// one readdir fills the whole listing, a batch draws it.
+void redraw(int win_id, const char* path) {
+    static struct dirent entries[MAX_ENTRIES];
+    static uint64_t pos;
+    io_cqe_t* cqe;
+    int count = 0;
+
+    if (!ring) {
+        redraw_unbatched(win_id, path);
+        return;
+    }
+
+    pos = 0;
+    queue_op(IORING_OP_READDIR, 0, 0, (uint32_t)path, (uint32_t)&pos, (uint32_t)entries, MAX_ENTRIES, 0, 0);
+    ring_flush(1);
+
+    // readdir returns how many entries it stored
+    while ((cqe = io_ring_peek_cqe(ring))) {
+        if (cqe->res > 0) count = (int)cqe->res;
+        io_ring_cqe_seen(ring);
+    }
+
+    queue_op(IORING_OP_DRAW_RECT, 0, 0, win_id, 0, 0, 400, 300, COLOR_BODY);
+    int y_pos = 10;
+    for (int i = 0; i < count; i++) {
+        int is_dir = entries[i].type & FS_DIRECTORY;
+        // Skip the label if the icon could not be drawn
+        queue_op(IORING_OP_DRAW_ICON, IOSQE_IO_LINK, 0, win_id,
+                 is_dir ? ICON_TYPE_FOLDER : ICON_TYPE_FILE, 10, y_pos, 0, 0);
+        queue_op(IORING_OP_DRAW_STRING, 0, 0, win_id, (uint32_t)entries[i].name,
+                 30, y_pos + 4, COLOR_TEXT, 0);
+        y_pos += 20;
+    }
+    ring_flush(1 + 2 * count);
+
+    while (io_ring_peek_cqe(ring)) {
+        io_ring_cqe_seen(ring);
     }
 }
 
@@ -41,6 +112,7 @@ void _start() {
     int win_id = syscall(SYS_CREATE_WINDOW, 50, 50, 400, 300, (int)"File Manager");
     char current_path[128] = "/";
 
+    ring_setup();
     redraw(win_id, current_path);
 
     event_t event;
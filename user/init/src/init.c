@@ -1,11 +1,5 @@
 #include <stdint.h>
-
-// Syscall numbers
-#define SYS_SOCKET          7
-#define SYS_CONNECT         20
-#define SYS_SEND            23
-#define SYS_RECV            24
-#define SYS_PRINT           1
+#include <limitless/syscall_nr.h>
 
 // Network constants
 #define AF_INET 2
@@ -1,19 +1,9 @@
 /* user/installer/src/main.c */
 
 #include <stdint.h>
+#include <limitless/syscall_nr.h>
 #include <stdbool.h>
 
-// --- Syscall Definitions ---
-#define SYS_CREATE_WINDOW   4
-#define SYS_CREATE_WIDGET   25
-#define SYS_POLL_EVENT      6
-#define SYS_FORK            17
-#define SYS_EXECVE          18
-#define SYS_YIELD           0
-#define SYS_DRAW_RECT       5
-#define SYS_DRAW_STRING_IN_WINDOW 30
-// Assume other necessary syscalls like open, read, write, mount exist
-
 // --- Theme and Layout ---
 #define COLOR_BG 0x1E293B
 #define COLOR_FG 0xF9FAFB
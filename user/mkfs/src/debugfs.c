@@ -0,0 +1,225 @@
+/* user/mkfs/src/debugfs.c */
+
+// debugfs: looks inside a LimitlessFS image without mounting it. Runs the
+// command given after the image, or reads commands from standard input.
+// Nothing is written to the image.
+
+#include "lfs_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEBUGFS_MAX_ARGS 8
+
+static const char* type_name(uint16_t type) {
+    switch (type) {
+    case LFS_TYPE_FILE: return "file";
+    case LFS_TYPE_DIR: return "dir";
+    default: return "?";
+    }
+}
+
+// Resolves `arg`: an absolute path, or an inode number written as <n>
+static int debugfs_inode(lfs_image_t* img, const char* arg, uint32_t* inum, lfs_inode_t* inode) {
+    if (arg[0] == '<') {
+        char* end;
+        unsigned long n = strtoul(arg + 1, &end, 0);
+        if (*end == '>' && !end[1] && lfs_read_inode(img, n, inode) == 0) {
+            *inum = n;
+            return 0;
+        }
+    } else if (lfs_lookup(img, arg, inum, inode) == 0) {
+        return 0;
+    }
+    printf("%s: not found\n", arg);
+    return -1;
+}
+
+// --- Commands ---
+
+static int cmd_stats(lfs_image_t* img, int argc, char** argv) {
+    const lfs_superblock_t* sb = &img->sb;
+    printf("Total blocks:         %u\n", sb->total_blocks);
+    printf("Journal:              blocks %u-%u\n", sb->journal_start_block,
+           sb->journal_start_block + sb->journal_num_blocks - 1);
+    printf("Inode bitmap:         block %u\n", sb->inode_bitmap_block);
+    printf("Block bitmap:         block %u\n", sb->data_bitmap_block);
+    printf("Inode table:          block %u\n", sb->inode_table_block);
+    printf("First data block:     %u\n", sb->data_blocks_start);
+    printf("Inodes:               %u\n", lfs_inode_count(sb));
+    return 0;
+}
+
+static int ls_fn(void* arg, const lfs_dir_entry_t* e, uint32_t lo, uint32_t hi) {
+    lfs_image_t* img = arg;
+    lfs_inode_t inode;
+    if (lfs_read_inode(img, e->inode, &inode) < 0) memset(&inode, 0, sizeof(inode));
+    printf("%8u  %-4s %04o %10llu  %.*s\n", e->inode, type_name(e->type), inode.permissions,
+           (unsigned long long)inode.size, e->name_len, e->name);
+    return 0;
+}
+
+static int cmd_ls(lfs_image_t* img, int argc, char** argv) {
+    uint32_t inum;
+    lfs_inode_t inode;
+    if (debugfs_inode(img, argc > 1 ? argv[1] : "/", &inum, &inode) < 0) return -1;
+    if (inode.type != LFS_TYPE_DIR) {
+        printf("%s: not a directory\n", argv[1]);
+        return -1;
+    }
+    if (lfs_walk_dir(img, inum, &inode, ls_fn, img) != 0) {
+        printf("directory index is corrupt\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int stat_fn(void* arg, const lfs_extent_t* e, uint64_t block) {
+    if (e) {
+        printf("  (%u-%llu): %llu-%llu\n", e->logical, (unsigned long long)e->logical + e->length - 1,
+               (unsigned long long)e->physical, (unsigned long long)(e->physical + e->length - 1));
+    } else {
+        printf("  (tree): %llu\n", (unsigned long long)block);
+    }
+    return 0;
+}
+
+static int cmd_stat(lfs_image_t* img, int argc, char** argv) {
+    uint32_t inum;
+    lfs_inode_t inode;
+    if (argc < 2) {
+        printf("usage: stat <path | <inode>>\n");
+        return -1;
+    }
+    if (debugfs_inode(img, argv[1], &inum, &inode) < 0) return -1;
+
+    printf("Inode: %u  Type: %s  Mode: %04o  Flags: 0x%x\n", inum, type_name(inode.type),
+           inode.permissions, inode.flags);
+    printf("User: %u  Group: %u  Size: %llu  Blocks: %llu\n", inode.uid, inode.gid,
+           (unsigned long long)inode.size, (unsigned long long)inode.blocks);
+    printf("Modified: %llu.%09llu\n", (unsigned long long)(inode.last_modified / 1000000000ull),
+           (unsigned long long)(inode.last_modified % 1000000000ull));
+    printf("Extents (depth %u, %u/%u):\n", inode.extent_header.depth, inode.extent_header.entries,
+           inode.extent_header.max);
+    if (lfs_walk_extents(img, &inode, stat_fn, NULL) < 0) {
+        printf("extent tree is corrupt\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int cmd_cat(lfs_image_t* img, int argc, char** argv) {
+    uint32_t inum;
+    lfs_inode_t inode;
+    if (argc < 2) {
+        printf("usage: cat <path | <inode>>\n");
+        return -1;
+    }
+    if (debugfs_inode(img, argv[1], &inum, &inode) < 0) return -1;
+
+    uint8_t buf[LFS_BLOCK_SIZE];
+    for (uint64_t off = 0; off < inode.size; off += LFS_BLOCK_SIZE) {
+        uint64_t phys = lfs_bmap(img, &inode, off / LFS_BLOCK_SIZE);
+        if (!phys) memset(buf, 0, sizeof(buf));
+        else if (lfs_read_block(img, phys, buf) < 0) return -1;
+        uint64_t n = inode.size - off < LFS_BLOCK_SIZE ? inode.size - off : LFS_BLOCK_SIZE;
+        fwrite(buf, 1, n, stdout);
+    }
+    return 0;
+}
+
+static int cmd_journal(lfs_image_t* img, int argc, char** argv) {
+    uint32_t pos, seq;
+    bool never_used;
+    if (lfs_journal_super(img, &pos, &seq, &never_used) < 0) {
+        printf("journal super block is corrupt\n");
+        return -1;
+    }
+    uint32_t log_blocks = img->sb.journal_num_blocks - 1;
+    printf("Log: %u blocks, up to %u per transaction\n", log_blocks, lfs_journal_max_txn(log_blocks));
+    if (never_used) {
+        printf("Never used since mkfs\n");
+        return 0;
+    }
+    printf("Tail: index %u, sequence %u\n", pos, seq);
+
+    lfs_journal_descriptor_t* desc = malloc(sizeof(*desc));
+    if (!desc) return -1;
+    uint32_t used = 0;
+    for (;;) {
+        int count = lfs_journal_scan(img, pos, seq, desc);
+        if (count < 0 || used + count + 2 > log_blocks) break;
+        printf("Transaction %u at index %u, %d blocks:", seq, pos, count);
+        for (int i = 0; i < count; i++) printf(" %llu", (unsigned long long)desc->targets[i]);
+        printf("\n");
+        used += count + 2;
+        pos = (pos + count + 2) % log_blocks;
+        seq++;
+    }
+    if (!used) printf("No committed transactions to replay\n");
+    free(desc);
+    return 0;
+}
+
+static const struct {
+    const char* name;
+    int (*fn)(lfs_image_t* img, int argc, char** argv);
+    const char* help;
+} commands[] = {
+    { "stats",   cmd_stats,   "superblock layout" },
+    { "ls",      cmd_ls,      "[path] - list a directory" },
+    { "stat",    cmd_stat,    "<path | <inode>> - inode fields and extents" },
+    { "cat",     cmd_cat,     "<path | <inode>> - file contents" },
+    { "journal", cmd_journal, "committed transactions in the log" },
+};
+
+#define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static int run(lfs_image_t* img, int argc, char** argv) {
+    if (argc == 0) return 0;
+    if (strcmp(argv[0], "help") == 0) {
+        for (size_t i = 0; i < NCOMMANDS; i++) printf("%-8s %s\n", commands[i].name, commands[i].help);
+        return 0;
+    }
+    for (size_t i = 0; i < NCOMMANDS; i++) {
+        if (strcmp(argv[0], commands[i].name) == 0) return commands[i].fn(img, argc, argv);
+    }
+    printf("%s: unknown command; try help\n", argv[0]);
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: debugfs image [command [args]]\n");
+        return 1;
+    }
+
+    lfs_image_t img;
+    if (lfs_image_open(&img, argv[1], false) < 0) return 1;
+    if (argc > 2) {
+        int ret = run(&img, argc - 2, argv + 2);
+        lfs_image_close(&img);
+        return ret < 0 ? 1 : 0;
+    }
+
+    char line[1024];
+    bool tty = isatty(0);
+    for (;;) {
+        if (tty) {
+            printf("debugfs: ");
+            fflush(stdout);
+        }
+        if (!fgets(line, sizeof(line), stdin)) break;
+
+        char* args[DEBUGFS_MAX_ARGS];
+        int n = 0;
+        for (char* tok = strtok(line, " \t\n"); tok && n < DEBUGFS_MAX_ARGS; tok = strtok(NULL, " \t\n")) {
+            args[n++] = tok;
+        }
+        if (n == 1 && (strcmp(args[0], "quit") == 0 || strcmp(args[0], "q") == 0)) break;
+        run(&img, n, args);
+    }
+    lfs_image_close(&img);
+    return 0;
+}
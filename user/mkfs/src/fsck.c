@@ -0,0 +1,418 @@
+/* user/mkfs/src/fsck.c */
+
+// fsck.limitless: checks a LimitlessFS image.
+//
+// The superblock layout is checked first, then the journal: committed
+// transactions that were never checkpointed are listed, and replayed with
+// -y as the kernel would on mount. The tree is then walked from the root,
+// checking every extent tree and directory index, and the blocks and
+// inodes it reaches are compared with the two allocation bitmaps. With -y
+// the bitmaps are rewritten to match, as long as the tree itself is intact;
+// damage to the tree is only reported.
+//
+// Exit status: 0 clean, 1 errors corrected, 4 errors left, 8 could not check.
+
+#include "lfs_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FSCK_OK          0
+#define FSCK_CORRECTED   1
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR       8
+
+// Mismatches listed one by one before only a count is given
+#define FSCK_MAX_REPORT 10
+
+typedef struct {
+    lfs_image_t img;
+    bool repair;
+    uint32_t inode_count;
+    int errors;            // Found and left
+    int fixed;             // Found and corrected
+
+    uint8_t* used_blocks;  // Blocks reached from the tree
+    uint8_t* used_inodes;  // Inodes reached from the tree
+    uint32_t* queue;       // Inodes reached, in the order they are checked
+    uint32_t queue_len;
+} fsck_t;
+
+static bool bit_get(const uint8_t* bits, uint64_t n) {
+    return bits[n / 8] & (1 << (n % 8));
+}
+
+static void bit_set(uint8_t* bits, uint64_t n) {
+    bits[n / 8] |= 1 << (n % 8);
+}
+
+static void fsck_error(fsck_t* fs, const char* fmt, uint64_t a, uint64_t b) {
+    fs->errors++;
+    printf(fmt, (unsigned long long)a, (unsigned long long)b);
+    putchar('\n');
+}
+
+// --- Superblock ---
+
+static int fsck_super(fsck_t* fs) {
+    const lfs_superblock_t* sb = &fs->img.sb;
+    uint64_t itable = (fs->inode_count + LFS_INODES_PER_BLOCK - 1) / LFS_INODES_PER_BLOCK;
+
+    const char* bad = NULL;
+    if (sb->total_blocks > fs->img.blocks) bad = "the volume is larger than the image";
+    else if (sb->journal_start_block == 0 || sb->journal_num_blocks < LFS_JOURNAL_MIN_BLOCKS) bad = "no usable journal";
+    else if ((uint64_t)sb->journal_start_block + sb->journal_num_blocks > sb->inode_bitmap_block) bad = "the journal overlaps the inode bitmap";
+    else if (sb->inode_bitmap_block + lfs_bitmap_blocks(fs->inode_count) > sb->data_bitmap_block) bad = "the inode bitmap overlaps the block bitmap";
+    else if (sb->data_bitmap_block + lfs_bitmap_blocks(sb->total_blocks) > sb->inode_table_block) bad = "the block bitmap overlaps the inode table";
+    else if (fs->inode_count == 0 || sb->inode_table_block + itable > sb->data_blocks_start) bad = "the inode table overlaps the data area";
+    else if (sb->data_blocks_start >= sb->total_blocks) bad = "no data area";
+
+    if (bad) {
+        printf("superblock: %s\n", bad);
+        return -1;
+    }
+    return 0;
+}
+
+// --- Journal ---
+
+// Finds committed transactions from the log tail on, replaying them with
+// -y. A torn or stale transaction ends the log, as on mount.
+static int fsck_journal(fsck_t* fs) {
+    uint32_t log_blocks = fs->img.sb.journal_num_blocks - 1;
+    uint32_t pos, seq;
+    bool never_used;
+    if (lfs_journal_super(&fs->img, &pos, &seq, &never_used) < 0) {
+        printf("journal: super block is corrupt\n");
+        return -1;
+    }
+    if (never_used) {
+        printf("journal: super block is blank; the log is taken as empty\n");
+        return 0;
+    }
+
+    lfs_journal_descriptor_t* desc = malloc(sizeof(*desc));
+    if (!desc) return -1;
+    uint32_t pending = 0, bad_targets = 0;
+    uint8_t buf[LFS_BLOCK_SIZE];
+
+    for (uint32_t used = 0; used < log_blocks; ) {
+        int count = lfs_journal_scan(&fs->img, pos, seq, desc);
+        if (count < 0 || used + count + 2 > log_blocks) break;
+
+        for (int i = 0; i < count; i++) {
+            uint64_t target = desc->targets[i];
+            if (target == 0 || target >= fs->img.sb.total_blocks ||
+                (target >= fs->img.sb.journal_start_block &&
+                 target < (uint64_t)fs->img.sb.journal_start_block + fs->img.sb.journal_num_blocks)) {
+                bad_targets++;
+                continue;
+            }
+            if (fs->repair) {
+                if (lfs_read_block(&fs->img, lfs_log_block(&fs->img, pos + 1 + i), buf) < 0 ||
+                    lfs_write_block(&fs->img, target, buf) < 0) {
+                    free(desc);
+                    return -1;
+                }
+            }
+        }
+        used += count + 2;
+        pos = (pos + count + 2) % log_blocks;
+        seq++;
+        pending++;
+    }
+    free(desc);
+
+    if (bad_targets) {
+        fsck_error(fs, "journal: %llu logged blocks point outside the metadata and data areas", bad_targets, 0);
+    }
+    if (!pending) return 0;
+
+    if (!fs->repair) {
+        // Not an error: the kernel replays them on the next mount. What
+        // follows is checked as it is on disk, without them.
+        printf("journal: %u committed transactions not yet checkpointed; run with -y to replay\n", pending);
+        return 0;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    lfs_journal_super_t* js = (lfs_journal_super_t*)buf;
+    js->h.magic = LFS_JOURNAL_MAGIC;
+    js->h.type = LFS_JOURNAL_SUPER;
+    js->log_blocks = log_blocks;
+    js->first = pos;
+    js->first_sequence = seq;
+    if (lfs_write_block(&fs->img, fs->img.sb.journal_start_block, buf) < 0) return -1;
+    printf("journal: replayed %u committed transactions\n", pending);
+    fs->fixed++;
+    return 0;
+}
+
+// --- Tree ---
+
+typedef struct {
+    fsck_t* fs;
+    uint32_t inum;
+    uint64_t blocks;     // Blocks mapped, data and tree
+    uint64_t end;        // One past the last file block mapped
+} fsck_extents_t;
+
+static int fsck_claim(fsck_t* fs, uint32_t inum, uint64_t block) {
+    const lfs_superblock_t* sb = &fs->img.sb;
+    if (block < sb->data_blocks_start || block >= sb->total_blocks) {
+        fsck_error(fs, "inode %llu: block %llu is outside the data area", inum, block);
+        return -1;
+    }
+    if (bit_get(fs->used_blocks, block)) {
+        fsck_error(fs, "inode %llu: block %llu is claimed twice", inum, block);
+        return -1;
+    }
+    bit_set(fs->used_blocks, block);
+    return 0;
+}
+
+static int fsck_extent_fn(void* arg, const lfs_extent_t* e, uint64_t block) {
+    fsck_extents_t* x = arg;
+    if (!e) {
+        x->blocks++;
+        return fsck_claim(x->fs, x->inum, block) < 0 ? 1 : 0;
+    }
+    for (uint64_t b = 0; b < e->length; b++) {
+        if (fsck_claim(x->fs, x->inum, e->physical + b) < 0) return 1;
+    }
+    x->blocks += e->length;
+    x->end = (uint64_t)e->logical + e->length;
+    return 0;
+}
+
+typedef struct {
+    fsck_t* fs;
+    uint32_t inum;
+    char** names;
+    uint32_t count;
+    uint32_t cap;
+} fsck_dir_t;
+
+static int fsck_dirent_fn(void* arg, const lfs_dir_entry_t* e, uint32_t lo, uint32_t hi) {
+    fsck_dir_t* d = arg;
+    fsck_t* fs = d->fs;
+
+    uint32_t hash = lfs_dir_hash(e->name, e->name_len);
+    if (hash < lo || hash > hi) fsck_error(fs, "directory %llu: a name is in the leaf for another hash (%llu)", d->inum, hash);
+    if (memchr(e->name, '/', e->name_len) || memchr(e->name, '\0', e->name_len) ||
+        (e->name_len == 1 && e->name[0] == '.') || (e->name_len == 2 && e->name[0] == '.' && e->name[1] == '.')) {
+        fsck_error(fs, "directory %llu: invalid name for inode %llu", d->inum, e->inode);
+    }
+
+    if (d->count == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 32;
+        d->names = realloc(d->names, d->cap * sizeof(char*));
+        if (!d->names) return -1;
+    }
+    char* name = malloc(e->name_len + 1);
+    if (!name) return -1;
+    memcpy(name, e->name, e->name_len);
+    name[e->name_len] = '\0';
+    d->names[d->count++] = name;
+
+    lfs_inode_t child;
+    if (e->inode == LFS_ROOT_INODE || e->inode >= fs->inode_count || lfs_read_inode(&fs->img, e->inode, &child) < 0) {
+        fsck_error(fs, "directory %llu: entry points to invalid inode %llu", d->inum, e->inode);
+        return 0;
+    }
+    if (child.type != e->type) {
+        fsck_error(fs, "directory %llu: entry type does not match inode %llu", d->inum, e->inode);
+    }
+    if (bit_get(fs->used_inodes, e->inode)) {
+        fsck_error(fs, "directory %llu: inode %llu is linked more than once", d->inum, e->inode);
+        return 0;
+    }
+    bit_set(fs->used_inodes, e->inode);
+    fs->queue[fs->queue_len++] = e->inode;
+    return 0;
+}
+
+static int fsck_name_cmp(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Checks the inode `inum`, reached from directory `parent`
+static void fsck_inode(fsck_t* fs, uint32_t inum, uint32_t parent) {
+    lfs_inode_t inode;
+    if (lfs_read_inode(&fs->img, inum, &inode) < 0) {
+        fsck_error(fs, "inode %llu: cannot be read", inum, 0);
+        return;
+    }
+    if (inode.type != LFS_TYPE_FILE && inode.type != LFS_TYPE_DIR) {
+        fsck_error(fs, "inode %llu: unknown type %llu", inum, inode.type);
+        return;
+    }
+
+    fsck_extents_t x = { .fs = fs, .inum = inum, .blocks = 0, .end = 0 };
+    int ret = lfs_walk_extents(&fs->img, &inode, fsck_extent_fn, &x);
+    if (ret < 0) fsck_error(fs, "inode %llu: extent tree is corrupt", inum, 0);
+    if (ret) return;
+    if (x.blocks != inode.blocks) {
+        fsck_error(fs, "inode %llu: counts %llu blocks", inum, inode.blocks);
+    }
+    if (inode.type != LFS_TYPE_DIR) return;
+
+    if (inode.size % LFS_BLOCK_SIZE || inode.size / LFS_BLOCK_SIZE != x.end) {
+        fsck_error(fs, "directory %llu: size %llu does not match its blocks", inum, inode.size);
+        return;
+    }
+    uint8_t buf[LFS_BLOCK_SIZE];
+    uint64_t phys = lfs_bmap(&fs->img, &inode, 0);
+    if (!phys || lfs_read_block(&fs->img, phys, buf) < 0) {
+        fsck_error(fs, "directory %llu: no index root", inum, 0);
+        return;
+    }
+    if (((const lfs_dx_root_t*)buf)->parent != parent) {
+        fsck_error(fs, "directory %llu: \"..\" is not inode %llu", inum, parent);
+    }
+
+    fsck_dir_t d = { .fs = fs, .inum = inum, .names = NULL, .count = 0, .cap = 0 };
+    if (lfs_walk_dir(&fs->img, inum, &inode, fsck_dirent_fn, &d) != 0) {
+        fsck_error(fs, "directory %llu: index or leaf is corrupt", inum, 0);
+    }
+    qsort(d.names, d.count, sizeof(char*), fsck_name_cmp);
+    for (uint32_t i = 0; i < d.count; i++) {
+        if (i && strcmp(d.names[i - 1], d.names[i]) == 0) {
+            fsck_error(fs, "directory %llu: name appears twice", inum, 0);
+        }
+        free(d.names[i]);
+    }
+    free(d.names);
+}
+
+static void fsck_tree(fsck_t* fs) {
+    lfs_inode_t root;
+    if (lfs_read_inode(&fs->img, LFS_ROOT_INODE, &root) < 0 || root.type != LFS_TYPE_DIR) {
+        fsck_error(fs, "root inode is not a directory", 0, 0);
+        return;
+    }
+
+    // Every inode is queued at most once, when first linked
+    bit_set(fs->used_inodes, LFS_ROOT_INODE);
+    uint32_t* parents = calloc(fs->inode_count, sizeof(uint32_t));
+    if (!parents) return;
+    fs->queue[fs->queue_len++] = LFS_ROOT_INODE;
+    for (uint32_t i = 0; i < fs->queue_len; i++) {
+        uint32_t inum = fs->queue[i];
+        uint32_t first_child = fs->queue_len;
+        fsck_inode(fs, inum, parents[inum]);
+        for (uint32_t c = first_child; c < fs->queue_len; c++) parents[fs->queue[c]] = inum;
+    }
+    free(parents);
+}
+
+// --- Bitmaps ---
+
+// Compares the on-disk bitmap at `disk_block` with `expect`, bit by bit,
+// and rewrites it with -y
+static int fsck_bitmap(fsck_t* fs, const char* what, uint64_t disk_block, const uint8_t* expect, uint64_t nbits) {
+    uint32_t nblocks = lfs_bitmap_blocks(nbits);
+    uint64_t leaked = 0, unmarked = 0;
+    uint8_t buf[LFS_BLOCK_SIZE];
+
+    for (uint32_t g = 0; g < nblocks; g++) {
+        if (lfs_read_block(&fs->img, disk_block + g, buf) < 0) return -1;
+        const uint8_t* want = expect + (size_t)g * LFS_BLOCK_SIZE;
+        if (memcmp(buf, want, LFS_BLOCK_SIZE) == 0) continue;
+
+        for (uint64_t i = 0; i < LFS_BLOCK_SIZE * 8; i++) {
+            bool have = bit_get(buf, i), need = bit_get(want, i);
+            if (have == need) continue;
+            uint64_t n = (uint64_t)g * LFS_BLOCK_SIZE * 8 + i;
+            if (leaked + unmarked < FSCK_MAX_REPORT) {
+                printf("%s %llu: %s\n", what, (unsigned long long)n,
+                       have ? "marked in use but not reachable" : "in use but marked free");
+            }
+            if (have) leaked++;
+            else unmarked++;
+        }
+        if (fs->repair && lfs_write_block(&fs->img, disk_block + g, want) < 0) return -1;
+    }
+
+    if (leaked + unmarked == 0) return 0;
+    printf("%s bitmap: %llu marked in use but not reachable, %llu in use but marked free%s\n", what,
+           (unsigned long long)leaked, (unsigned long long)unmarked, fs->repair ? "; rewritten" : "");
+    if (fs->repair) fs->fixed++;
+    else fs->errors++;
+    return 0;
+}
+
+// What each bitmap should hold: bits for what the tree reaches, for the
+// reserved area below `reserved`, and for everything past `nbits`
+static void fsck_expect(uint8_t* bits, uint64_t nbits, uint64_t reserved) {
+    uint64_t total = (uint64_t)lfs_bitmap_blocks(nbits) * LFS_BLOCK_SIZE * 8;
+    for (uint64_t b = 0; b < reserved && b < nbits; b++) bit_set(bits, b);
+    for (uint64_t b = nbits; b < total; b++) bit_set(bits, b);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: fsck.limitless [-n | -y] image\n"
+            "  -n  check only, change nothing (the default)\n"
+            "  -y  replay the journal and rewrite the bitmaps\n");
+    exit(FSCK_ERROR);
+}
+
+int main(int argc, char** argv) {
+    fsck_t fs;
+    memset(&fs, 0, sizeof(fs));
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ny")) != -1) {
+        switch (opt) {
+        case 'n': fs.repair = false; break;
+        case 'y': fs.repair = true; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+
+    if (lfs_image_open(&fs.img, argv[optind], fs.repair) < 0) return FSCK_ERROR;
+    fs.inode_count = lfs_inode_count(&fs.img.sb);
+    if (fsck_super(&fs) < 0) return FSCK_UNCORRECTED;
+    if (fsck_journal(&fs) < 0) return FSCK_UNCORRECTED;
+
+    const lfs_superblock_t* sb = &fs.img.sb;
+    fs.used_blocks = calloc(lfs_bitmap_blocks(sb->total_blocks), LFS_BLOCK_SIZE);
+    fs.used_inodes = calloc(lfs_bitmap_blocks(fs.inode_count), LFS_BLOCK_SIZE);
+    fs.queue = malloc(fs.inode_count * sizeof(uint32_t));
+    if (!fs.used_blocks || !fs.used_inodes || !fs.queue) {
+        fprintf(stderr, "fsck.limitless: out of memory\n");
+        return FSCK_ERROR;
+    }
+
+    fsck_tree(&fs);
+    uint32_t files = fs.queue_len;
+    uint64_t used = 0;
+    for (uint64_t b = sb->data_blocks_start; b < sb->total_blocks; b++) used += bit_get(fs.used_blocks, b);
+
+    // A damaged tree reaches less than is in use; freeing the rest would
+    // hand out blocks that still hold data
+    if (fs.repair && fs.errors) {
+        printf("bitmaps: not rewritten, the tree has errors\n");
+        fs.repair = false;
+    }
+    fsck_expect(fs.used_blocks, sb->total_blocks, sb->data_blocks_start);
+    fsck_expect(fs.used_inodes, fs.inode_count, 1);
+    if (fsck_bitmap(&fs, "block", sb->data_bitmap_block, fs.used_blocks, sb->total_blocks) < 0 ||
+        fsck_bitmap(&fs, "inode", sb->inode_bitmap_block, fs.used_inodes, fs.inode_count) < 0 ||
+        (fs.repair && fsync(fs.img.fd) < 0)) {
+        return FSCK_ERROR;
+    }
+    lfs_image_close(&fs.img);
+
+    printf("%s: %u/%u inodes, %llu/%llu data blocks", argv[optind], files, fs.inode_count,
+           (unsigned long long)used, (unsigned long long)(sb->total_blocks - sb->data_blocks_start));
+    if (fs.errors) printf(", %d errors left\n", fs.errors);
+    else if (fs.fixed) printf(", %d errors corrected\n", fs.fixed);
+    else printf(", clean\n");
+
+    if (fs.errors) return FSCK_UNCORRECTED;
+    return fs.fixed ? FSCK_CORRECTED : FSCK_OK;
+}
@@ -0,0 +1,360 @@
+/* user/mkfs/src/lfs_image.c */
+
+#include "lfs_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <lib/crc32.h>
+
+// --- Block I/O ---
+
+int lfs_image_open(lfs_image_t* img, const char* path, bool writable) {
+    memset(img, 0, sizeof(*img));
+    img->path = path;
+    img->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (img->fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(img->fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(img->fd);
+        return -1;
+    }
+    img->blocks = (uint64_t)st.st_size / LFS_BLOCK_SIZE;
+
+    uint8_t buf[LFS_BLOCK_SIZE];
+    if (img->blocks == 0 || lfs_read_block(img, 0, buf) < 0) {
+        fprintf(stderr, "%s: too small to hold a filesystem\n", path);
+        close(img->fd);
+        return -1;
+    }
+    memcpy(&img->sb, buf, sizeof(img->sb));
+    if (img->sb.magic != LFS_MAGIC) {
+        fprintf(stderr, "%s: not a LimitlessFS volume\n", path);
+        close(img->fd);
+        return -1;
+    }
+    return 0;
+}
+
+void lfs_image_close(lfs_image_t* img) {
+    if (img->fd >= 0) close(img->fd);
+    img->fd = -1;
+}
+
+int lfs_read_block(lfs_image_t* img, uint64_t block, void* buf) {
+    if (block >= img->blocks) {
+        fprintf(stderr, "%s: block %llu is past the end of the image\n", img->path, (unsigned long long)block);
+        return -1;
+    }
+    ssize_t n = pread(img->fd, buf, LFS_BLOCK_SIZE, (off_t)(block * LFS_BLOCK_SIZE));
+    if (n != LFS_BLOCK_SIZE) {
+        fprintf(stderr, "%s: cannot read block %llu\n", img->path, (unsigned long long)block);
+        return -1;
+    }
+    return 0;
+}
+
+int lfs_write_block(lfs_image_t* img, uint64_t block, const void* buf) {
+    ssize_t n = pwrite(img->fd, buf, LFS_BLOCK_SIZE, (off_t)(block * LFS_BLOCK_SIZE));
+    if (n != LFS_BLOCK_SIZE) {
+        fprintf(stderr, "%s: cannot write block %llu\n", img->path, (unsigned long long)block);
+        return -1;
+    }
+    if (block >= img->blocks) img->blocks = block + 1;
+    return 0;
+}
+
+int lfs_read_inode(lfs_image_t* img, uint32_t inum, lfs_inode_t* inode) {
+    uint8_t buf[LFS_BLOCK_SIZE];
+    if (inum >= lfs_inode_count(&img->sb)) return -1;
+    if (lfs_read_block(img, img->sb.inode_table_block + inum / LFS_INODES_PER_BLOCK, buf) < 0) return -1;
+    memcpy(inode, buf + (inum % LFS_INODES_PER_BLOCK) * LFS_INODE_SIZE, sizeof(*inode));
+    return 0;
+}
+
+int lfs_write_inode(lfs_image_t* img, uint32_t inum, const lfs_inode_t* inode) {
+    uint8_t buf[LFS_BLOCK_SIZE];
+    uint64_t block = img->sb.inode_table_block + inum / LFS_INODES_PER_BLOCK;
+    if (inum >= lfs_inode_count(&img->sb) || lfs_read_block(img, block, buf) < 0) return -1;
+    memcpy(buf + (inum % LFS_INODES_PER_BLOCK) * LFS_INODE_SIZE, inode, sizeof(*inode));
+    return lfs_write_block(img, block, buf);
+}
+
+uint32_t lfs_bitmap_blocks(uint64_t nbits) {
+    return (nbits + LFS_BLOCK_SIZE * 8 - 1) / (LFS_BLOCK_SIZE * 8);
+}
+
+// --- Extents ---
+
+typedef struct {
+    lfs_image_t* img;
+    lfs_extent_fn fn;
+    void* arg;
+    uint64_t next;     // Lowest file block the next extent may start at
+} lfs_walk_t;
+
+// Checks and walks the node whose header is `h`, covering file blocks
+// [lo, hi)
+static int lfs_walk_node(lfs_walk_t* w, const lfs_extent_header_t* h, uint16_t max, int depth,
+                         uint64_t lo, uint64_t hi) {
+    if (h->magic != LFS_EXTENT_MAGIC || h->max != max || h->entries > max || h->depth != depth) return -1;
+
+    if (depth == 0) {
+        const lfs_extent_t* e = (const lfs_extent_t*)(h + 1);
+        for (uint16_t i = 0; i < h->entries; i++) {
+            uint64_t end = (uint64_t)e[i].logical + e[i].length;
+            if (e[i].length == 0 || e[i].physical == 0 || e[i].logical < w->next ||
+                e[i].logical < lo || end > hi) {
+                return -1;
+            }
+            w->next = end;
+            int ret = w->fn(w->arg, &e[i], 0);
+            if (ret) return ret;
+        }
+        return 0;
+    }
+
+    const lfs_extent_index_t* ix = (const lfs_extent_index_t*)(h + 1);
+    for (uint16_t i = 0; i < h->entries; i++) {
+        uint64_t start = i ? ix[i].logical : lo;
+        uint64_t end = i + 1 < h->entries ? ix[i + 1].logical : hi;
+        if (ix[i].logical < lo || start > end || ix[i].child == 0) return -1;
+
+        int ret = w->fn(w->arg, NULL, ix[i].child);
+        if (ret) return ret;
+
+        uint8_t buf[LFS_BLOCK_SIZE];
+        if (lfs_read_block(w->img, ix[i].child, buf) < 0) return -1;
+        ret = lfs_walk_node(w, (const lfs_extent_header_t*)buf, LFS_EXTENTS_PER_BLOCK, depth - 1, start, end);
+        if (ret) return ret;
+    }
+    return 0;
+}
+
+int lfs_walk_extents(lfs_image_t* img, const lfs_inode_t* inode, lfs_extent_fn fn, void* arg) {
+    lfs_walk_t w = { .img = img, .fn = fn, .arg = arg, .next = 0 };
+    int depth = inode->extent_header.depth;
+    if (depth > LFS_MAX_EXTENT_DEPTH) return -1;
+    return lfs_walk_node(&w, &inode->extent_header, LFS_INLINE_EXTENTS, depth, 0, (uint64_t)1 << 32);
+}
+
+typedef struct {
+    uint32_t lblock;
+    uint64_t phys;
+} lfs_bmap_t;
+
+static int lfs_bmap_fn(void* arg, const lfs_extent_t* e, uint64_t block) {
+    lfs_bmap_t* b = arg;
+    if (!e) return 0;
+    if (e->logical > b->lblock) return 1;
+    if (b->lblock - e->logical < e->length) {
+        b->phys = e->physical + (b->lblock - e->logical);
+        return 1;
+    }
+    return 0;
+}
+
+uint64_t lfs_bmap(lfs_image_t* img, const lfs_inode_t* inode, uint32_t lblock) {
+    lfs_bmap_t b = { .lblock = lblock, .phys = 0 };
+    if (lfs_walk_extents(img, inode, lfs_bmap_fn, &b) < 0) return 0;
+    return b.phys;
+}
+
+// --- Directories ---
+
+typedef struct {
+    lfs_image_t* img;
+    const lfs_inode_t* dir;
+    uint32_t nblocks;
+    lfs_dirent_fn fn;
+    void* arg;
+} lfs_dirwalk_t;
+
+static int lfs_walk_leaf(lfs_dirwalk_t* w, const uint8_t* leaf, uint32_t lo, uint32_t hi) {
+    uint32_t off = 0;
+    while (off < LFS_BLOCK_SIZE) {
+        const lfs_dir_entry_t* e = (const lfs_dir_entry_t*)(leaf + off);
+        if (e->rec_len < LFS_DIR_REC_LEN(0) || (e->rec_len & 3) || off + e->rec_len > LFS_BLOCK_SIZE ||
+            LFS_DIR_REC_LEN(e->name_len) > e->rec_len) {
+            return -1;
+        }
+        if (e->name_len) {
+            int ret = w->fn(w->arg, e, lo, hi);
+            if (ret) return ret;
+        }
+        off += e->rec_len;
+    }
+    return 0;
+}
+
+// Walks the entries of an index block, whose names hash to [lo, hi]
+static int lfs_walk_index(lfs_dirwalk_t* w, const lfs_dx_countlimit_t* cl, const lfs_dx_entry_t* entries,
+                          uint16_t limit, int depth, uint32_t lo, uint32_t hi) {
+    if (cl->count == 0 || cl->count > cl->limit || cl->limit > limit) return -1;
+
+    for (uint16_t i = 0; i < cl->count; i++) {
+        uint32_t start = i ? entries[i].hash : lo;
+        uint32_t end = hi;
+        if (i + 1 < cl->count) {
+            if (entries[i + 1].hash <= start) return -1;
+            end = entries[i + 1].hash - 1;
+        }
+        if (i && (entries[i].hash < lo || entries[i].hash > hi)) return -1;
+        if (entries[i].block == 0 || entries[i].block >= w->nblocks) return -1;
+
+        uint8_t buf[LFS_BLOCK_SIZE];
+        uint64_t phys = lfs_bmap(w->img, w->dir, entries[i].block);
+        if (!phys || lfs_read_block(w->img, phys, buf) < 0) return -1;
+
+        int ret;
+        if (depth == 0) {
+            ret = lfs_walk_leaf(w, buf, start, end);
+        } else {
+            const lfs_dx_node_t* node = (const lfs_dx_node_t*)buf;
+            if (node->magic != LFS_DX_NODE_MAGIC) return -1;
+            ret = lfs_walk_index(w, &node->cl, node->entries, LFS_DX_NODE_LIMIT, depth - 1, start, end);
+        }
+        if (ret) return ret;
+    }
+    return 0;
+}
+
+int lfs_walk_dir(lfs_image_t* img, uint32_t inum, const lfs_inode_t* dir, lfs_dirent_fn fn, void* arg) {
+    lfs_dirwalk_t w = { .img = img, .dir = dir, .nblocks = dir->size / LFS_BLOCK_SIZE, .fn = fn, .arg = arg };
+    uint8_t buf[LFS_BLOCK_SIZE];
+    uint64_t phys = lfs_bmap(img, dir, 0);
+    if (dir->type != LFS_TYPE_DIR || !phys || lfs_read_block(img, phys, buf) < 0) return -1;
+
+    const lfs_dx_root_t* root = (const lfs_dx_root_t*)buf;
+    if (root->magic != LFS_DX_ROOT_MAGIC || root->self != inum || root->hash_version != LFS_DX_HASH_FNV1A ||
+        root->depth > LFS_DX_MAX_DEPTH || root->entries[0].hash != 0) {
+        return -1;
+    }
+    return lfs_walk_index(&w, &root->cl, root->entries, LFS_DX_ROOT_LIMIT, root->depth, 0, 0x7FFFFFFF);
+}
+
+typedef struct {
+    const char* name;
+    uint32_t len;
+    uint32_t inum;
+    bool found;
+} lfs_find_t;
+
+static int lfs_find_fn(void* arg, const lfs_dir_entry_t* e, uint32_t lo, uint32_t hi) {
+    lfs_find_t* f = arg;
+    if (e->name_len == f->len && memcmp(e->name, f->name, f->len) == 0) {
+        f->inum = e->inode;
+        f->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+int lfs_lookup(lfs_image_t* img, const char* path, uint32_t* inum, lfs_inode_t* inode) {
+    uint32_t cur = LFS_ROOT_INODE;
+    if (lfs_read_inode(img, cur, inode) < 0) return -1;
+
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+        const char* end = p;
+        while (*end && *end != '/') end++;
+
+        uint32_t len = end - p;
+        if (inode->type != LFS_TYPE_DIR) return -1;
+        if (len == 1 && p[0] == '.') {
+            // Stays put
+        } else if (len == 2 && p[0] == '.' && p[1] == '.') {
+            uint8_t buf[LFS_BLOCK_SIZE];
+            uint64_t phys = lfs_bmap(img, inode, 0);
+            if (!phys || lfs_read_block(img, phys, buf) < 0) return -1;
+            cur = ((const lfs_dx_root_t*)buf)->parent;
+        } else {
+            lfs_find_t f = { .name = p, .len = len, .found = false };
+            if (lfs_walk_dir(img, cur, inode, lfs_find_fn, &f) < 0 || !f.found) return -1;
+            cur = f.inum;
+        }
+        if (lfs_read_inode(img, cur, inode) < 0) return -1;
+        p = end;
+    }
+    *inum = cur;
+    return 0;
+}
+
+// --- Journal ---
+
+int lfs_journal_super(lfs_image_t* img, uint32_t* first, uint32_t* seq, bool* never_used) {
+    uint8_t buf[LFS_BLOCK_SIZE];
+    if (img->sb.journal_num_blocks < LFS_JOURNAL_MIN_BLOCKS ||
+        lfs_read_block(img, img->sb.journal_start_block, buf) < 0) {
+        return -1;
+    }
+
+    const lfs_journal_super_t* js = (const lfs_journal_super_t*)buf;
+    uint32_t log_blocks = img->sb.journal_num_blocks - 1;
+    *never_used = false;
+    if (js->h.magic == LFS_JOURNAL_MAGIC) {
+        if (js->h.type != LFS_JOURNAL_SUPER || js->log_blocks != log_blocks || js->first >= log_blocks) return -1;
+        *first = js->first;
+        *seq = js->first_sequence;
+        return 0;
+    }
+
+    // Like the kernel, anything else is an empty log that starts at 0
+    *never_used = true;
+    *first = 0;
+    *seq = 1;
+    return 0;
+}
+
+int lfs_journal_scan(lfs_image_t* img, uint32_t pos, uint32_t seq, lfs_journal_descriptor_t* desc) {
+    uint32_t log_blocks = img->sb.journal_num_blocks - 1;
+    uint8_t buf[LFS_BLOCK_SIZE];
+
+    if (lfs_read_block(img, lfs_log_block(img, pos), desc) < 0) return -1;
+    if (desc->h.magic != LFS_JOURNAL_MAGIC || desc->h.type != LFS_JOURNAL_DESCRIPTOR ||
+        desc->h.sequence != seq || desc->count == 0 || desc->count > lfs_journal_max_txn(log_blocks)) {
+        return -1;
+    }
+
+    uint32_t crc = crc32(0, desc, LFS_BLOCK_SIZE);
+    for (uint32_t i = 0; i < desc->count; i++) {
+        if (lfs_read_block(img, lfs_log_block(img, pos + 1 + i), buf) < 0) return -1;
+        crc = crc32(crc, buf, LFS_BLOCK_SIZE);
+    }
+
+    const lfs_journal_commit_t* commit = (const lfs_journal_commit_t*)buf;
+    if (lfs_read_block(img, lfs_log_block(img, pos + 1 + desc->count), buf) < 0) return -1;
+    if (commit->h.magic != LFS_JOURNAL_MAGIC || commit->h.type != LFS_JOURNAL_COMMIT ||
+        commit->h.sequence != seq || commit->count != desc->count || commit->checksum != crc) {
+        return -1;
+    }
+    return desc->count;
+}
+
+// --- Parsing ---
+
+int64_t lfs_parse_size(const char* s) {
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 0);
+    if (errno || end == s) return -1;
+
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end || v > (unsigned long long)INT64_MAX >> shift) return -1;
+    return (int64_t)(v << shift);
+}
@@ -0,0 +1,82 @@
+#ifndef LFS_IMAGE_H
+#define LFS_IMAGE_H
+
+// LimitlessFS images on the build host, for mkfs.limitless, fsck.limitless
+// and debugfs. The format comes from <limitless/lfs_format.h>, the same
+// header the kernel uses. Functions return -1 on error after printing
+// what went wrong to stderr.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <limitless/lfs_format.h>
+
+typedef struct {
+    int fd;
+    const char* path;
+    uint64_t blocks;       // Size of the image file, in blocks
+    lfs_superblock_t sb;
+} lfs_image_t;
+
+// Opens an existing image and reads its superblock; -1 if it is not one
+int lfs_image_open(lfs_image_t* img, const char* path, bool writable);
+void lfs_image_close(lfs_image_t* img);
+
+int lfs_read_block(lfs_image_t* img, uint64_t block, void* buf);
+int lfs_write_block(lfs_image_t* img, uint64_t block, const void* buf);
+
+int lfs_read_inode(lfs_image_t* img, uint32_t inum, lfs_inode_t* inode);
+int lfs_write_inode(lfs_image_t* img, uint32_t inum, const lfs_inode_t* inode);
+
+// Blocks each bitmap takes on disk
+uint32_t lfs_bitmap_blocks(uint64_t nbits);
+
+// --- Extents ---
+
+// Called for every leaf extent of a file in order of `logical`, and for
+// every tree block (`e` NULL, `block` set). A non-zero return stops the walk.
+typedef int (*lfs_extent_fn)(void* arg, const lfs_extent_t* e, uint64_t block);
+
+// Walks the extent tree of `inode`, checking every node on the way. -1 on
+// a corrupt tree, else what the callback last returned.
+int lfs_walk_extents(lfs_image_t* img, const lfs_inode_t* inode, lfs_extent_fn fn, void* arg);
+
+// Disk block of file block `lblock`; 0 for a hole
+uint64_t lfs_bmap(lfs_image_t* img, const lfs_inode_t* inode, uint32_t lblock);
+
+// --- Directories ---
+
+// Called for every name in a directory with the hash range of the leaf it
+// was found in ([lo, hi], both inclusive). A non-zero return stops the walk.
+typedef int (*lfs_dirent_fn)(void* arg, const lfs_dir_entry_t* e, uint32_t lo, uint32_t hi);
+
+// Walks every leaf of a directory through its hash index. -1 if the
+// directory is corrupt, else what the callback last returned.
+int lfs_walk_dir(lfs_image_t* img, uint32_t inum, const lfs_inode_t* dir, lfs_dirent_fn fn, void* arg);
+
+// Resolves an absolute path; -1 if a component is missing
+int lfs_lookup(lfs_image_t* img, const char* path, uint32_t* inum, lfs_inode_t* inode);
+
+// --- Journal ---
+
+// Reads the journal super block. *never_used is set for a log that was
+// never written to since mkfs, and *first and *seq then describe an empty
+// log. -1 if the super block is neither valid nor blank.
+int lfs_journal_super(lfs_image_t* img, uint32_t* first, uint32_t* seq, bool* never_used);
+
+// Checks the transaction at log index `pos` with sequence `seq` and
+// returns its image count, reading its descriptor into `desc`; -1 if it is
+// not a complete transaction.
+int lfs_journal_scan(lfs_image_t* img, uint32_t pos, uint32_t seq, lfs_journal_descriptor_t* desc);
+
+// Disk block of log index `pos`
+static inline uint64_t lfs_log_block(const lfs_image_t* img, uint32_t pos) {
+    return img->sb.journal_start_block + 1 + pos % (img->sb.journal_num_blocks - 1);
+}
+
+// --- Parsing ---
+
+// A size such as 4096, 64K, 16M or 2G; -1 if it is not one
+int64_t lfs_parse_size(const char* s);
+
+#endif
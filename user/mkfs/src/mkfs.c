@@ -0,0 +1,515 @@
+/* user/mkfs/src/mkfs.c */
+
+// mkfs.limitless: creates a LimitlessFS volume in an image file, optionally
+// populated from a directory tree on the build host.
+//
+// The volume is laid out as the superblock, the journal, the inode bitmap,
+// the block bitmap, the inode table, then data. Files and directories are
+// packed into the data area in inode order, each in one contiguous run, so
+// every inode maps its blocks with a single inline extent. Ownership is
+// reset to root; permissions and modification times are kept.
+
+#include "lfs_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Longest name the kernel's VFS can hand back through readdir
+#define MKFS_NAME_MAX 127
+
+#define MKFS_DEFAULT_SIZE (64ull << 20)
+#define MKFS_MAX_JOURNAL  8192
+
+// Journal credits the kernel reserves to add a name to a directory whose
+// extent tree is at its deepest; a log with a smaller transaction limit
+// mounts, but cannot create files
+#define MKFS_MIN_TXN 128
+
+typedef struct {
+    char* path;           // On the host; NULL for an empty root
+    char name[MKFS_NAME_MAX + 1];
+    uint8_t name_len;
+    uint32_t hash;
+    uint16_t type;        // LFS_TYPE_*
+    uint16_t mode;
+    uint64_t size;
+    uint64_t mtime;       // Nanoseconds
+    uint32_t parent;      // Inode number
+    uint32_t* children;   // Inode numbers, sorted by hash for directories
+    uint32_t nchildren;
+} mkfs_node_t;
+
+static mkfs_node_t* nodes;   // Indexed by inode number
+static uint32_t nnodes;
+static uint32_t nodes_cap;
+
+static void* xrealloc(void* p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "mkfs.limitless: out of memory\n");
+        exit(8);
+    }
+    return p;
+}
+
+// --- Scanning the source tree ---
+
+static uint32_t mkfs_add_node(const char* path, const char* name, const struct stat* st, uint32_t parent) {
+    if (nnodes == nodes_cap) {
+        nodes_cap = nodes_cap ? nodes_cap * 2 : 64;
+        nodes = xrealloc(nodes, nodes_cap * sizeof(mkfs_node_t));
+    }
+    uint32_t inum = nnodes++;
+    mkfs_node_t* n = &nodes[inum];
+    memset(n, 0, sizeof(*n));
+    n->path = path ? strdup(path) : NULL;
+    n->name_len = strlen(name);
+    memcpy(n->name, name, n->name_len);
+    n->hash = lfs_dir_hash(n->name, n->name_len);
+    n->type = S_ISDIR(st->st_mode) ? LFS_TYPE_DIR : LFS_TYPE_FILE;
+    n->mode = st->st_mode & 07777;
+    n->size = S_ISREG(st->st_mode) ? (uint64_t)st->st_size : 0;
+    n->mtime = (uint64_t)st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec;
+    n->parent = parent;
+    return inum;
+}
+
+// Adds the entries of the directory `inum` and, breadth first, of every
+// directory below it
+static int mkfs_scan(uint32_t root) {
+    for (uint32_t inum = root; inum < nnodes; inum++) {
+        if (nodes[inum].type != LFS_TYPE_DIR || !nodes[inum].path) continue;
+
+        DIR* d = opendir(nodes[inum].path);
+        if (!d) {
+            fprintf(stderr, "mkfs.limitless: %s: %s\n", nodes[inum].path, strerror(errno));
+            return -1;
+        }
+        struct dirent* de;
+        while ((de = readdir(d))) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+            char* path = xrealloc(NULL, strlen(nodes[inum].path) + strlen(de->d_name) + 2);
+            sprintf(path, "%s/%s", nodes[inum].path, de->d_name);
+            struct stat st;
+            if (lstat(path, &st) < 0) {
+                fprintf(stderr, "mkfs.limitless: %s: %s\n", path, strerror(errno));
+                free(path);
+                closedir(d);
+                return -1;
+            }
+            if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+                fprintf(stderr, "mkfs.limitless: %s: skipped, only files and directories are copied\n", path);
+            } else if (strlen(de->d_name) > MKFS_NAME_MAX) {
+                fprintf(stderr, "mkfs.limitless: %s: skipped, name longer than %d\n", path, MKFS_NAME_MAX);
+            } else {
+                uint32_t child = mkfs_add_node(path, de->d_name, &st, inum);
+                mkfs_node_t* dir = &nodes[inum];
+                dir->children = xrealloc(dir->children, (dir->nchildren + 1) * sizeof(uint32_t));
+                dir->children[dir->nchildren++] = child;
+            }
+            free(path);
+        }
+        closedir(d);
+    }
+    return 0;
+}
+
+// --- Directory layout ---
+
+static int mkfs_child_cmp(const void* a, const void* b) {
+    const mkfs_node_t* x = &nodes[*(const uint32_t*)a];
+    const mkfs_node_t* y = &nodes[*(const uint32_t*)b];
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    int c = memcmp(x->name, y->name, x->name_len < y->name_len ? x->name_len : y->name_len);
+    return c ? c : (int)x->name_len - (int)y->name_len;
+}
+
+// A directory's leaves: the index of its first child in each, and the
+// lowest hash each covers
+typedef struct {
+    uint32_t* first;
+    uint32_t* hash;
+    uint32_t count;
+} mkfs_leaves_t;
+
+// Packs the sorted children into leaves, keeping names of one hash together
+static int mkfs_plan_leaves(mkfs_node_t* dir, mkfs_leaves_t* lv) {
+    lv->first = xrealloc(NULL, (dir->nchildren + 1) * sizeof(uint32_t));
+    lv->hash = xrealloc(NULL, (dir->nchildren + 1) * sizeof(uint32_t));
+    lv->first[0] = 0;
+    lv->hash[0] = 0;
+    lv->count = 1;
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < dir->nchildren; ) {
+        uint32_t hash = nodes[dir->children[i]].hash;
+        uint32_t j = i, need = 0;
+        while (j < dir->nchildren && nodes[dir->children[j]].hash == hash) {
+            need += LFS_DIR_REC_LEN(nodes[dir->children[j]].name_len);
+            j++;
+        }
+        if (need > LFS_BLOCK_SIZE) {
+            fprintf(stderr, "mkfs.limitless: %s: too many names with one hash\n", dir->path);
+            return -1;
+        }
+        if (used + need > LFS_BLOCK_SIZE) {
+            lv->first[lv->count] = i;
+            lv->hash[lv->count] = hash;
+            lv->count++;
+            used = 0;
+        }
+        used += need;
+        i = j;
+    }
+    lv->first[lv->count] = dir->nchildren;
+    return 0;
+}
+
+// Blocks the index of a directory with `leaves` leaves takes, the root included
+static uint32_t mkfs_index_blocks(uint32_t leaves, uint8_t* depth) {
+    if (leaves <= LFS_DX_ROOT_LIMIT) {
+        *depth = 0;
+        return 1;
+    }
+    *depth = 1;
+    return 1 + (leaves + LFS_DX_NODE_LIMIT - 1) / LFS_DX_NODE_LIMIT;
+}
+
+static void mkfs_fill_leaf(uint8_t* buf, const mkfs_node_t* dir, uint32_t from, uint32_t to) {
+    memset(buf, 0, LFS_BLOCK_SIZE);
+    uint32_t off = 0, last = 0;
+    for (uint32_t i = from; i < to; i++) {
+        const mkfs_node_t* c = &nodes[dir->children[i]];
+        lfs_dir_entry_t* e = (lfs_dir_entry_t*)(buf + off);
+        e->inode = dir->children[i];
+        e->rec_len = LFS_DIR_REC_LEN(c->name_len);
+        e->name_len = c->name_len;
+        e->type = c->type;
+        memcpy(e->name, c->name, c->name_len);
+        last = off;
+        off += e->rec_len;
+    }
+    // The last entry runs to the end of the block; an empty leaf is one
+    // unused entry
+    ((lfs_dir_entry_t*)(buf + last))->rec_len = LFS_BLOCK_SIZE - last;
+}
+
+// --- Writing ---
+
+typedef struct {
+    lfs_image_t img;
+    uint64_t next;        // Next free data block
+    uint8_t* block_bits;
+    uint8_t* inode_bits;
+} mkfs_t;
+
+static int mkfs_alloc(mkfs_t* fs, uint64_t count, uint64_t* first) {
+    if (count > fs->img.sb.total_blocks - fs->next) {
+        fprintf(stderr, "mkfs.limitless: %s: image too small for the source tree\n", fs->img.path);
+        return -1;
+    }
+    *first = fs->next;
+    fs->next += count;
+    return 0;
+}
+
+static void mkfs_inode_init(lfs_inode_t* inode, const mkfs_node_t* n, uint64_t first, uint64_t count) {
+    memset(inode, 0, sizeof(*inode));
+    inode->type = n->type;
+    inode->permissions = n->mode;
+    inode->size = n->type == LFS_TYPE_DIR ? count * LFS_BLOCK_SIZE : n->size;
+    inode->last_modified = n->mtime;
+    inode->blocks = count;
+    inode->extent_header.magic = LFS_EXTENT_MAGIC;
+    inode->extent_header.max = LFS_INLINE_EXTENTS;
+    if (count) {
+        inode->extent_header.entries = 1;
+        inode->extent_root.extents[0].logical = 0;
+        inode->extent_root.extents[0].length = count;
+        inode->extent_root.extents[0].physical = first;
+    }
+}
+
+static int mkfs_write_file(mkfs_t* fs, uint32_t inum) {
+    const mkfs_node_t* n = &nodes[inum];
+    uint64_t count = (n->size + LFS_BLOCK_SIZE - 1) / LFS_BLOCK_SIZE, first = 0;
+    if (count && mkfs_alloc(fs, count, &first) < 0) return -1;
+
+    lfs_inode_t inode;
+    mkfs_inode_init(&inode, n, first, count);
+    if (lfs_write_inode(&fs->img, inum, &inode) < 0) return -1;
+    if (!count) return 0;
+
+    int fd = open(n->path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "mkfs.limitless: %s: %s\n", n->path, strerror(errno));
+        return -1;
+    }
+    uint8_t buf[LFS_BLOCK_SIZE];
+    int ret = 0;
+    for (uint64_t b = 0; b < count && ret == 0; b++) {
+        memset(buf, 0, sizeof(buf));
+        ssize_t got = read(fd, buf, sizeof(buf));
+        if (got < 0) {
+            fprintf(stderr, "mkfs.limitless: %s: %s\n", n->path, strerror(errno));
+            ret = -1;
+        } else {
+            // A file that shrank while copying reads back as zeroes
+            ret = lfs_write_block(&fs->img, first + b, buf);
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+static int mkfs_write_dir(mkfs_t* fs, uint32_t inum) {
+    mkfs_node_t* n = &nodes[inum];
+    qsort(n->children, n->nchildren, sizeof(uint32_t), mkfs_child_cmp);
+
+    mkfs_leaves_t lv;
+    int ret = -1;
+    if (mkfs_plan_leaves(n, &lv) < 0) goto out;
+
+    uint8_t depth;
+    uint32_t index = mkfs_index_blocks(lv.count, &depth);
+    uint64_t count = index + lv.count, first;
+    if (mkfs_alloc(fs, count, &first) < 0) goto out;
+
+    lfs_inode_t inode;
+    mkfs_inode_init(&inode, n, first, count);
+    if (lfs_write_inode(&fs->img, inum, &inode) < 0) goto out;
+
+    uint8_t buf[LFS_BLOCK_SIZE];
+    memset(buf, 0, sizeof(buf));
+    lfs_dx_root_t* root = (lfs_dx_root_t*)buf;
+    root->magic = LFS_DX_ROOT_MAGIC;
+    root->self = inum;
+    root->parent = n->parent;
+    root->hash_version = LFS_DX_HASH_FNV1A;
+    root->depth = depth;
+    root->cl.limit = LFS_DX_ROOT_LIMIT;
+    if (depth == 0) {
+        for (uint32_t i = 0; i < lv.count; i++) {
+            root->entries[i].hash = lv.hash[i];
+            root->entries[i].block = index + i;
+        }
+        root->cl.count = lv.count;
+    } else {
+        for (uint32_t i = 0; i < index - 1; i++) {
+            root->entries[i].hash = lv.hash[i * LFS_DX_NODE_LIMIT];
+            root->entries[i].block = 1 + i;
+        }
+        root->cl.count = index - 1;
+    }
+    if (lfs_write_block(&fs->img, first, buf) < 0) goto out;
+
+    // Index nodes, each covering the next LFS_DX_NODE_LIMIT leaves
+    for (uint32_t i = 0; i + 1 < index; i++) {
+        memset(buf, 0, sizeof(buf));
+        lfs_dx_node_t* node = (lfs_dx_node_t*)buf;
+        node->magic = LFS_DX_NODE_MAGIC;
+        node->cl.limit = LFS_DX_NODE_LIMIT;
+        for (uint32_t l = i * LFS_DX_NODE_LIMIT; l < lv.count && node->cl.count < LFS_DX_NODE_LIMIT; l++) {
+            node->entries[node->cl.count].hash = lv.hash[l];
+            node->entries[node->cl.count].block = index + l;
+            node->cl.count++;
+        }
+        if (lfs_write_block(&fs->img, first + 1 + i, buf) < 0) goto out;
+    }
+
+    for (uint32_t l = 0; l < lv.count; l++) {
+        mkfs_fill_leaf(buf, n, lv.first[l], lv.first[l + 1]);
+        if (lfs_write_block(&fs->img, first + index + l, buf) < 0) goto out;
+    }
+    ret = 0;
+
+out:
+    free(lv.first);
+    free(lv.hash);
+    return ret;
+}
+
+// Sets bits [0, count) and everything past `nbits` to the end of the last
+// bitmap block
+static void mkfs_bits_init(uint8_t* bits, uint64_t nbits, uint64_t count) {
+    uint64_t total = (uint64_t)lfs_bitmap_blocks(nbits) * LFS_BLOCK_SIZE * 8;
+    for (uint64_t b = 0; b < total; b++) {
+        if (b < count || b >= nbits) bits[b / 8] |= 1 << (b % 8);
+    }
+}
+
+static int mkfs_write_bitmap(mkfs_t* fs, uint64_t disk_block, const uint8_t* bits, uint64_t nbits) {
+    for (uint32_t g = 0; g < lfs_bitmap_blocks(nbits); g++) {
+        if (lfs_write_block(&fs->img, disk_block + g, bits + (size_t)g * LFS_BLOCK_SIZE) < 0) return -1;
+    }
+    return 0;
+}
+
+static int mkfs_write_journal(mkfs_t* fs) {
+    uint8_t buf[LFS_BLOCK_SIZE];
+    memset(buf, 0, sizeof(buf));
+    for (uint32_t b = 1; b < fs->img.sb.journal_num_blocks; b++) {
+        if (lfs_write_block(&fs->img, fs->img.sb.journal_start_block + b, buf) < 0) return -1;
+    }
+
+    lfs_journal_super_t* js = (lfs_journal_super_t*)buf;
+    js->h.magic = LFS_JOURNAL_MAGIC;
+    js->h.type = LFS_JOURNAL_SUPER;
+    js->log_blocks = fs->img.sb.journal_num_blocks - 1;
+    js->first = 0;
+    js->first_sequence = 1;
+    return lfs_write_block(&fs->img, fs->img.sb.journal_start_block, buf);
+}
+
+// --- Layout ---
+
+// Places every area, given the image size and the requested counts (0 for
+// the defaults)
+static int mkfs_layout(lfs_superblock_t* sb, uint64_t total, uint64_t inodes, uint64_t journal) {
+    if (total > UINT32_MAX) {
+        fprintf(stderr, "mkfs.limitless: image larger than %llu blocks\n", (unsigned long long)UINT32_MAX);
+        return -1;
+    }
+    if (!journal) {
+        // 1/64 of the volume, but enough for MKFS_MIN_TXN unless that
+        // would take more than a quarter of it
+        journal = total / 64;
+        if (journal < 4 * MKFS_MIN_TXN + 1) journal = 4 * MKFS_MIN_TXN + 1;
+        if (journal > total / 4) journal = total / 4;
+        if (journal > MKFS_MAX_JOURNAL) journal = MKFS_MAX_JOURNAL;
+        if (journal < LFS_JOURNAL_MIN_BLOCKS) journal = LFS_JOURNAL_MIN_BLOCKS;
+    }
+    if (journal < LFS_JOURNAL_MIN_BLOCKS) {
+        fprintf(stderr, "mkfs.limitless: the journal needs at least %d blocks\n", LFS_JOURNAL_MIN_BLOCKS);
+        return -1;
+    }
+    if (lfs_journal_max_txn(journal - 1) < MKFS_MIN_TXN) {
+        fprintf(stderr, "mkfs.limitless: warning: a %llu-block journal is too small for the kernel to create files\n",
+                (unsigned long long)journal);
+    }
+    if (!inodes) {
+        // One per 4 blocks, but never less than twice what the source
+        // tree needs so the volume has room to grow
+        inodes = total / 4;
+        if (inodes < 2 * (uint64_t)nnodes) inodes = 2 * (uint64_t)nnodes;
+    }
+    if (inodes < nnodes + 1) inodes = nnodes + 1;
+    inodes = (inodes + LFS_INODES_PER_BLOCK - 1) / LFS_INODES_PER_BLOCK * LFS_INODES_PER_BLOCK;
+    if (inodes > UINT32_MAX) inodes = UINT32_MAX / LFS_INODES_PER_BLOCK * LFS_INODES_PER_BLOCK;
+
+    memset(sb, 0, sizeof(*sb));
+    sb->magic = LFS_MAGIC;
+    sb->total_blocks = total;
+    sb->journal_start_block = 1;
+    sb->journal_num_blocks = journal;
+    uint64_t next = 1 + journal;
+    sb->inode_bitmap_block = next;
+    next += lfs_bitmap_blocks(inodes);
+    sb->data_bitmap_block = next;
+    next += lfs_bitmap_blocks(total);
+    sb->inode_table_block = next;
+    next += inodes / LFS_INODES_PER_BLOCK;
+    sb->inode_count = inodes;
+
+    if (next >= total) {
+        fprintf(stderr, "mkfs.limitless: %llu blocks cannot hold the metadata\n", (unsigned long long)total);
+        return -1;
+    }
+    sb->data_blocks_start = next;
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: mkfs.limitless [-s size] [-i inodes] [-j journal-blocks] [-d dir] image\n"
+            "  -s size    image size, with an optional K, M or G suffix (default 64M)\n"
+            "  -i inodes  inodes to make room for (default one per 4 blocks, at least twice\n"
+            "             what dir needs)\n"
+            "  -j blocks  journal size in blocks (default 1/64 of the volume, at least 513)\n"
+            "  -d dir     copy the files and directories under dir into the volume\n");
+    exit(8);
+}
+
+int main(int argc, char** argv) {
+    int64_t size = MKFS_DEFAULT_SIZE, inodes = 0, journal = 0;
+    const char* src = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:i:j:d:")) != -1) {
+        switch (opt) {
+        case 's': size = lfs_parse_size(optarg); break;
+        case 'i': inodes = lfs_parse_size(optarg); break;
+        case 'j': journal = lfs_parse_size(optarg); break;
+        case 'd': src = optarg; break;
+        default: usage();
+        }
+        if (size < 0 || inodes < 0 || journal < 0) usage();
+    }
+    if (optind != argc - 1) usage();
+
+    mkfs_t fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.img.path = argv[optind];
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    if (src && stat(src, &st) < 0) {
+        fprintf(stderr, "mkfs.limitless: %s: %s\n", src, strerror(errno));
+        return 8;
+    }
+    if (src && !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "mkfs.limitless: %s: not a directory\n", src);
+        return 8;
+    }
+    mkfs_add_node(src, "", &st, LFS_ROOT_INODE);
+    if (mkfs_scan(LFS_ROOT_INODE) < 0) return 8;
+
+    if (mkfs_layout(&fs.img.sb, (uint64_t)size / LFS_BLOCK_SIZE, inodes, journal) < 0) return 8;
+    lfs_superblock_t* sb = &fs.img.sb;
+
+    fs.img.fd = open(fs.img.path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fs.img.fd < 0 || ftruncate(fs.img.fd, (off_t)sb->total_blocks * LFS_BLOCK_SIZE) < 0) {
+        fprintf(stderr, "mkfs.limitless: %s: %s\n", fs.img.path, strerror(errno));
+        return 8;
+    }
+    fs.img.blocks = sb->total_blocks;
+    fs.next = sb->data_blocks_start;
+
+    for (uint32_t inum = 0; inum < nnodes; inum++) {
+        int ret = nodes[inum].type == LFS_TYPE_DIR ? mkfs_write_dir(&fs, inum) : mkfs_write_file(&fs, inum);
+        if (ret < 0) return 8;
+    }
+
+    fs.block_bits = calloc(lfs_bitmap_blocks(sb->total_blocks), LFS_BLOCK_SIZE);
+    fs.inode_bits = calloc(lfs_bitmap_blocks(sb->inode_count), LFS_BLOCK_SIZE);
+    if (!fs.block_bits || !fs.inode_bits) {
+        fprintf(stderr, "mkfs.limitless: out of memory\n");
+        return 8;
+    }
+    mkfs_bits_init(fs.block_bits, sb->total_blocks, fs.next);
+    mkfs_bits_init(fs.inode_bits, sb->inode_count, nnodes);
+
+    uint8_t buf[LFS_BLOCK_SIZE];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, sb, sizeof(*sb));
+    if (mkfs_write_bitmap(&fs, sb->data_bitmap_block, fs.block_bits, sb->total_blocks) < 0 ||
+        mkfs_write_bitmap(&fs, sb->inode_bitmap_block, fs.inode_bits, sb->inode_count) < 0 ||
+        mkfs_write_journal(&fs) < 0 ||
+        lfs_write_block(&fs.img, 0, buf) < 0 ||
+        fsync(fs.img.fd) < 0) {
+        return 8;
+    }
+    lfs_image_close(&fs.img);
+
+    printf("%s: %u blocks, %u inodes, %u-block journal; %u inodes and %llu data blocks in use\n",
+           fs.img.path, sb->total_blocks, sb->inode_count, sb->journal_num_blocks, nnodes,
+           (unsigned long long)(fs.next - sb->data_blocks_start));
+    return 0;
+}
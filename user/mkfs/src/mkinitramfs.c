@@ -0,0 +1,221 @@
+/* user/mkfs/src/mkinitramfs.c */
+
+// mkinitramfs: packs a directory tree on the build host into the cpio
+// "newc" archive the kernel unpacks into tmpfs at boot.
+//
+// Unlike cpio -H newc, every file's name is padded with NULs so its data
+// starts on a page boundary. newc counts the padding in the name size and
+// readers stop at the first NUL, so the archive stays a plain one; the
+// kernel can then lend the archive's own pages to tmpfs and map them
+// without a copy. Ownership is reset to root; permissions and
+// modification times are kept. Names are in byte order, each directory
+// before what it holds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define CPIO_MAGIC       "070701"
+#define CPIO_HEADER_SIZE 110
+#define CPIO_TRAILER     "TRAILER!!!"
+
+// Where file data is placed: the kernel's page size
+#define MKINITRAMFS_ALIGN 4096
+
+#define CPIO_ALIGN(x) (((x) + 3) & ~(uint64_t)3)
+
+typedef struct {
+    FILE* out;
+    const char* path;  // Of the archive, for messages
+    uint64_t off;      // Bytes written so far
+    uint32_t ino;
+} mkinitramfs_t;
+
+static int mkinitramfs_write(mkinitramfs_t* a, const void* buf, size_t len) {
+    if (len && fwrite(buf, 1, len, a->out) != len) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", a->path, strerror(errno));
+        return -1;
+    }
+    a->off += len;
+    return 0;
+}
+
+// Zeroes up to the next 4-byte boundary
+static int mkinitramfs_pad(mkinitramfs_t* a) {
+    static const uint8_t zero[4];
+    return mkinitramfs_write(a, zero, CPIO_ALIGN(a->off) - a->off);
+}
+
+// Writes the header and name of an entry whose data follows. Regular files
+// with data get their name padded so that data lands on a page boundary.
+static int mkinitramfs_header(mkinitramfs_t* a, const char* name, const struct stat* st, uint64_t size) {
+    uint64_t namesize = strlen(name) + 1;
+    if (S_ISREG(st->st_mode) && size) {
+        uint64_t end = a->off + CPIO_HEADER_SIZE + namesize;
+        namesize += (MKINITRAMFS_ALIGN - end % MKINITRAMFS_ALIGN) % MKINITRAMFS_ALIGN;
+    }
+    if (size > UINT32_MAX || namesize > UINT32_MAX) {
+        fprintf(stderr, "mkinitramfs: %s: too large for a newc archive\n", name);
+        return -1;
+    }
+
+    // ino, mode, uid, gid, nlink, mtime, filesize, devmajor, devminor,
+    // rdevmajor, rdevminor, namesize, check
+    char header[CPIO_HEADER_SIZE + 1];
+    snprintf(header, sizeof(header), CPIO_MAGIC "%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x",
+             a->ino++, (uint32_t)st->st_mode, 0, 0, S_ISDIR(st->st_mode) ? 2 : 1,
+             (uint32_t)st->st_mtime, (uint32_t)size, 0, 0, 0, 0, (uint32_t)namesize, 0);
+    if (mkinitramfs_write(a, header, CPIO_HEADER_SIZE) < 0) return -1;
+
+    size_t len = strlen(name);
+    if (mkinitramfs_write(a, name, len) < 0) return -1;
+    for (uint64_t i = len; i < namesize; i++) {
+        if (mkinitramfs_write(a, "", 1) < 0) return -1;
+    }
+    return mkinitramfs_pad(a);
+}
+
+// Copies the file at `path` into the archive
+static int mkinitramfs_copy(mkinitramfs_t* a, const char* path, uint64_t size) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char buf[65536];
+    while (size > 0) {
+        size_t want = size < sizeof(buf) ? size : sizeof(buf);
+        size_t got = fread(buf, 1, want, in);
+        if (got != want) {
+            fprintf(stderr, "mkinitramfs: %s: %s\n", path, ferror(in) ? strerror(errno) : "changed while being read");
+            fclose(in);
+            return -1;
+        }
+        if (mkinitramfs_write(a, buf, got) < 0) {
+            fclose(in);
+            return -1;
+        }
+        size -= got;
+    }
+    fclose(in);
+    return 0;
+}
+
+// --- Walking the source tree ---
+
+static int mkinitramfs_name_cmp(const struct dirent** x, const struct dirent** y) {
+    return strcmp((*x)->d_name, (*y)->d_name);
+}
+
+static int mkinitramfs_skip_dots(const struct dirent* de) {
+    return strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0;
+}
+
+// Adds `path` as `name`, and everything under it if it is a directory
+static int mkinitramfs_add(mkinitramfs_t* a, const char* path, const char* name) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        if (mkinitramfs_header(a, name, &st, st.st_size) < 0 || mkinitramfs_copy(a, path, st.st_size) < 0) return -1;
+        return mkinitramfs_pad(a);
+    }
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t len = readlink(path, target, sizeof(target));
+        if (len < 0 || len == sizeof(target)) {
+            fprintf(stderr, "mkinitramfs: %s: %s\n", path, len < 0 ? strerror(errno) : "link target too long");
+            return -1;
+        }
+        if (mkinitramfs_header(a, name, &st, len) < 0 || mkinitramfs_write(a, target, len) < 0) return -1;
+        return mkinitramfs_pad(a);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "mkinitramfs: %s: skipped, only files, directories and links are packed\n", path);
+        return 0;
+    }
+
+    if (mkinitramfs_header(a, name, &st, 0) < 0) return -1;
+    struct dirent** list;
+    int n = scandir(path, &list, mkinitramfs_skip_dots, mkinitramfs_name_cmp);
+    if (n < 0) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < n; i++) {
+        if (ret == 0) {
+            const char* child = list[i]->d_name;
+            char* child_path = malloc(strlen(path) + strlen(child) + 2);
+            char* child_name = malloc(strlen(name) + strlen(child) + 2);
+            if (!child_path || !child_name) {
+                fprintf(stderr, "mkinitramfs: out of memory\n");
+                ret = -1;
+            } else {
+                sprintf(child_path, "%s/%s", path, child);
+                // Entries under the root are named without a leading "./"
+                if (strcmp(name, ".") == 0) strcpy(child_name, child);
+                else sprintf(child_name, "%s/%s", name, child);
+                ret = mkinitramfs_add(a, child_path, child_name);
+            }
+            free(child_path);
+            free(child_name);
+        }
+        free(list[i]);
+    }
+    free(list);
+    return ret;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mkinitramfs dir archive\n"
+                    "  packs the tree under dir into a newc cpio archive, file data page-aligned\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) usage();
+
+    struct stat st;
+    if (stat(argv[1], &st) < 0) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "mkinitramfs: %s: not a directory\n", argv[1]);
+        return 1;
+    }
+
+    mkinitramfs_t a = { .path = argv[2], .off = 0, .ino = 1 };
+    a.out = fopen(a.path, "wb");
+    if (!a.out) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", a.path, strerror(errno));
+        return 1;
+    }
+
+    struct stat trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    int ret = mkinitramfs_add(&a, argv[1], ".");
+    if (ret == 0) {
+        a.ino = 0;
+        ret = mkinitramfs_header(&a, CPIO_TRAILER, &trailer, 0);
+    }
+    if (fclose(a.out) != 0 && ret == 0) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", a.path, strerror(errno));
+        ret = -1;
+    }
+    if (ret < 0) {
+        remove(a.path);
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,5 @@
 #include <stdint.h>
-#define SYS_CREATE_WINDOW 4
-#define SYS_POLL_EVENT 6
+#include <limitless/syscall_nr.h>
 #define EVENT_SYSTEM_ALERT 7
 
 // ... Event struct and syscall definitions ...
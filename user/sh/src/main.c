@@ -1,9 +1,6 @@
 #include <stdint.h>
+#include <limitless/syscall_nr.h>
 
-#define SYS_WRITE 15
-#define SYS_READ  14
-#define SYS_FORK  17
-#define SYS_EXECVE 18
 #define STDOUT 1
 #define STDIN  0
 
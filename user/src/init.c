@@ -1,11 +1,7 @@
 // user/src/init.c - The first user-space networking application
 
 #include <stdint.h>
-
-// Syscall numbers
-#define SYS_SOCKET          7
-#define SYS_BIND            8
-#define SYS_SENDTO          9
+#include <limitless/syscall_nr.h>
 
 // Network constants
 #define AF_INET 2
@@ -0,0 +1,103 @@
+/* user/strace/src/main.c */
+
+#include <stdint.h>
+#include <limitless/syscall.h>
+#include <limitless/systrace.h>
+
+// Prints every system call made by other processes, as it is made:
+//   [pid] name(arg0, arg1, arg2, ...)
+//   [pid] name = ret <latency ns>
+
+#define BATCH 64
+
+static const char* const syscall_names[] = {
+#define SYSCALL(sym, nr, name, flags) [nr] = #name,
+#include <limitless/syscalls.def>
+#undef SYSCALL
+};
+
+#define NUM_NAMES (sizeof(syscall_names) / sizeof(syscall_names[0]))
+
+static systrace_event_t events[BATCH];
+
+static void print(const char* s) {
+    syscall1(SYS_PRINT, (long)s);
+}
+
+static void print_u64(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    print(&buf[i]);
+}
+
+static void print_i64(int64_t value) {
+    if (value < 0) {
+        print("-");
+        print_u64((uint64_t)-value);
+    } else {
+        print_u64((uint64_t)value);
+    }
+}
+
+static void print_hex(uint64_t value) {
+    char buf[19];
+    int i = 18;
+    buf[i] = '\0';
+    do {
+        buf[--i] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    } while (value);
+    buf[--i] = 'x';
+    buf[--i] = '0';
+    print(&buf[i]);
+}
+
+static void print_name(uint16_t nr) {
+    if (nr < NUM_NAMES && syscall_names[nr]) {
+        print(syscall_names[nr]);
+    } else {
+        print("syscall_");
+        print_u64(nr);
+    }
+}
+
+static void print_event(const systrace_event_t* ev) {
+    print("[");
+    print_u64(ev->pid);
+    print("] ");
+    print_name(ev->nr);
+
+    if (ev->type == SYSTRACE_ENTER) {
+        print("(");
+        for (int i = 0; i < 6; i++) {
+            if (i) print(", ");
+            print_hex(ev->args[i]);
+        }
+        print(")\n");
+    } else {
+        print(" = ");
+        print_i64(ev->ret);
+        print(" <");
+        print_u64(ev->latency_ns);
+        print(" ns>\n");
+    }
+}
+
+void _start() {
+    if (syscall3(SYS_SYSTRACE_CTL, SYSTRACE_CTL_ENABLE, SYSTRACE_EVENTS, 0) != 0) {
+        print("strace: cannot enable tracing\n");
+        while (1);
+    }
+
+    while (1) {
+        long n = syscall2(SYS_SYSTRACE_READ, (long)events, BATCH);
+        for (long i = 0; i < n; i++) {
+            print_event(&events[i]);
+        }
+    }
+}
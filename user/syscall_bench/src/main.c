@@ -0,0 +1,107 @@
+/* user/syscall_bench/src/main.c */
+
+#include <stdint.h>
+#include <limitless/syscall_nr.h>
+#include <limitless/vdso.h>
+
+// Measures the round-trip cost of a null syscall (getpid) through the
+// legacy int 0x80 gate and through the SYSCALL instruction, and the cost of
+// reading the clock through the vDSO versus the system call.
+
+#define ITERATIONS 100000
+
+// Legacy gate: number in RAX, arguments in RBX, RCX, RDX, RSI, RDI
+static inline long syscall_int80(long num, long p1) {
+    long ret;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(num), "b"(p1)
+        : "memory"
+    );
+    return ret;
+}
+
+// Fast path: number in RAX, arguments in RDI, RSI, RDX, R10, R8, R9.
+// The CPU clobbers RCX (return RIP) and R11 (RFLAGS).
+static inline long syscall_fast(long num, long p1) {
+    long ret;
+    asm volatile(
+        "syscall"
+        : "=a"(ret)
+        : "a"(num), "D"(p1)
+        : "rcx", "r11", "memory"
+    );
+    return ret;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void print(const char* s) {
+    syscall_fast(SYS_PRINT, (long)s);
+}
+
+static void print_u64(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    print(&buf[i]);
+}
+
+void _start() {
+    uint64_t start, int80_cycles, fast_cycles, vdso_cycles, clock_cycles;
+    struct timespec ts;
+
+    // Warm up both paths
+    for (int i = 0; i < 1000; i++) {
+        syscall_int80(SYS_GETPID, 0);
+        syscall_fast(SYS_GETPID, 0);
+    }
+
+    start = rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        syscall_int80(SYS_GETPID, 0);
+    }
+    int80_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        syscall_fast(SYS_GETPID, 0);
+    }
+    fast_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        vdso_clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    vdso_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (int i = 0; i < ITERATIONS; i++) {
+        asm volatile("syscall" : : "a"(SYS_CLOCK_GETTIME), "D"(CLOCK_MONOTONIC), "S"(&ts) : "rcx", "r11", "memory");
+    }
+    clock_cycles = rdtsc() - start;
+
+    print("syscall_bench: int 0x80 round trip: ");
+    print_u64(int80_cycles / ITERATIONS);
+    print(" cycles\n");
+    print("syscall_bench: SYSCALL round trip:  ");
+    print_u64(fast_cycles / ITERATIONS);
+    print(" cycles\n");
+    print("syscall_bench: clock_gettime (vDSO):    ");
+    print_u64(vdso_cycles / ITERATIONS);
+    print(" cycles\n");
+    print("syscall_bench: clock_gettime (syscall): ");
+    print_u64(clock_cycles / ITERATIONS);
+    print(" cycles\n");
+
+    while (1);
+}
@@ -0,0 +1,85 @@
+/* user/syscount/src/main.c */
+
+#include <stdint.h>
+#include <limitless/syscall.h>
+#include <limitless/systrace.h>
+#include <limitless/vdso.h>
+
+// Counts system calls system-wide and prints, every INTERVAL_SEC seconds,
+// the count, average and maximum latency of each call that was made, with
+// its log2 latency histogram.
+
+#define INTERVAL_SEC 5
+
+static const char* const syscall_names[] = {
+#define SYSCALL(sym, nr, name, flags) [nr] = #name,
+#include <limitless/syscalls.def>
+#undef SYSCALL
+};
+
+#define NUM_NAMES (sizeof(syscall_names) / sizeof(syscall_names[0]))
+
+static void print(const char* s) {
+    syscall1(SYS_PRINT, (long)s);
+}
+
+static void print_u64(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    print(&buf[i]);
+}
+
+static void wait_interval(void) {
+    int64_t start = vdso_time(0);
+    while (vdso_time(0) - start < INTERVAL_SEC);
+}
+
+static void print_hist(const systrace_hist_t* h) {
+    for (int b = 0; b < SYSTRACE_HIST_BUCKETS; b++) {
+        if (!h->buckets[b]) continue;
+        print("    ");
+        print_u64(b ? 1ULL << b : 0);
+        print(" ns+: ");
+        print_u64(h->buckets[b]);
+        print("\n");
+    }
+}
+
+static void report(void) {
+    systrace_hist_t h;
+
+    print("syscount: calls, avg ns, max ns\n");
+    for (uint64_t nr = 0; nr < NUM_NAMES; nr++) {
+        if (!syscall_names[nr]) continue;
+        if (syscall2(SYS_SYSTRACE_HIST, nr, (long)&h) != 0 || !h.count) continue;
+
+        print("  ");
+        print(syscall_names[nr]);
+        print(": ");
+        print_u64(h.count);
+        print(", ");
+        print_u64(h.total_ns / h.count);
+        print(", ");
+        print_u64(h.max_ns);
+        print("\n");
+        print_hist(&h);
+    }
+}
+
+void _start() {
+    if (syscall3(SYS_SYSTRACE_CTL, SYSTRACE_CTL_ENABLE, SYSTRACE_HIST, 0) != 0) {
+        print("syscount: cannot enable tracing\n");
+        while (1);
+    }
+
+    while (1) {
+        wait_interval();
+        report();
+        syscall1(SYS_SYSTRACE_CTL, SYSTRACE_CTL_RESET);
+    }
+}
@@ -1,24 +1,9 @@
 /* user/terminal/src/main.c */
 
 #include <stdint.h>
+#include <limitless/syscall_nr.h>
 #include <stdbool.h>
 
-// --- Syscall Definitions ---
-#define SYS_CREATE_WINDOW   4
-#define SYS_POLL_EVENT      6
-#define SYS_PRINT           1
-#define SYS_PIPE_CREATE     28
-#define SYS_DUP2            29
-#define SYS_FORK            17
-#define SYS_EXECVE          18
-#define SYS_READ            14
-#define SYS_WRITE           15
-#define SYS_CLOSE           13
-#define SYS_YIELD           0
-#define SYS_DRAW_RECT       5
-// We need a syscall to draw a single character at a specific location
-// #define SYS_DRAW_CHAR_IN_WINDOW 32
-
 #define STDIN  0
 #define STDOUT 1
 #define STDERR 2